@@ -0,0 +1,109 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "internal/completion_poller.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/flags/flag.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "infiniband/verbs.h"
+
+ABSL_FLAG(int, cq_poll_batch, 32,
+          "Maximum number of work completions harvested by a single "
+          "ibv_poll_cq call.");
+
+namespace rdma_unit_test {
+namespace {
+
+// Returns the byte size of an array of `batch_size` work completions, checking
+// `batch_size` before the array is allocated.
+size_t CompletionsSize(int batch_size) {
+  CHECK_GT(batch_size, 0);  // Crash OK
+  return sizeof(ibv_wc) * batch_size;
+}
+
+}  // namespace
+
+double CompletionPoller::Stats::MeanBatch() const {
+  uint64_t non_empty_polls = polls - empty_polls;
+  if (non_empty_polls == 0) return 0;
+  return static_cast<double>(completions) / non_empty_polls;
+}
+
+std::string CompletionPoller::Stats::ToString() const {
+  std::string result =
+      absl::StrCat("polls: ", polls, ", empty: ", empty_polls,
+                   ", completions: ", completions, ", mean batch: ",
+                   MeanBatch(), ", max batch: ", max_batch, ", batches:");
+  for (int i = 0; i < kNumBuckets; ++i) {
+    if (batch_histogram[i] == 0) continue;
+    absl::StrAppend(&result, " [", 1u << i,
+                    i == kNumBuckets - 1 ? "+" : "", "]=", batch_histogram[i]);
+  }
+  return result;
+}
+
+CompletionPoller::CompletionPoller()
+    : CompletionPoller(absl::GetFlag(FLAGS_cq_poll_batch)) {}
+
+CompletionPoller::CompletionPoller(int batch_size)
+    : batch_size_(batch_size),
+      completions_(static_cast<ibv_wc*>(
+          ::operator new[](CompletionsSize(batch_size),
+                           std::align_val_t(ABSL_CACHELINE_SIZE)))) {}
+
+void CompletionPoller::AlignedDeleter::operator()(ibv_wc* completions) const {
+  ::operator delete[](completions, std::align_val_t(ABSL_CACHELINE_SIZE));
+}
+
+absl::Span<const ibv_wc> CompletionPoller::Poll(ibv_cq* cq,
+                                                int max_completions,
+                                                bool* error) {
+  int requested = std::min(max_completions, batch_size_);
+  if (error != nullptr) *error = false;
+  if (requested <= 0) return {};
+  int polled = ibv_poll_cq(cq, requested, completions_.get());
+  if (polled < 0) {
+    if (error != nullptr) *error = true;
+    polled = 0;
+  }
+  RecordPoll(polled);
+  return absl::MakeConstSpan(completions_.get(), polled);
+}
+
+void CompletionPoller::RecordPoll(int completions) {
+  ++stats_.polls;
+  if (completions <= 0) {
+    ++stats_.empty_polls;
+    return;
+  }
+  stats_.completions += completions;
+  stats_.max_batch =
+      std::max(stats_.max_batch, static_cast<uint32_t>(completions));
+  int bucket = 0;
+  while (bucket < Stats::kNumBuckets - 1 && (2 << bucket) <= completions) {
+    ++bucket;
+  }
+  ++stats_.batch_histogram[bucket];
+}
+
+}  // namespace rdma_unit_test
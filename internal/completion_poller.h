@@ -0,0 +1,115 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_INTERNAL_COMPLETION_POLLER_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_INTERNAL_COMPLETION_POLLER_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/flags/declare.h"
+#include "absl/types/span.h"
+#include "infiniband/verbs.h"
+
+ABSL_DECLARE_FLAG(int, cq_poll_batch);
+
+namespace rdma_unit_test {
+
+// Harvests completions from completion queues into a persistent, cache line
+// aligned array of `batch_size` work completions, so that polling does not
+// allocate or zero-initialize memory. The array is reused by every call, so a
+// poller must not be shared between threads; pollers are cheap enough to keep
+// one per cq (or per thread).
+class CompletionPoller {
+ public:
+  // Statistics on the poll batches achieved, ie. the number of completions
+  // returned by each ibv_poll_cq call.
+  struct Stats {
+    static constexpr int kNumBuckets = 12;
+
+    // Number of ibv_poll_cq calls, and how many of them returned nothing.
+    uint64_t polls = 0;
+    uint64_t empty_polls = 0;
+    uint64_t completions = 0;
+    uint32_t max_batch = 0;
+    // Histogram of non-empty batch sizes. Bucket i counts batches of size
+    // [2^i, 2^(i+1)); the last bucket also counts all larger batches.
+    std::array<uint64_t, kNumBuckets> batch_histogram = {};
+
+    // Average number of completions per non-empty poll.
+    double MeanBatch() const;
+    std::string ToString() const;
+  };
+
+  // Uses --cq_poll_batch as the batch size.
+  CompletionPoller();
+  explicit CompletionPoller(int batch_size);
+  CompletionPoller(CompletionPoller&& other) = default;
+  CompletionPoller& operator=(CompletionPoller&& other) = default;
+  CompletionPoller(const CompletionPoller& other) = delete;
+  CompletionPoller& operator=(const CompletionPoller& other) = delete;
+  ~CompletionPoller() = default;
+
+  // Polls at most min(`max_completions`, batch_size()) completions from `cq`.
+  // Returns the completions, which stay valid until the next call on this
+  // poller. Returns an empty span if there is no completion or ibv_poll_cq
+  // failed; `error` (if not null) is set to true in the latter case.
+  absl::Span<const ibv_wc> Poll(ibv_cq* cq, int max_completions,
+                                bool* error = nullptr);
+  absl::Span<const ibv_wc> Poll(ibv_cq* cq) {
+    return Poll(cq, batch_size_);
+  }
+
+  // Polls `cq` in batches until it is empty or `max_completions` completions
+  // were harvested, calling `handler(const ibv_wc&)` on each of them. Returns
+  // the number of completions handled.
+  template <typename Handler>
+  int Drain(ibv_cq* cq, int max_completions, Handler&& handler) {
+    int harvested = 0;
+    while (harvested < max_completions) {
+      int requested = std::min(max_completions - harvested, batch_size_);
+      absl::Span<const ibv_wc> completions = Poll(cq, requested);
+      for (const ibv_wc& completion : completions) {
+        handler(completion);
+      }
+      harvested += completions.size();
+      if (static_cast<int>(completions.size()) < requested) break;
+    }
+    return harvested;
+  }
+
+  // Accounts for a poll that harvested `completions` completions without going
+  // through Poll(), eg. when walking an extended cq with ibv_start_poll.
+  void RecordPoll(int completions);
+
+  int batch_size() const { return batch_size_; }
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = Stats(); }
+
+ private:
+  struct AlignedDeleter {
+    void operator()(ibv_wc* completions) const;
+  };
+
+  int batch_size_;
+  std::unique_ptr<ibv_wc[], AlignedDeleter> completions_;
+  Stats stats_;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_INTERNAL_COMPLETION_POLLER_H_
@@ -0,0 +1,165 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "internal/completion_poller.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "infiniband/verbs.h"
+
+namespace rdma_unit_test {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// A cq whose ibv_poll_cq goes through a fake provider op instead of a device.
+// It holds `pending` completions, numbered by wr_id, and records the number of
+// entries asked for by every poll.
+struct FakeCq {
+  FakeCq() {
+    context.ops.poll_cq = &FakeCq::PollCq;
+    cq.context = &context;
+    cq.cq_context = this;
+  }
+
+  static int PollCq(ibv_cq* cq, int num_entries, ibv_wc* wc) {
+    FakeCq* fake = static_cast<FakeCq*>(cq->cq_context);
+    fake->requests.push_back(num_entries);
+    if (fake->fail) return -1;
+    int polled = 0;
+    while (polled < num_entries && fake->pending > 0) {
+      wc[polled] = ibv_wc{};
+      wc[polled].wr_id = fake->next_wr_id++;
+      wc[polled].status = IBV_WC_SUCCESS;
+      ++polled;
+      --fake->pending;
+    }
+    return polled;
+  }
+
+  ibv_context context = {};
+  ibv_cq cq = {};
+  int pending = 0;
+  bool fail = false;
+  uint64_t next_wr_id = 0;
+  std::vector<int> requests;
+};
+
+TEST(CompletionPollerTest, PollNeverExceedsBatchSize) {
+  FakeCq fake;
+  fake.pending = 20;
+  CompletionPoller poller(/*batch_size=*/8);
+  EXPECT_EQ(poller.Poll(&fake.cq).size(), 8);
+  EXPECT_EQ(poller.Poll(&fake.cq, /*max_completions=*/100).size(), 8);
+  EXPECT_EQ(poller.Poll(&fake.cq, /*max_completions=*/3).size(), 3);
+  EXPECT_THAT(fake.requests, ElementsAre(8, 8, 3));
+  EXPECT_EQ(fake.pending, 1);
+}
+
+TEST(CompletionPollerTest, PollReturnsCompletionsInOrder) {
+  FakeCq fake;
+  fake.pending = 3;
+  CompletionPoller poller(/*batch_size=*/4);
+  absl::Span<const ibv_wc> completions = poller.Poll(&fake.cq);
+  ASSERT_EQ(completions.size(), 3);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(completions[i].wr_id, i);
+  }
+  EXPECT_THAT(poller.Poll(&fake.cq), IsEmpty());
+}
+
+TEST(CompletionPollerTest, NonPositiveMaxDoesNotPoll) {
+  FakeCq fake;
+  fake.pending = 1;
+  CompletionPoller poller(/*batch_size=*/4);
+  EXPECT_THAT(poller.Poll(&fake.cq, 0), IsEmpty());
+  EXPECT_THAT(poller.Poll(&fake.cq, -1), IsEmpty());
+  EXPECT_THAT(fake.requests, IsEmpty());
+  EXPECT_EQ(poller.stats().polls, 0);
+}
+
+TEST(CompletionPollerTest, PollErrorIsReported) {
+  FakeCq fake;
+  fake.fail = true;
+  CompletionPoller poller(/*batch_size=*/4);
+  bool error = false;
+  EXPECT_THAT(poller.Poll(&fake.cq, 4, &error), IsEmpty());
+  EXPECT_TRUE(error);
+  fake.fail = false;
+  EXPECT_THAT(poller.Poll(&fake.cq, 4, &error), IsEmpty());
+  EXPECT_FALSE(error);
+}
+
+TEST(CompletionPollerTest, DrainStopsAtMaxCompletions) {
+  FakeCq fake;
+  fake.pending = 100;
+  CompletionPoller poller(/*batch_size=*/8);
+  std::vector<uint64_t> wr_ids;
+  int drained = poller.Drain(&fake.cq, /*max_completions=*/20,
+                             [&wr_ids](const ibv_wc& completion) {
+                               wr_ids.push_back(completion.wr_id);
+                             });
+  EXPECT_EQ(drained, 20);
+  ASSERT_EQ(wr_ids.size(), 20);
+  EXPECT_EQ(wr_ids.front(), 0);
+  EXPECT_EQ(wr_ids.back(), 19);
+  // The last batch only asks for what is left of the budget.
+  EXPECT_THAT(fake.requests, ElementsAre(8, 8, 4));
+  EXPECT_EQ(fake.pending, 80);
+}
+
+TEST(CompletionPollerTest, DrainStopsOnShortBatch) {
+  FakeCq fake;
+  fake.pending = 10;
+  CompletionPoller poller(/*batch_size=*/8);
+  int drained =
+      poller.Drain(&fake.cq, /*max_completions=*/100, [](const ibv_wc&) {});
+  EXPECT_EQ(drained, 10);
+  // A batch shorter than requested means the cq is empty, so it is not polled
+  // again.
+  EXPECT_THAT(fake.requests, ElementsAre(8, 8));
+}
+
+TEST(CompletionPollerTest, StatsBucketBatchSizes) {
+  CompletionPoller poller(/*batch_size=*/8);
+  poller.RecordPoll(0);
+  poller.RecordPoll(1);
+  poller.RecordPoll(3);
+  poller.RecordPoll(8);
+  const CompletionPoller::Stats& stats = poller.stats();
+  EXPECT_EQ(stats.polls, 4);
+  EXPECT_EQ(stats.empty_polls, 1);
+  EXPECT_EQ(stats.completions, 12);
+  EXPECT_EQ(stats.max_batch, 8);
+  EXPECT_DOUBLE_EQ(stats.MeanBatch(), 4);
+  EXPECT_EQ(stats.batch_histogram[0], 1);
+  EXPECT_EQ(stats.batch_histogram[1], 1);
+  EXPECT_EQ(stats.batch_histogram[2], 0);
+  EXPECT_EQ(stats.batch_histogram[3], 1);
+  // Batches beyond the last bucket are counted in it.
+  poller.RecordPoll(1 << 20);
+  EXPECT_EQ(stats.batch_histogram[CompletionPoller::Stats::kNumBuckets - 1],
+            1);
+  poller.ResetStats();
+  EXPECT_EQ(poller.stats().polls, 0);
+}
+
+}  // namespace
+}  // namespace rdma_unit_test
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "public/counter_sampler.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include <magic_enum.hpp>
+#include "public/introspection.h"
+
+namespace rdma_unit_test {
+
+double CounterSampler::Sample::Rate(HardwareCounter counter) const {
+  auto iter = deltas.find(counter);
+  if (iter == deltas.end() || interval <= absl::ZeroDuration()) return 0;
+  return iter->second / absl::ToDoubleSeconds(interval);
+}
+
+CounterSampler::CounterSampler(
+    absl::string_view sysfs_device_name,
+    const absl::flat_hash_map<HardwareCounter, std::string>& counters,
+    int num_ports) {
+  for (const auto& [counter, name] : counters) {
+    std::vector<CounterFile>& files = files_[counter];
+    files.resize(num_ports);
+    for (int port = 1; port <= num_ports; ++port) {
+      CounterFile& file = files[port - 1];
+      file.path = absl::StrCat("/sys/class/infiniband/", sysfs_device_name,
+                               "/ports/", port, "/hw_counters/", name);
+      file.fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (file.fd < 0) {
+        file.open_status = absl::InternalError(absl::StrCat(
+            "Cannot open file ", file.path, ": ", std::strerror(errno)));
+      }
+    }
+  }
+}
+
+CounterSampler::~CounterSampler() {
+  StopSampling();
+  for (auto& [counter, files] : files_) {
+    for (CounterFile& file : files) {
+      if (file.fd >= 0) close(file.fd);
+    }
+  }
+}
+
+absl::StatusOr<uint64_t> CounterSampler::Read(HardwareCounter counter) const {
+  auto iter = files_.find(counter);
+  if (iter == files_.end()) {
+    return absl::NotFoundError(absl::StrCat(
+        "Counter ", magic_enum::enum_name(counter), " not sampled."));
+  }
+  uint64_t sum = 0;
+  for (const CounterFile& file : iter->second) {
+    absl::StatusOr<uint64_t> value = ReadFile(file);
+    if (!value.ok()) return value.status();
+    sum += *value;
+  }
+  return sum;
+}
+
+absl::StatusOr<uint64_t> CounterSampler::ReadFile(const CounterFile& file) {
+  if (file.fd < 0) return file.open_status;
+
+  // sysfs attributes are regenerated on every read from offset 0, and a 64 bit
+  // counter has at most 20 digits.
+  char buffer[32];
+  ssize_t size = pread(file.fd, buffer, sizeof(buffer) - 1, /*offset=*/0);
+  if (size < 0) {
+    return absl::InternalError(absl::StrCat("Cannot read file ", file.path,
+                                            ": ", std::strerror(errno)));
+  }
+  absl::string_view line(buffer, size);
+  uint64_t value;
+  if (absl::SimpleAtoi(absl::StripAsciiWhitespace(line), &value)) {
+    return value;
+  }
+  return absl::InternalError(
+      absl::StrCat("Cannot extract integer from line: ", line));
+}
+
+CounterSampler::CounterSnapshot CounterSampler::Snapshot() const {
+  CounterSnapshot snapshot;
+  for (const auto& [counter, files] : files_) {
+    absl::StatusOr<uint64_t> value = Read(counter);
+    if (value.ok()) snapshot[counter] = *value;
+  }
+  return snapshot;
+}
+
+absl::Status CounterSampler::StartSampling(absl::Duration interval) {
+  if (sampling_thread_.joinable()) {
+    return absl::FailedPreconditionError("Sampling already started.");
+  }
+  if (interval <= absl::ZeroDuration()) {
+    return absl::InvalidArgumentError("Sampling interval must be positive.");
+  }
+  stop_sampling_ = std::make_unique<absl::Notification>();
+  sampling_thread_ = std::thread([this, interval] { SamplingLoop(interval); });
+  return absl::OkStatus();
+}
+
+void CounterSampler::StopSampling() {
+  if (!sampling_thread_.joinable()) return;
+  stop_sampling_->Notify();
+  sampling_thread_.join();
+}
+
+std::vector<CounterSampler::Sample> CounterSampler::TakeSamples() {
+  absl::MutexLock lock(&samples_mutex_);
+  std::vector<Sample> samples;
+  samples.swap(samples_);
+  return samples;
+}
+
+void CounterSampler::SamplingLoop(absl::Duration interval) {
+  CounterSnapshot previous = Snapshot();
+  absl::Time previous_time = absl::Now();
+  absl::Time next_time = previous_time + interval;
+  // Sample on a fixed schedule, so that the time spent reading the counters
+  // does not skew the intervals.
+  while (!stop_sampling_->WaitForNotificationWithDeadline(next_time)) {
+    CounterSnapshot current = Snapshot();
+    const absl::Time now = absl::Now();
+    Sample sample{.time = now, .interval = now - previous_time};
+    for (const auto& [counter, value] : current) {
+      auto iter = previous.find(counter);
+      if (iter == previous.end()) continue;
+      // Counters are monotonic, unless reset by the driver.
+      sample.deltas[counter] = value >= iter->second ? value - iter->second : 0;
+    }
+    {
+      absl::MutexLock lock(&samples_mutex_);
+      samples_.push_back(std::move(sample));
+    }
+    previous = std::move(current);
+    previous_time = now;
+    next_time += interval;
+    if (next_time < now) next_time = now + interval;
+  }
+}
+
+}  // namespace rdma_unit_test
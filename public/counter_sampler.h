@@ -0,0 +1,121 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_PUBLIC_COUNTER_SAMPLER_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_PUBLIC_COUNTER_SAMPLER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "public/introspection.h"
+
+namespace rdma_unit_test {
+
+// Reads the sysfs hardware counters of a device with low overhead. The counter
+// files (/sys/class/infiniband/<device>/ports/<port>/hw_counters/*) of every
+// port are opened once at construction and re-read with pread(), so sampling
+// all counters costs one syscall per counter and port. The value of a counter
+// is its sum over the ports.
+//
+// The sampler can also sample all counters from a background thread at a
+// fixed interval, producing a time series of counter deltas and rates, eg. to
+// watch retransmissions and NAKs during a traffic run. Read() and Snapshot()
+// are thread safe.
+class CounterSampler {
+ public:
+  using HardwareCounter = NicIntrospection::HardwareCounter;
+  using CounterSnapshot = NicIntrospection::CounterSnapshot;
+
+  // The counter deltas over one background sampling interval.
+  struct Sample {
+    // Time at the end of the interval.
+    absl::Time time;
+    absl::Duration interval;
+    CounterSnapshot deltas;
+
+    // Returns the rate of `counter` over the interval, per second.
+    double Rate(HardwareCounter counter) const;
+  };
+
+  // Opens the files of `counters` (a map of counter to its sysfs file name)
+  // on ports 1 to `num_ports` of the device. Counters with a file which cannot
+  // be opened are reported as errors by Read() and left out of Snapshot().
+  CounterSampler(absl::string_view sysfs_device_name,
+                 const absl::flat_hash_map<HardwareCounter, std::string>&
+                     counters,
+                 int num_ports = 1);
+  // Movable and copyable are disallowed, the sampling thread points back at
+  // the sampler.
+  CounterSampler(const CounterSampler& other) = delete;
+  CounterSampler& operator=(const CounterSampler& other) = delete;
+  // Stops sampling and closes the counter files.
+  ~CounterSampler();
+
+  // Returns the current value of `counter`, summed over the ports.
+  absl::StatusOr<uint64_t> Read(HardwareCounter counter) const;
+
+  // Returns the current value of all counters which could be opened.
+  CounterSnapshot Snapshot() const;
+
+  // Starts sampling all counters every `interval` from a background thread.
+  // Returns FailedPreconditionError if sampling is already started.
+  absl::Status StartSampling(absl::Duration interval);
+
+  // Stops the background sampling thread, if any. Samples collected so far
+  // remain available through TakeSamples().
+  void StopSampling();
+
+  // Returns the samples collected since the last call, oldest first.
+  std::vector<Sample> TakeSamples();
+
+ private:
+  struct CounterFile {
+    std::string path;
+    // -1 if the file could not be opened.
+    int fd = -1;
+    // Error reported by Read() if the file could not be opened.
+    absl::Status open_status;
+  };
+
+  void SamplingLoop(absl::Duration interval);
+
+  // Reads the counter value from one of its files.
+  static absl::StatusOr<uint64_t> ReadFile(const CounterFile& file);
+
+  // The files of each counter, one per port.
+  absl::flat_hash_map<HardwareCounter, std::vector<CounterFile>> files_;
+
+  std::unique_ptr<absl::Notification> stop_sampling_;
+  std::thread sampling_thread_;
+
+  absl::Mutex samples_mutex_;
+  std::vector<Sample> samples_ ABSL_GUARDED_BY(samples_mutex_);
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_PUBLIC_COUNTER_SAMPLER_H_
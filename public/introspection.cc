@@ -14,10 +14,10 @@
 
 #include "public/introspection.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
-#include <fstream>
 #include <functional>
 #include <optional>
 #include <ostream>
@@ -29,24 +29,31 @@
 #include <vector>
 
 #include "gtest/gtest.h"
+#include "absl/base/call_once.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/flags/flag.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/match.h"
-#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_split.h"
 #include <magic_enum.hpp>
 #include "infiniband/verbs.h"
 #include "internal/introspection_registrar.h"
+#include "public/counter_sampler.h"
 #include "public/flags.h"
 #include "public/verbs_util.h"
 
 namespace rdma_unit_test {
 
+NicIntrospection::NicIntrospection(const std::string& name,
+                                   const ibv_device_attr& attr)
+    : name_(name), attr_(attr) {}
+
+NicIntrospection::~NicIntrospection() = default;
+
 NicIntrospection::CounterSnapshot NicIntrospection::GetCounterSnapshot() const {
   CounterSnapshot snapshot;
   for (const auto& [type, name] : GetHardwareCounters()) {
@@ -76,6 +83,13 @@ bool NicIntrospection::HasCounter(HardwareCounter counter) const {
 }
 
 std::string NicIntrospection::sysfs_device_name() const {
+  absl::call_once(sysfs_device_name_once_, [this]() {
+    sysfs_device_name_ = OpenSysfsDeviceName();
+  });
+  return sysfs_device_name_;
+}
+
+std::string NicIntrospection::OpenSysfsDeviceName() {
   // Introspection happens before the test happens and is used to examine
   // whether the NIC type is supported/registered.
   // In our current use case, we only test one NIC type at one time, so only
@@ -110,22 +124,16 @@ absl::StatusOr<uint64_t> NicIntrospection::GetCounterValue(
     return absl::NotFoundError(
         absl::StrCat("Cannot found counter ", magic_enum::enum_name(counter)));
   }
-  std::string path = absl::StrCat("/sys/class/infiniband/", sysfs_device_name(),
-                                  "/ports/1/hw_counters/", iter->second);
-  std::ifstream file(path);
-  if (!file.is_open()) {
-    return absl::InternalError(absl::StrCat("Cannot open file ", path));
-  }
-  std::string line;
-  if (!std::getline(file, line)) {
-    return absl::InternalError(absl::StrCat("Cannot get line ", line));
-  }
-  uint64_t value;
-  if (absl::SimpleAtoi(line, &value)) {
-    return value;
-  }
-  return absl::InternalError(
-      absl::StrCat("Cannot extract integer from line: ", line));
+  return counter_sampler().Read(counter);
+}
+
+CounterSampler& NicIntrospection::counter_sampler() const {
+  absl::call_once(counter_sampler_once_, [this]() {
+    counter_sampler_ = std::make_unique<CounterSampler>(
+        sysfs_device_name(), GetHardwareCounters(),
+        std::max<int>(1, attr_.phys_port_cnt));
+  });
+  return *counter_sampler_;
 }
 
 std::string NicIntrospection::DumpHardwareCounters() const {
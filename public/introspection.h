@@ -18,10 +18,12 @@
 #define THIRD_PARTY_RDMA_UNIT_TEST_PUBLIC_INTROSPECTION_H_
 
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 #include <tuple>
 
+#include "absl/base/call_once.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/statusor.h"
 #include "infiniband/verbs.h"
@@ -29,8 +31,10 @@
 
 namespace rdma_unit_test {
 
-// A class to consolidate NIC introspection logic. It is a trivially
-// destructable object which is created from an opened context.
+class CounterSampler;
+
+// A class to consolidate NIC introspection logic. It is created from an opened
+// context.
 class NicIntrospection {
  public:
   // Abstract hardware counter which might be supported by some providers.
@@ -88,9 +92,8 @@ class NicIntrospection {
 
   NicIntrospection() = delete;
   // Must use this constructor in order to use any of the other methods.
-  NicIntrospection(const std::string& name, const ibv_device_attr& attr)
-      : name_(name), attr_(attr) {}
-  virtual ~NicIntrospection() = default;
+  NicIntrospection(const std::string& name, const ibv_device_attr& attr);
+  virtual ~NicIntrospection();
 
   // Returns if the device supports target.
   virtual bool CheckCapability(ibv_device_cap_flags target) const {
@@ -175,6 +178,11 @@ class NicIntrospection {
   // Otherwise, returns a status indicating the reason of failure.
   absl::StatusOr<uint64_t> GetCounterValue(HardwareCounter counter) const;
 
+  // Returns the sampler of the provided hardware counters, summed over the
+  // ports of the device. It is created on first use and keeps the counter
+  // files open.
+  CounterSampler& counter_sampler() const;
+
   // Returns a snapshot to all provided hardware counters.
   CounterSnapshot GetCounterSnapshot() const;
 
@@ -184,7 +192,8 @@ class NicIntrospection {
   // Returns the name of the ibverbs device.
   const std::string device_name() const { return name_; }
 
-  // Returns the default name of the ibverbs device.
+  // Returns the default name of the ibverbs device. The device is only opened
+  // on the first call.
   std::string sysfs_device_name() const;
 
   // Returns the device attributes.
@@ -213,6 +222,15 @@ class NicIntrospection {
 
   const std::string name_;
   ibv_device_attr attr_;
+
+ private:
+  // Opens the device selected by --device_name to look up its sysfs name.
+  static std::string OpenSysfsDeviceName();
+
+  mutable absl::once_flag sysfs_device_name_once_;
+  mutable std::string sysfs_device_name_;
+  mutable absl::once_flag counter_sampler_once_;
+  mutable std::unique_ptr<CounterSampler> counter_sampler_;
 };
 
 // Returns an introspection object which can be queried for device capabilities.
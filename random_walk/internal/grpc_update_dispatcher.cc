@@ -16,12 +16,19 @@
 
 #include "random_walk/internal/grpc_update_dispatcher.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "grpcpp/client_context.h"
@@ -32,12 +39,60 @@
 #include "random_walk/internal/client_update_service.grpc.pb.h"
 #include "random_walk/internal/client_update_service.pb.h"
 #include "random_walk/internal/types.h"
+#include "random_walk/internal/update_batch.h"
+
+ABSL_FLAG(int, random_walk_update_batch_size, 16,
+          "The maximum number of ClientUpdates sent to a remote client in one "
+          "RPC in the multinode random walk. 1 disables batching.");
+ABSL_FLAG(absl::Duration, random_walk_update_batch_delay,
+          absl::Milliseconds(1),
+          "The maximum time a ClientUpdate waits for its batch to fill before "
+          "it is sent. Zero disables batching.");
 
 namespace rdma_unit_test {
 namespace random_walk {
+namespace {
+
+// The deadline of an UpdateBatch RPC, including its retries.
+constexpr absl::Duration kRpcTimeout = absl::Seconds(20);
+// The delay before resending a batch rejected by a full reorder window.
+constexpr absl::Duration kRetryDelay = absl::Milliseconds(1);
+
+}  // namespace
 
 GrpcUpdateDispatcher::GrpcUpdateDispatcher(ClientId owner_id)
-    : owner_id_(owner_id) {}
+    : owner_id_(owner_id),
+      batch_size_(
+          absl::GetFlag(FLAGS_random_walk_update_batch_delay) >
+                  absl::ZeroDuration()
+              ? std::max(1, absl::GetFlag(FLAGS_random_walk_update_batch_size))
+              : 1),
+      batch_delay_(absl::GetFlag(FLAGS_random_walk_update_batch_delay)) {
+  if (batch_size_ > 1) {
+    flusher_ = std::thread([this]() { FlushPeriodically(); });
+  }
+}
+
+GrpcUpdateDispatcher::~GrpcUpdateDispatcher() {
+  {
+    absl::MutexLock guard(&mutex_);
+    stop_ = true;
+  }
+  if (flusher_.joinable()) {
+    flusher_.join();
+  }
+  // Send what the flusher left behind. The RPCs hold their own stub, so they
+  // may outlive the dispatcher.
+  Flush();
+  absl::MutexLock guard(&mutex_);
+  size_t cancelled = 0;
+  for (const auto& [client_id, info] : rpc_infos_) {
+    cancelled += info.batch.total_cancelled();
+  }
+  LOG(INFO) << "Client " << owner_id_ << " dispatched " << updates_
+            << " updates in " << rpcs_ << " RPCs, " << cancelled
+            << " updates cancelled out.";
+}
 
 void GrpcUpdateDispatcher::RegisterRemoteUpdateHandler(
     ClientId client_id, const std::string& grpc_server_addr) {
@@ -47,42 +102,101 @@ void GrpcUpdateDispatcher::RegisterRemoteUpdateHandler(
   ::grpc::InsecureChannelCredentials();
   handler.channel = grpc::CreateChannel(grpc_server_addr, creds);
   handler.stub = ClientUpdateService::NewStub(handler.channel);
+  absl::MutexLock guard(&mutex_);
   map_util::InsertOrDie(rpc_infos_, client_id, handler);
 }
 
 void GrpcUpdateDispatcher::DispatchUpdate(const ClientUpdate& update) {
+  absl::MutexLock guard(&mutex_);
   if (update.has_destination_id()) {
-    SendUpdate(update.destination_id(), update);
+    BatchUpdate(update.destination_id(), update);
   } else {
     for (const auto& [client_id, remote_handler] : rpc_infos_) {
-      SendUpdate(client_id, update);
+      BatchUpdate(client_id, update);
     }
   }
 }
 
-void GrpcUpdateDispatcher::SendUpdate(ClientId client_id,
-                                      const ClientUpdate& update) {
-  struct RpcArgs {
-    ::grpc::ClientContext context;
-    OrderedUpdateRequest request;
-    UpdateResponse response;
-  };
+void GrpcUpdateDispatcher::Flush() {
+  absl::MutexLock guard(&mutex_);
+  pending_updates_ = false;
+  for (auto& [client_id, info] : rpc_infos_) {
+    SendBatch(info);
+  }
+}
+
+void GrpcUpdateDispatcher::BatchUpdate(ClientId client_id,
+                                       const ClientUpdate& update) {
   DCHECK(rpc_infos_.find(client_id) != rpc_infos_.end());
   RemoteHandler& info = rpc_infos_.at(client_id);
-  RpcArgs* args = new RpcArgs;
-  args->context.set_deadline(
-      absl::ToChronoTime(absl::Now() + absl::Seconds(20)));
-  *args->request.mutable_update() = update;
+  info.batch.Add(update);
+  if (info.batch.size() >= batch_size_) {
+    SendBatch(info);
+  } else {
+    pending_updates_ = true;
+  }
+}
+
+void GrpcUpdateDispatcher::SendBatch(RemoteHandler& info) {
+  std::vector<ClientUpdate> updates = info.batch.Take();
+  if (updates.empty()) {
+    return;
+  }
+  auto* args = new BatchRpc{.stub = info.stub,
+                            .deadline = absl::Now() + kRpcTimeout};
   args->request.set_source_id(owner_id_);
-  args->request.set_sequence_number(++info.next_sequence_number);
-
-  info.stub->async()->Update(&args->context, &args->request, &args->response,
-                             [args](::grpc::Status s) {
-                               if (!s.ok()) {
-                                 LOG(FATAL) << s.error_message();  // Crash ok
-                               }
-                               delete args;
-                             });
+  // The first update on a channel takes sequence number 0, as expected by
+  // UpdateReorderQueue.
+  args->request.set_first_sequence_number(info.next_sequence_number);
+  info.next_sequence_number += updates.size();
+  for (ClientUpdate& update : updates) {
+    *args->request.add_updates() = std::move(update);
+  }
+  ++rpcs_;
+  updates_ += updates.size();
+  StartBatchRpc(args);
+}
+
+void GrpcUpdateDispatcher::StartBatchRpc(BatchRpc* args) {
+  args->context = std::make_unique<::grpc::ClientContext>();
+  args->context->set_deadline(absl::ToChronoTime(args->deadline));
+  args->stub->async()->UpdateBatch(
+      args->context.get(), &args->request, &args->response,
+      [args](::grpc::Status s) {
+        // The receiver's reorder window is full until the updates ahead of
+        // this batch arrive. Resend the whole batch; the receiver skips the
+        // updates it has already accepted.
+        if (s.error_code() == ::grpc::StatusCode::RESOURCE_EXHAUSTED &&
+            absl::Now() + kRetryDelay < args->deadline) {
+          args->retry_alarm.Set(
+              absl::ToChronoTime(absl::Now() + kRetryDelay),
+              [args](bool ok) {
+                // The alarm is only cancelled by deleting `args`.
+                if (ok) StartBatchRpc(args);
+              });
+          return;
+        }
+        if (!s.ok()) {
+          LOG(FATAL) << s.error_message();  // Crash ok
+        }
+        delete args;
+      });
+}
+
+void GrpcUpdateDispatcher::FlushPeriodically() {
+  absl::MutexLock guard(&mutex_);
+  while (true) {
+    mutex_.Await(
+        absl::Condition(this, &GrpcUpdateDispatcher::StopOrPendingUpdates));
+    if (stop_ || mutex_.AwaitWithTimeout(absl::Condition(&stop_),
+                                         batch_delay_)) {
+      return;
+    }
+    pending_updates_ = false;
+    for (auto& [client_id, info] : rpc_infos_) {
+      SendBatch(info);
+    }
+  }
 }
 
 }  // namespace random_walk
@@ -17,32 +17,49 @@
 #ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_GRPC_UPDATE_DISPATCHER_H_
 #define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_GRPC_UPDATE_DISPATCHER_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <thread>  // NOLINT
 
+#include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/flags/declare.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "grpcpp/alarm.h"
 #include "grpcpp/channel.h"
+#include "grpcpp/client_context.h"
 #include "random_walk/internal/client_update_service.grpc.pb.h"
 #include "random_walk/internal/client_update_service.pb.h"
 #include "random_walk/internal/types.h"
+#include "random_walk/internal/update_batch.h"
 #include "random_walk/internal/update_dispatcher_interface.h"
 
+ABSL_DECLARE_FLAG(int, random_walk_update_batch_size);
+ABSL_DECLARE_FLAG(absl::Duration, random_walk_update_batch_delay);
+
 namespace rdma_unit_test {
 namespace random_walk {
 
 // The class responsible for dispatching ClientUpdates from a RandomWalkClient
-// to other RandomWalkClients via gRPC.
+// to other RandomWalkClients via gRPC. ClientUpdates are batched per remote
+// client (see UpdateBatch) and sent in one UpdateBatch RPC once the batch holds
+// --random_walk_update_batch_size updates, or at the latest after
+// --random_walk_update_batch_delay. A batch rejected because the receiver's
+// reorder window is full is resent until it is accepted.
 class GrpcUpdateDispatcher : public UpdateDispatcherInterface {
  public:
   GrpcUpdateDispatcher() = delete;
   GrpcUpdateDispatcher(ClientId owner_id);
-  // Movable but not copable.
-  GrpcUpdateDispatcher(GrpcUpdateDispatcher&& handler) = default;
-  GrpcUpdateDispatcher& operator=(GrpcUpdateDispatcher&& handler) = default;
+  // Neither movable nor copyable: the flusher thread holds `this`.
+  GrpcUpdateDispatcher(GrpcUpdateDispatcher&& handler) = delete;
+  GrpcUpdateDispatcher& operator=(GrpcUpdateDispatcher&& handler) = delete;
   GrpcUpdateDispatcher(const GrpcUpdateDispatcher& handler) = delete;
   GrpcUpdateDispatcher& operator=(const GrpcUpdateDispatcher& handler) = delete;
-  ~GrpcUpdateDispatcher() = default;
+  // Sends the batched ClientUpdates before returning.
+  ~GrpcUpdateDispatcher();
 
   // Registers the gRPC server address for a remote UpdateHandler. All
   // ClientUpdate targetting this specific [client_id] will be dispatched to
@@ -53,6 +70,9 @@ class GrpcUpdateDispatcher : public UpdateDispatcherInterface {
   // Implements UpdateDispatcherInterface.
   void DispatchUpdate(const ClientUpdate& update) override;
 
+  // Sends all batched ClientUpdates now.
+  void Flush();
+
  private:
   struct RemoteHandler {
     ClientId client_id;
@@ -60,15 +80,58 @@ class GrpcUpdateDispatcher : public UpdateDispatcherInterface {
     std::shared_ptr<::grpc::Channel> channel;
     std::shared_ptr<ClientUpdateService::Stub> stub;
     uint32_t next_sequence_number = 0;
+    UpdateBatch batch;
+  };
+
+  // Adds an ClientUpdate to the batch for the RandomWalkClient specified by
+  // [client_id], sending the batch if it is full.
+  void BatchUpdate(ClientId client_id, const ClientUpdate& update)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // The state of an UpdateBatch RPC, which lives until the RPC succeeds.
+  struct BatchRpc {
+    std::shared_ptr<ClientUpdateService::Stub> stub;
+    absl::Time deadline;
+    // A ClientContext cannot be reused, so every attempt gets a new one.
+    std::unique_ptr<::grpc::ClientContext> context;
+    OrderedUpdateBatchRequest request;
+    UpdateResponse response;
+    // Resends the batch after a rejection, without blocking the gRPC thread
+    // which ran the rejected attempt's callback.
+    ::grpc::Alarm retry_alarm;
   };
 
-  // Sends an ClientUpdate to the RandomWalkClient specified by [client_id].
-  void SendUpdate(ClientId client_id, const ClientUpdate& update);
+  // Sends the batched ClientUpdates of a remote handler, if any.
+  void SendBatch(RemoteHandler& info) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Starts an attempt of `args`' RPC, which is retried (after a short delay, on
+  // `args->retry_alarm`) while the receiver's reorder window is full, and
+  // deletes `args` once the RPC succeeds.
+  static void StartBatchRpc(BatchRpc* args);
+  // Waits for a batched ClientUpdate, gives its batch up to batch_delay_ to
+  // fill and sends every batch, until the dispatcher is destroyed.
+  void FlushPeriodically();
+  // The condition the flusher thread waits for.
+  bool StopOrPendingUpdates() const ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
+    return stop_ || pending_updates_;
+  }
 
-  // Maps remote RandomWalkClient's Id to the RemoteHandler struct.
-  absl::flat_hash_map<uint32_t, RemoteHandler> rpc_infos_;
   // The Id of the RandomWalkClient owning the dispatcher.
   const ClientId owner_id_;
+  // Configs.
+  const size_t batch_size_;
+  const absl::Duration batch_delay_;
+
+  absl::Mutex mutex_;
+  // Maps remote RandomWalkClient's Id to the RemoteHandler struct.
+  absl::flat_hash_map<uint32_t, RemoteHandler> rpc_infos_
+      ABSL_GUARDED_BY(mutex_);
+  // Statistics.
+  size_t rpcs_ ABSL_GUARDED_BY(mutex_) = 0;
+  size_t updates_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stop_ ABSL_GUARDED_BY(mutex_) = false;
+  // Whether a batch may hold ClientUpdates since the flusher last ran.
+  bool pending_updates_ ABSL_GUARDED_BY(mutex_) = false;
+  // Sends batches which are not full, if batching is enabled.
+  std::thread flusher_;
 };
 
 }  // namespace random_walk
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/grpc_update_dispatcher.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/grpc_update_handler.h"
+#include "random_walk/internal/inbound_update_interface.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr ClientId kLocalId = 0;
+constexpr ClientId kRemoteId = 1;
+constexpr int kBatchSize = 4;
+// Long enough for updates to be delivered by the in-process server.
+constexpr absl::Duration kDeliveryTimeout = absl::Seconds(10);
+
+// Records the qp_num of the AddUdQp updates delivered by the gRPC server.
+class RecordingClient : public InboundUpdateInterface {
+ public:
+  void PushInboundUpdate(const ClientUpdate& update) override {
+    absl::MutexLock guard(&mutex_);
+    qp_nums_.push_back(update.add_ud_qp().qp_num());
+  }
+
+  // Waits up to `timeout` for `count` updates and returns those delivered.
+  std::vector<uint32_t> WaitForUpdates(size_t count, absl::Duration timeout) {
+    absl::MutexLock guard(&mutex_);
+    awaited_count_ = count;
+    mutex_.AwaitWithTimeout(absl::Condition(this, &RecordingClient::Delivered),
+                            timeout);
+    return qp_nums_;
+  }
+
+ private:
+  bool Delivered() const ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
+    return qp_nums_.size() >= awaited_count_;
+  }
+
+  absl::Mutex mutex_;
+  std::vector<uint32_t> qp_nums_ ABSL_GUARDED_BY(mutex_);
+  size_t awaited_count_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+ClientUpdate AddUdQp(uint32_t qp_num) {
+  ClientUpdate update;
+  update.set_destination_id(kRemoteId);
+  update.mutable_add_ud_qp()->set_owner_id(kLocalId);
+  update.mutable_add_ud_qp()->set_qp_num(qp_num);
+  return update;
+}
+
+ClientUpdate RemoveUdQp(uint32_t qp_num) {
+  ClientUpdate update;
+  update.set_destination_id(kRemoteId);
+  update.mutable_remove_ud_qp()->set_owner_id(kLocalId);
+  update.mutable_remove_ud_qp()->set_qp_num(qp_num);
+  return update;
+}
+
+class GrpcUpdateDispatcherTest : public ::testing::Test {
+ protected:
+  // Creates the dispatcher under test with the given batching flags, sending
+  // to an in-process gRPC server.
+  void CreateDispatcher(absl::Duration batch_delay) {
+    absl::SetFlag(&FLAGS_random_walk_update_batch_size, kBatchSize);
+    absl::SetFlag(&FLAGS_random_walk_update_batch_delay, batch_delay);
+    dispatcher_ = std::make_unique<GrpcUpdateDispatcher>(kLocalId);
+    dispatcher_->RegisterRemoteUpdateHandler(kRemoteId,
+                                             handler_.GetServerAddress());
+  }
+
+  absl::FlagSaver flag_saver_;
+  std::shared_ptr<RecordingClient> client_ =
+      std::make_shared<RecordingClient>();
+  GrpcUpdateHandler handler_{client_};
+  std::unique_ptr<GrpcUpdateDispatcher> dispatcher_;
+};
+
+TEST_F(GrpcUpdateDispatcherTest, SendsFullBatches) {
+  CreateDispatcher(/*batch_delay=*/absl::Hours(1));
+  for (int qp_num = 0; qp_num < kBatchSize - 1; ++qp_num) {
+    dispatcher_->DispatchUpdate(AddUdQp(qp_num));
+  }
+  EXPECT_TRUE(
+      client_->WaitForUpdates(1, /*timeout=*/absl::Milliseconds(100)).empty());
+  dispatcher_->DispatchUpdate(AddUdQp(kBatchSize - 1));
+  EXPECT_THAT(client_->WaitForUpdates(kBatchSize, kDeliveryTimeout),
+              ElementsAre(0, 1, 2, 3));
+}
+
+TEST_F(GrpcUpdateDispatcherTest, FlushSendsPartialBatch) {
+  CreateDispatcher(/*batch_delay=*/absl::Hours(1));
+  dispatcher_->DispatchUpdate(AddUdQp(0));
+  dispatcher_->DispatchUpdate(AddUdQp(1));
+  dispatcher_->Flush();
+  EXPECT_THAT(client_->WaitForUpdates(2, kDeliveryTimeout), ElementsAre(0, 1));
+}
+
+TEST_F(GrpcUpdateDispatcherTest, DestructorSendsPartialBatch) {
+  CreateDispatcher(/*batch_delay=*/absl::Hours(1));
+  dispatcher_->DispatchUpdate(AddUdQp(0));
+  dispatcher_.reset();
+  EXPECT_THAT(client_->WaitForUpdates(1, kDeliveryTimeout), ElementsAre(0));
+}
+
+TEST_F(GrpcUpdateDispatcherTest, SendsPartialBatchAfterDelay) {
+  CreateDispatcher(/*batch_delay=*/absl::Milliseconds(1));
+  dispatcher_->DispatchUpdate(AddUdQp(0));
+  EXPECT_THAT(client_->WaitForUpdates(1, kDeliveryTimeout), ElementsAre(0));
+  // The flusher keeps serving later updates.
+  dispatcher_->DispatchUpdate(AddUdQp(1));
+  EXPECT_THAT(client_->WaitForUpdates(2, kDeliveryTimeout), ElementsAre(0, 1));
+}
+
+TEST_F(GrpcUpdateDispatcherTest, CancelsAddAndRemoveInBatch) {
+  CreateDispatcher(/*batch_delay=*/absl::Hours(1));
+  dispatcher_->DispatchUpdate(AddUdQp(0));
+  dispatcher_->DispatchUpdate(AddUdQp(1));
+  dispatcher_->DispatchUpdate(RemoveUdQp(0));
+  dispatcher_->DispatchUpdate(AddUdQp(2));
+  dispatcher_->Flush();
+  // Neither AddUdQp(0) nor RemoveUdQp(0) is sent, and sequence numbers stay
+  // contiguous, so the update sent after the batch is delivered too.
+  dispatcher_->DispatchUpdate(AddUdQp(3));
+  dispatcher_->Flush();
+  EXPECT_THAT(client_->WaitForUpdates(3, kDeliveryTimeout),
+              ElementsAre(1, 2, 3));
+}
+
+}  // namespace
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -16,6 +16,7 @@
 
 #include "random_walk/internal/ibv_resource_manager.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -57,6 +58,7 @@ bool IbvResourceManager::RemoteUdQpInfo::operator==(
 
 void IbvResourceManager::InsertCq(ibv_cq* cq) {
   map_util::InsertOrDie(cqs_, cq, CqInfo());
+  CHECK(cq_index_.Insert(cq));
 }
 
 IbvResourceManager::CqInfo* IbvResourceManager::GetMutableCqInfo(ibv_cq* cq) {
@@ -68,7 +70,7 @@ IbvResourceManager::CqInfo IbvResourceManager::GetCqInfo(ibv_cq* cq) const {
 }
 
 absl::optional<ibv_cq*> IbvResourceManager::GetRandomCq() const {
-  return sampler_.GetRandomMapKey(cqs_);
+  return sampler_.GetRandomSetElement(cq_index_);
 }
 
 absl::optional<ibv_cq*> IbvResourceManager::GetRandomCqNoReference() const {
@@ -83,20 +85,48 @@ absl::optional<ibv_cq*> IbvResourceManager::GetRandomCqNoReference() const {
 
 void IbvResourceManager::EraseCq(ibv_cq* cq) {
   map_util::CheckPresentAndErase(cqs_, cq);
+  CHECK(cq_index_.Erase(cq));
+  active_cqs_.Erase(cq);
 }
 
 std::vector<ibv_cq*> IbvResourceManager::GetAllCqs() const {
-  std::vector<ibv_cq*> cqs;
-  for (const auto& [cq, cq_info] : cqs_) {
-    cqs.push_back(cq);
-  }
-  return cqs;
+  return std::vector<ibv_cq*>(cq_index_.begin(), cq_index_.end());
 }
 
 size_t IbvResourceManager::CqCount() const { return cqs_.size(); }
 
+void IbvResourceManager::AddOutstandingCompletions(ibv_cq* cq,
+                                                   uint64_t count) {
+  CqInfo* cq_info = map_util::FindOrNull(cqs_, cq);
+  DCHECK(cq_info);
+  cq_info->outstanding_completions += count;
+  if (cq_info->outstanding_completions > 0) {
+    active_cqs_.Insert(cq);
+  }
+}
+
+void IbvResourceManager::RemoveOutstandingCompletions(ibv_cq* cq,
+                                                      uint64_t count) {
+  CqInfo* cq_info = map_util::FindOrNull(cqs_, cq);
+  if (cq_info == nullptr) {
+    return;
+  }
+  // Saturate, as completions of a QP destroyed with outstanding ops can be
+  // discounted before they are polled.
+  cq_info->outstanding_completions -=
+      std::min(count, cq_info->outstanding_completions);
+  if (cq_info->outstanding_completions == 0) {
+    active_cqs_.Erase(cq);
+  }
+}
+
+std::vector<ibv_cq*> IbvResourceManager::GetActiveCqs() const {
+  return std::vector<ibv_cq*>(active_cqs_.begin(), active_cqs_.end());
+}
+
 void IbvResourceManager::InsertPd(ibv_pd* pd) {
   map_util::InsertOrDie(pds_, pd, PdInfo());
+  CHECK(pd_index_.Insert(pd));
 }
 
 IbvResourceManager::PdInfo* IbvResourceManager::GetMutablePdInfo(ibv_pd* pd) {
@@ -108,7 +138,7 @@ IbvResourceManager::PdInfo IbvResourceManager::GetPdInfo(ibv_pd* pd) const {
 }
 
 absl::optional<ibv_pd*> IbvResourceManager::GetRandomPd() const {
-  return sampler_.GetRandomMapKey(pds_);
+  return sampler_.GetRandomSetElement(pd_index_);
 }
 
 absl::optional<ibv_pd*> IbvResourceManager::GetRandomPdNoReference() const {
@@ -125,12 +155,14 @@ absl::optional<ibv_pd*> IbvResourceManager::GetRandomPdNoReference() const {
 
 void IbvResourceManager::ErasePd(ibv_pd* pd) {
   map_util::CheckPresentAndErase(pds_, pd);
+  CHECK(pd_index_.Erase(pd));
 }
 
 size_t IbvResourceManager::PdCount() const { return pds_.size(); }
 
 void IbvResourceManager::InsertMr(ibv_mr* mr) {
   map_util::InsertOrDie(mrs_, mr, MrInfo());
+  CHECK(mr_index_.Insert(mr, mr->pd));
 }
 
 IbvResourceManager::MrInfo* IbvResourceManager::GetMutableMrInfo(ibv_mr* mr) {
@@ -142,7 +174,7 @@ IbvResourceManager::MrInfo IbvResourceManager::GetMrInfo(ibv_mr* mr) const {
 }
 
 absl::optional<ibv_mr*> IbvResourceManager::GetRandomMr() const {
-  return sampler_.GetRandomMapKey(mrs_);
+  return sampler_.GetRandomSetElement(mr_index_.all());
 }
 
 absl::optional<ibv_mr*> IbvResourceManager::GetRandomMrNoReference() const {
@@ -156,30 +188,26 @@ absl::optional<ibv_mr*> IbvResourceManager::GetRandomMrNoReference() const {
 }
 
 absl::optional<ibv_mr*> IbvResourceManager::GetRandomMr(ibv_pd* pd) const {
-  StreamSampler<ibv_mr*> stream_sampler;
-  for (const auto& [mr, mr_info] : mrs_) {
-    if (mr->pd == pd) {
-      stream_sampler.UpdateSample(mr);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomGroupElement(mr_index_, pd);
 }
 
 void IbvResourceManager::EraseMr(ibv_mr* mr) {
   map_util::CheckPresentAndErase(mrs_, mr);
+  CHECK(mr_index_.Erase(mr));
 }
 
 size_t IbvResourceManager::MrCount() const { return mrs_.size(); }
 
 void IbvResourceManager::InsertUnboundType1Mw(ibv_mw* mw) {
   DCHECK_EQ(mw->type, IBV_MW_TYPE_1);
-  map_util::InsertOrDie(type_1_mws_unbound_, mw);
+  CHECK(type_1_mws_unbound_.Insert(mw, mw->pd));
 }
 
 void IbvResourceManager::InsertBoundType1Mw(ibv_mw* mw,
                                             ibv_mw_bind_info bind_info) {
   DCHECK_EQ(mw->type, IBV_MW_TYPE_1);
   map_util::InsertOrDie(type_1_mws_bound_, mw, bind_info);
+  CHECK(type_1_mws_bound_index_.Insert(mw, mw->pd));
 }
 
 IbvResourceManager::Type1MwBindInfo IbvResourceManager::GetType1BindInfo(
@@ -188,41 +216,30 @@ IbvResourceManager::Type1MwBindInfo IbvResourceManager::GetType1BindInfo(
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomUnboundType1Mw() const {
-  return sampler_.GetRandomSetElement(type_1_mws_unbound_);
+  return sampler_.GetRandomSetElement(type_1_mws_unbound_.all());
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomUnboundType1Mw(
     ibv_pd* pd) const {
-  StreamSampler<ibv_mw*> stream_sampler;
-  for (const auto& mw : type_1_mws_unbound_) {
-    if (mw->pd == pd) {
-      stream_sampler.UpdateSample(mw);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomGroupElement(type_1_mws_unbound_, pd);
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomBoundType1Mw() const {
-  return sampler_.GetRandomMapKey(type_1_mws_bound_);
+  return sampler_.GetRandomSetElement(type_1_mws_bound_index_.all());
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomBoundType1Mw(
     ibv_pd* pd) const {
-  StreamSampler<ibv_mw*> stream_sampler;
-  for (const auto& [mw, mw_info] : type_1_mws_bound_) {
-    if (mw->pd == pd) {
-      stream_sampler.UpdateSample(mw);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomGroupElement(type_1_mws_bound_index_, pd);
 }
 
 void IbvResourceManager::EraseUnboundType1Mw(ibv_mw* mw) {
-  map_util::CheckPresentAndErase(type_1_mws_unbound_, mw);
+  CHECK(type_1_mws_unbound_.Erase(mw));
 }
 
 void IbvResourceManager::EraseBoundType1Mw(ibv_mw* mw) {
   map_util::CheckPresentAndErase(type_1_mws_bound_, mw);
+  CHECK(type_1_mws_bound_index_.Erase(mw));
 }
 
 size_t IbvResourceManager::Type1MwCount() const {
@@ -230,7 +247,7 @@ size_t IbvResourceManager::Type1MwCount() const {
 }
 
 void IbvResourceManager::InsertUnboundType2Mw(ibv_mw* mw) {
-  map_util::InsertOrDie(type_2_mws_unbound_, mw);
+  CHECK(type_2_mws_unbound_.Insert(mw, mw->pd));
 }
 
 void IbvResourceManager::InsertBoundType2Mw(ibv_mw* mw,
@@ -238,6 +255,7 @@ void IbvResourceManager::InsertBoundType2Mw(ibv_mw* mw,
                                             uint32_t qp_num) {
   Type2MwBindInfo bind{.mw = mw, .bind_info = bind_info, .qp_num = qp_num};
   map_util::InsertOrDie(type_2_mws_bound_, mw->rkey, bind);
+  CHECK(type_2_mws_bound_index_.Insert(mw->rkey, mw->pd));
 }
 
 IbvResourceManager::Type2MwBindInfo IbvResourceManager::GetType2BindInfo(
@@ -255,45 +273,38 @@ IbvResourceManager::TryGetType2BindInfo(uint32_t rkey) const {
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomUnboundType2Mw() const {
-  return sampler_.GetRandomSetElement(type_2_mws_unbound_);
+  return sampler_.GetRandomSetElement(type_2_mws_unbound_.all());
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomUnboundType2Mw(
     ibv_pd* pd) const {
-  StreamSampler<ibv_mw*> stream_sampler;
-  for (const auto& mw : type_2_mws_unbound_) {
-    if (mw->pd == pd) {
-      stream_sampler.UpdateSample(mw);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomGroupElement(type_2_mws_unbound_, pd);
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomBoundType2Mw() const {
-  auto sample = sampler_.GetRandomMapValue(type_2_mws_bound_);
-  if (!sample.has_value()) {
+  auto rkey = sampler_.GetRandomSetElement(type_2_mws_bound_index_.all());
+  if (!rkey.has_value()) {
     return absl::nullopt;
   }
-  return sample.value().mw;
+  return map_util::FindOrDie(type_2_mws_bound_, *rkey).mw;
 }
 
 absl::optional<ibv_mw*> IbvResourceManager::GetRandomBoundType2Mw(
     ibv_pd* pd) const {
-  StreamSampler<ibv_mw*> stream_sampler;
-  for (const auto& [rkey, mw_info] : type_2_mws_bound_) {
-    if (mw_info.mw->pd == pd) {
-      stream_sampler.UpdateSample(mw_info.mw);
-    }
+  auto rkey = sampler_.GetRandomGroupElement(type_2_mws_bound_index_, pd);
+  if (!rkey.has_value()) {
+    return absl::nullopt;
   }
-  return stream_sampler.ExtractSample();
+  return map_util::FindOrDie(type_2_mws_bound_, *rkey).mw;
 }
 
 void IbvResourceManager::EraseUnboundType2Mw(ibv_mw* mw) {
-  map_util::CheckPresentAndErase(type_2_mws_unbound_, mw);
+  CHECK(type_2_mws_unbound_.Erase(mw));
 }
 
 void IbvResourceManager::EraseBoundType2Mw(uint32_t rkey) {
   map_util::CheckPresentAndErase(type_2_mws_bound_, rkey);
+  CHECK(type_2_mws_bound_index_.Erase(rkey));
 }
 
 size_t IbvResourceManager::Type2MwCount() const {
@@ -309,7 +320,7 @@ void IbvResourceManager::InsertRdmaMemory(ClientId client_id, uint32_t rkey,
                    .length = length,
                    .pd_handle = pd_handle,
                    .qp_num = absl::nullopt};
-  map_util::InsertOrDie(rdma_memories_, value);
+  CHECK(rdma_memories_.Insert(value));
 }
 
 void IbvResourceManager::InsertRdmaMemory(ClientId client_id, uint32_t rkey,
@@ -321,7 +332,8 @@ void IbvResourceManager::InsertRdmaMemory(ClientId client_id, uint32_t rkey,
                     .length = length,
                     .pd_handle = pd_handle,
                     .qp_num = qp_num};
-  map_util::InsertOrDie(rdma_memories_, memory);
+  CHECK(rdma_memories_.Insert(memory));
+  CHECK(remote_type_2_mws_bound_.Insert(memory));
 }
 
 absl::optional<IbvResourceManager::RdmaMemory>
@@ -331,21 +343,17 @@ IbvResourceManager::GetRandomRdmaMemory() const {
 
 absl::optional<IbvResourceManager::RdmaMemory>
 IbvResourceManager::GetRandomRemoteBoundType2Mw() const {
-  StreamSampler<RdmaMemory> stream_sampler;
-  for (const auto& memory : rdma_memories_) {
-    if (memory.qp_num.has_value()) {
-      stream_sampler.UpdateSample(memory);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomSetElement(remote_type_2_mws_bound_);
 }
 
 void IbvResourceManager::EraseRdmaMemory(ClientId client_id, uint32_t rkey) {
-  map_util::CheckPresentAndErase(rdma_memories_, {client_id, rkey});
+  CHECK(rdma_memories_.Erase({.client_id = client_id, .rkey = rkey}));
+  remote_type_2_mws_bound_.Erase({.client_id = client_id, .rkey = rkey});
 }
 
 void IbvResourceManager::TryEraseRdmaMemory(ClientId client_id, uint32_t rkey) {
-  rdma_memories_.erase({client_id, rkey});
+  rdma_memories_.Erase({.client_id = client_id, .rkey = rkey});
+  remote_type_2_mws_bound_.Erase({.client_id = client_id, .rkey = rkey});
 }
 
 void IbvResourceManager::InsertRcQp(ibv_qp* qp, const ibv_qp_cap& cap) {
@@ -457,7 +465,7 @@ absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForBind() const {
   StreamSampler<ibv_qp*> stream_sampler;
   for (const auto& [qp_num, qp_info] : rc_qps_) {
     if (verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS &&
-        qp_info.remote_qp.has_value()) {
+        qp_info.remote_qp.has_value() && HasRoomForOp(qp_info)) {
       stream_sampler.UpdateSample(qp_info.qp);
     }
   }
@@ -465,13 +473,14 @@ absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForBind() const {
 }
 
 absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForMessaging(
-    ibv_qp_type qp_type) const {
+    ibv_qp_type qp_type, const PostingShard& shard) const {
   StreamSampler<ibv_qp*> stream_sampler;
   switch (qp_type) {
     case (IBV_QPT_RC): {
       for (const auto& [qp_num, qp_info] : rc_qps_) {
-        if (verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS &&
-            qp_info.remote_qp.has_value()) {
+        if (shard.Owns(qp_info.qp) &&
+            verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS &&
+            qp_info.remote_qp.has_value() && HasRoomForOp(qp_info, shard)) {
           stream_sampler.UpdateSample(qp_info.qp);
         }
       }
@@ -479,7 +488,9 @@ absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForMessaging(
     }
     case (IBV_QPT_UD): {
       for (const auto& [qp_num, qp_info] : ud_qps_) {
-        if (verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS) {
+        if (shard.Owns(qp_info.qp) &&
+            verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS &&
+            HasRoomForOp(qp_info, shard)) {
           stream_sampler.UpdateSample(qp_info.qp);
         }
       }
@@ -493,13 +504,15 @@ absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForMessaging(
 }
 
 absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForRdma(
-    ClientId client_id, uint32_t pd_handle) const {
+    ClientId client_id, uint32_t pd_handle, const PostingShard& shard) const {
   StreamSampler<ibv_qp*> stream_sampler;
   for (const auto& [qp_num, qp_info] : rc_qps_) {
-    if (verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS &&
+    if (shard.Owns(qp_info.qp) &&
+        verbs_util::GetQpState(qp_info.qp) == IBV_QPS_RTS &&
         qp_info.remote_qp.has_value() &&
         qp_info.remote_qp->client_id == client_id &&
-        qp_info.remote_qp->pd_handle == pd_handle) {
+        qp_info.remote_qp->pd_handle == pd_handle &&
+        HasRoomForOp(qp_info, shard)) {
       DCHECK_EQ(qp_info.qp->qp_type, IBV_QPT_RC);
       stream_sampler.UpdateSample(qp_info.qp);
     }
@@ -527,18 +540,60 @@ absl::optional<ibv_qp*> IbvResourceManager::GetRandomQpForDestroy(
 }
 
 ibv_qp* IbvResourceManager::GetLocalRcQp(ClientId client_id,
-                                         uint32_t remote_qpn) const {
+                                         uint32_t remote_qpn,
+                                         const PostingShard& shard) const {
   for (const auto& [qpn, qp_info] : rc_qps_) {
     if (qp_info.remote_qp.has_value() &&
         qp_info.remote_qp->client_id == client_id &&
         qp_info.remote_qp->qp_num == remote_qpn) {
+      if (!shard.Owns(qp_info.qp) ||
+          verbs_util::GetQpState(qp_info.qp) != IBV_QPS_RTS ||
+          !HasRoomForOp(qp_info, shard)) {
+        return nullptr;
+      }
       return qp_info.qp;
     }
   }
   return nullptr;
 }
 
-void IbvResourceManager::EraseQp(uint32_t qp_num, ibv_qp_type qp_type) {
+bool IbvResourceManager::HasRoomForOp(const QpInfo& qp_info,
+                                      const PostingShard& shard) const {
+  // Send and recv ops share inflight_ops, so bound them by the smaller queue.
+  uint64_t inflight_ops = qp_info.inflight_ops.size();
+  if (inflight_ops >=
+      std::min(qp_info.cap.max_send_wr, qp_info.cap.max_recv_wr)) {
+    return false;
+  }
+  for (ibv_cq* cq : {qp_info.qp->send_cq, qp_info.qp->recv_cq}) {
+    auto iter = cqs_.find(cq);
+    if (iter == cqs_.end()) {
+      continue;
+    }
+    // Every shard may have as many completions pending as this one.
+    uint64_t pending = 0;
+    if (shard.pending_completions != nullptr) {
+      auto pending_iter = shard.pending_completions->find(cq);
+      if (pending_iter != shard.pending_completions->end()) {
+        pending = pending_iter->second;
+      }
+    }
+    if (iter->second.outstanding_completions + shard.count * (pending + 1) >
+        static_cast<uint64_t>(cq->cqe)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void IbvResourceManager::EraseQp(uint32_t qp_num, ibv_qp_type qp_type,
+                                 ibv_cq* send_cq, ibv_cq* recv_cq) {
+  const QpInfo* qp_info = GetMutableQpInfo(qp_num);
+  DCHECK(qp_info);
+  for (uint64_t wr_id : qp_info->inflight_ops) {
+    RemoveOutstandingCompletions(
+        DecodeAction(wr_id) == Action::RECV ? recv_cq : send_cq, 1);
+  }
   switch (qp_type) {
     case (IBV_QPT_RC): {
       map_util::CheckPresentAndErase(rc_qps_, qp_num);
@@ -573,27 +628,22 @@ void IbvResourceManager::InsertRemoteUdQp(ClientId client_id, uint32_t qp_num,
                                           uint32_t qkey) {
   RemoteUdQpInfo qp_info{
       .client_id = client_id, .qp_num = qp_num, .q_key = qkey};
-  map_util::InsertOrDie(remote_ud_qps_, qp_info);
+  CHECK(remote_ud_qps_.Insert(qp_info, client_id));
 }
 
 void IbvResourceManager::EraseRemoteUdQp(ClientId client_id, uint32_t qp_num) {
-  map_util::CheckPresentAndErase(remote_ud_qps_, {client_id, qp_num});
+  CHECK(remote_ud_qps_.Erase({.client_id = client_id, .qp_num = qp_num}));
 }
 
 absl::optional<IbvResourceManager::RemoteUdQpInfo>
 IbvResourceManager::GetRandomRemoteUdQp(ClientId client_id) const {
-  StreamSampler<RemoteUdQpInfo> stream_sampler;
-  for (const auto& remote_ud_info : remote_ud_qps_) {
-    if (remote_ud_info.client_id == client_id) {
-      stream_sampler.UpdateSample(remote_ud_info);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomGroupElement(remote_ud_qps_, client_id);
 }
 
 void IbvResourceManager::InsertAh(ibv_ah* ah, ClientId client_id) {
   AhInfo ah_info{.client_id = client_id};
   map_util::InsertOrDie(ahs_, ah, ah_info);
+  CHECK(ah_index_.Insert(ah, ah->pd));
 }
 
 IbvResourceManager::AhInfo IbvResourceManager::GetAhInfo(ibv_ah* ah) const {
@@ -601,21 +651,16 @@ IbvResourceManager::AhInfo IbvResourceManager::GetAhInfo(ibv_ah* ah) const {
 }
 
 absl::optional<ibv_ah*> IbvResourceManager::GetRandomAh() const {
-  return sampler_.GetRandomMapKey(ahs_);
+  return sampler_.GetRandomSetElement(ah_index_.all());
 }
 
 absl::optional<ibv_ah*> IbvResourceManager::GetRandomAh(ibv_pd* pd) const {
-  StreamSampler<ibv_ah*> stream_sampler;
-  for (const auto& [ah, ah_info] : ahs_) {
-    if (ah->pd == pd) {
-      stream_sampler.UpdateSample(ah);
-    }
-  }
-  return stream_sampler.ExtractSample();
+  return sampler_.GetRandomGroupElement(ah_index_, pd);
 }
 
 void IbvResourceManager::EraseAh(ibv_ah* ah) {
   map_util::CheckPresentAndErase(ahs_, ah);
+  CHECK(ah_index_.Erase(ah));
 }
 
 }  // namespace random_walk
@@ -32,6 +32,21 @@
 namespace rdma_unit_test {
 namespace random_walk {
 
+// The share of QPs a thread may post data path ops to when `count` threads
+// post concurrently. Each QP is owned by exactly one shard, so no two threads
+// post to, or track the inflight ops of, the same QP.
+struct PostingShard {
+  uint32_t index = 0;
+  uint32_t count = 1;
+  // Completions the thread has posted which are not yet recorded with
+  // IbvResourceManager::AddOutstandingCompletions, or nullptr if there are
+  // none.
+  const absl::flat_hash_map<ibv_cq*, uint64_t>* pending_completions = nullptr;
+
+  // Returns true if the shard may post to the QP.
+  bool Owns(const ibv_qp* qp) const { return qp->qp_num % count == index; }
+};
+
 // IbvResource tracks metadadta of IbVerbs resources, such as queue pairs,
 // memory windows and memory regions. It provides methods for adding, removing
 // and modifying these resources. It also features methods for sampling random
@@ -43,6 +58,9 @@ class IbvResourceManager {
     // References to the CQ.
     absl::flat_hash_set<ibv_qp*> send_qps;
     absl::flat_hash_set<ibv_qp*> recv_qps;
+    // Number of posted work requests whose completions are expected on this
+    // CQ but have not been polled yet.
+    uint64_t outstanding_completions = 0;
   };
 
   // Metadata for PD.
@@ -180,6 +198,13 @@ class IbvResourceManager {
   std::vector<ibv_cq*> GetAllCqs() const;
   // Returns the total number of CQs in the pool.
   size_t CqCount() const;
+  // Records that `count` work requests whose completions go to `cq` were
+  // posted.
+  void AddOutstandingCompletions(ibv_cq* cq, uint64_t count = 1);
+  // Records that `count` completions were polled from `cq`.
+  void RemoveOutstandingCompletions(ibv_cq* cq, uint64_t count);
+  // Returns a vector consists of all CQs with outstanding completions.
+  std::vector<ibv_cq*> GetActiveCqs() const;
 
   // Inserts a PD into the sampling pool.
   void InsertPd(ibv_pd* pd);
@@ -307,19 +332,26 @@ class IbvResourceManager {
   // Returns a random QP to carry out a bind op. The QP must be:
   // 1. RC QP.
   // 2. must be RTS.
+  // 3. Have room for one more op (see HasRoomForOp).
   absl::optional<ibv_qp*> GetRandomQpForBind() const;
   // Returns a random QP to carry out messaging. The QP must be:
   // 1. In RTS state.
   // 2. If the QP is RC, the corresponding remote QP must be once brought to
   //    RTS.
-  absl::optional<ibv_qp*> GetRandomQpForMessaging(ibv_qp_type qp_type) const;
+  // 3. Have room for one more op (see HasRoomForOp).
+  // 4. Be owned by `shard`.
+  absl::optional<ibv_qp*> GetRandomQpForMessaging(
+      ibv_qp_type qp_type, const PostingShard& shard = {}) const;
   // Returns a random Qp to carry out RDMA and atomics. The QP must be:
   // 1. RC QP.
   // 2. The corresponding remote QP must be once brought to RTS.
   // 3. The client_id of the remote QP must match with the provided client_id.
   // 4. The PD handle of the remote QP must match with the provided pd_handle.
-  absl::optional<ibv_qp*> GetRandomQpForRdma(ClientId client_id,
-                                             uint32_t pd_handle) const;
+  // 5. Have room for one more op (see HasRoomForOp).
+  // 6. Be owned by `shard`.
+  absl::optional<ibv_qp*> GetRandomQpForRdma(
+      ClientId client_id, uint32_t pd_handle,
+      const PostingShard& shard = {}) const;
   // Gets a random QP:
   // 1. In ERROR state.
   // 2. With no Type 2 MW bound to it.
@@ -328,10 +360,17 @@ class IbvResourceManager {
       bool allow_outstanding_ops) const;
   // Returns the local RC QP connected to a specific remote QP, specified by the
   // remote cient_id and qp_num. Used specifically for Rdma/Atomics on type 2
-  // MWs.
-  ibv_qp* GetLocalRcQp(ClientId client_id, uint32_t remote_qpn) const;
-  // Erases a QP from the sampling pool.
-  void EraseQp(uint32_t qp_num, ibv_qp_type qp_type);
+  // MWs. Returns nullptr unless the QP:
+  // 1. Is in RTS state.
+  // 2. Has room for one more op (see HasRoomForOp).
+  // 3. Is owned by `shard`.
+  ibv_qp* GetLocalRcQp(ClientId client_id, uint32_t remote_qpn,
+                       const PostingShard& shard = {}) const;
+  // Erases a destroyed QP from the sampling pool. Its ops still in flight
+  // never complete, so their completions are discounted from the outstanding
+  // completions of `send_cq` and `recv_cq`, the CQs of the QP.
+  void EraseQp(uint32_t qp_num, ibv_qp_type qp_type, ibv_cq* send_cq,
+               ibv_cq* recv_cq);
   // Returns the total number of QPs of specific type.
   uint32_t QpCount(ibv_qp_type qp_type) const;
 
@@ -354,19 +393,38 @@ class IbvResourceManager {
   void EraseAh(ibv_ah* ah);
 
  private:
+  // Returns true if one more op can be posted to the QP without overflowing
+  // its work queues or its CQs, given the ops which are still in flight. This
+  // matters when several ops are posted before completions are polled. CQs are
+  // shared between shards, so each shard may fill only its share of a CQ.
+  bool HasRoomForOp(const QpInfo& qp_info,
+                    const PostingShard& shard = {}) const;
+
+  // Resources and their metadata are kept in hash maps, and are mirrored in
+  // IndexedSets (grouped by PD where a per-PD sampler exists) so that sampling
+  // is O(1) rather than a walk over the map.
   absl::flat_hash_map<ibv_cq*, CqInfo> cqs_;
+  IndexedSet<ibv_cq*> cq_index_;
+  IndexedSet<ibv_cq*> active_cqs_;  // CQs with outstanding completions.
   absl::flat_hash_map<ibv_pd*, PdInfo> pds_;
+  IndexedSet<ibv_pd*> pd_index_;
   absl::flat_hash_map<ibv_mr*, MrInfo> mrs_;
+  GroupedIndexedSet<ibv_mr*, ibv_pd*> mr_index_;
   absl::flat_hash_map<ibv_mw*, Type1MwBindInfo> type_1_mws_bound_;
-  absl::flat_hash_set<ibv_mw*> type_1_mws_unbound_;
+  GroupedIndexedSet<ibv_mw*, ibv_pd*> type_1_mws_bound_index_;
+  GroupedIndexedSet<ibv_mw*, ibv_pd*> type_1_mws_unbound_;
   absl::flat_hash_map<uint32_t, Type2MwBindInfo>
       type_2_mws_bound_;  // Key is rkey of the MW.
-  absl::flat_hash_set<ibv_mw*> type_2_mws_unbound_;
+  GroupedIndexedSet<uint32_t, ibv_pd*> type_2_mws_bound_index_;  // rkeys.
+  GroupedIndexedSet<ibv_mw*, ibv_pd*> type_2_mws_unbound_;
   absl::flat_hash_map<uint32_t, RcQpInfo> rc_qps_;  // Key is qp number.
   absl::flat_hash_map<uint32_t, UdQpInfo> ud_qps_;  // Key is qp number.
-  absl::flat_hash_set<RdmaMemory> rdma_memories_;
-  absl::flat_hash_set<RemoteUdQpInfo> remote_ud_qps_;
+  IndexedSet<RdmaMemory> rdma_memories_;
+  // The subset of rdma_memories_ which are remote bound type 2 MWs.
+  IndexedSet<RdmaMemory> remote_type_2_mws_bound_;
+  GroupedIndexedSet<RemoteUdQpInfo, ClientId> remote_ud_qps_;
   absl::flat_hash_map<ibv_ah*, AhInfo> ahs_;
+  GroupedIndexedSet<ibv_ah*, ibv_pd*> ah_index_;
   RandomWalkSampler sampler_;
 };
 
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/ibv_resource_manager.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "infiniband/verbs.h"
+#include "internal/verbs_attribute.h"
+#include "public/basic_fixture.h"
+#include "public/rdma_memblock.h"
+#include "public/status_matchers.h"
+#include "public/verbs_helper_suite.h"
+#include "public/verbs_util.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+using ::testing::IsEmpty;
+using ::testing::IsNull;
+using ::testing::NotNull;
+
+// As small as the smallest work queues of the random walk.
+constexpr uint32_t kMaxWr = 20;
+constexpr int kCqe = 200;
+constexpr ClientId kRemoteClient = 1;
+
+class IbvResourceManagerTest : public BasicFixture {
+ protected:
+  void SetUp() override {
+    BasicFixture::SetUp();
+    ASSERT_OK_AND_ASSIGN(context_, ibv_.OpenDevice());
+    pd_ = ibv_.AllocPd(context_);
+    ASSERT_THAT(pd_, NotNull());
+    cq_ = ibv_.CreateCq(context_, kCqe);
+    ASSERT_THAT(cq_, NotNull());
+    QpInitAttribute init_attr =
+        QpInitAttribute().set_max_send_wr(kMaxWr).set_max_recv_wr(kMaxWr);
+    qp_ = ibv_.CreateQp(pd_, cq_, IBV_QPT_RC, init_attr);
+    ASSERT_THAT(qp_, NotNull());
+    remote_qp_ = ibv_.CreateQp(pd_, cq_, IBV_QPT_RC, init_attr);
+    ASSERT_THAT(remote_qp_, NotNull());
+    ASSERT_OK(ibv_.SetUpLoopbackRcQps(qp_, remote_qp_,
+                                      ibv_.GetPortAttribute(context_)));
+    buffer_ = ibv_.AllocBuffer(/*pages=*/1);
+    mr_ = ibv_.RegMr(pd_, buffer_);
+    ASSERT_THAT(mr_, NotNull());
+
+    // Register `qp_` as the QP which remote type 2 MWs are bound to, with the
+    // capabilities it was actually created with.
+    ibv_qp_attr attr;
+    ibv_qp_init_attr created_attr;
+    ASSERT_EQ(ibv_query_qp(qp_, &attr, IBV_QP_CAP, &created_attr), 0);
+    cap_ = created_attr.cap;
+    manager_.InsertCq(cq_);
+    manager_.InsertRcQp(qp_, cap_);
+    manager_.GetMutableRcQpInfo(qp_)->remote_qp =
+        IbvResourceManager::RemoteRcQpInfo{.client_id = kRemoteClient,
+                                           .qp_num = remote_qp_->qp_num,
+                                           .pd_handle = pd_->handle};
+  }
+
+  // Posts an RDMA write on `qp_` and records it as the random walk does.
+  void PostWrite(uint64_t wr_id) {
+    ibv_sge sge = verbs_util::CreateSge(buffer_.span().subspan(0, 8), mr_);
+    ibv_send_wr write = verbs_util::CreateWriteWr(
+        wr_id, &sge, /*num_sge=*/1, buffer_.data() + 8, mr_->rkey);
+    ibv_send_wr* bad_wr = nullptr;
+    ASSERT_EQ(ibv_post_send(qp_, &write, &bad_wr), 0);
+    manager_.GetMutableRcQpInfo(qp_)->inflight_ops.insert(wr_id);
+    manager_.AddOutstandingCompletions(cq_);
+  }
+
+  VerbsHelperSuite ibv_;
+  IbvResourceManager manager_;
+  ibv_context* context_ = nullptr;
+  ibv_pd* pd_ = nullptr;
+  ibv_cq* cq_ = nullptr;
+  ibv_qp* qp_ = nullptr;
+  ibv_qp* remote_qp_ = nullptr;
+  ibv_qp_cap cap_;
+  RdmaMemBlock buffer_;
+  ibv_mr* mr_ = nullptr;
+};
+
+TEST_F(IbvResourceManagerTest, Type2MwQpStopsAtMaxSendWr) {
+  // Nothing is polled, so ops may only be posted until the send queue (or
+  // the CQ) is full. Posting more would fail.
+  const uint64_t expected = std::min<uint64_t>(
+      {cap_.max_send_wr, cap_.max_recv_wr, static_cast<uint64_t>(cq_->cqe)});
+  uint64_t posted = 0;
+  for (uint64_t wr_id = 0; wr_id < 2 * expected; ++wr_id) {
+    if (manager_.GetLocalRcQp(kRemoteClient, remote_qp_->qp_num) == nullptr) {
+      break;
+    }
+    PostWrite(wr_id);
+    ++posted;
+  }
+  EXPECT_EQ(posted, expected);
+  EXPECT_THAT(manager_.GetLocalRcQp(kRemoteClient, remote_qp_->qp_num),
+              IsNull());
+}
+
+TEST_F(IbvResourceManagerTest, Type2MwQpOnlyForOwningShard) {
+  PostingShard owner = {.index = qp_->qp_num % 2, .count = 2};
+  PostingShard other = {.index = (qp_->qp_num + 1) % 2, .count = 2};
+  EXPECT_EQ(manager_.GetLocalRcQp(kRemoteClient, remote_qp_->qp_num, owner),
+            qp_);
+  EXPECT_THAT(manager_.GetLocalRcQp(kRemoteClient, remote_qp_->qp_num, other),
+              IsNull());
+}
+
+TEST_F(IbvResourceManagerTest, Type2MwQpNotInRts) {
+  ASSERT_OK(ibv_.ModifyQpToError(qp_));
+  EXPECT_THAT(manager_.GetLocalRcQp(kRemoteClient, remote_qp_->qp_num),
+              IsNull());
+}
+
+TEST_F(IbvResourceManagerTest, EraseQpWithOutstandingOps) {
+  constexpr uint64_t kOps = 4;
+  for (uint64_t wr_id = 0; wr_id < kOps; ++wr_id) {
+    PostWrite(wr_id);
+  }
+  ASSERT_EQ(manager_.GetCqInfo(cq_).outstanding_completions, kOps);
+  ASSERT_OK(ibv_.ModifyQpToError(qp_));
+  const uint32_t qp_num = qp_->qp_num;
+  ASSERT_EQ(ibv_.DestroyQp(qp_), 0);
+  manager_.EraseQp(qp_num, IBV_QPT_RC, cq_, cq_);
+  // The completions of the destroyed QP will never be polled.
+  EXPECT_EQ(manager_.GetCqInfo(cq_).outstanding_completions, 0);
+  EXPECT_THAT(manager_.GetActiveCqs(), IsEmpty());
+  EXPECT_EQ(manager_.QpCount(IBV_QPT_RC), 0);
+}
+
+}  // namespace
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -16,9 +16,10 @@
 
 #include "random_walk/internal/logging.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
-#include <deque>
 #include <memory>
 #include <string>
 
@@ -32,399 +33,294 @@
 
 namespace rdma_unit_test {
 namespace random_walk {
+namespace {
 
-LogEntry::LogEntry(uint64_t entry_id)
-    : entry_id_(entry_id), timestamp_(absl::Now()) {}
-
-uint64_t LogEntry::entry_id() const { return entry_id_; }
-
-absl::Time LogEntry::timestamp() const { return timestamp_; }
-
-CreateCq::CreateCq(uint64_t entry_id, ibv_cq* cq)
-    : LogEntry(entry_id), cq_(cq) {}
-
-std::string CreateCq::ToString() const {
-  return absl::StrCat("AllocPd {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", cq = ", reinterpret_cast<uint64_t>(cq_), "}");
-}
-
-DestroyCq::DestroyCq(uint64_t entry_id, ibv_cq* cq)
-    : LogEntry(entry_id), cq_(cq) {}
-
-std::string DestroyCq::ToString() const {
-  return absl::StrCat("AllocPd {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", cq = ", reinterpret_cast<uint64_t>(cq_), "}");
-}
-
-AllocPd::AllocPd(uint64_t entry_id, ibv_pd* pd) : LogEntry(entry_id), pd_(pd) {}
-
-std::string AllocPd::ToString() const {
-  return absl::StrCat("AllocPd {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", pd = ", reinterpret_cast<uint64_t>(pd_), "}");
-}
-
-DeallocPd::DeallocPd(uint64_t entry_id, ibv_pd* pd)
-    : LogEntry(entry_id), pd_(pd) {}
-
-std::string DeallocPd::ToString() const {
-  return absl::StrCat("AllocPd {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", pd = ", reinterpret_cast<uint64_t>(pd_), "}");
-}
-
-RegMr::RegMr(uint64_t entry_id, ibv_pd* pd, const RdmaMemBlock& memblock,
-             ibv_mr* mr)
-    : LogEntry(entry_id),
-      pd_(pd),
-      addr_(reinterpret_cast<uint64_t>(memblock.data())),
-      length_(memblock.size()),
-      mr_(mr) {}
-
-std::string RegMr::ToString() const {
-  return absl::StrCat("RegMr {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", pd = ", reinterpret_cast<uint64_t>(pd_),
-                      ", addr = ", addr_, ", length = ", length_, "}.");
-}
-
-DeregMr::DeregMr(uint64_t entry_id, ibv_mr* mr) : LogEntry(entry_id), mr_(mr) {}
-
-std::string DeregMr::ToString() const {
-  return absl::StrCat("DeregMr {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", mr = ", reinterpret_cast<uint64_t>(mr_), "}.");
-}
-
-AllocMw::AllocMw(uint64_t entry_id, ibv_pd* pd, ibv_mw_type mw_type, ibv_mw* mw)
-    : LogEntry(entry_id), pd_(pd), mw_type_(mw_type), mw_(mw) {}
-
-std::string AllocMw::ToString() const {
-  return absl::StrCat("AllocMw {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", pd = ", reinterpret_cast<uint64_t>(pd_),
-                      ", mw_type = ", mw_type_, "}.");
-}
-
-DeallocMw::DeallocMw(uint64_t entry_id, ibv_mw* mw)
-    : LogEntry(entry_id), mw_(mw) {}
-
-std::string DeallocMw::ToString() const {
-  return absl::StrCat("DeallocMw {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", mw = ", reinterpret_cast<uint64_t>(mw_), "}.");
-}
-
-BindMw::BindMw(uint64_t entry_id, const ibv_mw_bind& bind, ibv_mw* mw)
-    : LogEntry(entry_id),
-      wr_id_(bind.wr_id),
-      rkey_(0),
-      mw_(mw),
-      bind_info_(bind.bind_info) {}
-
-BindMw::BindMw(uint64_t entry_id, const ibv_send_wr& bind)
-    : LogEntry(entry_id),
-      wr_id_(bind.wr_id),
-      rkey_(bind.bind_mw.rkey),
-      mw_(bind.bind_mw.mw),
-      bind_info_(bind.bind_mw.bind_info) {}
-
-std::string BindMw::ToString() const {
-  return absl::StrCat(
-      "BindMw {entry_id = ", entry_id(),
-      ", timestamp = ", absl::FormatTime(timestamp()), ", wr_id = ", wr_id_,
-      ", mw = ", reinterpret_cast<uint64_t>(mw_), ", rkey = ", rkey_,
-      ", addr = ", bind_info_.addr, ", length = ", bind_info_.length,
-      ", mr = ", reinterpret_cast<uint64_t>(bind_info_.mr), "}.");
-}
-
-CreateQp::CreateQp(uint64_t entry_id, ibv_qp* qp)
-    : LogEntry(entry_id), qp_(qp) {}
-
-std::string CreateQp::ToString() const {
-  return absl::StrCat("CreateQp {entry_id = ", entry_id(),
-                      ", qp = ", reinterpret_cast<uint64_t>(qp_), "}.");
-}
-
-CreateAh::CreateAh(uint64_t entry_id, ibv_pd* pd, ClientId client_id,
-                   ibv_ah* ah)
-    : LogEntry(entry_id), pd_(pd), client_id_(client_id), ah_(ah) {}
-
-std::string CreateAh::ToString() const {
-  return absl::StrCat("CreateAh {entry_id = ", entry_id(),
-                      ", pd = ", reinterpret_cast<uint64_t>(pd_),
-                      ", client id = ", client_id_,
-                      ", ah = ", reinterpret_cast<uint64_t>(ah_), "}.");
-}
-
-DestroyAh::DestroyAh(uint64_t entry_id, ibv_ah* ah)
-    : LogEntry(entry_id), ah_(ah) {}
-
-std::string DestroyAh::ToString() const {
-  return absl::StrCat("DestroyAh {entry_id = ", entry_id(),
-                      ", ah = ", reinterpret_cast<uint64_t>(ah_), "}.");
-}
-
-Send::Send(uint64_t entry_id, const ibv_send_wr& send)
-    : LogEntry(entry_id),
-      wr_id_(send.wr_id),
-      sges_(send.sg_list, send.sg_list + send.num_sge) {}
-
-std::string Send::ToString() const {
-  std::string ret =
-      absl::StrCat("Send {entry_id = ", entry_id(),
-                   ", timestamp = ", absl::FormatTime(timestamp()),
-                   ", wr_id = ", wr_id_, ", sges = ");
-  for (const ibv_sge& sge : sges_) {
-    absl::StrAppend(&ret, "{", sge.addr, ", ", sge.length, ",", sge.lkey,
-                    "}, ");
+std::string FormatSges(const LogRecord::OpFields& op) {
+  std::string ret;
+  for (int i = 0; i < std::min(op.num_sge, LogRecord::kMaxSges); ++i) {
+    absl::StrAppend(&ret, "{", op.sges[i].addr, ", ", op.sges[i].length, ", ",
+                    op.sges[i].lkey, "}, ");
   }
-  absl::StrAppend(&ret, "}");
-  return ret;
-}
-
-SendInv::SendInv(uint64_t entry_id, const ibv_send_wr& send, uint32_t rkey)
-    : LogEntry(entry_id),
-      wr_id_(send.wr_id),
-      sges_(send.sg_list, send.sg_list + send.num_sge),
-      rkey_(rkey) {}
-
-std::string SendInv::ToString() const {
-  std::string ret =
-      absl::StrCat("SendWithInvalidate {entry_id = ", entry_id(),
-                   ", timestamp = ", absl::FormatTime(timestamp()),
-                   ", wr_id = ", wr_id_, ", sges = ");
-  for (const ibv_sge& sge : sges_) {
-    absl::StrAppend(&ret, "{", sge.addr, ", ", sge.length, ",", sge.lkey,
-                    "}, ");
-  }
-  absl::StrAppend(&ret, "rkey = ", rkey_, "}");
-  return ret;
-}
-
-Recv::Recv(uint64_t entry_id, const ibv_recv_wr& recv)
-    : LogEntry(entry_id),
-      wr_id_(recv.wr_id),
-      sges_(recv.sg_list, recv.sg_list + recv.num_sge) {}
-
-std::string Recv::ToString() const {
-  std::string ret =
-      absl::StrCat("Recv {entry_id = ", entry_id(),
-                   ", timestamp = ", absl::FormatTime(timestamp()),
-                   ", wr_id = ", wr_id_, ", sges = ");
-  for (const ibv_sge& sge : sges_) {
-    absl::StrAppend(&ret, "{", sge.addr, ", ", sge.length, ", ", sge.lkey,
-                    "}, ");
+  if (op.num_sge > LogRecord::kMaxSges) {
+    absl::StrAppend(&ret, "(", op.num_sge - LogRecord::kMaxSges, " more), ");
   }
-  absl::StrAppend(&ret, "}");
   return ret;
 }
 
-Read::Read(uint64_t entry_id, const ibv_send_wr& read)
-    : LogEntry(entry_id),
-      wr_id_(read.wr_id),
-      sges_(read.sg_list, read.sg_list + read.num_sge),
-      remote_addr_(read.wr.rdma.remote_addr),
-      rkey_(read.wr.rdma.rkey) {}
-
-std::string Read::ToString() const {
-  std::string ret =
-      absl::StrCat("Recv {entry_id = ", entry_id(),
-                   ", timestamp = ", absl::FormatTime(timestamp()),
-                   ", wr_id = ", wr_id_, ", sges = ");
-  for (const ibv_sge& sge : sges_) {
-    absl::StrAppend(&ret, "{", sge.addr, ", ", sge.length, ", ", sge.lkey,
-                    "}, ");
+}  // namespace
+
+std::string LogRecord::ToString() const {
+  std::string header =
+      absl::StrCat("{entry_id = ", entry_id, ", timestamp = ",
+                   absl::FormatTime(absl::FromUnixNanos(timestamp_ns)));
+  switch (type) {
+    case Type::kCreateCq:
+      return absl::StrCat("CreateCq ", header,
+                          ", cq = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kDestroyCq:
+      return absl::StrCat("DestroyCq ", header,
+                          ", cq = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kAllocPd:
+      return absl::StrCat("AllocPd ", header,
+                          ", pd = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kDeallocPd:
+      return absl::StrCat("DeallocPd ", header,
+                          ", pd = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kRegMr:
+      return absl::StrCat(
+          "RegMr ", header, ", pd = ", reinterpret_cast<uint64_t>(reg_mr.pd),
+          ", addr = ", reg_mr.addr, ", length = ", reg_mr.length,
+          ", mr = ", reinterpret_cast<uint64_t>(reg_mr.mr), "}.");
+    case Type::kDeregMr:
+      return absl::StrCat("DeregMr ", header,
+                          ", mr = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kAllocMw:
+      return absl::StrCat("AllocMw ", header,
+                          ", pd = ", reinterpret_cast<uint64_t>(alloc_mw.pd),
+                          ", mw_type = ", alloc_mw.mw_type,
+                          ", mw = ", reinterpret_cast<uint64_t>(alloc_mw.mw),
+                          "}.");
+    case Type::kDeallocMw:
+      return absl::StrCat("DeallocMw ", header,
+                          ", mw = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kBindMw:
+      return absl::StrCat(
+          "BindMw ", header, ", wr_id = ", bind_mw.wr_id,
+          ", mw = ", reinterpret_cast<uint64_t>(bind_mw.mw),
+          ", rkey = ", bind_mw.rkey, ", addr = ", bind_mw.bind_info.addr,
+          ", length = ", bind_mw.bind_info.length,
+          ", mr = ", reinterpret_cast<uint64_t>(bind_mw.bind_info.mr), "}.");
+    case Type::kCreateQp:
+      return absl::StrCat("CreateQp ", header,
+                          ", qp = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kCreateAh:
+      return absl::StrCat("CreateAh ", header,
+                          ", pd = ", reinterpret_cast<uint64_t>(create_ah.pd),
+                          ", client id = ", create_ah.client_id,
+                          ", ah = ", reinterpret_cast<uint64_t>(create_ah.ah),
+                          "}.");
+    case Type::kDestroyAh:
+      return absl::StrCat("DestroyAh ", header,
+                          ", ah = ", reinterpret_cast<uint64_t>(object), "}.");
+    case Type::kSend:
+      return absl::StrCat("Send ", header, ", wr_id = ", op.wr_id,
+                          ", sges = ", FormatSges(op), "}");
+    case Type::kRecv:
+      return absl::StrCat("Recv ", header, ", wr_id = ", op.wr_id,
+                          ", sges = ", FormatSges(op), "}");
+    case Type::kRead:
+      return absl::StrCat("Read ", header, ", wr_id = ", op.wr_id,
+                          ", sges = ", FormatSges(op),
+                          "remote addr = ", op.remote_addr,
+                          ", rkey = ", op.rkey, "}");
+    case Type::kWrite:
+      return absl::StrCat("Write ", header, ", wr_id = ", op.wr_id,
+                          ", sges = ", FormatSges(op),
+                          "remote addr = ", op.remote_addr,
+                          ", rkey = ", op.rkey, "}");
+    case Type::kFetchAdd:
+      return absl::StrCat("FetchAdd ", header, ", wr_id = ", op.wr_id,
+                          ", sges = ", FormatSges(op),
+                          "remote addr = ", op.remote_addr,
+                          ", rkey = ", op.rkey,
+                          ", compare add = ", op.compare_add, "}");
+    case Type::kCompSwap:
+      return absl::StrCat("CompSwap ", header, ", wr_id = ", op.wr_id,
+                          ", sges = ", FormatSges(op),
+                          "remote addr = ", op.remote_addr,
+                          ", rkey = ", op.rkey,
+                          ", compare add = ", op.compare_add,
+                          ", swap = ", op.swap, "}");
+    case Type::kCompletion:
+      return absl::StrCat("Completion ", header,
+                          ", wr_id = ", completion.wr_id,
+                          ", status = ", completion.status,
+                          ", opcode = ", completion.opcode, "}");
   }
-  absl::StrAppend(&ret, "remote addr = ", remote_addr_, ", rkey = ", rkey_,
-                  "}");
-  return ret;
+  return absl::StrCat("Unknown ", header, "}");
 }
 
-Write::Write(uint64_t entry_id, const ibv_send_wr& write)
-    : LogEntry(entry_id),
-      wr_id_(write.wr_id),
-      sges_(write.sg_list, write.sg_list + write.num_sge),
-      remote_addr_(write.wr.rdma.remote_addr),
-      rkey_(write.wr.rdma.rkey) {}
-
-std::string Write::ToString() const {
-  std::string ret =
-      absl::StrCat("Write {entry_id = ", entry_id(),
-                   ", timestamp = ", absl::FormatTime(timestamp()),
-                   ", wr_id = ", wr_id_, ", sges = ");
-  for (const ibv_sge& sge : sges_) {
-    absl::StrAppend(&ret, "{", sge.addr, ", ", sge.length, ", ", sge.lkey,
-                    "}, ");
-  }
-  absl::StrAppend(&ret, "remote addr = ", remote_addr_, ", rkey = ", rkey_,
-                  "}");
-  return ret;
-}
+RandomWalkLogger::RandomWalkLogger(size_t log_capacity)
+    : log_capacity_(log_capacity),
+      slots_(std::make_unique<Slot[]>(log_capacity)) {}
 
-FetchAdd::FetchAdd(uint64_t entry_id, const ibv_send_wr& fetch_add)
-    : LogEntry(entry_id),
-      wr_id_(fetch_add.wr_id),
-      sge_(*fetch_add.sg_list),
-      remote_addr_(fetch_add.wr.atomic.remote_addr),
-      rkey_(fetch_add.wr.atomic.rkey),
-      compare_add_(fetch_add.wr.atomic.compare_add) {}
-
-std::string FetchAdd::ToString() const {
-  return absl::StrCat("Recv {entry_id = ", entry_id(),
-                      ", timestamp = ", absl::FormatTime(timestamp()),
-                      ", wr_id = ", wr_id_, ", sge = [", sge_.addr, ", ",
-                      sge_.length, ", ", sge_.lkey,
-                      "], compare add = ", compare_add_, "}");
+LogRecord& RandomWalkLogger::NextRecord(LogRecord::Type type) {
+  uint64_t entry_id = published_.load(std::memory_order_relaxed) + 1;
+  Slot& slot = slots_[(entry_id - 1) % log_capacity_];
+  // Mark the slot as being written before any of the record is. The fence
+  // keeps the record stores from being reordered before the marker.
+  slot.sequence.store(2 * entry_id - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  LogRecord& record = slot.record;
+  record.entry_id = entry_id;
+  record.timestamp_ns = absl::GetCurrentTimeNanos();
+  record.type = type;
+  return record;
 }
 
-CompSwap::CompSwap(uint64_t entry_id, const ibv_send_wr& comp_swap)
-    : LogEntry(entry_id),
-      wr_id_(comp_swap.wr_id),
-      sge_(*comp_swap.sg_list),
-      remote_addr_(comp_swap.wr.atomic.remote_addr),
-      rkey_(comp_swap.wr.atomic.rkey),
-      compare_add_(comp_swap.wr.atomic.compare_add),
-      swap_(comp_swap.wr.atomic.swap) {}
-
-std::string CompSwap::ToString() const {
-  return absl::StrCat(
-      "Recv {entry_id = ", entry_id(),
-      ", timestamp = ", absl::FormatTime(timestamp()), ", wr_id = ", wr_id_,
-      ", sge = [", sge_.addr, ", ", sge_.length, ", ", sge_.lkey,
-      "], compare add = ", compare_add_, ", swap = ", swap_, "}");
+void RandomWalkLogger::Publish() {
+  uint64_t entry_id = published_.load(std::memory_order_relaxed) + 1;
+  slots_[(entry_id - 1) % log_capacity_].sequence.store(
+      2 * entry_id, std::memory_order_release);
+  published_.store(entry_id, std::memory_order_release);
 }
 
-Completion::Completion(uint64_t entry_id, const ibv_wc& wc)
-    : LogEntry(entry_id), completion_(wc) {}
-
-std::string Completion::ToString() const {
-  return absl::StrCat("Completion {wr_id = ", completion_.wr_id,
-                      ", status = ", completion_.status,
-                      ", opcode = ", completion_.opcode, "}");
+void RandomWalkLogger::RecordOp(LogRecord& record, uint64_t wr_id,
+                                const ibv_sge* sges, int num_sge) {
+  record.op.wr_id = wr_id;
+  record.op.num_sge = num_sge;
+  std::copy_n(sges, std::min(num_sge, LogRecord::kMaxSges), record.op.sges);
 }
 
-RandomWalkLogger::RandomWalkLogger(size_t log_capacity)
-    : log_capacity_(log_capacity) {}
-
 void RandomWalkLogger::PushCreateCq(ibv_cq* cq) {
-  logs_.emplace_back(std::make_unique<CreateCq>(next_entry_id_++, cq));
-  Flush();
+  NextRecord(LogRecord::Type::kCreateCq).object = cq;
+  Publish();
 }
 
 void RandomWalkLogger::PushDestroyCq(ibv_cq* cq) {
-  logs_.emplace_back(std::make_unique<DestroyCq>(next_entry_id_++, cq));
-  Flush();
+  NextRecord(LogRecord::Type::kDestroyCq).object = cq;
+  Publish();
 }
 
 void RandomWalkLogger::PushAllocPd(ibv_pd* pd) {
-  logs_.emplace_back(std::make_unique<AllocPd>(next_entry_id_++, pd));
-  Flush();
+  NextRecord(LogRecord::Type::kAllocPd).object = pd;
+  Publish();
 }
 
 void RandomWalkLogger::PushDeallocPd(ibv_pd* pd) {
-  logs_.emplace_back(std::make_unique<DeallocPd>(next_entry_id_++, pd));
-  Flush();
+  NextRecord(LogRecord::Type::kDeallocPd).object = pd;
+  Publish();
 }
 
 void RandomWalkLogger::PushRegMr(ibv_pd* pd, const RdmaMemBlock& memblock,
                                  ibv_mr* mr) {
-  logs_.emplace_back(
-      std::make_unique<RegMr>(next_entry_id_++, pd, memblock, mr));
-  Flush();
+  NextRecord(LogRecord::Type::kRegMr).reg_mr = {
+      .pd = pd,
+      .addr = reinterpret_cast<uint64_t>(memblock.data()),
+      .length = memblock.size(),
+      .mr = mr};
+  Publish();
 }
 
 void RandomWalkLogger::PushDeregMr(ibv_mr* mr) {
-  logs_.emplace_back(std::make_unique<DeregMr>(next_entry_id_++, mr));
-  Flush();
+  NextRecord(LogRecord::Type::kDeregMr).object = mr;
+  Publish();
 }
 
 void RandomWalkLogger::PushAllocMw(ibv_pd* pd, ibv_mw_type mw_type,
                                    ibv_mw* mw) {
-  logs_.emplace_back(
-      std::make_unique<AllocMw>(next_entry_id_++, pd, mw_type, mw));
-  Flush();
+  NextRecord(LogRecord::Type::kAllocMw).alloc_mw = {
+      .pd = pd, .mw_type = mw_type, .mw = mw};
+  Publish();
 }
 
 void RandomWalkLogger::PushDeallocMw(ibv_mw* mw) {
-  logs_.emplace_back(std::make_unique<DeallocMw>(next_entry_id_++, mw));
-  Flush();
+  NextRecord(LogRecord::Type::kDeallocMw).object = mw;
+  Publish();
 }
 
 void RandomWalkLogger::PushBindMw(const ibv_mw_bind& bind, ibv_mw* mw) {
-  logs_.emplace_back(std::make_unique<BindMw>(next_entry_id_++, bind, mw));
-  Flush();
+  NextRecord(LogRecord::Type::kBindMw).bind_mw = {
+      .wr_id = bind.wr_id, .rkey = 0, .mw = mw, .bind_info = bind.bind_info};
+  Publish();
 }
 
 void RandomWalkLogger::PushBindMw(const ibv_send_wr& bind) {
-  logs_.emplace_back(std::make_unique<BindMw>(next_entry_id_++, bind));
-  Flush();
+  NextRecord(LogRecord::Type::kBindMw).bind_mw = {
+      .wr_id = bind.wr_id,
+      .rkey = bind.bind_mw.rkey,
+      .mw = bind.bind_mw.mw,
+      .bind_info = bind.bind_mw.bind_info};
+  Publish();
 }
 
 void RandomWalkLogger::PushCreateQp(ibv_qp* qp) {
-  logs_.emplace_back(std::make_unique<CreateQp>(next_entry_id_++, qp));
-  Flush();
+  NextRecord(LogRecord::Type::kCreateQp).object = qp;
+  Publish();
 }
 
 void RandomWalkLogger::PushCreateAh(ibv_pd* pd, ClientId client_id,
                                     ibv_ah* ah) {
-  logs_.emplace_back(
-      std::make_unique<CreateAh>(next_entry_id_++, pd, client_id, ah));
-  Flush();
+  NextRecord(LogRecord::Type::kCreateAh).create_ah = {
+      .pd = pd, .client_id = client_id, .ah = ah};
+  Publish();
 }
+
 void RandomWalkLogger::PushDestroyAh(ibv_ah* ah) {
-  logs_.emplace_back(std::make_unique<DestroyAh>(next_entry_id_++, ah));
-  Flush();
+  NextRecord(LogRecord::Type::kDestroyAh).object = ah;
+  Publish();
 }
 
 void RandomWalkLogger::PushSend(const ibv_send_wr& send_wr) {
-  logs_.emplace_back(std::make_unique<Send>(next_entry_id_++, send_wr));
-  Flush();
+  RecordOp(NextRecord(LogRecord::Type::kSend), send_wr.wr_id, send_wr.sg_list,
+           send_wr.num_sge);
+  Publish();
 }
 
 void RandomWalkLogger::PushRecv(const ibv_recv_wr& recv_wr) {
-  logs_.emplace_back(std::make_unique<Recv>(next_entry_id_++, recv_wr));
-  Flush();
+  RecordOp(NextRecord(LogRecord::Type::kRecv), recv_wr.wr_id, recv_wr.sg_list,
+           recv_wr.num_sge);
+  Publish();
 }
 
 void RandomWalkLogger::PushRead(const ibv_send_wr& read_wr) {
-  logs_.emplace_back(std::make_unique<Read>(next_entry_id_++, read_wr));
-  Flush();
+  LogRecord& record = NextRecord(LogRecord::Type::kRead);
+  RecordOp(record, read_wr.wr_id, read_wr.sg_list, read_wr.num_sge);
+  record.op.remote_addr = read_wr.wr.rdma.remote_addr;
+  record.op.rkey = read_wr.wr.rdma.rkey;
+  Publish();
 }
 
 void RandomWalkLogger::PushWrite(const ibv_send_wr& write_wr) {
-  logs_.emplace_back(std::make_unique<Write>(next_entry_id_++, write_wr));
-  Flush();
+  LogRecord& record = NextRecord(LogRecord::Type::kWrite);
+  RecordOp(record, write_wr.wr_id, write_wr.sg_list, write_wr.num_sge);
+  record.op.remote_addr = write_wr.wr.rdma.remote_addr;
+  record.op.rkey = write_wr.wr.rdma.rkey;
+  Publish();
 }
 
 void RandomWalkLogger::PushFetchAdd(const ibv_send_wr& fetch_add_wr) {
-  logs_.emplace_back(
-      std::make_unique<FetchAdd>(next_entry_id_++, fetch_add_wr));
-  Flush();
+  LogRecord& record = NextRecord(LogRecord::Type::kFetchAdd);
+  RecordOp(record, fetch_add_wr.wr_id, fetch_add_wr.sg_list,
+           fetch_add_wr.num_sge);
+  record.op.remote_addr = fetch_add_wr.wr.atomic.remote_addr;
+  record.op.rkey = fetch_add_wr.wr.atomic.rkey;
+  record.op.compare_add = fetch_add_wr.wr.atomic.compare_add;
+  Publish();
 }
 
 void RandomWalkLogger::PushCompSwap(const ibv_send_wr& comp_swap_wr) {
-  logs_.emplace_back(
-      std::make_unique<CompSwap>(next_entry_id_++, comp_swap_wr));
-  Flush();
+  LogRecord& record = NextRecord(LogRecord::Type::kCompSwap);
+  RecordOp(record, comp_swap_wr.wr_id, comp_swap_wr.sg_list,
+           comp_swap_wr.num_sge);
+  record.op.remote_addr = comp_swap_wr.wr.atomic.remote_addr;
+  record.op.rkey = comp_swap_wr.wr.atomic.rkey;
+  record.op.compare_add = comp_swap_wr.wr.atomic.compare_add;
+  record.op.swap = comp_swap_wr.wr.atomic.swap;
+  Publish();
 }
 
 void RandomWalkLogger::PushCompletion(const ibv_wc& cqe) {
-  logs_.emplace_back(std::make_unique<Completion>(next_entry_id_++, cqe));
-  Flush();
+  NextRecord(LogRecord::Type::kCompletion).completion = cqe;
+  Publish();
 }
 
 void RandomWalkLogger::PrintLogs() const {
-  for (const auto& entry : logs_) {
-    LOG(INFO) << entry->ToString();
-  }
-}
-
-void RandomWalkLogger::Flush() {
-  while (logs_.size() > log_capacity_) {
-    logs_.pop_front();
+  uint64_t last = published_.load(std::memory_order_acquire);
+  uint64_t first = last > log_capacity_ ? last - log_capacity_ + 1 : 1;
+  for (uint64_t entry_id = first; entry_id <= last; ++entry_id) {
+    const Slot& slot = slots_[(entry_id - 1) % log_capacity_];
+    // The producer has since started overwriting the slot.
+    if (slot.sequence.load(std::memory_order_acquire) != 2 * entry_id) {
+      continue;
+    }
+    LogRecord record = slot.record;
+    // Skip the copy if the producer started overwriting the slot during it.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != 2 * entry_id) {
+      continue;
+    }
+    LOG(INFO) << record.ToString();
   }
 }
 
@@ -17,14 +17,12 @@
 #ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_LOGGING_H_
 #define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_LOGGING_H_
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
-#include <deque>
 #include <memory>
 #include <string>
-#include <vector>
 
-#include "absl/time/time.h"
 #include "infiniband/verbs.h"
 #include "public/rdma_memblock.h"
 #include "random_walk/internal/types.h"
@@ -32,243 +30,111 @@
 namespace rdma_unit_test {
 namespace random_walk {
 
-// An abstract class that represents an entry in the log.
-class LogEntry {
- public:
-  explicit LogEntry(uint64_t entry_id);
-  virtual ~LogEntry() = default;
-  uint64_t entry_id() const;
-  absl::Time timestamp() const;
-  virtual std::string ToString() const = 0;
-
- private:
-  uint64_t entry_id_;
-  absl::Time timestamp_;
-};
-
-// The set of concrete classes for different types of logs entries. Each class
-// represent either an Action or a processed completion.
-
-class CreateCq : public LogEntry {
- public:
-  CreateCq(uint64_t entry_id, ibv_cq* cq);
-  std::string ToString() const override;
-
- private:
-  ibv_cq* cq_;
-};
-
-class DestroyCq : public LogEntry {
- public:
-  DestroyCq(uint64_t entry_id, ibv_cq* cq);
-  std::string ToString() const override;
-
- private:
-  ibv_cq* cq_;
-};
-
-class AllocPd : public LogEntry {
- public:
-  AllocPd(uint64_t entry_id, ibv_pd* pd);
-  std::string ToString() const override;
-
- private:
-  ibv_pd* pd_;
-};
-
-class DeallocPd : public LogEntry {
- public:
-  DeallocPd(uint64_t entry_id, ibv_pd* pd);
-  std::string ToString() const override;
-
- private:
-  ibv_pd* pd_;
-};
-
-class RegMr : public LogEntry {
- public:
-  RegMr(uint64_t entry_id, ibv_pd* pd, const RdmaMemBlock& memblock,
-        ibv_mr* mr);
-  std::string ToString() const override;
-
- private:
-  ibv_pd* pd_;
-  uint64_t addr_;
-  uint64_t length_;
-  ibv_mr* mr_;
-};
-
-class DeregMr : public LogEntry {
- public:
-  DeregMr(uint64_t entry_id, ibv_mr* mr);
-  std::string ToString() const override;
-
- private:
-  ibv_mr* mr_;
-};
-
-class AllocMw : public LogEntry {
- public:
-  AllocMw(uint64_t entry_id, ibv_pd* pd, ibv_mw_type mw_type, ibv_mw* mw);
-  std::string ToString() const override;
-
- private:
-  ibv_pd* pd_;
-  ibv_mw_type mw_type_;
-  ibv_mw* mw_;
-};
-
-class DeallocMw : public LogEntry {
- public:
-  DeallocMw(uint64_t entry_id, ibv_mw* mw);
-  std::string ToString() const override;
-
- private:
-  ibv_mw* mw_;
-};
-
-class BindMw : public LogEntry {
- public:
-  BindMw(uint64_t entry_id, const ibv_mw_bind& bind, ibv_mw* mw);
-  BindMw(uint64_t entry_id, const ibv_send_wr& bind);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  uint32_t rkey_;  // For type 2 MW.
-  ibv_mw* mw_;
-  ibv_mw_bind_info bind_info_;
-};
-
-class CreateQp : public LogEntry {
- public:
-  CreateQp(uint64_t entry_id, ibv_qp* qp);
-  std::string ToString() const override;
-
- private:
-  ibv_qp* qp_;
-};
-
-class CreateAh : public LogEntry {
- public:
-  CreateAh(uint64_t entry_id, ibv_pd* pd, ClientId client_id, ibv_ah* ah);
-  std::string ToString() const override;
-
- private:
-  ibv_pd* pd_;
-  ClientId client_id_;
-  ibv_ah* ah_;
-};
-
-class DestroyAh : public LogEntry {
- public:
-  DestroyAh(uint64_t entry_id, ibv_ah* ah);
-  std::string ToString() const override;
-
- private:
-  ibv_ah* ah_;
-};
-
-class Send : public LogEntry {
- public:
-  Send(uint64_t entry_id, const ibv_send_wr& send);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  std::vector<ibv_sge> sges_;
-};
-
-class SendInv : public LogEntry {
- public:
-  SendInv(uint64_t entry_id, const ibv_send_wr& send, uint32_t rkey);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  std::vector<ibv_sge> sges_;
-  uint32_t rkey_;
-};
-
-class Recv : public LogEntry {
- public:
-  Recv(uint64_t entry_id, const ibv_recv_wr& recv);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  std::vector<ibv_sge> sges_;
-};
-
-class Read : public LogEntry {
- public:
-  Read(uint64_t entry_id, const ibv_send_wr& read);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  std::vector<ibv_sge> sges_;
-  uint64_t remote_addr_;
-  uint32_t rkey_;
-};
-
-class Write : public LogEntry {
- public:
-  Write(uint64_t entry_id, const ibv_send_wr& write);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  std::vector<ibv_sge> sges_;
-  uint64_t remote_addr_;
-  uint32_t rkey_;
-};
-
-class FetchAdd : public LogEntry {
- public:
-  FetchAdd(uint64_t entry_id, const ibv_send_wr& fetch_add);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  ibv_sge sge_;
-  uint64_t remote_addr_;
-  uint32_t rkey_;
-  uint64_t compare_add_;
-};
-
-class CompSwap : public LogEntry {
- public:
-  CompSwap(uint64_t entry_id, const ibv_send_wr& comp_swap);
-  std::string ToString() const override;
-
- private:
-  uint64_t wr_id_;
-  ibv_sge sge_;
-  uint64_t remote_addr_;
-  uint32_t rkey_;
-  uint64_t compare_add_;
-  uint64_t swap_;
-};
-
-class Completion : public LogEntry {
- public:
-  Completion(uint64_t entry_id, const ibv_wc& wc);
-  std::string ToString() const override;
-
- private:
-  ibv_wc completion_;
+// An entry in the log. It represents either an Action or a processed
+// completion. LogRecord is a plain tagged union so that logging copies a few
+// fields into a preallocated slot; formatting is deferred to ToString().
+struct LogRecord {
+  // At most this many SGEs of a work request are recorded.
+  static constexpr int kMaxSges = 4;
+
+  enum class Type : uint8_t {
+    kCreateCq,
+    kDestroyCq,
+    kAllocPd,
+    kDeallocPd,
+    kRegMr,
+    kDeregMr,
+    kAllocMw,
+    kDeallocMw,
+    kBindMw,
+    kCreateQp,
+    kCreateAh,
+    kDestroyAh,
+    kSend,
+    kRecv,
+    kRead,
+    kWrite,
+    kFetchAdd,
+    kCompSwap,
+    kCompletion,
+  };
+
+  // Fields of kRegMr.
+  struct RegMrFields {
+    ibv_pd* pd;
+    uint64_t addr;
+    uint64_t length;
+    ibv_mr* mr;
+  };
+
+  // Fields of kAllocMw.
+  struct AllocMwFields {
+    ibv_pd* pd;
+    ibv_mw_type mw_type;
+    ibv_mw* mw;
+  };
+
+  // Fields of kBindMw.
+  struct BindMwFields {
+    uint64_t wr_id;
+    uint32_t rkey;  // For type 2 MW.
+    ibv_mw* mw;
+    ibv_mw_bind_info bind_info;
+  };
+
+  // Fields of kCreateAh.
+  struct CreateAhFields {
+    ibv_pd* pd;
+    ClientId client_id;
+    ibv_ah* ah;
+  };
+
+  // Fields of the data path ops, kSend through kCompSwap.
+  struct OpFields {
+    uint64_t wr_id;
+    // The number of SGEs of the work request, of which the first
+    // min(num_sge, kMaxSges) are recorded in `sges`.
+    int num_sge;
+    ibv_sge sges[kMaxSges];
+    uint64_t remote_addr;
+    uint32_t rkey;
+    uint64_t compare_add;
+    uint64_t swap;
+  };
+
+  std::string ToString() const;
+
+  uint64_t entry_id;
+  int64_t timestamp_ns;
+  Type type;
+  union {
+    // The ibv_* object created or destroyed by the other resource actions.
+    void* object;
+    RegMrFields reg_mr;
+    AllocMwFields alloc_mw;
+    BindMwFields bind_mw;
+    CreateAhFields create_ah;
+    OpFields op;
+    ibv_wc completion;
+  };
 };
 
 // The class provides logging services for the RandomWalkClients. It provides a
-// fixed capacity circular queue to store the last portions of commands and
-// completions witnessed by the RandomWalkClient.
+// fixed capacity ring of LogRecords to store the last portions of commands and
+// completions witnessed by the RandomWalkClient. Pushing a record never
+// allocates.
+//
+// The logger has a single producer, the client thread. PrintLogs() can also be
+// called from another thread, e.g. a crash handler, while the producer is
+// running; it then prints the records published so far. Every slot is guarded
+// by a sequence lock, so a record overwritten during the print is skipped
+// rather than printed torn.
 class RandomWalkLogger {
  public:
   explicit RandomWalkLogger(size_t log_capacity);
-  // Movable but not copyable.
-  RandomWalkLogger(RandomWalkLogger&& logger) = default;
-  RandomWalkLogger& operator=(RandomWalkLogger&& logger) = default;
+  // Neither copyable nor movable.
+  RandomWalkLogger(RandomWalkLogger&& logger) = delete;
+  RandomWalkLogger& operator=(RandomWalkLogger&& logger) = delete;
   RandomWalkLogger(const RandomWalkLogger& logger) = delete;
   RandomWalkLogger& operator=(const RandomWalkLogger& logger) = delete;
   ~RandomWalkLogger() = default;
@@ -297,15 +163,30 @@ class RandomWalkLogger {
   void PrintLogs() const;
 
  private:
-  // Call logs_.pop_front() until logs_.size() is not larger than log_capacity_.
-  void Flush();
+  // A ring slot. `sequence` is 2 * entry_id of the record in the slot once it
+  // is published, and odd while the producer writes the record.
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    LogRecord record;
+  };
+
+  // Returns the slot for the next record, with its header filled in. The slot
+  // is marked as being written until Publish().
+  LogRecord& NextRecord(LogRecord::Type type);
+  // Makes the record returned by the last NextRecord() visible to PrintLogs().
+  void Publish();
+  // Fills the op fields of `record` from a send or recv work request.
+  static void RecordOp(LogRecord& record, uint64_t wr_id, const ibv_sge* sges,
+                       int num_sge);
 
-  uint64_t next_entry_id_ = 1;
   // The capacity of the log. The log will only keep the last [log_capcity_]
   // entries.
-  const uint32_t log_capacity_;
-  // The circular queue storing all log entries.
-  std::deque<std::unique_ptr<LogEntry>> logs_;
+  const size_t log_capacity_;
+  // The ring storing the log records. The record with entry id i is at
+  // slots_[(i - 1) % log_capacity_].
+  std::unique_ptr<Slot[]> slots_;
+  // The number of records pushed, which is also the entry id of the last one.
+  std::atomic<uint64_t> published_{0};
 };
 
 }  // namespace random_walk
@@ -39,14 +39,13 @@ namespace random_walk {
 MultiNodeOrchestrator::MultiNodeOrchestrator(size_t num_clients,
                                              const ActionWeights& weights) {
   clients_.resize(num_clients);
+  dispatchers_.resize(num_clients);
   handlers_.resize(num_clients);
-  std::vector<std::shared_ptr<GrpcUpdateDispatcher>> dispatchers(num_clients,
-                                                                 nullptr);
 
   for (ClientId id = 0; id < num_clients; ++id) {
     clients_[id] = std::make_shared<RandomWalkClient>(id, weights);
-    dispatchers[id] = std::make_shared<GrpcUpdateDispatcher>(id);
-    clients_[id]->RegisterUpdateDispatcher(dispatchers[id]);
+    dispatchers_[id] = std::make_shared<GrpcUpdateDispatcher>(id);
+    clients_[id]->RegisterUpdateDispatcher(dispatchers_[id]);
     handlers_[id] = std::make_unique<GrpcUpdateHandler>(clients_[id]);
   }
 
@@ -54,7 +53,7 @@ MultiNodeOrchestrator::MultiNodeOrchestrator(size_t num_clients,
     for (ClientId remote_id = 0; remote_id < num_clients; ++remote_id) {
       clients_[local_id]->AddRemoteClient(remote_id,
                                           clients_[remote_id]->GetGid());
-      dispatchers[local_id]->RegisterRemoteUpdateHandler(
+      dispatchers_[local_id]->RegisterRemoteUpdateHandler(
           remote_id, handlers_[remote_id]->GetServerAddress());
     }
   }
@@ -69,6 +68,7 @@ void MultiNodeOrchestrator::RunClients(absl::Duration duration) {
   for (auto& client : client_threads) {
     client.join();
   }
+  FlushDispatchers();
   for (const auto& client : clients_) {
     client->PrintStats();
   }
@@ -83,10 +83,17 @@ void MultiNodeOrchestrator::RunClients(size_t num_steps) {
   for (auto& client : client_threads) {
     client.join();
   }
+  FlushDispatchers();
   for (const auto& client : clients_) {
     client->PrintStats();
   }
 }
 
+void MultiNodeOrchestrator::FlushDispatchers() {
+  for (const auto& dispatcher : dispatchers_) {
+    dispatcher->Flush();
+  }
+}
+
 }  // namespace random_walk
 }  // namespace rdma_unit_test
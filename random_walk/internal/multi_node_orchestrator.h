@@ -54,7 +54,12 @@ class MultiNodeOrchestrator {
   void RunClients(size_t num_steps);
 
  private:
+  // Sends the ClientUpdates still batched in the dispatchers once the clients
+  // stop.
+  void FlushDispatchers();
+
   std::vector<std::shared_ptr<RandomWalkClient>> clients_;
+  std::vector<std::shared_ptr<GrpcUpdateDispatcher>> dispatchers_;
   std::vector<std::unique_ptr<GrpcUpdateHandler>> handlers_;
 };
 
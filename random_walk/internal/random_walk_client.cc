@@ -18,12 +18,16 @@
 
 #include <sched.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <deque>
+#include <limits>
 #include <memory>
+#include <thread>  // NOLINT
 #include <tuple>
 #include <vector>
 
@@ -44,6 +48,7 @@
 #include "absl/types/span.h"
 #include <magic_enum.hpp>
 #include "infiniband/verbs.h"
+#include "internal/completion_poller.h"
 #include "internal/verbs_attribute.h"
 #include "public/introspection.h"
 #include "public/map_util.h"
@@ -62,18 +67,76 @@
 #include "random_walk/internal/sampling.h"
 #include "random_walk/internal/types.h"
 #include "random_walk/internal/update_dispatcher_interface.h"
+#include "traffic/latency_histogram.h"
 
 ABSL_FLAG(bool, allow_outstanding_ops, false,
           "Controls if client will destroy qp with outstanding ops.");
+ABSL_FLAG(bool, random_walk_throughput_mode, false,
+          "If true, random walk steps do not sleep before polling completions, "
+          "so that the walk runs as fast as the verbs allow.");
+ABSL_FLAG(int, random_walk_data_ops_per_step, 0,
+          "The number of data path ops (send, recv, RDMA, atomics) to issue "
+          "back to back in each random walk step, on top of the random "
+          "action, to load the data path while the control path churns.");
+ABSL_FLAG(absl::Duration, random_walk_rate_interval, absl::Seconds(10),
+          "The interval at which each client logs its step, command and "
+          "completion rates. Zero disables the time series.");
+ABSL_FLAG(int, random_walk_data_path_threads, 0,
+          "The number of threads per client which issue data path ops "
+          "(send, recv, RDMA, atomics) concurrently with the random walk, "
+          "each to its own subset of the client's QPs.");
 
 namespace rdma_unit_test {
 namespace random_walk {
+namespace {
+
+// Returns `action_weights` with the weights of all control path actions set to
+// zero.
+ActionWeights DataPathWeights(const ActionWeights& action_weights) {
+  ActionWeights weights = action_weights;
+  weights.set_create_cq(0);
+  weights.set_destroy_cq(0);
+  weights.set_allocate_pd(0);
+  weights.set_deallocate_pd(0);
+  weights.set_register_mr(0);
+  weights.set_deregister_mr(0);
+  weights.set_allocate_type_1_mw(0);
+  weights.set_allocate_type_2_mw(0);
+  weights.set_deallocate_type_1_mw(0);
+  weights.set_deallocate_type_2_mw(0);
+  weights.set_bind_type_1_mw(0);
+  weights.set_bind_type_2_mw(0);
+  weights.set_create_rc_qp_pair(0);
+  weights.set_create_ud_qp(0);
+  weights.set_modify_qp_error(0);
+  weights.set_destroy_qp(0);
+  weights.set_create_ah(0);
+  weights.set_destroy_ah(0);
+  return weights;
+}
+
+// Returns true if `action_weights` gives a data path action a positive weight,
+// ie. if a sampler of DataPathWeights(action_weights) can pick an action.
+bool HasDataPathActions(const ActionWeights& action_weights) {
+  return action_weights.send() > 0 || action_weights.send_with_inv() > 0 ||
+         action_weights.recv() > 0 || action_weights.read() > 0 ||
+         action_weights.write() > 0 || action_weights.fetch_add() > 0 ||
+         action_weights.comp_swap() > 0;
+}
+
+}  // namespace
 
 RandomWalkClient::RandomWalkClient(ClientId client_id,
                                    const ActionWeights& action_weights)
     : log_(kLogSize),
       id_(client_id),
       allow_outstanding_ops_(absl::GetFlag(FLAGS_allow_outstanding_ops)),
+      throughput_mode_(absl::GetFlag(FLAGS_random_walk_throughput_mode)),
+      data_ops_per_step_(
+          HasDataPathActions(action_weights)
+              ? absl::GetFlag(FLAGS_random_walk_data_ops_per_step)
+              : 0),
+      rate_interval_(absl::GetFlag(FLAGS_random_walk_rate_interval)),
       action_sampler_([action_weights]() -> ActionWeights {
         if (Introspection().SupportsType2()) {
           return action_weights;
@@ -86,14 +149,37 @@ RandomWalkClient::RandomWalkClient(ClientId client_id,
           new_weights.set_deallocate_type_2_mw(0);
           return new_weights;
         }
-      }()) {
+      }()),
+      data_path_sampler_(DataPathWeights(action_weights)) {
   memory_ = ibv_.AllocBuffer(RandomWalkSampler::kGroundMemoryPages);
   memset(memory_.data(), '-', memory_.size());
   context_ = ibv_.OpenDevice().value();
   CHECK(context_);  // Crash ok
   port_attr_ = ibv_.GetPortAttribute(context_);
+  uint32_t data_path_threads =
+      std::max(0, absl::GetFlag(FLAGS_random_walk_data_path_threads));
+  // With only control path weights, there are no data path ops to issue.
+  if (!HasDataPathActions(action_weights) &&
+      (data_path_threads > 0 ||
+       absl::GetFlag(FLAGS_random_walk_data_ops_per_step) > 0)) {
+    LOG(WARNING) << "Client " << id_
+                 << " has no data path action weights; ignoring "
+                    "--random_walk_data_path_threads and "
+                    "--random_walk_data_ops_per_step.";
+    data_path_threads = 0;
+  }
+  for (uint32_t i = 0; i < data_path_threads; ++i) {
+    auto worker =
+        std::make_unique<DataPathWorker>(DataPathWeights(action_weights));
+    worker->shard = {.index = i,
+                     .count = data_path_threads,
+                     .pending_completions = &worker->pending_completions};
+    workers_.push_back(std::move(worker));
+  }
 }
 
+RandomWalkClient::~RandomWalkClient() { StopDataPathWorkers(); }
+
 void RandomWalkClient::AddRemoteClient(ClientId client_id, const ibv_gid& gid) {
   map_util::InsertOrDie(client_gids_, client_id, gid);
 }
@@ -121,6 +207,9 @@ void RandomWalkClient::Run(absl::Duration duration) {
 
   BootstrapRandomWalk();
   absl::SleepFor(absl::Milliseconds(10));
+  run_start_ = rate_baseline_time_ = absl::Now();
+  rate_baseline_ = stats_;
+  StartDataPathWorkers();
   while (absl::Now() < finish) {
     absl::Status result = RandomWalk();
     if (!result.ok()) {
@@ -130,6 +219,7 @@ void RandomWalkClient::Run(absl::Duration duration) {
     }
     ++step_count;
   }
+  StopDataPathWorkers();
   LOG(INFO) << "Random walk completes " << step_count << " steps in "
             << duration << ".";
 }
@@ -139,6 +229,9 @@ void RandomWalkClient::Run(size_t steps) {
 
   BootstrapRandomWalk();
   absl::SleepFor(absl::Milliseconds(10));
+  run_start_ = rate_baseline_time_ = absl::Now();
+  rate_baseline_ = stats_;
+  StartDataPathWorkers();
   while (step_count < steps) {
     absl::Status result = RandomWalk();
     if (!result.ok()) {
@@ -148,6 +241,7 @@ void RandomWalkClient::Run(size_t steps) {
     }
     ++step_count;
   }
+  StopDataPathWorkers();
   LOG(INFO) << "Random walk completes " << step_count << "steps.";
 }
 
@@ -172,100 +266,144 @@ void RandomWalkClient::BootstrapRandomWalk() {
 }
 
 absl::Status RandomWalkClient::RandomWalk() {
-  FlushInboundUpdateQueue();
-  RETURN_IF_ERROR(DoRandomAction());
-  sched_yield();
-  absl::SleepFor(absl::Milliseconds(2));
+  {
+    int64_t wait_start_ns = absl::GetCurrentTimeNanos();
+    absl::MutexLock guard(&resources_mtx_);
+    writer_lock_wait_.Record(absl::GetCurrentTimeNanos() - wait_start_ns);
+    MergePendingCompletions();
+    FlushInboundUpdateQueue();
+    RETURN_IF_ERROR(DoRandomAction());
+    RETURN_IF_ERROR(DoDataPathActions());
+  }
+  if (!throughput_mode_) {
+    sched_yield();
+    absl::SleepFor(absl::Milliseconds(2));
+  }
+  int64_t wait_start_ns = absl::GetCurrentTimeNanos();
+  absl::MutexLock guard(&resources_mtx_);
+  writer_lock_wait_.Record(absl::GetCurrentTimeNanos() - wait_start_ns);
+  // Merge first so that the completions of all ops posted so far are counted
+  // before any of them is polled.
+  MergePendingCompletions();
   FlushAllCompletionQueues();
+  ++stats_.steps;
+  MaybeLogRates();
   return absl::OkStatus();
 }
 
-absl::Status RandomWalkClient::DoAction(Action action) {
-  // Process all incoming updates first.
-  FlushInboundUpdateQueue();
-  absl::StatusCode result = absl::StatusCode::kOk;
-  switch (action) {
-    case Action::CREATE_CQ: {
-      result = TryCreateCq();
-      break;
-    }
-    case Action::DESTROY_CQ: {
-      result = TryDestroyCq();
-      break;
-    }
-    case Action::ALLOC_PD: {
-      result = TryAllocPd();
-      break;
-    }
-    case Action::DEALLOC_PD: {
-      result = TryDeallocPd();
-      break;
-    }
-    case Action::REG_MR: {
-      result = TryRegMr();
-      break;
-    }
-    case Action::DEREG_MR: {
-      result = TryDeregMr();
-      break;
-    }
-    case Action::ALLOC_TYPE_1_MW: {
-      result = TryAllocType1Mw();
-      break;
-    }
-    case Action::ALLOC_TYPE_2_MW: {
-      result = TryAllocType2Mw();
-      break;
-    }
-    case Action::BIND_TYPE_1_MW: {
-      result = TryBindType1Mw();
-      break;
-    }
-    case Action::BIND_TYPE_2_MW: {
-      result = TryBindType2Mw();
-      break;
-    }
-    case Action::DEALLOC_TYPE_1_MW: {
-      result = TryDeallocType1Mw();
-      break;
-    }
-    case Action::DEALLOC_TYPE_2_MW: {
-      result = TryDeallocType2Mw();
-      break;
-    }
-    case Action::SEND: {
-      result = TrySend();
-      break;
-    }
-    case Action::SEND_WITH_INV: {
-      result = TrySendWithInv();
-      break;
+absl::Status RandomWalkClient::DoDataPathActions() {
+  for (int i = 0; i < data_ops_per_step_; ++i) {
+    absl::StatusCode result = TryAction(data_path_sampler_.RandomAction());
+    if (result == absl::StatusCode::kOk) {
+      ++stats_.commands;
+      ++stats_.data_path_ops;
+    } else if (result == absl::StatusCode::kInternal) {
+      return absl::InternalError("Failed to issue a data path op.");
     }
-    case Action::RECV: {
-      result = TryRecv();
-      break;
+  }
+  return absl::OkStatus();
+}
+
+void RandomWalkClient::MaybeLogRates() {
+  if (rate_interval_ <= absl::ZeroDuration()) {
+    return;
+  }
+  absl::Time now = absl::Now();
+  double seconds = absl::ToDoubleSeconds(now - rate_baseline_time_);
+  if (seconds < absl::ToDoubleSeconds(rate_interval_)) {
+    return;
+  }
+  size_t worker_ops = 0;
+  for (const auto& worker : workers_) {
+    worker_ops += worker->stats.data_path_ops;
+  }
+  LOG(INFO) << "Client " << id_ << " rates at "
+            << absl::ToDoubleSeconds(now - run_start_) << "s: steps/s = "
+            << (stats_.steps - rate_baseline_.steps) / seconds
+            << ", commands/s = "
+            << (stats_.commands - rate_baseline_.commands) / seconds
+            << ", data_path_ops/s = "
+            << (stats_.data_path_ops - rate_baseline_.data_path_ops) / seconds
+            << ", worker_ops/s = "
+            << (worker_ops - rate_baseline_worker_ops_) / seconds
+            << ", completions/s = "
+            << (stats_.completions - rate_baseline_.completions) / seconds;
+  rate_baseline_ = stats_;
+  rate_baseline_worker_ops_ = worker_ops;
+  rate_baseline_time_ = now;
+}
+
+void RandomWalkClient::StartDataPathWorkers() {
+  stop_workers_ = false;
+  for (auto& worker : workers_) {
+    DataPathWorker* worker_ptr = worker.get();
+    worker->thread =
+        std::thread([this, worker_ptr]() { RunDataPathWorker(worker_ptr); });
+  }
+}
+
+void RandomWalkClient::StopDataPathWorkers() {
+  stop_workers_ = true;
+  for (auto& worker : workers_) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
     }
-    case Action::READ: {
-      result = TryRead();
-      break;
+  }
+  absl::MutexLock guard(&resources_mtx_);
+  MergePendingCompletions();
+}
+
+void RandomWalkClient::RunDataPathWorker(DataPathWorker* worker) {
+  DataPathContext context = {
+      .log = worker->log,
+      .stats = worker->stats,
+      .bitgen = worker->bitgen,
+      .shard = worker->shard,
+      .pending_completions = &worker->pending_completions,
+  };
+  int failed_attempts = 0;
+  while (!stop_workers_) {
+    Action action = worker->action_sampler.RandomAction();
+    absl::StatusCode result;
+    {
+      int64_t wait_start_ns = absl::GetCurrentTimeNanos();
+      absl::ReaderMutexLock guard(&resources_mtx_);
+      worker->lock_wait.Record(absl::GetCurrentTimeNanos() - wait_start_ns);
+      result = TryDataPathAction(action, context);
     }
-    case Action::WRITE: {
-      result = TryWrite();
-      break;
+    if (result == absl::StatusCode::kOk) {
+      ++worker->stats.commands;
+      ++worker->stats.data_path_ops;
+      failed_attempts = 0;
+      continue;
     }
-    case Action::FETCH_ADD: {
-      result = TryFetchAdd();
-      break;
+    if (result == absl::StatusCode::kInternal) {
+      LOG(FATAL) << "Data path worker " << worker->shard.index
+                 << " failed to issue a data path op.";
     }
-    case Action::COMP_SWAP: {
-      result = TryCompSwap();
-      break;
+    // Only the random walk drains the CQs, so when every QP of the shard is
+    // full, retrying right away cannot succeed. Back off outside the lock.
+    if (++failed_attempts < kWorkerSpinAttempts) {
+      sched_yield();
+    } else {
+      absl::SleepFor(kWorkerBackoff);
     }
-    default: {
-      return absl::InternalError("Try to carry out unknown action.");
+  }
+}
+
+void RandomWalkClient::MergePendingCompletions() {
+  for (auto& worker : workers_) {
+    for (const auto& [cq, count] : worker->pending_completions) {
+      resource_manager_.AddOutstandingCompletions(cq, count);
     }
+    worker->pending_completions.clear();
   }
+}
 
+absl::Status RandomWalkClient::DoAction(Action action) {
+  // Process all incoming updates first.
+  FlushInboundUpdateQueue();
+  absl::StatusCode result = TryAction(action);
   if (result != absl::StatusCode::kOk) {
     return absl::InternalError(absl::StrCat(
         "Cannot do action (", magic_enum::enum_name(action), ")."));
@@ -279,44 +417,77 @@ absl::Status RandomWalkClient::DoAction(Action action) {
   return absl::OkStatus();
 }
 
-void RandomWalkClient::PrintLogs() const { log_.PrintLogs(); }
+void RandomWalkClient::PrintLogs() const {
+  log_.PrintLogs();
+  for (const auto& worker : workers_) {
+    LOG(INFO) << "Data path worker " << worker->shard.index << ":";
+    worker->log.PrintLogs();
+  }
+}
 
 void RandomWalkClient::PrintStats() const {
+  // Completions of the ops issued by data path workers are processed by the
+  // random walk, so fold those ops into the totals.
+  Stats stats = stats_;
+  for (const auto& worker : workers_) {
+    stats.commands += worker->stats.commands;
+    stats.data_path_ops += worker->stats.data_path_ops;
+    stats.send += worker->stats.send;
+    stats.recv += worker->stats.recv;
+    stats.read += worker->stats.read;
+    stats.write += worker->stats.write;
+    stats.fetch_add += worker->stats.fetch_add;
+    stats.comp_swap += worker->stats.comp_swap;
+  }
   LOG(INFO) << "Dumping stats for client " << id_;
   LOG(INFO) << "Statistics:";
-  LOG(INFO) << "commands = " << stats_.commands;
-  LOG(INFO) << "create_cq = " << stats_.create_cq;
-  LOG(INFO) << "destroy_cq = " << stats_.destroy_cq;
-  LOG(INFO) << "alloc_pd = " << stats_.alloc_pd;
-  LOG(INFO) << "dealloc_pd = " << stats_.dealloc_pd;
-  LOG(INFO) << "reg_mr = " << stats_.reg_mr;
-  LOG(INFO) << "dererg_mr = " << stats_.dereg_mr;
-  LOG(INFO) << "alloc_type_1_mw = " << stats_.alloc_type_1_mw;
-  LOG(INFO) << "alloc_type_2_mw = " << stats_.alloc_type_2_mw;
-  LOG(INFO) << "dealloc_type_1_mw = " << stats_.dealloc_type_1_mw;
-  LOG(INFO) << "dealloc_type_2_mw = " << stats_.dealloc_type_2_mw;
-  LOG(INFO) << "create_qp_pair = " << stats_.create_rc_qp_pair;
-  LOG(INFO) << "create_ud_qp = " << stats_.create_ud_qp;
-  LOG(INFO) << "modify_qp_error = " << stats_.modify_qp_error;
-  LOG(INFO) << "destroy_qp = " << stats_.destroy_qp;
-  LOG(INFO) << "create_ah = " << stats_.create_ah;
-  LOG(INFO) << "destroy_ah = " << stats_.destroy_ah;
-  LOG(INFO) << "bind_type_1_mw = " << stats_.bind_type_1_mw_success << "/"
-            << stats_.bind_type_1_mw;
-  LOG(INFO) << "bind_type_2_mw = " << stats_.bind_type_2_mw_success << "/"
-            << stats_.bind_type_2_mw;
-  LOG(INFO) << "send = " << stats_.send_success << "/" << stats_.send;
-  LOG(INFO) << "send_with_inv = " << stats_.send_with_inv_success << "/"
-            << stats_.send_with_inv;
-  LOG(INFO) << "recv = " << stats_.recv_success << "/" << stats_.recv;
-  LOG(INFO) << "read = " << stats_.read_success << "/" << stats_.read;
-  LOG(INFO) << "write = " << stats_.write_success << "/" << stats_.write;
-  LOG(INFO) << "fetch_add = " << stats_.fetch_add_success << "/"
-            << stats_.fetch_add;
-  LOG(INFO) << "comp_swap = " << stats_.comp_swap_success << "/"
-            << stats_.comp_swap;
+  LOG(INFO) << "commands = " << stats.commands;
+  LOG(INFO) << "steps = " << stats.steps << " ("
+            << stats.steps / absl::ToDoubleSeconds(absl::Now() - run_start_)
+            << " steps/s)";
+  LOG(INFO) << "data_path_ops = " << stats.data_path_ops;
+  if (!workers_.empty()) {
+    double seconds = absl::ToDoubleSeconds(absl::Now() - run_start_);
+    for (const auto& worker : workers_) {
+      LOG(INFO) << "worker " << worker->shard.index
+                << " data_path_ops = " << worker->stats.data_path_ops << " ("
+                << worker->stats.data_path_ops / seconds << " ops/s), "
+                << "lock wait = " << worker->lock_wait.ToString();
+    }
+    LOG(INFO) << "random walk lock wait = " << writer_lock_wait_.ToString();
+  }
+  LOG(INFO) << "create_cq = " << stats.create_cq;
+  LOG(INFO) << "destroy_cq = " << stats.destroy_cq;
+  LOG(INFO) << "alloc_pd = " << stats.alloc_pd;
+  LOG(INFO) << "dealloc_pd = " << stats.dealloc_pd;
+  LOG(INFO) << "reg_mr = " << stats.reg_mr;
+  LOG(INFO) << "dererg_mr = " << stats.dereg_mr;
+  LOG(INFO) << "alloc_type_1_mw = " << stats.alloc_type_1_mw;
+  LOG(INFO) << "alloc_type_2_mw = " << stats.alloc_type_2_mw;
+  LOG(INFO) << "dealloc_type_1_mw = " << stats.dealloc_type_1_mw;
+  LOG(INFO) << "dealloc_type_2_mw = " << stats.dealloc_type_2_mw;
+  LOG(INFO) << "create_qp_pair = " << stats.create_rc_qp_pair;
+  LOG(INFO) << "create_ud_qp = " << stats.create_ud_qp;
+  LOG(INFO) << "modify_qp_error = " << stats.modify_qp_error;
+  LOG(INFO) << "destroy_qp = " << stats.destroy_qp;
+  LOG(INFO) << "create_ah = " << stats.create_ah;
+  LOG(INFO) << "destroy_ah = " << stats.destroy_ah;
+  LOG(INFO) << "bind_type_1_mw = " << stats.bind_type_1_mw_success << "/"
+            << stats.bind_type_1_mw;
+  LOG(INFO) << "bind_type_2_mw = " << stats.bind_type_2_mw_success << "/"
+            << stats.bind_type_2_mw;
+  LOG(INFO) << "send = " << stats.send_success << "/" << stats.send;
+  LOG(INFO) << "send_with_inv = " << stats.send_with_inv_success << "/"
+            << stats.send_with_inv;
+  LOG(INFO) << "recv = " << stats.recv_success << "/" << stats.recv;
+  LOG(INFO) << "read = " << stats.read_success << "/" << stats.read;
+  LOG(INFO) << "write = " << stats.write_success << "/" << stats.write;
+  LOG(INFO) << "fetch_add = " << stats.fetch_add_success << "/"
+            << stats.fetch_add;
+  LOG(INFO) << "comp_swap = " << stats.comp_swap_success << "/"
+            << stats.comp_swap;
   LOG(INFO) << "completion_statuses: ";
-  LOG(INFO) << "total completions = " << stats_.completions;
+  LOG(INFO) << "total completions = " << stats.completions;
   for (ibv_wc_status status :
        {IBV_WC_SUCCESS,           IBV_WC_LOC_LEN_ERR,
         IBV_WC_LOC_QP_OP_ERR,     IBV_WC_LOC_EEC_OP_ERR,
@@ -330,7 +501,17 @@ void RandomWalkClient::PrintStats() const {
         IBV_WC_INV_EEC_STATE_ERR, IBV_WC_FATAL_ERR,
         IBV_WC_RESP_TIMEOUT_ERR,  IBV_WC_GENERAL_ERR}) {
     LOG(INFO) << ibv_wc_status_str(status) << " = "
-              << stats_.completion_statuses[status];
+              << stats.completion_statuses[status];
+  }
+  LOG(INFO) << "cq polling: " << completion_poller_.stats().ToString();
+  LOG(INFO) << "action latencies:";
+  for (Action action : kActions) {
+    const LatencyHistogram& latency =
+        action_latencies_[static_cast<size_t>(action)];
+    if (latency.count() > 0) {
+      LOG(INFO) << magic_enum::enum_name(action) << " = "
+                << latency.ToString();
+    }
   }
   LOG(INFO) << profiler_.DumpStats();
 }
@@ -513,7 +694,6 @@ absl::StatusCode RandomWalkClient::DeallocType2Mw(ibv_mw* mw, bool is_bound) {
 absl::StatusCode RandomWalkClient::DestroyQp(ibv_qp* qp) {
   // Check that Qp satisfies precondition.
   DCHECK_EQ(verbs_util::GetQpState(qp), IBV_QPS_ERR);
-  DCHECK(resource_manager_.GetQpInfo(qp).inflight_ops.empty());
 
   ibv_pd* pd = qp->pd;
   ibv_cq* send_cq = qp->send_cq;
@@ -525,7 +705,9 @@ absl::StatusCode RandomWalkClient::DestroyQp(ibv_qp* qp) {
     LOG(ERROR) << "Failed to destroy qp (" << result << ").";
     return absl::StatusCode::kInternal;
   }
-  resource_manager_.EraseQp(qp_num, qp_type);
+  // With --allow_outstanding_ops the QP may still have ops in flight, whose
+  // completions are discounted.
+  resource_manager_.EraseQp(qp_num, qp_type, send_cq, recv_cq);
   ++stats_.destroy_qp;
   PdInfo* pd_info = resource_manager_.GetMutablePdInfo(pd);
   DCHECK(pd_info);
@@ -547,7 +729,11 @@ absl::StatusCode RandomWalkClient::DestroyQp(ibv_qp* qp) {
 }
 
 absl::StatusCode RandomWalkClient::TryDoRandomAction() {
-  Action action = action_sampler_.RandomAction();
+  return TryAction(action_sampler_.RandomAction());
+}
+
+absl::StatusCode RandomWalkClient::TryAction(Action action) {
+  int64_t start_ns = absl::GetCurrentTimeNanos();
   absl::StatusCode result;
   switch (action) {
     case Action::CREATE_CQ: {
@@ -622,40 +808,58 @@ absl::StatusCode RandomWalkClient::TryDoRandomAction() {
       result = TryDestroyAh();
       break;
     }
-    case Action::SEND: {
-      result = TrySend();
-      break;
-    }
     case Action::SEND_WITH_INV: {
       result = TrySendWithInv();
       break;
     }
-    case Action::RECV: {
-      result = TryRecv();
+    case Action::SEND:
+    case Action::RECV:
+    case Action::READ:
+    case Action::WRITE:
+    case Action::FETCH_ADD:
+    case Action::COMP_SWAP: {
+      DataPathContext context = {
+          .log = log_, .stats = stats_, .bitgen = bitgen_};
+      result = TryDataPathAction(action, context);
       break;
     }
+    default: {
+      LOG(FATAL) << "Unknown action code.";
+      result = absl::StatusCode::kInternal;
+    }
+  }
+  if (result == absl::StatusCode::kOk) {
+    action_latencies_[static_cast<size_t>(action)].Record(
+        absl::GetCurrentTimeNanos() - start_ns);
+  }
+  return result;
+}
+
+absl::StatusCode RandomWalkClient::TryDataPathAction(
+    Action action, DataPathContext& context) {
+  switch (action) {
+    case Action::SEND: {
+      return TrySend(context);
+    }
+    case Action::RECV: {
+      return TryRecv(context);
+    }
     case Action::READ: {
-      result = TryRead();
-      break;
+      return TryRead(context);
     }
     case Action::WRITE: {
-      result = TryWrite();
-      break;
+      return TryWrite(context);
     }
     case Action::FETCH_ADD: {
-      result = TryFetchAdd();
-      break;
+      return TryFetchAdd(context);
     }
     case Action::COMP_SWAP: {
-      result = TryCompSwap();
-      break;
+      return TryCompSwap(context);
     }
     default: {
-      LOG(FATAL) << "Unknown action code.";
-      result = absl::StatusCode::kInternal;
+      return absl::StatusCode::kFailedPrecondition;
     }
   }
-  return result;
 }
 
 absl::StatusCode RandomWalkClient::TryCreateCq() {
@@ -901,7 +1105,7 @@ absl::StatusCode RandomWalkClient::TryBindType1Mw() {
   ibv_mw* mw = mw_sample.value();
   DCHECK(mw);
   absl::Span<uint8_t> buffer = sampler_.RandomMwSpan(mr);
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::BIND_TYPE_1_MW);
+  uint64_t wr_id = NextWrId(Action::BIND_TYPE_1_MW);
   ibv_mw_bind bind_wr = verbs_util::CreateType1MwBindWr(wr_id, buffer, mr);
   int result = ibv_bind_mw(qp, mw, &bind_wr);
   log_.PushBindMw(bind_wr, mw);
@@ -910,6 +1114,7 @@ absl::StatusCode RandomWalkClient::TryBindType1Mw() {
     return absl::StatusCode::kInternal;
   }
   resource_manager_.GetMutableRcQpInfo(qp)->inflight_ops.insert(wr_id);
+  resource_manager_.AddOutstandingCompletions(qp->send_cq);
   log_.PushBindMw(bind_wr, mw);
   ++stats_.bind_type_1_mw;
   MrInfo* mr_info = resource_manager_.GetMutableMrInfo(mr);
@@ -944,7 +1149,7 @@ absl::StatusCode RandomWalkClient::TryBindType2Mw() {
   DCHECK(mw);
   absl::Span<uint8_t> buffer = sampler_.RandomMwSpan(mr);
   uint32_t rkey = absl::Uniform<uint32_t>(bitgen_);
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::BIND_TYPE_2_MW);
+  uint64_t wr_id = NextWrId(Action::BIND_TYPE_2_MW);
   ibv_send_wr bind_wr =
       verbs_util::CreateType2BindWr(wr_id, mw, buffer, rkey, mr);
   ibv_send_wr* bad_wr = nullptr;
@@ -954,6 +1159,7 @@ absl::StatusCode RandomWalkClient::TryBindType2Mw() {
     return absl::StatusCode::kInternal;
   }
   resource_manager_.GetMutableRcQpInfo(qp)->inflight_ops.insert(wr_id);
+  resource_manager_.AddOutstandingCompletions(qp->send_cq);
   log_.PushBindMw(bind_wr);
   ++stats_.bind_type_2_mw;
   MrInfo* mr_info = resource_manager_.GetMutableMrInfo(mr);
@@ -1139,11 +1345,12 @@ absl::StatusCode RandomWalkClient::TryDestroyAh() {
   return absl::StatusCode::kOk;
 }
 
-absl::StatusCode RandomWalkClient::TrySend() {
-  ibv_qp_type qp_type = absl::Bernoulli(bitgen_, kMessagingUdProbability)
-                            ? IBV_QPT_UD
-                            : IBV_QPT_RC;
-  auto qp_sample = resource_manager_.GetRandomQpForMessaging(qp_type);
+absl::StatusCode RandomWalkClient::TrySend(DataPathContext& context) {
+  ibv_qp_type qp_type =
+      absl::Bernoulli(context.bitgen, kMessagingUdProbability) ? IBV_QPT_UD
+                                                               : IBV_QPT_RC;
+  auto qp_sample =
+      resource_manager_.GetRandomQpForMessaging(qp_type, context.shard);
   if (!qp_sample.has_value()) {
     return absl::StatusCode::kFailedPrecondition;
   }
@@ -1170,7 +1377,7 @@ absl::StatusCode RandomWalkClient::TrySend() {
   for (const auto& buffer : buffers) {
     sges.push_back(verbs_util::CreateSge(buffer, mr));
   }
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::SEND);
+  uint64_t wr_id = NextWrId(Action::SEND);
   ibv_send_wr send = verbs_util::CreateSendWr(wr_id, sges.data(), sges.size());
   if (qp_type == IBV_QPT_UD) {
     auto ah_sample = resource_manager_.GetRandomAh(qp->pd);
@@ -1190,9 +1397,9 @@ absl::StatusCode RandomWalkClient::TrySend() {
     send.wr.ud.remote_qpn = remote_ud.qp_num;
     send.wr.ud.remote_qkey = remote_ud.q_key;
   }
-  if (absl::Bernoulli(bitgen_, kSendImmProbability)) {
+  if (absl::Bernoulli(context.bitgen, kSendImmProbability)) {
     send.opcode = IBV_WR_SEND_WITH_IMM;
-    send.imm_data = absl::Uniform<uint32_t>(bitgen_);
+    send.imm_data = absl::Uniform<uint32_t>(context.bitgen);
   }
   ibv_send_wr* bad_wr = nullptr;
   int result = ibv_post_send(qp, &send, &bad_wr);
@@ -1203,8 +1410,9 @@ absl::StatusCode RandomWalkClient::TrySend() {
   QpInfo* qp_info = resource_manager_.GetMutableQpInfo(qp);
   DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
   qp_info->inflight_ops.insert(wr_id);
-  log_.PushSend(send);
-  ++stats_.send;
+  RecordPost(context, qp->send_cq);
+  context.log.PushSend(send);
+  ++context.stats.send;
 
   return absl::StatusCode::kOk;
 }
@@ -1218,14 +1426,14 @@ absl::StatusCode RandomWalkClient::TrySendWithInv() {
   DCHECK(remote_mw.qp_num.has_value());
   ibv_qp* qp = resource_manager_.GetLocalRcQp(remote_mw.client_id,
                                               remote_mw.qp_num.value());
-  if (!qp || verbs_util::GetQpState(qp) != IBV_QPS_RTS) {
+  if (!qp) {
     return absl::StatusCode::kFailedPrecondition;
   }
   RcQpInfo rc_info = resource_manager_.GetRcQpInfo(qp);
   // Half of the time, just do the send with an empty SGL.
   ibv_send_wr send_inv;
   std::vector<ibv_sge> sges;
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::SEND_WITH_INV);
+  uint64_t wr_id = NextWrId(Action::SEND_WITH_INV);
   if (absl::Bernoulli(bitgen_, 0.5)) {
     send_inv = verbs_util::CreateSendWr(wr_id, nullptr, /*num_sge=*/0);
   } else {
@@ -1254,6 +1462,7 @@ absl::StatusCode RandomWalkClient::TrySendWithInv() {
   QpInfo* qp_info = resource_manager_.GetMutableQpInfo(qp);
   DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
   qp_info->inflight_ops.insert(wr_id);
+  resource_manager_.AddOutstandingCompletions(qp->send_cq);
   log_.PushSend(send_inv);
   ++stats_.send_with_inv;
   invalidate_ops_.PushInvalidate(send_inv.wr_id, send_inv.invalidate_rkey,
@@ -1262,11 +1471,12 @@ absl::StatusCode RandomWalkClient::TrySendWithInv() {
   return absl::StatusCode::kOk;
 }
 
-absl::StatusCode RandomWalkClient::TryRecv() {
-  ibv_qp_type qp_type = absl::Bernoulli(bitgen_, kMessagingUdProbability)
-                            ? IBV_QPT_UD
-                            : IBV_QPT_RC;
-  auto qp_sample = resource_manager_.GetRandomQpForMessaging(qp_type);
+absl::StatusCode RandomWalkClient::TryRecv(DataPathContext& context) {
+  ibv_qp_type qp_type =
+      absl::Bernoulli(context.bitgen, kMessagingUdProbability) ? IBV_QPT_UD
+                                                               : IBV_QPT_RC;
+  auto qp_sample =
+      resource_manager_.GetRandomQpForMessaging(qp_type, context.shard);
   if (!qp_sample.has_value()) {
     return absl::StatusCode::kFailedPrecondition;
   }
@@ -1293,7 +1503,7 @@ absl::StatusCode RandomWalkClient::TryRecv() {
   for (const absl::Span<uint8_t>& buffer : buffers) {
     sges.push_back(verbs_util::CreateSge(buffer, mr));
   }
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::RECV);
+  uint64_t wr_id = NextWrId(Action::RECV);
   ibv_recv_wr recv = verbs_util::CreateRecvWr(wr_id, sges.data(), sges.size());
   ibv_recv_wr* bad_wr = nullptr;
   int result = ibv_post_recv(qp, &recv, &bad_wr);
@@ -1301,8 +1511,9 @@ absl::StatusCode RandomWalkClient::TryRecv() {
     QpInfo* qp_info = resource_manager_.GetMutableQpInfo(qp);
     DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
     qp_info->inflight_ops.insert(wr_id);
-    log_.PushRecv(recv);
-    ++stats_.recv;
+    RecordPost(context, qp->recv_cq);
+    context.log.PushRecv(recv);
+    ++context.stats.recv;
     return absl::StatusCode::kOk;
   } else if (result == ENOMEM) {
     return absl::StatusCode::kOk;
@@ -1312,7 +1523,7 @@ absl::StatusCode RandomWalkClient::TryRecv() {
   }
 }
 
-absl::StatusCode RandomWalkClient::TryRead() {
+absl::StatusCode RandomWalkClient::TryRead(DataPathContext& context) {
   auto memory_opt = resource_manager_.GetRandomRdmaMemory();
   if (!memory_opt) {
     return absl::StatusCode::kFailedPrecondition;
@@ -1320,15 +1531,11 @@ absl::StatusCode RandomWalkClient::TryRead() {
   RdmaMemory memory = memory_opt.value();
   ibv_qp* qp = nullptr;
   if (memory.qp_num.has_value()) {
-    ibv_qp* local_qp =
-        resource_manager_.GetLocalRcQp(memory.client_id, memory.qp_num.value());
-    if (local_qp != nullptr &&
-        verbs_util::GetQpState(local_qp) == IBV_QPS_RTS) {
-      qp = local_qp;
-    }
+    qp = resource_manager_.GetLocalRcQp(memory.client_id,
+                                        memory.qp_num.value(), context.shard);
   } else {
-    auto qp_sample = resource_manager_.GetRandomQpForRdma(memory.client_id,
-                                                          memory.pd_handle);
+    auto qp_sample = resource_manager_.GetRandomQpForRdma(
+        memory.client_id, memory.pd_handle, context.shard);
     if (qp_sample.has_value()) {
       qp = qp_sample.value();
     }
@@ -1353,7 +1560,7 @@ absl::StatusCode RandomWalkClient::TryRead() {
   for (const auto& local_buffer : local_buffers) {
     sges.push_back(verbs_util::CreateSge(local_buffer, mr));
   }
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::READ);
+  uint64_t wr_id = NextWrId(Action::READ);
   ibv_send_wr read = verbs_util::CreateReadWr(wr_id, sges.data(), sges.size(),
                                               remote_addr, memory.rkey);
   ibv_send_wr* bad_wr = nullptr;
@@ -1368,13 +1575,14 @@ absl::StatusCode RandomWalkClient::TryRead() {
   RcQpInfo* qp_info = resource_manager_.GetMutableRcQpInfo(qp);
   DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
   qp_info->inflight_ops.insert(wr_id);
-  log_.PushRead(read);
-  ++stats_.read;
+  RecordPost(context, qp->send_cq);
+  context.log.PushRead(read);
+  ++context.stats.read;
 
   return absl::StatusCode::kOk;
 }
 
-absl::StatusCode RandomWalkClient::TryWrite() {
+absl::StatusCode RandomWalkClient::TryWrite(DataPathContext& context) {
   auto memory_opt = resource_manager_.GetRandomRdmaMemory();
   if (!memory_opt) {
     return absl::StatusCode::kFailedPrecondition;
@@ -1382,15 +1590,11 @@ absl::StatusCode RandomWalkClient::TryWrite() {
   RdmaMemory memory = memory_opt.value();
   ibv_qp* qp = nullptr;
   if (memory.qp_num.has_value()) {
-    ibv_qp* local_qp =
-        resource_manager_.GetLocalRcQp(memory.client_id, memory.qp_num.value());
-    if (local_qp != nullptr &&
-        verbs_util::GetQpState(local_qp) == IBV_QPS_RTS) {
-      qp = local_qp;
-    }
+    qp = resource_manager_.GetLocalRcQp(memory.client_id,
+                                        memory.qp_num.value(), context.shard);
   } else {
-    auto qp_sample = resource_manager_.GetRandomQpForRdma(memory.client_id,
-                                                          memory.pd_handle);
+    auto qp_sample = resource_manager_.GetRandomQpForRdma(
+        memory.client_id, memory.pd_handle, context.shard);
     if (qp_sample.has_value()) {
       qp = qp_sample.value();
     }
@@ -1415,7 +1619,7 @@ absl::StatusCode RandomWalkClient::TryWrite() {
   for (const auto& local_buffer : local_buffers) {
     sges.push_back(verbs_util::CreateSge(local_buffer, mr));
   }
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::WRITE);
+  uint64_t wr_id = NextWrId(Action::WRITE);
   ibv_send_wr write = verbs_util::CreateWriteWr(wr_id, sges.data(), sges.size(),
                                                 remote_addr, memory.rkey);
   ibv_send_wr* bad_wr = nullptr;
@@ -1427,13 +1631,14 @@ absl::StatusCode RandomWalkClient::TryWrite() {
   RcQpInfo* qp_info = resource_manager_.GetMutableRcQpInfo(qp);
   DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
   qp_info->inflight_ops.insert(wr_id);
-  log_.PushWrite(write);
-  ++stats_.write;
+  RecordPost(context, qp->send_cq);
+  context.log.PushWrite(write);
+  ++context.stats.write;
 
   return absl::StatusCode::kOk;
 }
 
-absl::StatusCode RandomWalkClient::TryFetchAdd() {
+absl::StatusCode RandomWalkClient::TryFetchAdd(DataPathContext& context) {
   auto memory_opt = resource_manager_.GetRandomRdmaMemory();
   if (!memory_opt) {
     return absl::StatusCode::kFailedPrecondition;
@@ -1441,15 +1646,11 @@ absl::StatusCode RandomWalkClient::TryFetchAdd() {
   RdmaMemory memory = memory_opt.value();
   ibv_qp* qp = nullptr;
   if (memory.qp_num.has_value()) {
-    ibv_qp* local_qp =
-        resource_manager_.GetLocalRcQp(memory.client_id, memory.qp_num.value());
-    if (local_qp != nullptr &&
-        verbs_util::GetQpState(local_qp) == IBV_QPS_RTS) {
-      qp = local_qp;
-    }
+    qp = resource_manager_.GetLocalRcQp(memory.client_id,
+                                        memory.qp_num.value(), context.shard);
   } else {
-    auto qp_sample = resource_manager_.GetRandomQpForRdma(memory.client_id,
-                                                          memory.pd_handle);
+    auto qp_sample = resource_manager_.GetRandomQpForRdma(
+        memory.client_id, memory.pd_handle, context.shard);
     if (qp_sample.has_value()) {
       qp = qp_sample.value();
     }
@@ -1467,10 +1668,10 @@ absl::StatusCode RandomWalkClient::TryFetchAdd() {
       reinterpret_cast<uint8_t*>(mr->addr), mr->length);
   uint8_t* remote_addr = sampler_.RandomAtomicAddr(
       reinterpret_cast<uint8_t*>(memory.addr), memory.length);
-  uint64_t add = absl::Uniform<uint64_t>(bitgen_);
+  uint64_t add = absl::Uniform<uint64_t>(context.bitgen);
 
   ibv_sge sge = verbs_util::CreateAtomicSge(local_addr, mr);
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::FETCH_ADD);
+  uint64_t wr_id = NextWrId(Action::FETCH_ADD);
   ibv_send_wr fetch_add = verbs_util::CreateFetchAddWr(
       wr_id, &sge, /*num_sge=*/1, remote_addr, memory.rkey, add);
   ibv_send_wr* bad_wr = nullptr;
@@ -1482,13 +1683,14 @@ absl::StatusCode RandomWalkClient::TryFetchAdd() {
   RcQpInfo* qp_info = resource_manager_.GetMutableRcQpInfo(qp);
   DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
   qp_info->inflight_ops.insert(wr_id);
-  log_.PushFetchAdd(fetch_add);
-  ++stats_.fetch_add;
+  RecordPost(context, qp->send_cq);
+  context.log.PushFetchAdd(fetch_add);
+  ++context.stats.fetch_add;
 
   return absl::StatusCode::kOk;
 }
 
-absl::StatusCode RandomWalkClient::TryCompSwap() {
+absl::StatusCode RandomWalkClient::TryCompSwap(DataPathContext& context) {
   auto memory_opt = resource_manager_.GetRandomRdmaMemory();
   if (!memory_opt) {
     return absl::StatusCode::kFailedPrecondition;
@@ -1496,15 +1698,11 @@ absl::StatusCode RandomWalkClient::TryCompSwap() {
   RdmaMemory memory = memory_opt.value();
   ibv_qp* qp = nullptr;
   if (memory.qp_num.has_value()) {
-    ibv_qp* local_qp =
-        resource_manager_.GetLocalRcQp(memory.client_id, memory.qp_num.value());
-    if (local_qp != nullptr &&
-        verbs_util::GetQpState(local_qp) == IBV_QPS_RTS) {
-      qp = local_qp;
-    }
+    qp = resource_manager_.GetLocalRcQp(memory.client_id,
+                                        memory.qp_num.value(), context.shard);
   } else {
-    auto qp_sample = resource_manager_.GetRandomQpForRdma(memory.client_id,
-                                                          memory.pd_handle);
+    auto qp_sample = resource_manager_.GetRandomQpForRdma(
+        memory.client_id, memory.pd_handle, context.shard);
     if (qp_sample.has_value()) {
       qp = qp_sample.value();
     }
@@ -1522,11 +1720,11 @@ absl::StatusCode RandomWalkClient::TryCompSwap() {
       reinterpret_cast<uint8_t*>(mr->addr), mr->length);
   uint8_t* remote_addr = sampler_.RandomAtomicAddr(
       reinterpret_cast<uint8_t*>(memory.addr), memory.length);
-  uint64_t add = absl::Uniform<uint64_t>(bitgen_);
-  uint64_t swap = absl::Uniform<uint64_t>(bitgen_);
+  uint64_t add = absl::Uniform<uint64_t>(context.bitgen);
+  uint64_t swap = absl::Uniform<uint64_t>(context.bitgen);
 
   ibv_sge sge = verbs_util::CreateAtomicSge(local_addr, mr);
-  uint64_t wr_id = EncodeAction(next_raw_wr_id_++, Action::COMP_SWAP);
+  uint64_t wr_id = NextWrId(Action::COMP_SWAP);
   ibv_send_wr comp_swap = verbs_util::CreateCompSwapWr(
       wr_id, &sge, /*num_sge=*/1, remote_addr, memory.rkey, add, swap);
   ibv_send_wr* bad_wr = nullptr;
@@ -1538,12 +1736,26 @@ absl::StatusCode RandomWalkClient::TryCompSwap() {
   RcQpInfo* qp_info = resource_manager_.GetMutableRcQpInfo(qp);
   DCHECK(qp_info) << "Cannot find info for QP " << qp->qp_num;
   qp_info->inflight_ops.insert(wr_id);
-  log_.PushCompSwap(comp_swap);
-  ++stats_.comp_swap;
+  RecordPost(context, qp->send_cq);
+  context.log.PushCompSwap(comp_swap);
+  ++context.stats.comp_swap;
 
   return absl::StatusCode::kOk;
 }
 
+uint64_t RandomWalkClient::NextWrId(Action action) {
+  return EncodeAction(next_raw_wr_id_.fetch_add(1, std::memory_order_relaxed),
+                      action);
+}
+
+void RandomWalkClient::RecordPost(DataPathContext& context, ibv_cq* cq) {
+  if (context.pending_completions == nullptr) {
+    resource_manager_.AddOutstandingCompletions(cq);
+  } else {
+    ++(*context.pending_completions)[cq];
+  }
+}
+
 void RandomWalkClient::PushOutboundUpdate(ClientUpdate& update) {
   dispatcher_->DispatchUpdate(update);
 }
@@ -1661,7 +1873,8 @@ void RandomWalkClient::ProcessUpdate(const ClientUpdate& update) {
 }
 
 void RandomWalkClient::FlushAllCompletionQueues() {
-  std::vector<ibv_cq*> cqs = resource_manager_.GetAllCqs();
+  // Idle CQs are skipped: only CQs with posted but unpolled work are visited.
+  std::vector<ibv_cq*> cqs = resource_manager_.GetActiveCqs();
   for (const auto& cq : cqs) {
     DCHECK(cq);
     FlushCompletionQueue(cq);
@@ -1669,13 +1882,11 @@ void RandomWalkClient::FlushAllCompletionQueues() {
 }
 
 void RandomWalkClient::FlushCompletionQueue(ibv_cq* cq) {
-  ibv_wc completion;
-  while (true) {
-    int count = ibv_poll_cq(cq, 1, &completion);
-    if (count == 0) {
-      break;
-    }
-    ProcessCompletion(completion);
+  int completions = completion_poller_.Drain(
+      cq, std::numeric_limits<int>::max(),
+      [this](const ibv_wc& completion) { ProcessCompletion(completion); });
+  if (completions > 0) {
+    resource_manager_.RemoveOutstandingCompletions(cq, completions);
   }
 }
 
@@ -18,10 +18,13 @@
 #define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_RANDOM_WALK_CLIENT_H_
 
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <deque>
 #include <memory>
+#include <thread>  // NOLINT
+#include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
@@ -32,6 +35,7 @@
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "infiniband/verbs.h"
+#include "internal/completion_poller.h"
 #include "public/rdma_memblock.h"
 #include "public/verbs_helper_suite.h"
 #include "random_walk/internal/bind_ops_tracker.h"
@@ -45,8 +49,13 @@
 #include "random_walk/internal/sampling.h"
 #include "random_walk/internal/types.h"
 #include "random_walk/internal/update_dispatcher_interface.h"
+#include "traffic/latency_histogram.h"
 
 ABSL_DECLARE_FLAG(bool, allow_outstanding_ops);
+ABSL_DECLARE_FLAG(bool, random_walk_throughput_mode);
+ABSL_DECLARE_FLAG(int, random_walk_data_ops_per_step);
+ABSL_DECLARE_FLAG(absl::Duration, random_walk_rate_interval);
+ABSL_DECLARE_FLAG(int, random_walk_data_path_threads);
 
 namespace rdma_unit_test {
 namespace random_walk {
@@ -74,6 +83,11 @@ class RandomWalkClient : public InboundUpdateInterface {
   static constexpr int kMinQpWr = 20;
   // The minimum CQE capacity of a CQ.
   static constexpr int kMinCqe = 50;
+  // A data path worker which fails to issue this many ops in a row, typically
+  // because the queues of its QPs are full until the random walk polls them,
+  // sleeps for kWorkerBackoff between attempts rather than yielding.
+  static constexpr int kWorkerSpinAttempts = 16;
+  static constexpr absl::Duration kWorkerBackoff = absl::Microseconds(100);
 
   // ---------------------------------------------------------------------------
 
@@ -86,7 +100,7 @@ class RandomWalkClient : public InboundUpdateInterface {
   RandomWalkClient& operator=(RandomWalkClient&& client) = default;
   RandomWalkClient(const RandomWalkClient& client) = delete;
   RandomWalkClient& operator=(const RandomWalkClient& client) = delete;
-  ~RandomWalkClient() = default;
+  ~RandomWalkClient();
 
   // ---------------------------------------------------------------------------
 
@@ -116,9 +130,13 @@ class RandomWalkClient : public InboundUpdateInterface {
   // 1. Recent action logs: records the most recent |kLogSize| events (commands
   // and completion) witnessed by the client. See RandomWalkLogger for more
   // details.
+  // 2. The recent data path ops of each data path worker thread, if any.
   void PrintLogs() const;
   // Prints via LOG(INFO) the running statistics of the client, such as number
-  // of (each type of) commands issued.
+  // of (each type of) commands issued, the overall step rate and the latency
+  // histogram of each type of command. With data path worker threads, it also
+  // prints the op rate of each worker and how long the worker and the random
+  // walk waited for each other on resources_mtx_.
   void PrintStats() const;
 
  private:
@@ -173,11 +191,50 @@ class RandomWalkClient : public InboundUpdateInterface {
     size_t comp_swap = 0;
     size_t comp_swap_success = 0;
     size_t completions = 0;
+    // Number of random walk steps, and of the data path ops issued on top of
+    // the random action of each step (see --random_walk_data_ops_per_step).
+    size_t steps = 0;
+    size_t data_path_ops = 0;
     std::array<size_t, 22> completion_statuses = {
         0};  // There are a total of 22 completion
              // statuses in ibverbs, from 0 to 21.
   };
 
+  // The state a data path op is issued with. The random walk issues ops with
+  // the client's own log, stats and random generator and may post to any QP.
+  // Each data path worker thread has its own, and only posts to the QPs of its
+  // shard.
+  struct DataPathContext {
+    RandomWalkLogger& log;
+    Stats& stats;
+    absl::BitGen& bitgen;
+    PostingShard shard;
+    // Completions posted but not yet recorded in the resource manager, or
+    // nullptr to record them in the resource manager as they are posted.
+    absl::flat_hash_map<ibv_cq*, uint64_t>* pending_completions = nullptr;
+  };
+
+  // A thread issuing random data path ops back to back alongside the random
+  // walk, see --random_walk_data_path_threads. All of its state, except the
+  // thread itself, is only accessed with resources_mtx_ held, shared by the
+  // worker and exclusively by the random walk.
+  struct DataPathWorker {
+    explicit DataPathWorker(const ActionWeights& action_weights)
+        : log(kLogSize), action_sampler(action_weights) {}
+
+    RandomWalkLogger log;
+    Stats stats;
+    absl::BitGen bitgen;
+    ActionSampler action_sampler;
+    PostingShard shard;
+    // Completions posted by the worker since the random walk last merged them
+    // into the resource manager, see MergePendingCompletions.
+    absl::flat_hash_map<ibv_cq*, uint64_t> pending_completions;
+    // Time spent waiting for resources_mtx_ before each op.
+    LatencyHistogram lock_wait;
+    std::thread thread;
+  };
+
   // Performs some initial commands to bootstrap the random walk. This mostly
   // includes creating the minimum number of MRs, MWs, PDs to start the
   // random walk.
@@ -186,11 +243,34 @@ class RandomWalkClient : public InboundUpdateInterface {
   // 1. Fetch inbound ClientUpdate from any remote clients.
   // 2. Carry out one random but via Action (see type.h). See each corresponding
   //    method (e.g. TryRegMr) for the set of Action and what each Action does.
-  // 3. Fetch any remaining entries from the completion queue.
+  // 3. Issue --random_walk_data_ops_per_step data path ops, if any.
+  // 4. Fetch any remaining entries from the completion queue.
+  // Steps 1-3 and step 4 each hold resources_mtx_ exclusively, so data path
+  // workers only run in between, e.g. while the step sleeps.
   absl::Status RandomWalk();
   // The same as RandomWalk, but instead of carrying out random Action, carry
   // out a specific Action.
   absl::Status DoAction(Action action);
+  // Issues --random_walk_data_ops_per_step random data path ops (send, recv,
+  // RDMA and atomics) back to back, without polling in between, so that they
+  // are in flight together. Ops which cannot be issued, e.g. because every QP
+  // is full, are skipped.
+  absl::Status DoDataPathActions();
+  // Logs the step, command and completion rates since the previous call if
+  // --random_walk_rate_interval has elapsed, forming a time series.
+  void MaybeLogRates() ABSL_EXCLUSIVE_LOCKS_REQUIRED(resources_mtx_);
+
+  // Starts and stops the data path worker threads. Workers are started after
+  // the random walk is bootstrapped and stopped, with their pending
+  // completions merged, before Run returns.
+  void StartDataPathWorkers();
+  void StopDataPathWorkers();
+  // The loop of a data path worker thread, which issues one random data path
+  // op at a time, with resources_mtx_ held shared, until stop_workers_ is set.
+  void RunDataPathWorker(DataPathWorker* worker);
+  // Records the completions posted by data path workers in the resource
+  // manager, so that their CQs get polled.
+  void MergePendingCompletions() ABSL_EXCLUSIVE_LOCKS_REQUIRED(resources_mtx_);
 
   // Helper function to create a RC QP.
   ibv_qp* CreateLocalRcQp(ibv_pd* pd);
@@ -221,6 +301,12 @@ class RandomWalkClient : public InboundUpdateInterface {
   // Tries to perform a random action with random input.
   // Returns a StatusCode specified below.
   absl::StatusCode TryDoRandomAction();
+  // Tries to perform a specific action with random input, see below. Records
+  // the latency of the action if it is issued.
+  absl::StatusCode TryAction(Action action);
+  // Tries to perform a data path action (send, recv, RDMA or atomics) within
+  // `context`. Returns kFailedPrecondition for any other action.
+  absl::StatusCode TryDataPathAction(Action action, DataPathContext& context);
 
   // Tries a specific action with random input. Returns a absl::StatusCode:
   // -- Ok: when the action succeeded.
@@ -248,13 +334,19 @@ class RandomWalkClient : public InboundUpdateInterface {
   absl::StatusCode TryDestroyQp();
   absl::StatusCode TryCreateAh();
   absl::StatusCode TryDestroyAh();
-  absl::StatusCode TrySend();
+  absl::StatusCode TrySend(DataPathContext& context);
   absl::StatusCode TrySendWithInv();
-  absl::StatusCode TryRecv();
-  absl::StatusCode TryRead();
-  absl::StatusCode TryWrite();
-  absl::StatusCode TryFetchAdd();
-  absl::StatusCode TryCompSwap();
+  absl::StatusCode TryRecv(DataPathContext& context);
+  absl::StatusCode TryRead(DataPathContext& context);
+  absl::StatusCode TryWrite(DataPathContext& context);
+  absl::StatusCode TryFetchAdd(DataPathContext& context);
+  absl::StatusCode TryCompSwap(DataPathContext& context);
+
+  // Returns a new wr_id for an op of `action`. Safe to call from any thread.
+  uint64_t NextWrId(Action action);
+  // Records that an op whose completion goes to `cq` was posted within
+  // `context`.
+  void RecordPost(DataPathContext& context, ibv_cq* cq);
 
   // Pushes an ClientUpdate to outbound_updates queue.
   void PushOutboundUpdate(ClientUpdate& update);
@@ -282,6 +374,9 @@ class RandomWalkClient : public InboundUpdateInterface {
 
   // Configs.
   const bool allow_outstanding_ops_;
+  const bool throughput_mode_;
+  const int data_ops_per_step_;
+  const absl::Duration rate_interval_;
 
   // - The memory_ field represents the "ground" memory buffer for the client.
   // - Memory Regions/Windows are allocated from it.
@@ -289,7 +384,7 @@ class RandomWalkClient : public InboundUpdateInterface {
   // - Other static resource for clients.
   ibv_context* context_;
   PortAttribute port_attr_;
-  uint32_t next_raw_wr_id_ = 0;
+  std::atomic<uint32_t> next_raw_wr_id_{0};
 
   // Resource manager for MW, MR, and QP.
   IbvResourceManager resource_manager_;
@@ -297,6 +392,8 @@ class RandomWalkClient : public InboundUpdateInterface {
   BindOpsTracker bind_ops_;
   InvalidateOpsTracker invalidate_ops_;
   CompletionProfile profiler_;
+  // Harvests completions from all cqs in batches of --cq_poll_batch.
+  CompletionPoller completion_poller_;
 
   absl::flat_hash_map<ClientId, ibv_gid> client_gids_;
 
@@ -310,12 +407,33 @@ class RandomWalkClient : public InboundUpdateInterface {
   const IbvObjectBound caps_;
   RandomWalkSampler sampler_;
   ActionSampler action_sampler_;
+  // Samples among the data path actions only, for DoDataPathActions.
+  ActionSampler data_path_sampler_;
 
   // Statistics.
   Stats stats_;
+  // Latency of each issued action, indexed by Action.
+  std::array<LatencyHistogram, kActions.size()> action_latencies_;
+  absl::Time run_start_;
+  // Stats at the previous MaybeLogRates() report.
+  Stats rate_baseline_;
+  absl::Time rate_baseline_time_;
+  // Data path ops of all workers at the previous MaybeLogRates() report.
+  size_t rate_baseline_worker_ops_ = 0;
+
+  // Data path worker threads, see --random_walk_data_path_threads.
+  std::vector<std::unique_ptr<DataPathWorker>> workers_;
+  std::atomic<bool> stop_workers_{false};
+  // Time the random walk spent waiting for resources_mtx_ in each step.
+  LatencyHistogram writer_lock_wait_;
 
   // Mutexes.
   mutable absl::Mutex mtx_in_updates_;
+  // Guards the resources, i.e. resource_manager_ and the verbs objects in it,
+  // when there are data path workers. Workers hold it shared to post to the
+  // QPs of their own shard; the random walk holds it exclusively to change
+  // resources and to poll completions.
+  absl::Mutex resources_mtx_;
 
   // absl::BitGen for random number generators.
   mutable absl::BitGen bitgen_;
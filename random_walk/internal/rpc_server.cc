@@ -16,11 +16,15 @@
 
 #include "random_walk/internal/rpc_server.h"
 
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <string>
+#include <utility>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/log/check.h"
+#include "absl/status/status.h"
 #include "absl/synchronization/mutex.h"
 #include "grpcpp/server_context.h"
 #include "grpcpp/support/status.h"
@@ -40,12 +44,57 @@ grpc::Status RpcServer::Update(grpc::ServerContext* context,
   absl::MutexLock guard(&mutex_);
   DCHECK(client_);
   UpdateReorderQueue& reorder_queue = reorder_queues_[request->source_id()];
-  reorder_queue.Push(request->sequence_number(), request->update());
-  for (auto maybe_update = reorder_queue.Pull(); maybe_update.has_value();
-       maybe_update = reorder_queue.Pull()) {
-    client_->PushInboundUpdate(maybe_update.value());
+  // The request is owned by the server and not read after this call, so an
+  // accepted update is moved into the queue rather than copied.
+  absl::Status status = reorder_queue.Push(
+      request->sequence_number(),
+      std::move(*const_cast<OrderedUpdateRequest*>(request)->mutable_update()));
+  PushInOrderUpdates(reorder_queue);
+  // A retried update has already been accepted.
+  if (absl::IsAlreadyExists(status)) {
+    return ::grpc::Status::OK;
   }
-  return ::grpc::Status::OK;
+  return ToGrpcStatus(status);
+}
+
+grpc::Status RpcServer::UpdateBatch(grpc::ServerContext* context,
+                                    const OrderedUpdateBatchRequest* request,
+                                    UpdateResponse* response) {
+  absl::MutexLock guard(&mutex_);
+  DCHECK(client_);
+  UpdateReorderQueue& reorder_queue = reorder_queues_[request->source_id()];
+  uint32_t sequence_number = request->first_sequence_number();
+  absl::Status status = absl::OkStatus();
+  // As in Update(), move the updates out of the request.
+  for (ClientUpdate& update :
+       *const_cast<OrderedUpdateBatchRequest*>(request)->mutable_updates()) {
+    status = reorder_queue.Push(sequence_number++, std::move(update));
+    // A retried batch repeats the updates accepted by earlier attempts.
+    if (absl::IsAlreadyExists(status)) {
+      status = absl::OkStatus();
+      continue;
+    }
+    if (!status.ok()) {
+      break;
+    }
+  }
+  PushInOrderUpdates(reorder_queue);
+  return ToGrpcStatus(status);
+}
+
+void RpcServer::PushInOrderUpdates(UpdateReorderQueue& reorder_queue) {
+  for (const ClientUpdate& update : reorder_queue.PullAll()) {
+    client_->PushInboundUpdate(update);
+  }
+}
+
+::grpc::Status RpcServer::ToGrpcStatus(const absl::Status& status) {
+  if (status.ok()) {
+    return ::grpc::Status::OK;
+  }
+  // absl::StatusCode and grpc::StatusCode share the same canonical codes.
+  return ::grpc::Status(static_cast<::grpc::StatusCode>(status.code()),
+                        std::string(status.message()));
 }
 
 }  // namespace random_walk
@@ -21,6 +21,7 @@
 
 #include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
 #include "absl/synchronization/mutex.h"
 #include "grpcpp/server_context.h"
 #include "grpcpp/support/status.h"
@@ -46,8 +47,18 @@ class RpcServer final : public ClientUpdateService::Service {
   ::grpc::Status Update(::grpc::ServerContext* context,
                         const OrderedUpdateRequest* request,
                         UpdateResponse* response) override;
+  ::grpc::Status UpdateBatch(::grpc::ServerContext* context,
+                             const OrderedUpdateBatchRequest* request,
+                             UpdateResponse* response) override;
 
  private:
+  // Pushes every update of `reorder_queue` which is now in order to client_.
+  void PushInOrderUpdates(UpdateReorderQueue& reorder_queue)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Converts the status of UpdateReorderQueue::Push to the RPC status, so that
+  // the sender learns about an overflowing reorder window and retries.
+  static ::grpc::Status ToGrpcStatus(const absl::Status& status);
+
   absl::Mutex mutex_;
   const std::shared_ptr<InboundUpdateInterface> client_;
   absl::flat_hash_map<ClientId, UpdateReorderQueue> reorder_queues_
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/rpc_server.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "grpcpp/support/status.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/inbound_update_interface.h"
+#include "random_walk/internal/update_reorder_queue.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+using ::testing::ElementsAre;
+
+// Records the tags of the updates pushed by the RpcServer.
+class RecordingClient : public InboundUpdateInterface {
+ public:
+  void PushInboundUpdate(const ClientUpdate& update) override {
+    tags_.push_back(update.destination_id());
+  }
+
+  const std::vector<uint32_t>& tags() const { return tags_; }
+
+ private:
+  std::vector<uint32_t> tags_;
+};
+
+// Returns a batch of `count` updates from sequence number `first` on, each
+// tagged with its sequence number.
+OrderedUpdateBatchRequest MakeBatch(uint32_t first, uint32_t count) {
+  OrderedUpdateBatchRequest request;
+  request.set_source_id(1);
+  request.set_first_sequence_number(first);
+  for (uint32_t i = 0; i < count; ++i) {
+    request.add_updates()->set_destination_id(first + i);
+  }
+  return request;
+}
+
+TEST(RpcServerTest, RetriedBatchSkipsAcceptedUpdates) {
+  constexpr uint32_t kWindow = UpdateReorderQueue::kDefaultWindow;
+  auto client = std::make_shared<RecordingClient>();
+  RpcServer server(client);
+  UpdateResponse response;
+
+  // The batch after the first one overflows the window half way through.
+  OrderedUpdateBatchRequest late = MakeBatch(kWindow / 2, kWindow);
+  EXPECT_EQ(server.UpdateBatch(nullptr, &late, &response).error_code(),
+            ::grpc::StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_TRUE(client->tags().empty());
+
+  OrderedUpdateBatchRequest early = MakeBatch(0, kWindow / 2);
+  EXPECT_TRUE(server.UpdateBatch(nullptr, &early, &response).ok());
+  EXPECT_EQ(client->tags().size(), kWindow);
+
+  // The retry is accepted, and only the remaining updates are delivered.
+  EXPECT_TRUE(server.UpdateBatch(nullptr, &late, &response).ok());
+  ASSERT_EQ(client->tags().size(), kWindow + kWindow / 2);
+  for (uint32_t i = 0; i < client->tags().size(); ++i) {
+    EXPECT_EQ(client->tags()[i], i);
+  }
+
+  // A retry after the whole batch was accepted changes nothing.
+  EXPECT_TRUE(server.UpdateBatch(nullptr, &late, &response).ok());
+  EXPECT_EQ(client->tags().size(), kWindow + kWindow / 2);
+}
+
+TEST(RpcServerTest, RetriedUpdateIsAccepted) {
+  auto client = std::make_shared<RecordingClient>();
+  RpcServer server(client);
+  UpdateResponse response;
+  OrderedUpdateRequest request;
+  request.set_source_id(1);
+  request.set_sequence_number(0);
+  request.mutable_update()->set_destination_id(0);
+  EXPECT_TRUE(server.Update(nullptr, &request, &response).ok());
+  EXPECT_TRUE(server.Update(nullptr, &request, &response).ok());
+  EXPECT_THAT(client->tags(), ElementsAre(0));
+}
+
+}  // namespace
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -40,16 +40,16 @@ namespace random_walk {
 RdmaMemBlock RandomWalkSampler::RandomMrRdmaMemblock(
     const RdmaMemBlock& memblock) const {
   DCHECK_LE(kMinMrSize, memblock.size());
-  uint64_t size =
-      absl::Uniform(bitgen_, kMinMrSize, std::min(kMaxMrSize, memblock.size()));
-  uint64_t offset = absl::Uniform(bitgen_, 0ul, memblock.size() - size);
+  uint64_t size = absl::Uniform(bitgen(), kMinMrSize,
+                                std::min(kMaxMrSize, memblock.size()));
+  uint64_t offset = absl::Uniform(bitgen(), 0ul, memblock.size() - size);
   return memblock.subblock(offset, size);
 }
 
 absl::Span<uint8_t> RandomWalkSampler::RandomMwSpan(ibv_mr* mr) const {
   DCHECK_GE(mr->length, kMinMwSize);
-  uint64_t size = absl::Uniform(bitgen_, kMinMwSize, mr->length);
-  uint64_t offset = absl::Uniform(bitgen_, 0ul, mr->length - size);
+  uint64_t size = absl::Uniform(bitgen(), kMinMwSize, mr->length);
+  uint64_t offset = absl::Uniform(bitgen(), 0ul, mr->length - size);
   uint8_t* addr = reinterpret_cast<uint8_t*>(mr->addr) + offset;
   return absl::MakeSpan(addr, size);
 }
@@ -59,11 +59,11 @@ RandomWalkSampler::RandomRdmaBuffersPair(ibv_mr* local_mr,
                                          uint64_t remote_memory_addr,
                                          uint64_t remote_memory_length,
                                          size_t max_buffers) const {
-  uint64_t length = kOpSizes[absl::Uniform(bitgen_, 0ul, kOpSizes.size())];
+  uint64_t length = kOpSizes[absl::Uniform(bitgen(), 0ul, kOpSizes.size())];
   std::vector<absl::Span<uint8_t>> buffers =
       CreateLocalBuffers(local_mr, length, max_buffers);
   uint64_t remote_offset =
-      absl::Uniform(bitgen_, 0ul, remote_memory_length - length);
+      absl::Uniform(bitgen(), 0ul, remote_memory_length - length);
   uint8_t* remote_addr =
       reinterpret_cast<uint8_t*>(remote_memory_addr) + remote_offset;
   return std::make_pair(buffers, remote_addr);
@@ -80,7 +80,7 @@ uint8_t* RandomWalkSampler::RandomAtomicAddr(void* addr,
   DCHECK_GE(valid_length, 8ul);
   valid_length -= valid_length % 8;
   uint64_t num_blocks = valid_length / 8;
-  uint64_t random_block = absl::Uniform(bitgen_, 0ul, num_blocks);
+  uint64_t random_block = absl::Uniform(bitgen(), 0ul, num_blocks);
   return reinterpret_cast<uint8_t*>(start_addr + random_block * 8);
 }
 
@@ -107,15 +107,15 @@ std::vector<absl::Span<uint8_t>> RandomWalkSampler::CreateLocalBuffers(
     ibv_mr* mr, size_t total_length, size_t max_buffers) const {
   DCHECK_LE(total_length, mr->length);
   size_t num_buffers = 1;
-  if (max_buffers > 1 && absl::Bernoulli(bitgen_, 0.5)) {
-    num_buffers = absl::Uniform<size_t>(bitgen_, 2ul, max_buffers + 1);
+  if (max_buffers > 1 && absl::Bernoulli(bitgen(), 0.5)) {
+    num_buffers = absl::Uniform<size_t>(bitgen(), 2ul, max_buffers + 1);
   }
   std::vector<size_t> buffer_boundaries;
   buffer_boundaries.reserve(num_buffers + 1);
   buffer_boundaries.push_back(0);
   buffer_boundaries.push_back(total_length);
   for (size_t i = 0; i < num_buffers - 1; ++i) {
-    buffer_boundaries.push_back(absl::Uniform(bitgen_, 0ul, total_length));
+    buffer_boundaries.push_back(absl::Uniform(bitgen(), 0ul, total_length));
   }
   std::sort(buffer_boundaries.begin(), buffer_boundaries.end());
   std::vector<absl::Span<uint8_t>> buffers;
@@ -123,7 +123,7 @@ std::vector<absl::Span<uint8_t>> RandomWalkSampler::CreateLocalBuffers(
   for (size_t i = 0; i < buffer_boundaries.size() - 1; ++i) {
     size_t buffer_length = buffer_boundaries[i + 1] - buffer_boundaries[i];
     size_t buffer_offset =
-        absl::Uniform(bitgen_, 0ul, mr->length - buffer_length);
+        absl::Uniform(bitgen(), 0ul, mr->length - buffer_length);
     absl::Span<uint8_t> new_buffer = absl::MakeSpan(
         static_cast<uint8_t*>(mr->addr) + buffer_offset, buffer_length);
     buffers.push_back(new_buffer);
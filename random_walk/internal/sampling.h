@@ -43,6 +43,127 @@ namespace random_walk {
 // This file contains a set of sampler classes that help a RandomWalkClient
 // to generate random commands.
 
+// IndexedSet is a set that keeps its elements densely packed in a vector, with
+// a hash map from element to its position. Insert, Erase and random access by
+// position are all O(1); erasing swaps the last element into the vacated slot.
+// This lets RandomWalkSampler draw a uniformly random element without walking
+// a hash table iterator.
+template <typename ElemT>
+class IndexedSet {
+ public:
+  IndexedSet() = default;
+  // Movable and copyable.
+  IndexedSet(IndexedSet&& set) = default;
+  IndexedSet& operator=(IndexedSet&& set) = default;
+  IndexedSet(const IndexedSet& set) = default;
+  IndexedSet& operator=(const IndexedSet& set) = default;
+  ~IndexedSet() = default;
+
+  // Inserts an element. Returns false if the element is already present.
+  bool Insert(const ElemT& element) {
+    auto [iter, inserted] = index_.try_emplace(element, elements_.size());
+    if (!inserted) {
+      return false;
+    }
+    elements_.push_back(element);
+    return true;
+  }
+
+  // Erases an element. Returns false if the element is not present.
+  bool Erase(const ElemT& element) {
+    auto iter = index_.find(element);
+    if (iter == index_.end()) {
+      return false;
+    }
+    size_t position = iter->second;
+    index_.erase(iter);
+    if (position != elements_.size() - 1) {
+      elements_[position] = std::move(elements_.back());
+      index_[elements_[position]] = position;
+    }
+    elements_.pop_back();
+    return true;
+  }
+
+  bool contains(const ElemT& element) const {
+    return index_.contains(element);
+  }
+  size_t size() const { return elements_.size(); }
+  bool empty() const { return elements_.empty(); }
+  // Returns the element at `position`, which must be less than size().
+  const ElemT& at(size_t position) const { return elements_[position]; }
+  typename std::vector<ElemT>::const_iterator begin() const {
+    return elements_.cbegin();
+  }
+  typename std::vector<ElemT>::const_iterator end() const {
+    return elements_.cend();
+  }
+
+ private:
+  std::vector<ElemT> elements_;
+  absl::flat_hash_map<ElemT, size_t> index_;
+};
+
+// GroupedIndexedSet is an IndexedSet whose elements are additionally
+// partitioned by a group key, e.g. the PD a resource belongs to, so that
+// sampling within one group is also O(1). The group of an element is recorded
+// on insertion, so erasing never needs to dereference the element itself; this
+// allows erasing a verbs object after it has been destroyed.
+template <typename ElemT, typename GroupT>
+class GroupedIndexedSet {
+ public:
+  GroupedIndexedSet() = default;
+  // Movable and copyable.
+  GroupedIndexedSet(GroupedIndexedSet&& set) = default;
+  GroupedIndexedSet& operator=(GroupedIndexedSet&& set) = default;
+  GroupedIndexedSet(const GroupedIndexedSet& set) = default;
+  GroupedIndexedSet& operator=(const GroupedIndexedSet& set) = default;
+  ~GroupedIndexedSet() = default;
+
+  // Inserts an element into `group`. Returns false if the element is already
+  // present.
+  bool Insert(const ElemT& element, const GroupT& group) {
+    if (!all_.Insert(element)) {
+      return false;
+    }
+    group_of_.emplace(element, group);
+    groups_[group].Insert(element);
+    return true;
+  }
+
+  // Erases an element. Returns false if the element is not present.
+  bool Erase(const ElemT& element) {
+    auto group_iter = group_of_.find(element);
+    if (group_iter == group_of_.end()) {
+      return false;
+    }
+    auto members_iter = groups_.find(group_iter->second);
+    members_iter->second.Erase(element);
+    if (members_iter->second.empty()) {
+      groups_.erase(members_iter);
+    }
+    group_of_.erase(group_iter);
+    all_.Erase(element);
+    return true;
+  }
+
+  bool contains(const ElemT& element) const { return all_.contains(element); }
+  size_t size() const { return all_.size(); }
+  bool empty() const { return all_.empty(); }
+  // Returns all elements regardless of group.
+  const IndexedSet<ElemT>& all() const { return all_; }
+  // Returns the elements of `group`, or nullptr if the group has no element.
+  const IndexedSet<ElemT>* group(const GroupT& group) const {
+    auto iter = groups_.find(group);
+    return iter == groups_.end() ? nullptr : &iter->second;
+  }
+
+ private:
+  IndexedSet<ElemT> all_;
+  absl::flat_hash_map<ElemT, GroupT> group_of_;
+  absl::flat_hash_map<GroupT, IndexedSet<ElemT>> groups_;
+};
+
 // The class provides helper functions for sampling random command parameters.
 class RandomWalkSampler {
  public:
@@ -75,12 +196,33 @@ class RandomWalkSampler {
     if (set.empty()) {
       return absl::nullopt;
     }
-    size_t rand_idx = absl::Uniform(bitgen_, 0u, set.size());
+    size_t rand_idx = absl::Uniform(bitgen(), 0u, set.size());
     auto iter = set.cbegin();
     std::advance(iter, rand_idx);
     return *iter;
   }
 
+  // Returns a uniformly random element from an IndexedSet in O(1).
+  template <class Type>
+  absl::optional<Type> GetRandomSetElement(const IndexedSet<Type>& set) const {
+    if (set.empty()) {
+      return absl::nullopt;
+    }
+    return set.at(absl::Uniform(bitgen(), 0u, set.size()));
+  }
+
+  // Returns a uniformly random element of `group` in a GroupedIndexedSet in
+  // O(1).
+  template <class Type, class GroupT>
+  absl::optional<Type> GetRandomGroupElement(
+      const GroupedIndexedSet<Type, GroupT>& set, const GroupT& group) const {
+    const IndexedSet<Type>* members = set.group(group);
+    if (members == nullptr) {
+      return absl::nullopt;
+    }
+    return GetRandomSetElement(*members);
+  }
+
   // Returns a uniformly random key from an absl::flat_hash_map.
   template <typename Key, typename Value>
   absl::optional<Key> GetRandomMapKey(
@@ -88,7 +230,7 @@ class RandomWalkSampler {
     if (map.empty()) {
       return absl::nullopt;
     }
-    size_t rand_idx = absl::Uniform(bitgen_, 0u, map.size());
+    size_t rand_idx = absl::Uniform(bitgen(), 0u, map.size());
     auto iter = map.cbegin();
     std::advance(iter, rand_idx);
     return iter->first;
@@ -101,7 +243,7 @@ class RandomWalkSampler {
     if (map.empty()) {
       return absl::nullopt;
     }
-    size_t rand_idx = absl::Uniform(bitgen_, 0u, map.size());
+    size_t rand_idx = absl::Uniform(bitgen(), 0u, map.size());
     auto iter = map.cbegin();
     std::advance(iter, rand_idx);
     return iter->second;
@@ -114,7 +256,7 @@ class RandomWalkSampler {
     if (map.empty()) {
       return absl::nullopt;
     }
-    size_t rand_idx = absl::Uniform(bitgen_, 0u, map.size());
+    size_t rand_idx = absl::Uniform(bitgen(), 0u, map.size());
     auto iter = map.cbegin();
     std::advance(iter, rand_idx);
     return *iter;
@@ -126,7 +268,7 @@ class RandomWalkSampler {
     if (lst.empty()) {
       return absl::nullopt;
     }
-    size_t rand_idx = absl::Uniform(bitgen_, 0u, lst.size());
+    size_t rand_idx = absl::Uniform(bitgen(), 0u, lst.size());
     auto iter = lst.begin();
     std::advance(iter, rand_idx);
     return *iter;
@@ -171,7 +313,12 @@ class RandomWalkSampler {
                                                       size_t total_length,
                                                       size_t max_buffers) const;
 
-  mutable absl::BitGen bitgen_;
+  // Each thread samples from its own generator, so that a RandomWalkSampler
+  // can be shared by threads.
+  static absl::BitGen& bitgen() {
+    static thread_local absl::BitGen bitgen;
+    return bitgen;
+  }
 };
 
 // ActionSampler provides functions that samples a random action, i.e. command
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/sampling.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+using ::testing::UnorderedElementsAreArray;
+
+constexpr int kSamples = 100000;
+
+std::vector<int> Elements(const IndexedSet<int>& set) {
+  return std::vector<int>(set.begin(), set.end());
+}
+
+// Samples `sample` kSamples times and expects every element of `expected` to
+// be drawn with probability 1/expected.size(), within 10%. With kSamples
+// samples over a handful of elements, 10% is well over 10 standard deviations.
+template <typename SampleFn>
+void ExpectUniform(SampleFn sample, const std::vector<int>& expected) {
+  absl::flat_hash_map<int, int> counts;
+  for (int i = 0; i < kSamples; ++i) {
+    absl::optional<int> element = sample();
+    ASSERT_TRUE(element.has_value());
+    ++counts[*element];
+  }
+  ASSERT_EQ(counts.size(), expected.size());
+  const double mean = static_cast<double>(kSamples) / expected.size();
+  for (int element : expected) {
+    SCOPED_TRACE(element);
+    EXPECT_GT(counts[element], 0.9 * mean);
+    EXPECT_LT(counts[element], 1.1 * mean);
+  }
+}
+
+TEST(IndexedSetTest, InsertAndErase) {
+  IndexedSet<int> set;
+  EXPECT_TRUE(set.empty());
+  EXPECT_TRUE(set.Insert(1));
+  EXPECT_TRUE(set.Insert(2));
+  EXPECT_FALSE(set.Insert(1));
+  EXPECT_EQ(set.size(), 2);
+  EXPECT_TRUE(set.Erase(1));
+  EXPECT_FALSE(set.Erase(1));
+  EXPECT_FALSE(set.contains(1));
+  EXPECT_TRUE(set.contains(2));
+  EXPECT_THAT(Elements(set), UnorderedElementsAre(2));
+}
+
+TEST(IndexedSetTest, SwapRemoveKeepsPositions) {
+  IndexedSet<int> set;
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(set.Insert(i));
+  }
+  // Erase from the front, the middle and the back; all but the last move the
+  // back element into the vacated position.
+  for (int element : {0, 5, 9, 3}) {
+    ASSERT_TRUE(set.Erase(element));
+  }
+  EXPECT_THAT(Elements(set), UnorderedElementsAre(1, 2, 4, 6, 7, 8));
+  // The moved elements can still be erased, and erased elements re-inserted.
+  for (int element : {8, 7, 1}) {
+    ASSERT_TRUE(set.Erase(element));
+  }
+  ASSERT_TRUE(set.Insert(0));
+  EXPECT_THAT(Elements(set), UnorderedElementsAre(0, 2, 4, 6));
+  for (size_t i = 0; i < set.size(); ++i) {
+    EXPECT_TRUE(set.contains(set.at(i)));
+  }
+}
+
+TEST(IndexedSetTest, SamplesUniformlyAfterSwapRemove) {
+  IndexedSet<int> set;
+  for (int i = 0; i < 12; ++i) {
+    ASSERT_TRUE(set.Insert(i));
+  }
+  for (int element : {0, 11, 4, 7, 2}) {
+    ASSERT_TRUE(set.Erase(element));
+  }
+  RandomWalkSampler sampler;
+  ExpectUniform([&]() { return sampler.GetRandomSetElement(set); },
+                {1, 3, 5, 6, 8, 9, 10});
+}
+
+TEST(IndexedSetTest, EmptySetHasNoSample) {
+  IndexedSet<int> set;
+  RandomWalkSampler sampler;
+  EXPECT_EQ(sampler.GetRandomSetElement(set), absl::nullopt);
+  ASSERT_TRUE(set.Insert(1));
+  ASSERT_TRUE(set.Erase(1));
+  EXPECT_EQ(sampler.GetRandomSetElement(set), absl::nullopt);
+}
+
+TEST(GroupedIndexedSetTest, GroupsTrackMembers) {
+  GroupedIndexedSet<int, char> set;
+  EXPECT_TRUE(set.Insert(1, 'a'));
+  EXPECT_TRUE(set.Insert(2, 'a'));
+  EXPECT_TRUE(set.Insert(3, 'b'));
+  // An element belongs to a single group.
+  EXPECT_FALSE(set.Insert(1, 'b'));
+  EXPECT_EQ(set.size(), 3);
+  ASSERT_NE(set.group('a'), nullptr);
+  EXPECT_THAT(Elements(*set.group('a')), UnorderedElementsAre(1, 2));
+  EXPECT_THAT(Elements(*set.group('b')), UnorderedElementsAre(3));
+  EXPECT_EQ(set.group('c'), nullptr);
+
+  EXPECT_TRUE(set.Erase(3));
+  EXPECT_FALSE(set.Erase(3));
+  // Empty groups are dropped.
+  EXPECT_EQ(set.group('b'), nullptr);
+  EXPECT_TRUE(set.Erase(1));
+  EXPECT_THAT(Elements(*set.group('a')), UnorderedElementsAre(2));
+  EXPECT_THAT(Elements(set.all()), UnorderedElementsAre(2));
+}
+
+TEST(GroupedIndexedSetTest, SamplesGroupUniformlyAfterSwapRemove) {
+  GroupedIndexedSet<int, int> set;
+  std::vector<int> even;
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_TRUE(set.Insert(i, i % 2));
+  }
+  for (int element : {0, 18, 6, 7, 19}) {
+    ASSERT_TRUE(set.Erase(element));
+  }
+  for (int i = 0; i < 20; i += 2) {
+    if (set.contains(i)) even.push_back(i);
+  }
+  ASSERT_THAT(Elements(*set.group(0)), UnorderedElementsAreArray(even));
+  RandomWalkSampler sampler;
+  ExpectUniform([&]() { return sampler.GetRandomGroupElement(set, 0); }, even);
+  ExpectUniform([&]() { return sampler.GetRandomSetElement(set.all()); },
+                {1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17});
+  EXPECT_EQ(sampler.GetRandomGroupElement(set, 2), absl::nullopt);
+}
+
+}  // namespace
+}  // namespace random_walk
+}  // namespace rdma_unit_test
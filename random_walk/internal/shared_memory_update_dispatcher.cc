@@ -0,0 +1,65 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/shared_memory_update_dispatcher.h"
+
+#include <sched.h>
+
+#include <memory>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/shared_update_segment.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+SharedMemoryUpdateDispatcher::SharedMemoryUpdateDispatcher(
+    ClientId owner_id, std::shared_ptr<SharedUpdateSegment> segment)
+    : owner_id_(owner_id), segment_(std::move(segment)) {
+  DCHECK(segment_);
+  DCHECK_LT(owner_id_, segment_->num_clients());
+}
+
+void SharedMemoryUpdateDispatcher::DispatchUpdate(const ClientUpdate& update) {
+  if (update.has_destination_id()) {
+    SendUpdate(update.destination_id(), update);
+  } else {
+    for (ClientId client_id = 0; client_id < segment_->num_clients();
+         ++client_id) {
+      SendUpdate(client_id, update);
+    }
+  }
+}
+
+void SharedMemoryUpdateDispatcher::SendUpdate(ClientId client_id,
+                                              const ClientUpdate& update) {
+  absl::Status status = segment_->TryPush(owner_id_, client_id, update);
+  while (absl::IsResourceExhausted(status)) {
+    sched_yield();
+    status = segment_->TryPush(owner_id_, client_id, update);
+  }
+  LOG_IF(ERROR, !status.ok())
+      << "Client " << owner_id_ << " dropped an update to client " << client_id
+      << ": " << status;
+}
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
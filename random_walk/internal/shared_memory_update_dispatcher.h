@@ -0,0 +1,68 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_MEMORY_UPDATE_DISPATCHER_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_MEMORY_UPDATE_DISPATCHER_H_
+
+#include <memory>
+
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/shared_update_segment.h"
+#include "random_walk/internal/types.h"
+#include "random_walk/internal/update_dispatcher_interface.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+// The class responsible for dispatching ClientUpdates from a RandomWalkClient
+// to other RandomWalkClients on the same host, possibly in other processes,
+// through a SharedUpdateSegment. The remote clients receive them with a
+// SharedMemoryUpdateHandler. When the ring to a remote client is full, the
+// dispatcher waits for the handler to drain it. Updates too large for a slot
+// of the ring are logged and dropped.
+class SharedMemoryUpdateDispatcher : public UpdateDispatcherInterface {
+ public:
+  SharedMemoryUpdateDispatcher() = delete;
+  SharedMemoryUpdateDispatcher(ClientId owner_id,
+                               std::shared_ptr<SharedUpdateSegment> segment);
+  // Movable but not copyable.
+  SharedMemoryUpdateDispatcher(SharedMemoryUpdateDispatcher&& dispatcher) =
+      default;
+  SharedMemoryUpdateDispatcher& operator=(
+      SharedMemoryUpdateDispatcher&& dispatcher) = default;
+  SharedMemoryUpdateDispatcher(const SharedMemoryUpdateDispatcher& dispatcher) =
+      delete;
+  SharedMemoryUpdateDispatcher& operator=(
+      const SharedMemoryUpdateDispatcher& dispatcher) = delete;
+  ~SharedMemoryUpdateDispatcher() override = default;
+
+  // Implements UpdateDispatcherInterface. Must be called from one thread at a
+  // time, as the dispatcher is the single producer of its rings.
+  void DispatchUpdate(const ClientUpdate& update) override;
+
+ private:
+  // Sends an ClientUpdate to the RandomWalkClient specified by [client_id].
+  void SendUpdate(ClientId client_id, const ClientUpdate& update);
+
+  // The Id of the RandomWalkClient owning the dispatcher.
+  ClientId owner_id_;
+  std::shared_ptr<SharedUpdateSegment> segment_;
+};
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_MEMORY_UPDATE_DISPATCHER_H_
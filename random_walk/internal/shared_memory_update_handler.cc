@@ -0,0 +1,68 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/shared_memory_update_handler.h"
+
+#include <memory>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/inbound_update_interface.h"
+#include "random_walk/internal/shared_update_segment.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+SharedMemoryUpdateHandler::SharedMemoryUpdateHandler(
+    ClientId owner_id, std::shared_ptr<SharedUpdateSegment> segment,
+    std::shared_ptr<InboundUpdateInterface> client)
+    : owner_id_(owner_id),
+      segment_(std::move(segment)),
+      client_(std::move(client)) {
+  DCHECK(segment_);
+  DCHECK(client_);
+  DCHECK_LT(owner_id_, segment_->num_clients());
+  poller_ = std::thread([this]() { Poll(); });
+}
+
+SharedMemoryUpdateHandler::~SharedMemoryUpdateHandler() {
+  stop_ = true;
+  poller_.join();
+}
+
+void SharedMemoryUpdateHandler::Poll() {
+  while (!stop_) {
+    bool idle = true;
+    for (ClientId source = 0; source < segment_->num_clients(); ++source) {
+      for (auto update = segment_->TryPop(source, owner_id_);
+           update.has_value(); update = segment_->TryPop(source, owner_id_)) {
+        client_->PushInboundUpdate(update.value());
+        idle = false;
+      }
+    }
+    if (idle) {
+      absl::SleepFor(absl::Microseconds(50));
+    }
+  }
+}
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_MEMORY_UPDATE_HANDLER_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_MEMORY_UPDATE_HANDLER_H_
+
+#include <atomic>
+#include <memory>
+#include <thread>  // NOLINT
+
+#include "random_walk/internal/inbound_update_interface.h"
+#include "random_walk/internal/shared_update_segment.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+// This is a RAII class that maintains a thread polling the rings of a
+// SharedUpdateSegment which lead to a RandomWalkClient, and pushes the
+// ClientUpdates it receives to the client in the order of each ring.
+class SharedMemoryUpdateHandler {
+ public:
+  SharedMemoryUpdateHandler() = delete;
+  SharedMemoryUpdateHandler(ClientId owner_id,
+                            std::shared_ptr<SharedUpdateSegment> segment,
+                            std::shared_ptr<InboundUpdateInterface> client);
+  // Not movable or copyable, as the polling thread refers to the handler.
+  SharedMemoryUpdateHandler(SharedMemoryUpdateHandler&& handler) = delete;
+  SharedMemoryUpdateHandler& operator=(SharedMemoryUpdateHandler&& handler) =
+      delete;
+  SharedMemoryUpdateHandler(const SharedMemoryUpdateHandler& handler) = delete;
+  SharedMemoryUpdateHandler& operator=(
+      const SharedMemoryUpdateHandler& handler) = delete;
+  ~SharedMemoryUpdateHandler();
+
+ private:
+  // Polls the rings until the handler is destroyed.
+  void Poll();
+
+  // The Id of the RandomWalkClient owning the handler.
+  const ClientId owner_id_;
+  const std::shared_ptr<SharedUpdateSegment> segment_;
+  const std::shared_ptr<InboundUpdateInterface> client_;
+  std::atomic<bool> stop_{false};
+  std::thread poller_;
+};
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_MEMORY_UPDATE_HANDLER_H_
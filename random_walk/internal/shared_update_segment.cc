@@ -0,0 +1,201 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/shared_update_segment.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+int memfd_create(const char* name, unsigned int flags) {
+  return syscall(SYS_memfd_create, name, flags);
+}
+
+// Maps `size` bytes of the memfd `fd` shared.
+uint8_t* MapShared(int fd, size_t size) {
+  void* address =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return address == MAP_FAILED ? nullptr : static_cast<uint8_t*>(address);
+}
+
+}  // namespace
+
+std::shared_ptr<SharedUpdateSegment> SharedUpdateSegment::Create(
+    size_t num_clients) {
+  CHECK_GT(num_clients, 0ul);  // Crash ok
+  size_t size = SegmentSize(num_clients);
+  int fd = memfd_create("random_walk_updates", 0);
+  CHECK_GE(fd, 0) << strerror(errno);                   // Crash ok
+  CHECK_EQ(ftruncate(fd, size), 0) << strerror(errno);  // Crash ok
+  uint8_t* base = MapShared(fd, size);
+  CHECK(base) << strerror(errno);  // Crash ok
+  // The memfd is zero filled; construct the headers in place nonetheless so
+  // that the atomics are properly initialized.
+  new (base) SegmentHeader{.magic = kMagic,
+                           .num_clients = num_clients,
+                           .ring_capacity = kRingCapacity,
+                           .slot_size = kSlotSize};
+  auto segment = std::shared_ptr<SharedUpdateSegment>(
+      new SharedUpdateSegment(fd, base, size, num_clients));
+  for (ClientId source = 0; source < num_clients; ++source) {
+    for (ClientId destination = 0; destination < num_clients; ++destination) {
+      new (segment->Ring(source, destination)) RingHeader();
+    }
+  }
+  return segment;
+}
+
+absl::StatusOr<std::shared_ptr<SharedUpdateSegment>>
+SharedUpdateSegment::Attach(int fd) {
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Cannot stat fd ", fd, ": ", strerror(errno)));
+  }
+  size_t size = stat_buf.st_size;
+  if (size < sizeof(SegmentHeader)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Fd ", fd, " is too small for an update segment."));
+  }
+  int dup_fd = dup(fd);
+  if (dup_fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("Cannot duplicate fd ", fd, ": ", strerror(errno)));
+  }
+  uint8_t* base = MapShared(dup_fd, size);
+  if (base == nullptr) {
+    close(dup_fd);
+    return absl::InternalError(
+        absl::StrCat("Cannot map fd ", fd, ": ", strerror(errno)));
+  }
+  // Construct the segment first, so that it unmaps on error.
+  const auto* header = reinterpret_cast<const SegmentHeader*>(base);
+  auto segment = std::shared_ptr<SharedUpdateSegment>(
+      new SharedUpdateSegment(dup_fd, base, size, header->num_clients));
+  if (header->magic != kMagic || header->ring_capacity != kRingCapacity ||
+      header->slot_size != kSlotSize ||
+      size != SegmentSize(header->num_clients)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Fd ", fd, " is not an update segment of this layout."));
+  }
+  return segment;
+}
+
+SharedUpdateSegment::~SharedUpdateSegment() {
+  int result = munmap(base_, size_);
+  CHECK_EQ(result, 0);  // Crash ok
+  result = close(fd_);
+  CHECK_EQ(result, 0);  // Crash ok
+}
+
+absl::Status SharedUpdateSegment::TryPush(ClientId source,
+                                          ClientId destination,
+                                          const ClientUpdate& update) {
+  uint32_t length = update.ByteSizeLong();
+  if (length > kSlotSize - sizeof(length)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ClientUpdate of ", length, " bytes is too large for a ",
+                     kSlotSize, " byte slot."));
+  }
+  RingHeader* ring = Ring(source, destination);
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) == kRingCapacity) {
+    return absl::ResourceExhaustedError("Ring is full.");
+  }
+  uint8_t* slot = Slot(ring, head);
+  memcpy(slot, &length, sizeof(length));
+  bool serialized = update.SerializeToArray(slot + sizeof(length), length);
+  CHECK(serialized);  // Crash ok
+  ring->head.store(head + 1, std::memory_order_release);
+  return absl::OkStatus();
+}
+
+absl::optional<ClientUpdate> SharedUpdateSegment::TryPop(
+    ClientId source, ClientId destination) {
+  RingHeader* ring = Ring(source, destination);
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail == ring->head.load(std::memory_order_acquire)) {
+    return absl::nullopt;
+  }
+  const uint8_t* slot = Slot(ring, tail);
+  uint32_t length;
+  memcpy(&length, slot, sizeof(length));
+  ClientUpdate update;
+  bool parsed = update.ParseFromArray(slot + sizeof(length), length);
+  CHECK(parsed) << "Corrupted ClientUpdate in shared memory.";  // Crash ok
+  ring->tail.store(tail + 1, std::memory_order_release);
+  return update;
+}
+
+void SharedUpdateSegment::MarkClientFinished() {
+  Header()->finished_clients.fetch_add(1, std::memory_order_acq_rel);
+}
+
+size_t SharedUpdateSegment::FinishedClients() const {
+  return Header()->finished_clients.load(std::memory_order_acquire);
+}
+
+size_t SharedUpdateSegment::SegmentSize(size_t num_clients) {
+  // Rings start on the first cache line after the segment header.
+  static_assert(sizeof(SegmentHeader) <= alignof(RingHeader));
+  return alignof(RingHeader) + num_clients * num_clients * kRingSize;
+}
+
+SharedUpdateSegment::SharedUpdateSegment(int fd, uint8_t* base, size_t size,
+                                         size_t num_clients)
+    : fd_(fd), base_(base), size_(size), num_clients_(num_clients) {}
+
+SharedUpdateSegment::SegmentHeader* SharedUpdateSegment::Header() const {
+  return reinterpret_cast<SegmentHeader*>(base_);
+}
+
+SharedUpdateSegment::RingHeader* SharedUpdateSegment::Ring(
+    ClientId source, ClientId destination) const {
+  DCHECK_LT(source, num_clients_);
+  DCHECK_LT(destination, num_clients_);
+  return reinterpret_cast<RingHeader*>(
+      base_ + alignof(RingHeader) +
+      (source * num_clients_ + destination) * kRingSize);
+}
+
+uint8_t* SharedUpdateSegment::Slot(RingHeader* ring, uint64_t index) const {
+  return reinterpret_cast<uint8_t*>(ring + 1) +
+         (index % kRingCapacity) * kSlotSize;
+}
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_UPDATE_SEGMENT_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_UPDATE_SEGMENT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/optional.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+// A shared memory segment carrying ClientUpdates between RandomWalkClients on
+// the same host, possibly in different processes. The segment is a memfd (as
+// in RdmaMemBlock) holding one single-producer single-consumer ring per
+// ordered pair of clients, so that each client sends to each other client on
+// a ring of its own and no locks are needed: the producer only advances the
+// head of a ring and the consumer only advances its tail. ClientUpdates are
+// serialized into fixed size slots of the ring.
+// Another process maps the segment with Attach(), given a file descriptor of
+// the memfd, e.g. inherited on fork or opened through /proc/<pid>/fd/<fd>.
+class SharedUpdateSegment {
+ public:
+  // The number of slots of each ring.
+  static constexpr uint64_t kRingCapacity = 256;
+  // The size of a slot, including the 4 byte length of the serialized
+  // ClientUpdate in it.
+  static constexpr size_t kSlotSize = 256;
+
+  // Creates a segment for `num_clients` clients.
+  static std::shared_ptr<SharedUpdateSegment> Create(size_t num_clients);
+  // Maps an existing segment from a file descriptor of its memfd. The
+  // descriptor is duplicated, the caller keeps ownership of `fd`.
+  static absl::StatusOr<std::shared_ptr<SharedUpdateSegment>> Attach(int fd);
+
+  // Not movable or copyable; shared via std::shared_ptr.
+  SharedUpdateSegment(SharedUpdateSegment&& segment) = delete;
+  SharedUpdateSegment& operator=(SharedUpdateSegment&& segment) = delete;
+  SharedUpdateSegment(const SharedUpdateSegment& segment) = delete;
+  SharedUpdateSegment& operator=(const SharedUpdateSegment& segment) = delete;
+  ~SharedUpdateSegment();
+
+  // Returns the file descriptor of the memfd backing the segment.
+  int fd() const { return fd_; }
+  size_t num_clients() const { return num_clients_; }
+
+  // Appends a ClientUpdate to the ring from `source` to `destination`. Returns
+  // ResourceExhausted if the ring is full, and InvalidArgument if the
+  // serialized update does not fit in a slot. Only one thread may push to a
+  // ring.
+  absl::Status TryPush(ClientId source, ClientId destination,
+                       const ClientUpdate& update);
+  // Removes the oldest ClientUpdate from the ring from `source` to
+  // `destination`. Returns nullopt if the ring is empty. Only one thread may
+  // pop from a ring.
+  absl::optional<ClientUpdate> TryPop(ClientId source, ClientId destination);
+
+  // Records that a client, in any process, is done sending updates. Clients
+  // keep receiving updates until all clients are done, so that a client which
+  // finishes early does not leave the others blocked on a full ring.
+  void MarkClientFinished();
+  // Returns the number of clients which called MarkClientFinished().
+  size_t FinishedClients() const;
+
+ private:
+  // Placed at the start of the segment to validate Attach().
+  struct SegmentHeader {
+    uint64_t magic;
+    uint64_t num_clients;
+    uint64_t ring_capacity;
+    uint64_t slot_size;
+    std::atomic<uint64_t> finished_clients{0};
+  };
+
+  // Placed at the start of each ring, followed by its slots. Head and tail
+  // count slots from the creation of the ring and are on their own cache
+  // lines, so that the producer and the consumer do not false share.
+  struct RingHeader {
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+  };
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Ring indices must be lock free to be shared by processes.");
+
+  static constexpr uint64_t kMagic = 0x5257555044415445;  // "RWUPDATE"
+  static constexpr size_t kRingSize =
+      sizeof(RingHeader) + kRingCapacity * kSlotSize;
+
+  // Returns the size of a segment for `num_clients` clients.
+  static size_t SegmentSize(size_t num_clients);
+
+  SharedUpdateSegment(int fd, uint8_t* base, size_t size, size_t num_clients);
+
+  SegmentHeader* Header() const;
+  // Returns the header of the ring from `source` to `destination`.
+  RingHeader* Ring(ClientId source, ClientId destination) const;
+  // Returns slot `index` of a ring.
+  uint8_t* Slot(RingHeader* ring, uint64_t index) const;
+
+  const int fd_;
+  uint8_t* const base_;
+  const size_t size_;
+  const size_t num_clients_;
+};
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SHARED_UPDATE_SEGMENT_H_
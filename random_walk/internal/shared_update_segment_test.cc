@@ -0,0 +1,189 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/shared_update_segment.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "public/status_matchers.h"
+#include "random_walk/internal/client_update_service.pb.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+constexpr uint64_t kCapacity = SharedUpdateSegment::kRingCapacity;
+
+// Returns an update tagged with `tag`.
+ClientUpdate MakeUpdate(uint32_t tag) {
+  ClientUpdate update;
+  update.mutable_add_ud_qp()->set_qp_num(tag);
+  return update;
+}
+
+TEST(SharedUpdateSegmentTest, PopsInOrderAcrossWraparound) {
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(1);
+  EXPECT_EQ(segment->TryPop(0, 0), absl::nullopt);
+  // Keep the ring half full so that head and tail wrap around several times.
+  uint32_t pushed = 0;
+  uint32_t popped = 0;
+  while (popped < 3 * kCapacity) {
+    while (pushed - popped < kCapacity / 2) {
+      ASSERT_OK(segment->TryPush(0, 0, MakeUpdate(pushed++)));
+    }
+    absl::optional<ClientUpdate> update = segment->TryPop(0, 0);
+    ASSERT_TRUE(update.has_value());
+    EXPECT_EQ(update->add_ud_qp().qp_num(), popped++);
+  }
+}
+
+TEST(SharedUpdateSegmentTest, FullRingRejectsPush) {
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(1);
+  for (uint32_t i = 0; i < kCapacity; ++i) {
+    ASSERT_OK(segment->TryPush(0, 0, MakeUpdate(i)));
+  }
+  EXPECT_THAT(segment->TryPush(0, 0, MakeUpdate(kCapacity)),
+              StatusIs(absl::StatusCode::kResourceExhausted));
+  ASSERT_TRUE(segment->TryPop(0, 0).has_value());
+  EXPECT_OK(segment->TryPush(0, 0, MakeUpdate(kCapacity)));
+}
+
+TEST(SharedUpdateSegmentTest, OversizedUpdateRejected) {
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(1);
+  // No field of a ClientUpdate is long enough to overflow a slot, pad it with
+  // an unknown field instead.
+  ClientUpdate update = MakeUpdate(1);
+  update.GetReflection()->MutableUnknownFields(&update)->AddLengthDelimited(
+      1000, std::string(SharedUpdateSegment::kSlotSize, 'x'));
+  EXPECT_THAT(segment->TryPush(0, 0, update),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  // The ring is left untouched.
+  EXPECT_EQ(segment->TryPop(0, 0), absl::nullopt);
+  ASSERT_OK(segment->TryPush(0, 0, MakeUpdate(2)));
+  absl::optional<ClientUpdate> popped = segment->TryPop(0, 0);
+  ASSERT_TRUE(popped.has_value());
+  EXPECT_EQ(popped->add_ud_qp().qp_num(), 2);
+}
+
+TEST(SharedUpdateSegmentTest, RingsAreIndependent) {
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(2);
+  ASSERT_OK(segment->TryPush(0, 1, MakeUpdate(1)));
+  ASSERT_OK(segment->TryPush(1, 0, MakeUpdate(2)));
+  EXPECT_EQ(segment->TryPop(0, 0), absl::nullopt);
+  EXPECT_EQ(segment->TryPop(1, 1), absl::nullopt);
+  absl::optional<ClientUpdate> update = segment->TryPop(1, 0);
+  ASSERT_TRUE(update.has_value());
+  EXPECT_EQ(update->add_ud_qp().qp_num(), 2);
+  update = segment->TryPop(0, 1);
+  ASSERT_TRUE(update.has_value());
+  EXPECT_EQ(update->add_ud_qp().qp_num(), 1);
+}
+
+TEST(SharedUpdateSegmentTest, ConcurrentProducerAndConsumer) {
+  constexpr uint32_t kUpdates = 100 * kCapacity;
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(2);
+  std::thread producer([&segment]() {
+    for (uint32_t i = 0; i < kUpdates;) {
+      if (segment->TryPush(0, 1, MakeUpdate(i)).ok()) ++i;
+    }
+  });
+  for (uint32_t i = 0; i < kUpdates;) {
+    absl::optional<ClientUpdate> update = segment->TryPop(0, 1);
+    if (!update.has_value()) continue;
+    EXPECT_EQ(update->add_ud_qp().qp_num(), i);
+    ++i;
+  }
+  producer.join();
+  EXPECT_EQ(segment->TryPop(0, 1), absl::nullopt);
+}
+
+TEST(SharedUpdateSegmentTest, AttachFromChildProcess) {
+  constexpr uint32_t kUpdates = 10 * kCapacity;
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(2);
+  const std::string path =
+      absl::StrCat("/proc/", getpid(), "/fd/", segment->fd());
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // Only async-signal-safe exits from the child, without gtest assertions.
+    // Attach through the path of the parent's descriptor rather than the
+    // inherited one, as an unrelated process would.
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) _exit(1);
+    absl::StatusOr<std::shared_ptr<SharedUpdateSegment>> attached =
+        SharedUpdateSegment::Attach(fd);
+    close(fd);
+    if (!attached.ok() || (*attached)->num_clients() != 2) _exit(2);
+    for (uint32_t i = 0; i < kUpdates;) {
+      absl::Status status = (*attached)->TryPush(1, 0, MakeUpdate(i));
+      if (status.ok()) {
+        ++i;
+      } else if (!absl::IsResourceExhausted(status)) {
+        _exit(3);
+      }
+    }
+    (*attached)->MarkClientFinished();
+    _exit(0);
+  }
+  for (uint32_t i = 0; i < kUpdates;) {
+    absl::optional<ClientUpdate> update = segment->TryPop(1, 0);
+    if (!update.has_value()) continue;
+    EXPECT_EQ(update->add_ud_qp().qp_num(), i);
+    ++i;
+  }
+  int wstatus = 0;
+  ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+  ASSERT_TRUE(WIFEXITED(wstatus));
+  EXPECT_EQ(WEXITSTATUS(wstatus), 0);
+  EXPECT_EQ(segment->TryPop(1, 0), absl::nullopt);
+  EXPECT_EQ(segment->FinishedClients(), 1);
+}
+
+TEST(SharedUpdateSegmentTest, AttachSharesFinishedClients) {
+  std::shared_ptr<SharedUpdateSegment> segment = SharedUpdateSegment::Create(2);
+  ASSERT_OK_AND_ASSIGN(std::shared_ptr<SharedUpdateSegment> attached,
+                       SharedUpdateSegment::Attach(segment->fd()));
+  EXPECT_EQ(attached->num_clients(), 2);
+  segment->MarkClientFinished();
+  attached->MarkClientFinished();
+  EXPECT_EQ(segment->FinishedClients(), 2);
+  EXPECT_EQ(attached->FinishedClients(), 2);
+}
+
+TEST(SharedUpdateSegmentTest, AttachRejectsOtherFiles) {
+  int fd = open("/dev/zero", O_RDWR);
+  ASSERT_GE(fd, 0);
+  EXPECT_THAT(SharedUpdateSegment::Attach(fd).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  close(fd);
+}
+
+}  // namespace
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -16,11 +16,22 @@
 
 #include "random_walk/internal/single_node_orchestrator.h"
 
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
 #include <cstddef>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <thread>  // NOLINT
 #include <vector>
 
+#include "absl/flags/flag.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/statusor.h"
 #include "absl/time/time.h"
 #include "infiniband/verbs.h"
 #include "public/verbs_helper_suite.h"
@@ -28,14 +39,86 @@
 #include "random_walk/internal/loopback_update_dispatcher.h"
 #include "random_walk/internal/random_walk_client.h"
 #include "random_walk/internal/random_walk_config.pb.h"
+#include "random_walk/internal/shared_memory_update_dispatcher.h"
+#include "random_walk/internal/shared_memory_update_handler.h"
+#include "random_walk/internal/shared_update_segment.h"
 #include "random_walk/internal/types.h"
 
+ABSL_FLAG(bool, random_walk_shared_memory_updates, false,
+          "If true, clients exchange out-of-band updates through lock-free "
+          "rings in a shared memory segment instead of direct calls.");
+ABSL_FLAG(bool, random_walk_client_processes, false,
+          "If true, each client runs in a process of its own, forked by the "
+          "orchestrator, and the clients exchange updates through a shared "
+          "memory segment as with --random_walk_shared_memory_updates.");
+
 namespace rdma_unit_test {
 namespace random_walk {
+namespace {
+
+// Runs client `id` of `num_clients` in a process forked by the orchestrator,
+// and returns the exit status of the process.
+int RunClientProcess(int segment_fd, size_t num_clients, ClientId id,
+                     const ActionWeights& weights,
+                     const std::function<void(RandomWalkClient&)>& run) {
+  // Map the segment through the inherited memfd, as a process which was not
+  // forked from the orchestrator would through /proc/<pid>/fd/<fd>.
+  absl::StatusOr<std::shared_ptr<SharedUpdateSegment>> segment =
+      SharedUpdateSegment::Attach(segment_fd);
+  if (!segment.ok()) {
+    LOG(ERROR) << "Client " << id << " cannot attach the update segment: "
+               << segment.status();
+    return 1;
+  }
+  auto client = std::make_shared<RandomWalkClient>(id, weights);
+  client->RegisterUpdateDispatcher(
+      std::make_shared<SharedMemoryUpdateDispatcher>(id, *segment));
+  auto handler =
+      std::make_unique<SharedMemoryUpdateHandler>(id, *segment, client);
+  // All the clients use the same port of this host.
+  for (ClientId remote_id = 0; remote_id < num_clients; ++remote_id) {
+    client->AddRemoteClient(remote_id, client->GetGid());
+  }
+  run(*client);
+  client->PrintStats();
+  // Keep receiving updates until no client sends any more.
+  (*segment)->MarkClientFinished();
+  while ((*segment)->FinishedClients() < num_clients) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  return 0;
+}
+
+}  // namespace
 
 SingleNodeOrchestrator::SingleNodeOrchestrator(size_t num_clients,
-                                               const ActionWeights& weights) {
+                                               const ActionWeights& weights)
+    : weights_(weights) {
+  if (absl::GetFlag(FLAGS_random_walk_client_processes)) {
+    // The clients are created in their own processes by RunClients().
+    segment_ = SharedUpdateSegment::Create(num_clients);
+    return;
+  }
   clients_.resize(num_clients);
+  if (absl::GetFlag(FLAGS_random_walk_shared_memory_updates)) {
+    std::shared_ptr<SharedUpdateSegment> segment =
+        SharedUpdateSegment::Create(num_clients);
+    for (ClientId id = 0; id < num_clients; ++id) {
+      clients_[id] = std::make_shared<RandomWalkClient>(id, weights);
+      clients_[id]->RegisterUpdateDispatcher(
+          std::make_shared<SharedMemoryUpdateDispatcher>(id, segment));
+      handlers_.push_back(std::make_unique<SharedMemoryUpdateHandler>(
+          id, segment, clients_[id]));
+    }
+    for (ClientId local_id = 0; local_id < num_clients; ++local_id) {
+      for (ClientId remote_id = 0; remote_id < num_clients; ++remote_id) {
+        clients_[local_id]->AddRemoteClient(remote_id,
+                                            clients_[remote_id]->GetGid());
+      }
+    }
+    return;
+  }
+
   std::vector<std::shared_ptr<LoopbackUpdateDispatcher>> dispatchers(
       num_clients, nullptr);
   for (ClientId id = 0; id < num_clients; ++id) {
@@ -54,6 +137,11 @@ SingleNodeOrchestrator::SingleNodeOrchestrator(size_t num_clients,
 }
 
 void SingleNodeOrchestrator::RunClients(absl::Duration duration) {
+  if (segment_ != nullptr) {
+    RunClientProcesses(
+        [duration](RandomWalkClient& client) { client.Run(duration); });
+    return;
+  }
   std::vector<std::thread> client_threads;
   client_threads.reserve(clients_.size());
   for (const auto& client : clients_) {
@@ -68,6 +156,10 @@ void SingleNodeOrchestrator::RunClients(absl::Duration duration) {
 }
 
 void SingleNodeOrchestrator::RunClients(size_t steps) {
+  if (segment_ != nullptr) {
+    RunClientProcesses([steps](RandomWalkClient& client) { client.Run(steps); });
+    return;
+  }
   std::vector<std::thread> client_threads;
   client_threads.reserve(clients_.size());
   for (const auto& client : clients_) {
@@ -81,5 +173,26 @@ void SingleNodeOrchestrator::RunClients(size_t steps) {
   }
 }
 
+void SingleNodeOrchestrator::RunClientProcesses(
+    const std::function<void(RandomWalkClient&)>& run) {
+  std::vector<pid_t> children;
+  for (ClientId id = 0; id < segment_->num_clients(); ++id) {
+    pid_t pid = fork();
+    CHECK_GE(pid, 0) << "Failed to fork client " << id << ": "  // Crash ok
+                     << strerror(errno);
+    if (pid == 0) {
+      _exit(RunClientProcess(segment_->fd(), segment_->num_clients(), id,
+                             weights_, run));
+    }
+    children.push_back(pid);
+  }
+  for (ClientId id = 0; id < children.size(); ++id) {
+    int status = 0;
+    CHECK_EQ(waitpid(children[id], &status, 0), children[id]);  // Crash ok
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)         // Crash ok
+        << "Client " << id << " process failed with status " << status << ".";
+  }
+}
+
 }  // namespace random_walk
 }  // namespace rdma_unit_test
@@ -18,13 +18,20 @@
 #define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_SINGLE_NODE_ORCHESTRATOR_H_
 
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <vector>
 
+#include "absl/flags/declare.h"
 #include "absl/time/time.h"
 #include "infiniband/verbs.h"
 #include "random_walk/internal/random_walk_client.h"
 #include "random_walk/internal/random_walk_config.pb.h"
+#include "random_walk/internal/shared_memory_update_handler.h"
+#include "random_walk/internal/shared_update_segment.h"
+
+ABSL_DECLARE_FLAG(bool, random_walk_shared_memory_updates);
+ABSL_DECLARE_FLAG(bool, random_walk_client_processes);
 
 namespace rdma_unit_test {
 namespace random_walk {
@@ -50,7 +57,17 @@ class SingleNodeOrchestrator {
   void RunClients(size_t steps);
 
  private:
+  // Runs `run` on every client, each in a process of its own, and crashes if
+  // any of them fails. See --random_walk_client_processes.
+  void RunClientProcesses(const std::function<void(RandomWalkClient&)>& run);
+
+  ActionWeights weights_;
+  // Only used with --random_walk_client_processes, where clients_ is empty.
+  std::shared_ptr<SharedUpdateSegment> segment_;
   std::vector<std::shared_ptr<RandomWalkClient>> clients_;
+  // Only used with --random_walk_shared_memory_updates. Declared after
+  // clients_ so the polling threads stop before the clients are destroyed.
+  std::vector<std::unique_ptr<SharedMemoryUpdateHandler>> handlers_;
 };
 
 }  // namespace random_walk
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/update_batch.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "random_walk/internal/client_update_service.pb.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+void UpdateBatch::Add(const ClientUpdate& update) {
+  switch (update.contents_case()) {
+    case ClientUpdate::kAddRkey: {
+      rkey_adds_[{update.add_rkey().owner_id(), update.add_rkey().rkey()}] =
+          updates_.size();
+      break;
+    }
+    case ClientUpdate::kRemoveRkey: {
+      if (CancelAdd(rkey_adds_, {update.remove_rkey().owner_id(),
+                                 update.remove_rkey().rkey()})) {
+        return;
+      }
+      break;
+    }
+    case ClientUpdate::kAddUdQp: {
+      ud_qp_adds_[{update.add_ud_qp().owner_id(),
+                   update.add_ud_qp().qp_num()}] = updates_.size();
+      break;
+    }
+    case ClientUpdate::kRemoveUdQp: {
+      if (CancelAdd(ud_qp_adds_, {update.remove_ud_qp().owner_id(),
+                                  update.remove_ud_qp().qp_num()})) {
+        return;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  updates_.push_back(update);
+}
+
+std::vector<ClientUpdate> UpdateBatch::Take() {
+  std::vector<ClientUpdate> updates;
+  updates.reserve(size());
+  for (ClientUpdate& update : updates_) {
+    if (update.contents_case() != ClientUpdate::CONTENTS_NOT_SET) {
+      updates.push_back(std::move(update));
+    }
+  }
+  updates_.clear();
+  cancelled_ = 0;
+  rkey_adds_.clear();
+  ud_qp_adds_.clear();
+  return updates;
+}
+
+bool UpdateBatch::CancelAdd(absl::flat_hash_map<ResourceKey, size_t>& adds,
+                            const ResourceKey& key) {
+  auto iter = adds.find(key);
+  if (iter == adds.end()) {
+    return false;
+  }
+  updates_[iter->second].clear_contents();
+  adds.erase(iter);
+  ++cancelled_;
+  // Both the add and the remove are dropped.
+  total_cancelled_ += 2;
+  return true;
+}
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_UPDATE_BATCH_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_UPDATE_BATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "random_walk/internal/client_update_service.pb.h"
+#include "random_walk/internal/types.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+
+// A batch of ClientUpdates bound for one remote RandomWalkClient. Updates keep
+// the order they are added in, except that an update adding an rkey (or a UD
+// QP) and a later update in the same batch removing it cancel each other out,
+// so that the remote sees neither of them.
+class UpdateBatch {
+ public:
+  UpdateBatch() = default;
+  // Movable and copyable.
+  UpdateBatch(UpdateBatch&& batch) = default;
+  UpdateBatch& operator=(UpdateBatch&& batch) = default;
+  UpdateBatch(const UpdateBatch& batch) = default;
+  UpdateBatch& operator=(const UpdateBatch& batch) = default;
+  ~UpdateBatch() = default;
+
+  // Adds an update to the end of the batch.
+  void Add(const ClientUpdate& update);
+
+  // Returns the number of updates in the batch, not counting those cancelled.
+  size_t size() const { return updates_.size() - cancelled_; }
+  bool empty() const { return size() == 0; }
+  // Returns the number of updates cancelled out since construction.
+  size_t total_cancelled() const { return total_cancelled_; }
+
+  // Returns the updates of the batch in order and empties the batch.
+  std::vector<ClientUpdate> Take();
+
+ private:
+  // Identifies an rkey or a UD QP by its owner and its rkey or qp_num.
+  using ResourceKey = std::pair<ClientId, uint32_t>;
+
+  // Cancels the update adding `key` if it is in the batch, returning false if
+  // it is not.
+  bool CancelAdd(absl::flat_hash_map<ResourceKey, size_t>& adds,
+                 const ResourceKey& key);
+
+  // Cancelled updates stay in place with their contents cleared.
+  std::vector<ClientUpdate> updates_;
+  size_t cancelled_ = 0;
+  size_t total_cancelled_ = 0;
+  // Index in updates_ of the updates adding an rkey or a UD QP.
+  absl::flat_hash_map<ResourceKey, size_t> rkey_adds_;
+  absl::flat_hash_map<ResourceKey, size_t> ud_qp_adds_;
+};
+
+}  // namespace random_walk
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_UPDATE_BATCH_H_
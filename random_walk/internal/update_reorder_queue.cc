@@ -16,32 +16,74 @@
 
 #include "random_walk/internal/update_reorder_queue.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
 
-#include "absl/container/flat_hash_map.h"
-#include "absl/meta/type_traits.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "absl/types/optional.h"
-#include "public/map_util.h"
 #include "random_walk/internal/client_update_service.pb.h"
 
 namespace rdma_unit_test {
 namespace random_walk {
 
-void UpdateReorderQueue::Push(uint32_t sequence_number,
-                              const ClientUpdate& update) {
-  map_util::InsertOrDie(reorder_queue_, sequence_number, update);
+UpdateReorderQueue::UpdateReorderQueue(size_t window,
+                                       uint32_t first_sequence_number)
+    : next_expected_sequence_number_(first_sequence_number), slots_(window) {
+  CHECK(window > 0 && (window & (window - 1)) == 0)  // Crash ok
+      << "Window " << window << " is not a power of 2.";
+  CHECK_LE(window, std::numeric_limits<uint32_t>::max() / 2);  // Crash ok
+}
+
+absl::Status UpdateReorderQueue::Push(uint32_t sequence_number,
+                                      ClientUpdate&& update) {
+  // Unsigned arithmetic, so that the distance is right when the sequence
+  // number wraps around. Sequence numbers already pulled are a long way ahead.
+  uint32_t distance = sequence_number - next_expected_sequence_number_;
+  if (distance > std::numeric_limits<uint32_t>::max() / 2) {
+    return absl::AlreadyExistsError(
+        absl::StrCat("Update ", sequence_number, " has already been pulled."));
+  }
+  if (distance >= slots_.size()) {
+    return absl::ResourceExhaustedError(absl::StrCat(
+        "Update ", sequence_number, " is beyond the reorder window [",
+        next_expected_sequence_number_, ", ",
+        next_expected_sequence_number_ + slots_.size(), ")."));
+  }
+  absl::optional<ClientUpdate>& slot =
+      slots_[sequence_number & (slots_.size() - 1)];
+  if (slot.has_value()) {
+    return absl::AlreadyExistsError(
+        absl::StrCat("Update ", sequence_number, " has already been pushed."));
+  }
+  slot = std::move(update);
+  return absl::OkStatus();
 }
 
 absl::optional<ClientUpdate> UpdateReorderQueue::Pull() {
-  auto iter = reorder_queue_.find(next_expected_sequence_number_);
-  if (iter == reorder_queue_.end()) {
+  absl::optional<ClientUpdate>& slot =
+      slots_[next_expected_sequence_number_ & (slots_.size() - 1)];
+  if (!slot.has_value()) {
     return absl::nullopt;
   }
   ++next_expected_sequence_number_;
-  ClientUpdate update = iter->second;
-  reorder_queue_.erase(iter);
+  absl::optional<ClientUpdate> update = std::move(slot);
+  slot.reset();
   return update;
 }
 
+std::vector<ClientUpdate> UpdateReorderQueue::PullAll() {
+  std::vector<ClientUpdate> updates;
+  for (absl::optional<ClientUpdate> update = Pull(); update.has_value();
+       update = Pull()) {
+    updates.push_back(std::move(update).value());
+  }
+  return updates;
+}
+
 }  // namespace random_walk
 }  // namespace rdma_unit_test
@@ -17,11 +17,14 @@
 #ifndef THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_UPDATE_REORDER_QUEUE_H_
 #define THIRD_PARTY_RDMA_UNIT_TEST_RANDOM_WALK_INTERNAL_UPDATE_REORDER_QUEUE_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
-#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
 #include "absl/types/optional.h"
 #include "random_walk/internal/client_update_service.pb.h"
+
 namespace rdma_unit_test {
 namespace random_walk {
 
@@ -30,31 +33,57 @@ namespace random_walk {
 // Push(): Push a new ClientUpdate to the queue.
 // Pull(): Pull the next ClientUpdate in order. If the expected ClientUpdate
 // has not yet been Push()-ed, return absl::nullopt.
+// PullAll(): Pull every ClientUpdate which is in order.
 // The ordering is done according to the sequence_number() of ClientUpdate.
 // It is up to the UpdateDispatcher to guarantee the sequence of ClientUpdate
 // sent via a particular channel (dispatcher-handler pair) goes contiguously
 // starting from 0.
+// Out of order ClientUpdates are buffered in a fixed window of slots, indexed
+// by sequence_number % window, so that memory is bounded and ClientUpdates are
+// moved rather than copied in and out of the queue.
 class UpdateReorderQueue {
  public:
-  UpdateReorderQueue() = default;
+  // The default number of ClientUpdates the queue can buffer, counting from
+  // the next expected one.
+  static constexpr size_t kDefaultWindow = 1024;
+
+  // `window` must be a power of 2, so that slots stay consistent when the
+  // sequence number wraps around. The first expected ClientUpdate has
+  // `first_sequence_number`.
+  explicit UpdateReorderQueue(size_t window = kDefaultWindow,
+                              uint32_t first_sequence_number = 0);
   // Movable but not copyable.
   UpdateReorderQueue(UpdateReorderQueue&& queue) = default;
   UpdateReorderQueue& operator=(UpdateReorderQueue&& queue) = default;
   UpdateReorderQueue(const UpdateReorderQueue& queue) = delete;
-  UpdateReorderQueue& operator=(const UpdateReorderQueue& queue) = default;
+  UpdateReorderQueue& operator=(const UpdateReorderQueue& queue) = delete;
   ~UpdateReorderQueue() = default;
 
-  // Pushes a new ClientUpdate to the queue.
-  void Push(uint32_t sequence_number, const ClientUpdate& update);
+  // Pushes a new ClientUpdate to the queue. Returns:
+  // -- ResourceExhaustedError: when the ClientUpdate is too far ahead of the
+  //                            next expected one to fit in the window. The
+  //                            sender should retry once the queue is pulled;
+  //                            GrpcUpdateDispatcher resends the whole batch.
+  // -- AlreadyExistsError: when a ClientUpdate with the same sequence number
+  //                        has already been pushed or pulled, eg. by an
+  //                        earlier attempt of a retried batch. RpcServer
+  //                        treats these as accepted.
+  // `update` is only moved from if it is accepted, so that a rejected update
+  // can be pushed again.
+  absl::Status Push(uint32_t sequence_number, ClientUpdate&& update);
 
   // Pulles the next expected ClientUpdate from the queue. If the ClientUpdate
   // has not yet been Push()-ed yet, return absl::nullopt.
-  // The first expected ClientUpdate has sequence_number() = 0.
   absl::optional<ClientUpdate> Pull();
 
+  // Pulls all ClientUpdates which are in order, i.e. up to the first one not
+  // yet Push()-ed.
+  std::vector<ClientUpdate> PullAll();
+
  private:
-  uint32_t next_expected_sequence_number_ = 0;
-  absl::flat_hash_map<uint32_t, ClientUpdate> reorder_queue_;
+  uint32_t next_expected_sequence_number_;
+  // The ClientUpdate with sequence number n is in slot n % slots_.size().
+  std::vector<absl::optional<ClientUpdate>> slots_;
 };
 
 }  // namespace random_walk
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "random_walk/internal/update_reorder_queue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "random_walk/internal/client_update_service.pb.h"
+
+namespace rdma_unit_test {
+namespace random_walk {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr size_t kWindow = 4;
+
+// Returns an update tagged with its sequence number.
+ClientUpdate MakeUpdate(uint32_t sequence_number) {
+  ClientUpdate update;
+  update.set_destination_id(sequence_number);
+  return update;
+}
+
+// Returns the tags of `updates`.
+std::vector<uint32_t> Tags(const std::vector<ClientUpdate>& updates) {
+  std::vector<uint32_t> tags;
+  for (const ClientUpdate& update : updates) {
+    tags.push_back(update.destination_id());
+  }
+  return tags;
+}
+
+TEST(UpdateReorderQueueTest, PullsInOrder) {
+  UpdateReorderQueue queue(kWindow);
+  EXPECT_EQ(queue.Pull(), absl::nullopt);
+  ASSERT_TRUE(queue.Push(2, MakeUpdate(2)).ok());
+  ASSERT_TRUE(queue.Push(1, MakeUpdate(1)).ok());
+  EXPECT_TRUE(queue.PullAll().empty());
+  ASSERT_TRUE(queue.Push(0, MakeUpdate(0)).ok());
+  EXPECT_THAT(Tags(queue.PullAll()), ElementsAre(0, 1, 2));
+  EXPECT_EQ(queue.Pull(), absl::nullopt);
+}
+
+TEST(UpdateReorderQueueTest, SlotsWrapAround) {
+  UpdateReorderQueue queue(kWindow);
+  // Reverse every group of kWindow updates, so that each group fills every
+  // slot out of order.
+  std::vector<uint32_t> pulled;
+  for (uint32_t group = 0; group < 3 * kWindow; ++group) {
+    for (uint32_t i = kWindow; i > 0; --i) {
+      uint32_t sequence = group * kWindow + i - 1;
+      ASSERT_TRUE(queue.Push(sequence, MakeUpdate(sequence)).ok());
+    }
+    for (uint32_t tag : Tags(queue.PullAll())) {
+      pulled.push_back(tag);
+    }
+  }
+  ASSERT_EQ(pulled.size(), 3 * kWindow * kWindow);
+  for (uint32_t i = 0; i < pulled.size(); ++i) {
+    EXPECT_EQ(pulled[i], i);
+  }
+}
+
+TEST(UpdateReorderQueueTest, SequenceNumberWrapsAround) {
+  constexpr uint32_t kFirst = std::numeric_limits<uint32_t>::max() - 1;
+  UpdateReorderQueue queue(kWindow, kFirst);
+  ASSERT_TRUE(queue.Push(1, MakeUpdate(1)).ok());
+  ASSERT_TRUE(queue.Push(0, MakeUpdate(0)).ok());
+  ASSERT_TRUE(queue.Push(kFirst + 1, MakeUpdate(kFirst + 1)).ok());
+  EXPECT_TRUE(queue.PullAll().empty());
+  ASSERT_TRUE(queue.Push(kFirst, MakeUpdate(kFirst)).ok());
+  EXPECT_THAT(Tags(queue.PullAll()), ElementsAre(kFirst, kFirst + 1, 0, 1));
+  EXPECT_TRUE(absl::IsAlreadyExists(queue.Push(kFirst, MakeUpdate(kFirst))));
+}
+
+TEST(UpdateReorderQueueTest, OverflowIsRetriable) {
+  UpdateReorderQueue queue(kWindow);
+  for (uint32_t i = 1; i < kWindow; ++i) {
+    ASSERT_TRUE(queue.Push(i, MakeUpdate(i)).ok());
+  }
+  EXPECT_TRUE(
+      absl::IsResourceExhausted(queue.Push(kWindow, MakeUpdate(kWindow))));
+  ASSERT_TRUE(queue.Push(0, MakeUpdate(0)).ok());
+  EXPECT_EQ(queue.PullAll().size(), kWindow);
+  // The window has moved on, so the retry succeeds.
+  ASSERT_TRUE(queue.Push(kWindow, MakeUpdate(kWindow)).ok());
+  EXPECT_THAT(Tags(queue.PullAll()), ElementsAre(kWindow));
+}
+
+TEST(UpdateReorderQueueTest, RejectsDuplicates) {
+  UpdateReorderQueue queue(kWindow);
+  ASSERT_TRUE(queue.Push(1, MakeUpdate(1)).ok());
+  EXPECT_TRUE(absl::IsAlreadyExists(queue.Push(1, MakeUpdate(1))));
+  ASSERT_TRUE(queue.Push(0, MakeUpdate(0)).ok());
+  EXPECT_EQ(queue.PullAll().size(), 2);
+  EXPECT_TRUE(absl::IsAlreadyExists(queue.Push(0, MakeUpdate(0))));
+}
+
+}  // namespace
+}  // namespace random_walk
+}  // namespace rdma_unit_test
@@ -15,10 +15,13 @@
  */
 
 #include "gtest/gtest.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "absl/time/time.h"
 #include "public/basic_fixture.h"
 #include "random_walk/action_weights.h"
 #include "random_walk/internal/multi_node_orchestrator.h"
+#include "random_walk/internal/random_walk_client.h"
 #include "random_walk/internal/random_walk_config.pb.h"
 #include "random_walk/internal/single_node_orchestrator.h"
 
@@ -50,6 +53,41 @@ TEST_F(RandomWalkTest, SingleNodeTwoClientsRdma) {
   orchestrator.RunClients(kRandomWalkDuration);
 }
 
+TEST_F(RandomWalkTest, SingleNodeTwoClientsRdmaDataPathThreads) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_random_walk_data_path_threads, 2);
+  absl::SetFlag(&FLAGS_random_walk_data_ops_per_step, 4);
+  ActionWeights weights = SimpleRdmaActions();
+  SingleNodeOrchestrator orchestrator(2, weights);
+  orchestrator.RunClients(kRandomWalkDuration);
+}
+
+TEST_F(RandomWalkTest, SingleNodeSingleClientControlPathDataPathThreads) {
+  // Without data path weights, the data path flags are ignored.
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_random_walk_data_path_threads, 2);
+  absl::SetFlag(&FLAGS_random_walk_data_ops_per_step, 4);
+  ActionWeights weights = UniformControlPathActions();
+  SingleNodeOrchestrator orchestrator(1, weights);
+  orchestrator.RunClients(kRandomWalkDuration);
+}
+
+TEST_F(RandomWalkTest, SingleNodeTwoClientsRdmaSharedMemoryUpdates) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_random_walk_shared_memory_updates, true);
+  ActionWeights weights = SimpleRdmaActions();
+  SingleNodeOrchestrator orchestrator(2, weights);
+  orchestrator.RunClients(kRandomWalkDuration);
+}
+
+TEST_F(RandomWalkTest, SingleNodeTwoClientProcessesRdma) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_random_walk_client_processes, true);
+  ActionWeights weights = SimpleRdmaActions();
+  SingleNodeOrchestrator orchestrator(2, weights);
+  orchestrator.RunClients(kRandomWalkDuration);
+}
+
 TEST_F(RandomWalkTest, MultiNodeTwoClientsRdma) {
   ActionWeights weights = SimpleRdmaActions();
   MultiNodeOrchestrator orchestrator(2, weights);
@@ -20,6 +20,7 @@
 #include "gtest/gtest.h"
 #include "absl/log/log.h"
 #include "absl/strings/str_format.h"
+#include "public/introspection.h"
 #include "public/status_matchers.h"
 #include "traffic/op_profiles.h"
 #include "traffic/op_types.h"
@@ -37,6 +38,7 @@ class BasicRcTest : public RdmaStressFixture {
     int num_ops;
     int ops_in_flight;
     OperationGenerator* op_generator;
+    bool extended_cq = false;
   };
 
   // Perform RC communication between two Clients:
@@ -51,7 +53,8 @@ class BasicRcTest : public RdmaStressFixture {
         .max_op_size =
             std::max(config.op_size, config.op_generator->MaxOpSize()),
         .max_outstanding_ops_per_qp = config.ops_in_flight,
-        .max_qps = config.num_qps};
+        .max_qps = config.num_qps,
+        .extended_cq = config.extended_cq};
     Client initiator(/*client_id=*/0, context(), port_attr(), client_config),
         target(/*client_id=*/1, context(), port_attr(), client_config);
     LOG(INFO) << "initiator id: " << initiator.client_id()
@@ -73,6 +76,15 @@ class BasicRcTest : public RdmaStressFixture {
         target, config.num_qps, ops_per_qp, batch_per_qp, config.ops_in_flight,
         config.ops_in_flight * config.num_qps);
     EXPECT_EQ(ops_completed, ops_expected);
+    if (config.extended_cq) {
+      // The completions must have been polled from extended cqs, with their
+      // hardware timestamps if the device provides them.
+      EXPECT_TRUE(initiator.extended_cqs());
+      EXPECT_TRUE(target.extended_cqs());
+      if (initiator.completion_timestamps()) {
+        EXPECT_GE(initiator.timestamped_completions(), ops_completed);
+      }
+    }
 
     HaltExecution(initiator);
     HaltExecution(target);
@@ -145,6 +157,24 @@ INSTANTIATE_TEST_SUITE_P(
                              ops_in_flight, TestOp::ToString(op_type));
     });
 
+// Runs the same traffic with cqs backed by extended cqs.
+TEST_F(BasicRcTest, ExtendedCq) {
+  if (!Introspection().SupportsExtendedCqs()) {
+    GTEST_SKIP() << "NIC does not support extended CQs.";
+  }
+  constexpr int kOpSize = 256;
+  ConstantRcOperationGenerator op_generator(OpTypes::kWrite, kOpSize);
+  const Config kConfig{.num_qps = 10,
+                       .op_size = kOpSize,
+                       .num_ops = 10000,
+                       .ops_in_flight = 32,
+                       .op_generator = &op_generator,
+                       .extended_cq = true};
+
+  ConfigureLatencyMeasurements(OpTypes::kWrite);
+  ExecuteRcTest(kConfig);
+}
+
 class MixedOpsTest : public BasicRcTest,
                      public testing::WithParamInterface<std::tuple<
                          /*num_qps*/ int, /*num_ops*/ int,
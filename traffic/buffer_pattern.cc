@@ -0,0 +1,285 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/buffer_pattern.h"
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define RDMA_UNIT_TEST_BUFFER_PATTERN_X86 1
+#endif
+
+namespace rdma_unit_test {
+namespace buffer_pattern {
+namespace {
+
+constexpr uint32_t kGolden = 0x9E3779B9;
+constexpr uint64_t kWordSize = sizeof(uint32_t);
+
+// The murmur3 32 bit finalizer.
+inline uint32_t Mix(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h;
+}
+
+// Folds the 64 bit seed into the 32 bit key of the word sequence.
+inline uint32_t Key(uint64_t seed) {
+  return Mix(static_cast<uint32_t>(seed) ^
+             Mix(static_cast<uint32_t>(seed >> 32) + kGolden));
+}
+
+// Returns the pattern word at index `word`, ie. at byte offset 4 * word.
+inline uint32_t Word(uint32_t key, uint64_t word) {
+  return Mix(key + static_cast<uint32_t>(word) * kGolden);
+}
+
+// Fills or checks the trailing bytes of the buffer, from word index `word` on,
+// with the scalar implementation.
+void FillScalar(uint32_t key, uint64_t word, absl::Span<uint8_t> buffer) {
+  uint8_t* data = buffer.data();
+  const uint64_t size = buffer.size();
+  for (uint64_t offset = word * kWordSize; offset < size;
+       offset += kWordSize, ++word) {
+    // Words are stored little endian, also for a partial last word.
+    const uint32_t value = Word(key, word);
+    std::memcpy(data + offset, &value,
+                size - offset < kWordSize ? size - offset : kWordSize);
+  }
+}
+
+std::optional<uint64_t> FindMismatchScalar(uint32_t key, uint64_t word,
+                                           absl::Span<const uint8_t> buffer) {
+  const uint8_t* data = buffer.data();
+  const uint64_t size = buffer.size();
+  for (uint64_t offset = word * kWordSize; offset < size;
+       offset += kWordSize, ++word) {
+    const uint32_t value = Word(key, word);
+    uint8_t expected[kWordSize];
+    std::memcpy(expected, &value, kWordSize);
+    for (uint64_t i = 0; i < kWordSize && offset + i < size; ++i) {
+      if (data[offset + i] != expected[i]) return offset + i;
+    }
+  }
+  return std::nullopt;
+}
+
+#ifdef RDMA_UNIT_TEST_BUFFER_PATTERN_X86
+
+__attribute__((target("avx2"))) inline __m256i Mix256(__m256i h) {
+  h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+  h = _mm256_mullo_epi32(h, _mm256_set1_epi32(static_cast<int>(0x85EBCA6B)));
+  h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+  h = _mm256_mullo_epi32(h, _mm256_set1_epi32(static_cast<int>(0xC2B2AE35)));
+  return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+}
+
+// Returns the pre-mix values of the 8 words starting at word 0 and the
+// per-iteration increment.
+__attribute__((target("avx2"))) inline __m256i FirstWords256(uint32_t key) {
+  return _mm256_add_epi32(
+      _mm256_set1_epi32(static_cast<int>(key)),
+      _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                         _mm256_set1_epi32(static_cast<int>(kGolden))));
+}
+
+__attribute__((target("avx2"))) void FillAvx2(uint32_t key,
+                                              absl::Span<uint8_t> buffer) {
+  constexpr uint32_t kWords = sizeof(__m256i) / kWordSize;
+  const uint64_t num_vectors = buffer.size() / sizeof(__m256i);
+  __m256i words = FirstWords256(key);
+  const __m256i increment = _mm256_set1_epi32(static_cast<int>(kGolden * kWords));
+  auto* out = reinterpret_cast<__m256i*>(buffer.data());
+  for (uint64_t i = 0; i < num_vectors; ++i) {
+    _mm256_storeu_si256(out + i, Mix256(words));
+    words = _mm256_add_epi32(words, increment);
+  }
+  FillScalar(key, num_vectors * kWords, buffer);
+}
+
+__attribute__((target("avx2"))) std::optional<uint64_t> FindMismatchAvx2(
+    uint32_t key, absl::Span<const uint8_t> buffer) {
+  constexpr uint32_t kWords = sizeof(__m256i) / kWordSize;
+  const uint64_t num_vectors = buffer.size() / sizeof(__m256i);
+  __m256i words = FirstWords256(key);
+  const __m256i increment = _mm256_set1_epi32(static_cast<int>(kGolden * kWords));
+  const auto* in = reinterpret_cast<const __m256i*>(buffer.data());
+  for (uint64_t i = 0; i < num_vectors; ++i) {
+    const __m256i equal =
+        _mm256_cmpeq_epi32(_mm256_loadu_si256(in + i), Mix256(words));
+    if (_mm256_movemask_epi8(equal) != -1) {
+      return FindMismatchScalar(
+          key, i * kWords, buffer.subspan(0, (i + 1) * sizeof(__m256i)));
+    }
+    words = _mm256_add_epi32(words, increment);
+  }
+  return FindMismatchScalar(key, num_vectors * kWords, buffer);
+}
+
+__attribute__((target("avx512f"))) inline __m512i Mix512(__m512i h) {
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+  h = _mm512_mullo_epi32(h, _mm512_set1_epi32(static_cast<int>(0x85EBCA6B)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+  h = _mm512_mullo_epi32(h, _mm512_set1_epi32(static_cast<int>(0xC2B2AE35)));
+  return _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+}
+
+__attribute__((target("avx512f"))) inline __m512i FirstWords512(uint32_t key) {
+  return _mm512_add_epi32(
+      _mm512_set1_epi32(static_cast<int>(key)),
+      _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                           11, 12, 13, 14, 15),
+                         _mm512_set1_epi32(static_cast<int>(kGolden))));
+}
+
+__attribute__((target("avx512f"))) void FillAvx512(
+    uint32_t key, absl::Span<uint8_t> buffer) {
+  constexpr uint32_t kWords = sizeof(__m512i) / kWordSize;
+  const uint64_t num_vectors = buffer.size() / sizeof(__m512i);
+  __m512i words = FirstWords512(key);
+  const __m512i increment = _mm512_set1_epi32(static_cast<int>(kGolden * kWords));
+  auto* out = reinterpret_cast<__m512i*>(buffer.data());
+  for (uint64_t i = 0; i < num_vectors; ++i) {
+    _mm512_storeu_si512(out + i, Mix512(words));
+    words = _mm512_add_epi32(words, increment);
+  }
+  FillScalar(key, num_vectors * kWords, buffer);
+}
+
+__attribute__((target("avx512f"))) std::optional<uint64_t> FindMismatchAvx512(
+    uint32_t key, absl::Span<const uint8_t> buffer) {
+  constexpr uint32_t kWords = sizeof(__m512i) / kWordSize;
+  const uint64_t num_vectors = buffer.size() / sizeof(__m512i);
+  __m512i words = FirstWords512(key);
+  const __m512i increment = _mm512_set1_epi32(static_cast<int>(kGolden * kWords));
+  const auto* in = reinterpret_cast<const __m512i*>(buffer.data());
+  for (uint64_t i = 0; i < num_vectors; ++i) {
+    if (_mm512_cmpneq_epi32_mask(_mm512_loadu_si512(in + i), Mix512(words)) !=
+        0) {
+      return FindMismatchScalar(
+          key, i * kWords, buffer.subspan(0, (i + 1) * sizeof(__m512i)));
+    }
+    words = _mm512_add_epi32(words, increment);
+  }
+  return FindMismatchScalar(key, num_vectors * kWords, buffer);
+}
+
+#endif  // RDMA_UNIT_TEST_BUFFER_PATTERN_X86
+
+Implementation DetectImplementation() {
+  if (IsSupported(Implementation::kAvx512)) return Implementation::kAvx512;
+  if (IsSupported(Implementation::kAvx2)) return Implementation::kAvx2;
+  return Implementation::kScalar;
+}
+
+Implementation GetImplementation() {
+  static const Implementation implementation = DetectImplementation();
+  return implementation;
+}
+
+}  // namespace
+
+uint64_t Seed(uint64_t client_id, uint64_t qp_id, uint64_t op_id) {
+  // Chains the ids through the 64 bit murmur3 finalizer.
+  uint64_t seed = 0;
+  for (uint64_t id : {client_id, qp_id, op_id}) {
+    seed = (seed ^ id) * 0xFF51AFD7ED558CCD;
+    seed ^= seed >> 33;
+    seed *= 0xC4CEB9FE1A85EC53;
+    seed ^= seed >> 33;
+  }
+  return seed;
+}
+
+bool IsSupported(Implementation implementation) {
+  switch (implementation) {
+    case Implementation::kScalar:
+      return true;
+#ifdef RDMA_UNIT_TEST_BUFFER_PATTERN_X86
+    case Implementation::kAvx2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+    case Implementation::kAvx512:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+  }
+}
+
+void FillWith(Implementation implementation, uint64_t seed,
+              absl::Span<uint8_t> buffer) {
+  const uint32_t key = Key(seed);
+  switch (implementation) {
+#ifdef RDMA_UNIT_TEST_BUFFER_PATTERN_X86
+    case Implementation::kAvx512:
+      return FillAvx512(key, buffer);
+    case Implementation::kAvx2:
+      return FillAvx2(key, buffer);
+#endif
+    default:
+      return FillScalar(key, /*word=*/0, buffer);
+  }
+}
+
+std::optional<uint64_t> FindMismatchWith(Implementation implementation,
+                                         uint64_t seed,
+                                         absl::Span<const uint8_t> buffer) {
+  const uint32_t key = Key(seed);
+  switch (implementation) {
+#ifdef RDMA_UNIT_TEST_BUFFER_PATTERN_X86
+    case Implementation::kAvx512:
+      return FindMismatchAvx512(key, buffer);
+    case Implementation::kAvx2:
+      return FindMismatchAvx2(key, buffer);
+#endif
+    default:
+      return FindMismatchScalar(key, /*word=*/0, buffer);
+  }
+}
+
+void Fill(uint64_t seed, absl::Span<uint8_t> buffer) {
+  FillWith(GetImplementation(), seed, buffer);
+}
+
+std::optional<uint64_t> FindMismatch(uint64_t seed,
+                                     absl::Span<const uint8_t> buffer) {
+  return FindMismatchWith(GetImplementation(), seed, buffer);
+}
+
+absl::string_view ImplementationName() {
+  switch (GetImplementation()) {
+    case Implementation::kAvx512:
+      return "avx512";
+    case Implementation::kAvx2:
+      return "avx2";
+    case Implementation::kScalar:
+      return "scalar";
+  }
+  return "scalar";
+}
+
+}  // namespace buffer_pattern
+}  // namespace rdma_unit_test
@@ -0,0 +1,72 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_BUFFER_PATTERN_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_BUFFER_PATTERN_H_
+
+#include <cstdint>
+#include <optional>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace rdma_unit_test {
+namespace buffer_pattern {
+
+// Generates and checks the data pattern of op buffers. The pattern is a
+// function of a 64 bit seed (see Seed()) and of the byte offset within the
+// buffer, so a buffer can be verified against its seed alone, without a copy
+// of the source data, and data landing at the wrong offset (eg. across MTU
+// boundaries) or from another op is detected. Every 4 byte word is a
+// well-mixed hash of the seed and the word index.
+//
+// Both functions use AVX-512 or AVX2 kernels when the cpu supports them, and
+// a portable scalar implementation otherwise; all implementations produce the
+// same pattern.
+
+// Returns the seed of the pattern of an op. Op ids are only unique within a
+// qp, and qp ids within a client, so all three are mixed into the seed.
+uint64_t Seed(uint64_t client_id, uint64_t qp_id, uint64_t op_id);
+
+// Fills `buffer` with the pattern for `seed`.
+void Fill(uint64_t seed, absl::Span<uint8_t> buffer);
+
+// Returns the offset of the first byte of `buffer` which does not match the
+// pattern for `seed`, or std::nullopt if the whole buffer matches.
+std::optional<uint64_t> FindMismatch(uint64_t seed,
+                                     absl::Span<const uint8_t> buffer);
+
+// Returns the name of the implementation used by Fill() and FindMismatch(),
+// ie. "avx512", "avx2" or "scalar".
+absl::string_view ImplementationName();
+
+// The implementations of the pattern. Fill() and FindMismatch() use the
+// fastest one supported by the cpu; the functions below select one
+// explicitly, so tests can check that all of them agree.
+enum class Implementation { kScalar, kAvx2, kAvx512 };
+
+// Returns true if `implementation` is compiled in and supported by the cpu.
+bool IsSupported(Implementation implementation);
+
+// Like Fill() and FindMismatch(), with the given supported implementation.
+void FillWith(Implementation implementation, uint64_t seed,
+              absl::Span<uint8_t> buffer);
+std::optional<uint64_t> FindMismatchWith(Implementation implementation,
+                                         uint64_t seed,
+                                         absl::Span<const uint8_t> buffer);
+
+}  // namespace buffer_pattern
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_BUFFER_PATTERN_H_
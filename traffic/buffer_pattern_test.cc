@@ -0,0 +1,103 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/buffer_pattern.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+
+namespace rdma_unit_test {
+namespace buffer_pattern {
+namespace {
+
+// Covers empty buffers, partial trailing words and several vectors of both
+// vector widths, at an unaligned start.
+constexpr uint64_t kMaxSize = 3 * 64 + 7;
+constexpr uint64_t kSeed = 0x0123456789ABCDEF;
+
+class BufferPatternTest : public ::testing::TestWithParam<Implementation> {
+ protected:
+  void SetUp() override {
+    if (!IsSupported(GetParam())) {
+      GTEST_SKIP() << "Implementation not supported by this cpu.";
+    }
+  }
+};
+
+TEST_P(BufferPatternTest, FillMatchesScalar) {
+  std::vector<uint8_t> storage(kMaxSize + 1);
+  std::vector<uint8_t> expected(kMaxSize);
+  for (uint64_t size = 0; size <= kMaxSize; ++size) {
+    absl::Span<uint8_t> buffer = absl::MakeSpan(storage).subspan(1, size);
+    FillWith(GetParam(), kSeed, buffer);
+    FillWith(Implementation::kScalar, kSeed,
+             absl::MakeSpan(expected).subspan(0, size));
+    EXPECT_THAT(buffer, ::testing::ElementsAreArray(expected.data(), size))
+        << "size " << size;
+  }
+}
+
+TEST_P(BufferPatternTest, AcceptsScalarPattern) {
+  std::vector<uint8_t> buffer(kMaxSize);
+  for (uint64_t size = 0; size <= kMaxSize; ++size) {
+    absl::Span<uint8_t> span = absl::MakeSpan(buffer).subspan(0, size);
+    FillWith(Implementation::kScalar, kSeed, span);
+    EXPECT_EQ(FindMismatchWith(GetParam(), kSeed, span), std::nullopt)
+        << "size " << size;
+  }
+}
+
+TEST_P(BufferPatternTest, FindsFirstMismatch) {
+  std::vector<uint8_t> buffer(kMaxSize);
+  FillWith(Implementation::kScalar, kSeed, absl::MakeSpan(buffer));
+  for (uint64_t offset = 0; offset < kMaxSize; ++offset) {
+    buffer[offset] ^= 0x1;
+    EXPECT_EQ(FindMismatchWith(GetParam(), kSeed, buffer), offset);
+    buffer[offset] ^= 0x1;
+  }
+}
+
+TEST_P(BufferPatternTest, RejectsOtherSeeds) {
+  std::vector<uint8_t> buffer(kMaxSize);
+  FillWith(Implementation::kScalar, Seed(/*client_id=*/0, /*qp_id=*/1, 2),
+           absl::MakeSpan(buffer));
+  EXPECT_EQ(FindMismatchWith(GetParam(), Seed(0, 1, 2), buffer), std::nullopt);
+  EXPECT_NE(FindMismatchWith(GetParam(), Seed(1, 1, 2), buffer), std::nullopt);
+  EXPECT_NE(FindMismatchWith(GetParam(), Seed(0, 0, 2), buffer), std::nullopt);
+  EXPECT_NE(FindMismatchWith(GetParam(), Seed(0, 1, 1), buffer), std::nullopt);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Implementations, BufferPatternTest,
+    ::testing::Values(Implementation::kScalar, Implementation::kAvx2,
+                      Implementation::kAvx512),
+    [](const ::testing::TestParamInfo<Implementation>& info) {
+      switch (info.param) {
+        case Implementation::kAvx2:
+          return "Avx2";
+        case Implementation::kAvx512:
+          return "Avx512";
+        default:
+          return "Scalar";
+      }
+    });
+
+}  // namespace
+}  // namespace buffer_pattern
+}  // namespace rdma_unit_test
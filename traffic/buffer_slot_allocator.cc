@@ -0,0 +1,110 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/buffer_slot_allocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace rdma_unit_test {
+
+BufferSlotAllocator::BufferSlotAllocator(uint8_t* base_addr,
+                                         uint64_t slot_size,
+                                         uint32_t num_slots)
+    : base_addr_(base_addr),
+      slot_size_(slot_size),
+      active_(num_slots, false),
+      runs_(num_slots),
+      free_slots_(num_slots) {
+  if (num_slots > 0) {
+    runs_[0] = {.first = 0, .count = num_slots};
+    runs_count_ = 1;
+  }
+}
+
+uint8_t* BufferSlotAllocator::Allocate() {
+  if (free_slots_ == 0) return nullptr;
+  uint32_t index = FrontRun().first;
+  active_[index] = true;
+  --free_slots_;
+  if (--FrontRun().count == 0) {
+    runs_head_ = (runs_head_ + 1) % runs_.size();
+    --runs_count_;
+  } else {
+    ++FrontRun().first;
+  }
+  return SlotAddress(index);
+}
+
+bool BufferSlotAllocator::Allocate(uint32_t count,
+                                   std::vector<uint8_t*>& addrs) {
+  if (count > free_slots_) return false;
+  while (count > 0) {
+    uint32_t take = std::min(count, FrontRun().count);
+    TakeFromFrontRun(take, addrs);
+    count -= take;
+  }
+  return true;
+}
+
+void BufferSlotAllocator::TakeFromFrontRun(uint32_t count,
+                                           std::vector<uint8_t*>& addrs) {
+  Run& run = FrontRun();
+  for (uint32_t i = 0; i < count; ++i) {
+    active_[run.first + i] = true;
+    addrs.push_back(SlotAddress(run.first + i));
+  }
+  free_slots_ -= count;
+  run.first += count;
+  run.count -= count;
+  if (run.count == 0) {
+    runs_head_ = (runs_head_ + 1) % runs_.size();
+    --runs_count_;
+  }
+}
+
+bool BufferSlotAllocator::Free(uint8_t* addr) {
+  std::optional<uint32_t> index = SlotIndex(addr);
+  if (!index.has_value() || !active_[*index]) return false;
+  active_[*index] = false;
+  ++free_slots_;
+  // Extend the most recently freed run if this slot directly follows it, so
+  // that slots freed in allocation order stay contiguous.
+  if (runs_count_ > 0 && BackRun().first + BackRun().count == *index) {
+    ++BackRun().count;
+    return true;
+  }
+  ++runs_count_;
+  BackRun() = {.first = *index, .count = 1};
+  return true;
+}
+
+bool BufferSlotAllocator::IsActive(const uint8_t* addr) const {
+  std::optional<uint32_t> index = SlotIndex(addr);
+  return index.has_value() && active_[*index];
+}
+
+std::optional<uint32_t> BufferSlotAllocator::SlotIndex(
+    const uint8_t* addr) const {
+  if (addr < base_addr_ || slot_size_ == 0) return std::nullopt;
+  uint64_t offset = addr - base_addr_;
+  if (offset % slot_size_ != 0 || offset / slot_size_ >= active_.size()) {
+    return std::nullopt;
+  }
+  return offset / slot_size_;
+}
+
+}  // namespace rdma_unit_test
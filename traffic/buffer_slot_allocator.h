@@ -0,0 +1,107 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_BUFFER_SLOT_ALLOCATOR_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_BUFFER_SLOT_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace rdma_unit_test {
+
+// Hands out fixed size slots of a contiguous buffer to RDMA ops. Free slots are
+// kept in a FIFO of runs of adjacent slots, so:
+// - Allocation always returns the least recently freed slots, and freed slots
+//   are reused in the order they were freed.
+// - Allocating and freeing a slot is O(1).
+// - Slots that are freed in the order they were allocated (e.g. in-order
+//   completions on a qp) coalesce into runs, so a batch allocation is normally
+//   served by adjacent slots of the buffer.
+// This class is not thread safe.
+class BufferSlotAllocator {
+ public:
+  BufferSlotAllocator() = default;
+  // Divides the `num_slots * slot_size` bytes starting at `base_addr` into
+  // `num_slots` slots, all of which are initially free.
+  BufferSlotAllocator(uint8_t* base_addr, uint64_t slot_size,
+                      uint32_t num_slots);
+  BufferSlotAllocator(const BufferSlotAllocator& other) = default;
+  BufferSlotAllocator& operator=(const BufferSlotAllocator& other) = default;
+  BufferSlotAllocator(BufferSlotAllocator&& other) = default;
+  BufferSlotAllocator& operator=(BufferSlotAllocator&& other) = default;
+  ~BufferSlotAllocator() = default;
+
+  // Allocates a single slot and returns its address, or nullptr if all slots
+  // are in use.
+  uint8_t* Allocate();
+
+  // Allocates `count` slots and appends their addresses to `addrs`, in
+  // ascending address order when the slots are contiguous. If the oldest free
+  // run holds at least `count` slots, the slots are adjacent in the buffer;
+  // otherwise they are taken slot by slot in FIFO order. Returns false, without
+  // allocating anything, if fewer than `count` slots are free.
+  bool Allocate(uint32_t count, std::vector<uint8_t*>& addrs);
+
+  // Returns the slot at `addr` to the allocator. Returns false if `addr` is not
+  // the address of an allocated slot.
+  bool Free(uint8_t* addr);
+
+  // Returns true if `addr` is the address of an allocated slot.
+  bool IsActive(const uint8_t* addr) const;
+
+  uint8_t* base_addr() const { return base_addr_; }
+  uint64_t slot_size() const { return slot_size_; }
+  uint32_t num_slots() const { return active_.size(); }
+  uint32_t free_slots() const { return free_slots_; }
+  uint32_t active_slots() const { return num_slots() - free_slots_; }
+
+ private:
+  // A run of `count` adjacent free slots starting at slot index `first`.
+  struct Run {
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  // Returns the index of the slot starting at `addr`, or nullopt if `addr` is
+  // not the start of a slot.
+  std::optional<uint32_t> SlotIndex(const uint8_t* addr) const;
+  uint8_t* SlotAddress(uint32_t index) const {
+    return base_addr_ + index * slot_size_;
+  }
+
+  Run& FrontRun() { return runs_[runs_head_]; }
+  Run& BackRun() {
+    return runs_[(runs_head_ + runs_count_ - 1) % runs_.size()];
+  }
+  // Takes `count` slots from the front of the oldest run and appends their
+  // addresses to `addrs`. `count` must not exceed the size of the run.
+  void TakeFromFrontRun(uint32_t count, std::vector<uint8_t*>& addrs);
+
+  uint8_t* base_addr_ = nullptr;
+  uint64_t slot_size_ = 0;
+  // Whether each slot is currently allocated.
+  std::vector<bool> active_;
+  // Circular FIFO of free runs. Runs are disjoint and non-empty, so there are
+  // never more runs than slots.
+  std::vector<Run> runs_;
+  size_t runs_head_ = 0;
+  size_t runs_count_ = 0;
+  uint32_t free_slots_ = 0;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_BUFFER_SLOT_ALLOCATOR_H_
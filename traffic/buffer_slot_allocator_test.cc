@@ -0,0 +1,124 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "traffic/buffer_slot_allocator.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace rdma_unit_test {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+constexpr uint64_t kSlotSize = 64;
+constexpr uint32_t kNumSlots = 4;
+
+class BufferSlotAllocatorTest : public testing::Test {
+ protected:
+  uint8_t* Slot(uint32_t index) { return buffer_.data() + index * kSlotSize; }
+
+  std::vector<uint8_t> buffer_ = std::vector<uint8_t>(kSlotSize * kNumSlots);
+  BufferSlotAllocator allocator_{buffer_.data(), kSlotSize, kNumSlots};
+};
+
+TEST_F(BufferSlotAllocatorTest, AllocatesEverySlotThenExhausts) {
+  EXPECT_EQ(allocator_.num_slots(), kNumSlots);
+  EXPECT_EQ(allocator_.free_slots(), kNumSlots);
+  for (uint32_t i = 0; i < kNumSlots; ++i) {
+    EXPECT_EQ(allocator_.Allocate(), Slot(i));
+    EXPECT_TRUE(allocator_.IsActive(Slot(i)));
+  }
+  EXPECT_EQ(allocator_.free_slots(), 0);
+  EXPECT_EQ(allocator_.active_slots(), kNumSlots);
+  EXPECT_EQ(allocator_.Allocate(), nullptr);
+  std::vector<uint8_t*> addrs;
+  EXPECT_FALSE(allocator_.Allocate(1, addrs));
+  EXPECT_THAT(addrs, IsEmpty());
+}
+
+TEST_F(BufferSlotAllocatorTest, BatchLargerThanFreeSlotsAllocatesNothing) {
+  std::vector<uint8_t*> addrs;
+  ASSERT_TRUE(allocator_.Allocate(kNumSlots - 1, addrs));
+  EXPECT_FALSE(allocator_.Allocate(2, addrs));
+  EXPECT_EQ(addrs.size(), kNumSlots - 1);
+  EXPECT_EQ(allocator_.free_slots(), 1);
+}
+
+TEST_F(BufferSlotAllocatorTest, ReusesSlotsInFreeOrder) {
+  std::vector<uint8_t*> addrs;
+  ASSERT_TRUE(allocator_.Allocate(kNumSlots, addrs));
+  EXPECT_TRUE(allocator_.Free(Slot(2)));
+  EXPECT_TRUE(allocator_.Free(Slot(0)));
+  EXPECT_FALSE(allocator_.IsActive(Slot(2)));
+  EXPECT_EQ(allocator_.Allocate(), Slot(2));
+  EXPECT_EQ(allocator_.Allocate(), Slot(0));
+  EXPECT_EQ(allocator_.Allocate(), nullptr);
+}
+
+TEST_F(BufferSlotAllocatorTest, SlotsFreedInOrderCoalesce) {
+  std::vector<uint8_t*> addrs;
+  ASSERT_TRUE(allocator_.Allocate(kNumSlots, addrs));
+  // Completions in posting order free adjacent slots, which are then handed out
+  // as one adjacent batch.
+  for (uint32_t i = 1; i < kNumSlots; ++i) {
+    EXPECT_TRUE(allocator_.Free(Slot(i)));
+  }
+  addrs.clear();
+  ASSERT_TRUE(allocator_.Allocate(kNumSlots - 1, addrs));
+  EXPECT_THAT(addrs, ElementsAre(Slot(1), Slot(2), Slot(3)));
+}
+
+TEST_F(BufferSlotAllocatorTest, BatchSpansRuns) {
+  std::vector<uint8_t*> addrs;
+  ASSERT_TRUE(allocator_.Allocate(kNumSlots, addrs));
+  EXPECT_TRUE(allocator_.Free(Slot(3)));
+  EXPECT_TRUE(allocator_.Free(Slot(0)));
+  EXPECT_TRUE(allocator_.Free(Slot(1)));
+  addrs.clear();
+  ASSERT_TRUE(allocator_.Allocate(3, addrs));
+  EXPECT_THAT(addrs, ElementsAre(Slot(3), Slot(0), Slot(1)));
+  EXPECT_EQ(allocator_.free_slots(), 0);
+}
+
+TEST_F(BufferSlotAllocatorTest, RejectsInvalidFrees) {
+  uint8_t* slot = allocator_.Allocate();
+  ASSERT_EQ(slot, Slot(0));
+  // Not allocated, not the start of a slot, or outside of the buffer.
+  EXPECT_FALSE(allocator_.Free(Slot(1)));
+  EXPECT_FALSE(allocator_.Free(slot + 1));
+  EXPECT_FALSE(allocator_.Free(Slot(kNumSlots)));
+  EXPECT_FALSE(allocator_.Free(buffer_.data() - kSlotSize));
+  EXPECT_TRUE(allocator_.Free(slot));
+  // Double free.
+  EXPECT_FALSE(allocator_.Free(slot));
+  EXPECT_EQ(allocator_.free_slots(), kNumSlots);
+}
+
+TEST(BufferSlotAllocatorEmptyTest, DefaultHasNoSlots) {
+  BufferSlotAllocator allocator;
+  EXPECT_EQ(allocator.num_slots(), 0);
+  EXPECT_EQ(allocator.Allocate(), nullptr);
+  std::vector<uint8_t*> addrs;
+  EXPECT_TRUE(allocator.Allocate(0, addrs));
+  EXPECT_FALSE(allocator.Allocate(1, addrs));
+}
+
+}  // namespace
+}  // namespace rdma_unit_test
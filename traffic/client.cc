@@ -18,25 +18,30 @@
 #include <fcntl.h>
 #include <math.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 
 #include <algorithm>
-#include <climits>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
-#include <functional>
+#include <limits>
 #include <list>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <string>
+#include <thread>  // NOLINT
 #include <utility>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/flags/flag.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
@@ -49,6 +54,7 @@
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "infiniband/verbs.h"
+#include "internal/completion_poller.h"
 #include "internal/verbs_attribute.h"
 #include "internal/verbs_cleanup.h"
 #include "public/page_size.h"
@@ -57,10 +63,15 @@
 #include "public/status_matchers.h"
 #include "public/verbs_helper_suite.h"
 #include "public/verbs_util.h"
+#include "traffic/buffer_pattern.h"
+#include "traffic/hot_path_logging.h"
+#include "traffic/op_pacer.h"
+#include "traffic/op_trace.h"
 #include "traffic/op_types.h"
 #include "traffic/operation_generator.h"
 #include "traffic/qp_op_interface.h"
 #include "traffic/qp_state.h"
+#include "traffic/tsc_clock.h"
 
 ABSL_FLAG(bool, huge_page_buffers, false,
           "When true, each client allocates huge page buffers. If huge page is"
@@ -77,10 +88,41 @@ ABSL_FLAG(
     " this number of seconds passes but no new completion has arrived. In a"
     " well-working non-faulty test, we expect consecutive completions to arrive"
     " much less than this timeout apart.");
+ABSL_FLAG(int, shard_cpu_offset, 0,
+          "When a client has more than one shard and this is non-negative, "
+          "ExecuteOps pins the thread driving shard i to the "
+          "(shard_cpu_offset + i)-th cpu, modulo the number of cpus, of the "
+          "cpus the process may run on. Restrict the process with taskset to "
+          "keep concurrent processes off each other's cpus. Negative leaves "
+          "the threads unpinned.");
+ABSL_FLAG(absl::Duration, op_summary_interval, absl::Seconds(1),
+          "Interval between the aggregate progress summaries (ops issued, "
+          "completed, inflight and throughput) logged while ExecuteOps runs. "
+          "Per-op logs are controlled separately by --hot_path_logging.");
+ABSL_FLAG(double, offered_load_ops_per_sec, 0,
+          "When positive, ExecuteOps issues ops open-loop at this rate instead "
+          "of whenever an op completes, and logs latencies from the intended "
+          "issue time of every op. Exclusive with --offered_load_gbps.");
+ABSL_FLAG(double, offered_load_gbps, 0,
+          "Same as --offered_load_ops_per_sec, with the rate given in gigabits "
+          "of op payload per second.");
+ABSL_FLAG(std::string, op_trace_dir, "",
+          "If set, every Client records the ops it posts into "
+          "<op_trace_dir>/client_<client_id>.optrace, which can be replayed "
+          "with Client::ReplayTrace() or a TraceOperationGenerator.");
+ABSL_FLAG(std::string, offered_load_interarrival, "fixed",
+          "Distribution of the time between the intended issue times of "
+          "open-loop ops: fixed or poisson.");
 
 namespace rdma_unit_test {
 namespace {
 
+// Returns a new id for a Client instance, never reused within the process.
+uint64_t NextInstanceId() {
+  static std::atomic<uint64_t> next_instance_id{0};
+  return next_instance_id.fetch_add(1, std::memory_order_relaxed);
+}
+
 void PrintAsyncEvent(struct ibv_context* ctx, struct ibv_async_event* event) {
   switch (event->event_type) {
     /* QP events */
@@ -180,6 +222,26 @@ void SetQpKeys(QpState* const qp_state, const ibv_mr* const src_mr,
   qp_state->set_dest_rkey(dest_mr->rkey);
 }
 
+// Returns the offered load set by the --offered_load_* flags, or nullopt if
+// ops should be issued closed-loop.
+std::optional<OpPacer::Options> OfferedLoadFromFlags() {
+  OpPacer::Options options{
+      .ops_per_sec = absl::GetFlag(FLAGS_offered_load_ops_per_sec),
+      .gbps = absl::GetFlag(FLAGS_offered_load_gbps)};
+  if (options.ops_per_sec <= 0 && options.gbps <= 0) {
+    return std::nullopt;
+  }
+  CHECK(options.ops_per_sec <= 0 || options.gbps <= 0)  // Crash OK
+      << "Only one of --offered_load_ops_per_sec and --offered_load_gbps can "
+         "be set.";
+  absl::StatusOr<OpPacer::Interarrival> interarrival =
+      OpPacer::ParseInterarrival(
+          absl::GetFlag(FLAGS_offered_load_interarrival));
+  CHECK_OK(interarrival.status());  // Crash OK
+  options.interarrival = *interarrival;
+  return options;
+}
+
 }  // namespace
 
 Client::Client(int client_id, ibv_context* context, PortAttribute port_attr,
@@ -187,10 +249,9 @@ Client::Client(int client_id, ibv_context* context, PortAttribute port_attr,
     : context_(context),
       pd_(ibv_.AllocPd(context)),
       port_attr_(port_attr),
-      send_cq_(nullptr),
-      recv_cq_(nullptr),
       qps_{},
       client_id_(client_id),
+      instance_id_(NextInstanceId()),
       max_outstanding_ops_per_qp_(config.max_outstanding_ops_per_qp),
       buffer_per_qp_([config]() -> int {
         // Make sure that buffer is at least as large as necessary to hold the
@@ -254,35 +315,99 @@ Client::Client(int client_id, ibv_context* context, PortAttribute port_attr,
   CHECK(dest_mr_[0]);  // Crash OK
   LOG(INFO) << "dest_lkey: " << dest_mr_.back()->lkey;
 
-  // Create completion queues.
-  int cq_size = max_outstanding_ops_per_qp_ * max_qps_;
+  // Create completion queues, one send and one recv cq per shard.
+  CHECK_GT(config.num_shards, 0);  // Crash OK
+  const int num_shards = config.num_shards;
+  const int max_qps_per_shard = (max_qps_ + num_shards - 1) / num_shards;
+  int cq_size = max_outstanding_ops_per_qp_ * max_qps_per_shard;
   ibv_device_attr dev_attr = {};
   CHECK_EQ(0, ibv_query_device(context_, &dev_attr));  // Crash OK
   int cq_slots = std::min(dev_attr.max_cqe, cq_size);
-  send_cc_ = ibv_.CreateChannel(context_);
-  send_cq_ = ibv_.CreateCq(context_,
-                           config.send_cq_size > 0
-                               ? std::min(dev_attr.max_cqe, config.send_cq_size)
-                               : cq_slots,
-                           send_cc_);
-  CHECK(send_cq_);  // Crash OK
-  recv_cc_ = ibv_.CreateChannel(context_);
-  recv_cq_ = ibv_.CreateCq(context_,
-                           config.recv_cq_size > 0
-                               ? std::min(dev_attr.max_cqe, config.recv_cq_size)
-                               : cq_slots,
-                           recv_cc_);
-  CHECK(recv_cq_);  // Crash OK
+  const int send_cq_slots =
+      config.send_cq_size > 0 ? std::min(dev_attr.max_cqe, config.send_cq_size)
+                              : cq_slots;
+  const int recv_cq_slots =
+      config.recv_cq_size > 0 ? std::min(dev_attr.max_cqe, config.recv_cq_size)
+                              : cq_slots;
+  uint64_t wc_flags = 0;
+  if (config.extended_cq) {
+    wc_flags |= IBV_WC_EX_WITH_BYTE_LEN;
+    completion_timestamps_ = verbs_util::CheckExtendedCompletionHasCapability(
+        context_, IBV_WC_EX_WITH_COMPLETION_TIMESTAMP);
+    if (completion_timestamps_) {
+      wc_flags |= IBV_WC_EX_WITH_COMPLETION_TIMESTAMP;
+    }
+  }
+  // Creates an extended cq if requested, or a regular one otherwise or if
+  // creating the extended cq fails.
+  auto create_cq = [&](int cqe, ibv_comp_channel* channel,
+                       ibv_cq_ex** cq_ex) -> ibv_cq* {
+    if (config.extended_cq) {
+      ibv_cq_init_attr_ex attr = {.cqe = static_cast<uint32_t>(cqe),
+                                  .channel = channel,
+                                  .wc_flags = wc_flags};
+      *cq_ex = ibv_.CreateCqEx(context_, attr);
+      if (*cq_ex != nullptr) return ibv_cq_ex_to_cq(*cq_ex);
+      LOG(WARNING) << "Client " << client_id_
+                   << ": failed to create an extended cq, falling back to a "
+                      "regular cq.";
+    }
+    return ibv_.CreateCq(context_, cqe, channel);
+  };
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    CompletionShard& shard = shards_.emplace_back();
+    shard.send_cc = ibv_.CreateChannel(context_);
+    shard.send_cq = create_cq(send_cq_slots, shard.send_cc, &shard.send_cq_ex);
+    CHECK(shard.send_cq);  // Crash OK
+    shard.recv_cc = ibv_.CreateChannel(context_);
+    shard.recv_cq = create_cq(recv_cq_slots, shard.recv_cc, &shard.recv_cq_ex);
+    CHECK(shard.recv_cq);  // Crash OK
+  }
+  // Timestamps are only recorded if every cq is extended.
+  for (const CompletionShard& shard : shards_) {
+    if (shard.send_cq_ex == nullptr || shard.recv_cq_ex == nullptr) {
+      completion_timestamps_ = false;
+    }
+  }
+  if (completion_timestamps_) {
+    absl::StatusOr<HcaClock> hca_clock = HcaClock::Create(context_);
+    if (hca_clock.ok()) {
+      hca_clock_ = *std::move(hca_clock);
+    } else {
+      LOG(WARNING) << "Client " << client_id_
+                   << ": cannot convert completion timestamps to host time, "
+                      "latencies are measured when completions are polled: "
+                   << hca_clock.status();
+    }
+  }
 
   qps_.reserve(max_qps_);
+
+  const std::string trace_dir = absl::GetFlag(FLAGS_op_trace_dir);
+  if (!trace_dir.empty()) {
+    absl::StatusOr<std::unique_ptr<OpTraceWriter>> writer =
+        OpTraceWriter::Create(
+            absl::StrCat(trace_dir, "/client_", client_id_, ".optrace"));
+    if (writer.ok()) {
+      StartRecording(*std::move(writer));
+    } else {
+      LOG(WARNING) << "Client " << client_id_
+                   << " does not record its ops: " << writer.status();
+    }
+  }
 }
 
 Client::~Client() {
-  if (send_epoll_fd_.has_value()) {
-    CHECK_EQ(TEMP_FAILURE_RETRY(close(*send_epoll_fd_)), 0);  // Crash OK
-  }
-  if (recv_epoll_fd_.has_value()) {
-    CHECK_EQ(TEMP_FAILURE_RETRY(close(*recv_epoll_fd_)), 0);  // Crash OK
+  for (const CompletionShard& shard : shards_) {
+    if (shard.send_epoll_fd.has_value()) {
+      CHECK_EQ(TEMP_FAILURE_RETRY(close(*shard.send_epoll_fd)),  // Crash OK
+               0);
+    }
+    if (shard.recv_epoll_fd.has_value()) {
+      CHECK_EQ(TEMP_FAILURE_RETRY(close(*shard.recv_epoll_fd)),  // Crash OK
+               0);
+    }
   }
 }
 
@@ -292,13 +417,17 @@ absl::StatusOr<uint32_t> Client::CreateQp(bool is_rc,
     return absl::OutOfRangeError(
         absl::StrCat("Max allowed qps per client is ", max_qps_));
 
+  // Qps are spread over the shards round robin by qp_id.
+  const CompletionShard& shard = shards_[qps_.size() % shards_.size()];
   ibv_qp* qp;
   if (is_rc) {
-    qp = ibv_.CreateQp(pd_, send_cq_, recv_cq_, IBV_QPT_RC, qp_init_attribute);
+    qp = ibv_.CreateQp(pd_, shard.send_cq, shard.recv_cq, IBV_QPT_RC,
+                       qp_init_attribute);
 
     CHECK(qp);  // Crash OK
   } else {
-    qp = ibv_.CreateQp(pd_, send_cq_, recv_cq_, IBV_QPT_UD, qp_init_attribute);
+    qp = ibv_.CreateQp(pd_, shard.send_cq, shard.recv_cq, IBV_QPT_UD,
+                       qp_init_attribute);
     CHECK(qp);                                                   // Crash OK
     CHECK_OK(ibv_.ModifyUdQpResetToRts(qp, port_attr_, kQKey));  // Crash OK
   }
@@ -319,17 +448,25 @@ absl::StatusOr<uint32_t> Client::CreateQp(bool is_rc,
     qps_[qp_id] = std::move(qp_state);
   }
 
+  qps_[qp_id]->set_trace_writer(trace_writer_.get());
+
   LOG(INFO) << "Client" << client_id()
           << ", created Qp: " << qps_[qp_id]->ToString();
   return qp_id;
 }
 
 absl::Status Client::DeleteQp(uint32_t qp_id) {
-  auto qp = qps_.at(qp_id)->qp();
+  QpState* qp_state = qps_.at(qp_id).get();
+  auto qp = qp_state->qp();
   if (0 != ibv_.DestroyQp(qp)) {
     return absl::InternalError(absl::StrCat(
         "Client ", client_id(), " failed to destroy qp id ", qp_id));
   }
+  if (qp_state->dirty_link().on_list) {
+    QpState** link = &shards_[qp_id % shards_.size()].dirty_qps;
+    while (*link != qp_state) link = &(*link)->dirty_link().next;
+    *link = qp_state->dirty_link().next;
+  }
   qps_.erase(qp_id);
   return absl::OkStatus();
 }
@@ -354,18 +491,19 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
   using BufferType = QpState::OpAddressesParams::BufferType;
 
   if (attributes.num_ops < 1) return absl::OkStatus();
-  if (attributes.initiator_qp_id >= qps_.size()) {
+  // Shard threads post concurrently, so only look qps up without inserting.
+  QpState* initiator_qp_state = qp_state(attributes.initiator_qp_id);
+  if (initiator_qp_state == nullptr) {
     return absl::OutOfRangeError(absl::StrCat("qp ", attributes.initiator_qp_id,
                                               " is not created yet!"));
   }
 
   OpTypes op_type = attributes.op_type;
-  std::string op_type_str = TestOp::ToString(op_type);
-  std::unique_ptr<QpState>& initiator_qp_state =
-      qps_[attributes.initiator_qp_id];
-  LOG(INFO) << "Post " << attributes.num_ops << " " << op_type_str
-          << " op on initiator client" << client_id() << ", "
-          << initiator_qp_state->ToString();
+  HOT_PATH_LOG(INFO) << "Post " << attributes.num_ops << " "
+                     << TestOp::ToString(op_type)
+                     << " op on initiator client" << client_id() << ", "
+                     << initiator_qp_state->ToString();
+  const bool print_op_buffers = absl::GetFlag(FLAGS_print_op_buffers);
 
   BufferType initiator_buffer_type;
   BufferType target_buffer_type;
@@ -383,8 +521,8 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
       target_buffer_type = BufferType::kSrcBuffer;
       break;
     default:
-      return absl::InternalError(
-          absl::StrCat("op_type '", op_type_str, "' not recognized."));
+      return absl::InternalError(absl::StrCat(
+          "op_type '", TestOp::ToString(op_type), "' not recognized."));
   }
 
   int op_bytes = attributes.op_bytes;
@@ -406,8 +544,7 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
   std::vector<uint8_t*> target_op_addrs = {};
   if (!is_send_recv) {
     op_buffer_info.buffer_to_use = target_buffer_type;
-    QpState* initiator_rc_qp_state = qps_[attributes.initiator_qp_id].get();
-    QpOpInterface* target_qp_state = initiator_rc_qp_state->remote_qp_state();
+    QpOpInterface* target_qp_state = initiator_qp_state->remote_qp_state();
     ASSIGN_OR_RETURN(target_op_addrs,
                      target_qp_state->GetNextOpAddresses(op_buffer_info));
   }
@@ -417,16 +554,17 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
     uint8_t* initiator_op_addr = initiator_op_addrs[i];
     const uint64_t op_id = initiator_qp_state->GetOpIdAndIncr();
 
-    // Create scatter-gather entry.
-    auto sge = std::make_unique<ibv_sge>();
-    sge->addr = reinterpret_cast<uint64_t>(initiator_op_addr);
-    sge->length = op_bytes;
-
-    auto op = std::make_unique<TestOp>();
+    // The TestOp carries its own scatter-gather entry and work request, and
+    // comes from the qp's pool, so this loop does not allocate.
+    TestOpPtr op = initiator_qp_state->NewOp();
     op->op_id = op_id;
     op->qp_id = attributes.initiator_qp_id;
-    op->length = sge->length;
+    op->length = op_bytes;
     op->op_type = op_type;
+    op->intended_post_tsc = attributes.intended_post_tsc;
+    ibv_sge* sge = &op->sge;
+    sge->addr = reinterpret_cast<uint64_t>(initiator_op_addr);
+    sge->length = op_bytes;
 
     if (initiator_buffer_type == BufferType::kSrcBuffer) {
       sge->lkey = initiator_qp_state->src_lkey();
@@ -443,13 +581,12 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
     }
 
     if (op_type == OpTypes::kRecv) {
-      // Fill in the buffer with random bytes.
-      std::generate_n(op->dest_addr, op->length, std::ref(random));
+      // Fill in the buffer with a random pattern, which no send will match.
+      buffer_pattern::Fill(static_cast<uint64_t>(random()) << 32 | random(),
+                           absl::MakeSpan(op->dest_addr, op->length));
       uint64_t wr_id = reinterpret_cast<uint64_t>(op.get());
-      auto wqe_recv = std::make_unique<ibv_recv_wr>(
-          verbs_util::CreateRecvWr(wr_id, sge.get(), /*num_sge=*/1));
-      initiator_qp_state->BatchRcRecvWqe(std::move(wqe_recv), std::move(sge),
-                                         op->op_id);
+      op->recv_wr = verbs_util::CreateRecvWr(wr_id, sge, /*num_sge=*/1);
+      initiator_qp_state->BatchRcRecvWqe(op.get());
     } else {
       uint32_t target_src_rkey;
       uint32_t target_dest_rkey;
@@ -458,17 +595,16 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
         target_src_rkey = target_qp_state->src_rkey();
         target_dest_rkey = target_qp_state->dest_rkey();
       }
-      std::unique_ptr<ibv_send_wr> wqe_send;
+      ibv_send_wr& wqe_send = op->send_wr;
       uint64_t wr_id = reinterpret_cast<uint64_t>(op.get());
       switch (op_type) {
         case OpTypes::kWrite:
-          wqe_send = std::make_unique<ibv_send_wr>(
-              verbs_util::CreateWriteWr(wr_id, sge.get(), /*num_sge=*/1,
-                                        op->dest_addr, target_dest_rkey));
+          wqe_send = verbs_util::CreateWriteWr(wr_id, sge, /*num_sge=*/1,
+                                               op->dest_addr, target_dest_rkey);
           break;
         case OpTypes::kRead:
-          wqe_send = std::make_unique<ibv_send_wr>(verbs_util::CreateReadWr(
-              wr_id, sge.get(), /*num_sge=*/1, op->src_addr, target_src_rkey));
+          wqe_send = verbs_util::CreateReadWr(wr_id, sge, /*num_sge=*/1,
+                                              op->src_addr, target_src_rkey);
           break;
         case OpTypes::kCompSwap:
           if (!attributes.swap.has_value()) {
@@ -485,9 +621,9 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
             // writes to the target address.
             op->compare_add = *reinterpret_cast<uint64_t*>(op->src_addr);
           }
-          wqe_send = std::make_unique<ibv_send_wr>(verbs_util::CreateCompSwapWr(
-              wr_id, sge.get(), /*num_sge=*/1, op->src_addr, target_src_rkey,
-              op->compare_add, attributes.swap.value()));
+          wqe_send = verbs_util::CreateCompSwapWr(
+              wr_id, sge, /*num_sge=*/1, op->src_addr, target_src_rkey,
+              op->compare_add, attributes.swap.value());
           break;
         case OpTypes::kFetchAdd:
           if (!attributes.add.has_value()) {
@@ -495,51 +631,62 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
                 "Cannot post kFetchAdd operation without a valid add value.");
           }
           op->compare_add = attributes.add.value();
-          wqe_send = std::make_unique<ibv_send_wr>(verbs_util::CreateFetchAddWr(
-              wr_id, sge.get(), /*num_sge=*/1, op->src_addr, target_src_rkey,
-              attributes.add.value()));
+          wqe_send = verbs_util::CreateFetchAddWr(wr_id, sge, /*num_sge=*/1,
+                                                  op->src_addr, target_src_rkey,
+                                                  attributes.add.value());
           break;
         case OpTypes::kSend:
-          wqe_send = std::make_unique<ibv_send_wr>(
-              verbs_util::CreateSendWr(wr_id, sge.get(), /*num_sge=*/1));
+          wqe_send = verbs_util::CreateSendWr(wr_id, sge, /*num_sge=*/1);
           break;
         default:
           return absl::InternalError(
-              absl::StrCat("op_type '", op_type_str, "' not recognized."));
+              absl::StrCat("op_type '", TestOp::ToString(op_type),
+                           "' not recognized."));
       }
 
       if (initiator_qp_state->is_rc()) {
-        InitializeSrcBuffer(op->src_addr, op->length, op->op_id);
-        initiator_qp_state->BatchRcSendWqe(std::move(wqe_send), std::move(sge),
-                                           op->op_id);
+        InitializeSrcBuffer(op->src_addr, op->length, op->qp_id, op->op_id);
+        initiator_qp_state->BatchRcSendWqe(op.get());
       } else {
         if (!attributes.ud_send_attributes.has_value()) {
           return absl::InvalidArgumentError(
               "Must provide attributes for UD send operations.");
         }
         op->remote_qp = attributes.ud_send_attributes->remote_qp;
-        wqe_send->wr.ud.ah = attributes.ud_send_attributes->remote_ah;
+        wqe_send.wr.ud.ah = attributes.ud_send_attributes->remote_ah;
         uint32_t remote_qp_num = op->remote_qp->qp()->qp_num;
-        wqe_send->wr.ud.remote_qpn = remote_qp_num;
-        wqe_send->wr.ud.remote_qkey = kQKey;
-        InitializeSrcBuffer(op->src_addr, op->length,
+        wqe_send.wr.ud.remote_qpn = remote_qp_num;
+        wqe_send.wr.ud.remote_qkey = kQKey;
+        InitializeSrcBuffer(op->src_addr, op->length, op->qp_id,
                             attributes.ud_send_attributes->remote_op_id);
+        if (op->length >= sizeof(UdPayloadHeader)) {
+          UdPayloadHeader{.client_id = static_cast<uint32_t>(client_id()),
+                          .qp_id = op->qp_id,
+                          .op_id = op->op_id}
+              .WriteTo(op->src_addr);
+        }
 
         // Post the wqe.
+        op->post_timestamp_ns = absl::GetCurrentTimeNanos();
         ibv_send_wr* bad_wr;
-        EXPECT_EQ(0, ibv_post_send(initiator_qp_state->qp(), wqe_send.get(),
+        EXPECT_EQ(0, ibv_post_send(initiator_qp_state->qp(), &wqe_send,
                                    &bad_wr));
+        initiator_qp_state->RecordPostedOp(*op, /*end_of_batch=*/true);
       }
     }
 
-    MaybePrintBuffer(
-        absl::StrFormat("client %lu, qp_id %lu, op_id: %lu, src before %s: ",
-                        client_id(), op->qp_id, op->op_id, op_type_str),
-        op->SrcBuffer());
-    MaybePrintBuffer(
-        absl::StrFormat("client %lu, qp_id %lu, op_id: %lu, dest before %s: ",
-                        client_id(), op->qp_id, op->op_id, op_type_str),
-        op->DestBuffer());
+    if (print_op_buffers) {
+      MaybePrintBuffer(
+          absl::StrFormat("client %lu, qp_id %lu, op_id: %lu, src before %s: ",
+                          client_id(), op->qp_id, op->op_id,
+                          TestOp::ToString(op_type)),
+          op->SrcBuffer());
+      MaybePrintBuffer(
+          absl::StrFormat("client %lu, qp_id %lu, op_id: %lu, dest before %s: ",
+                          client_id(), op->qp_id, op->op_id,
+                          TestOp::ToString(op_type)),
+          op->DestBuffer());
+    }
 
     (initiator_qp_state->outstanding_ops())[op->op_id] = std::move(op);
   }
@@ -556,54 +703,462 @@ absl::Status Client::PostOps(const OpAttributes& attributes) {
   return absl::OkStatus();
 }
 
+absl::Status Client::PostOneOp(
+    Client& target, uint32_t qp_id,
+    const OperationGenerator::OpAttributes& op_attributes, int ud_recv_bytes,
+    uint64_t atomic_value, bool flush, uint64_t intended_post_tsc) {
+  QpState* qp_state = this->qp_state(qp_id);
+  if (qp_state == nullptr) {
+    return absl::NotFoundError(
+        absl::StrCat("Client ", client_id(), " has no qp ", qp_id));
+  }
+  Client::OpAttributes initiator_attributes = {
+      .op_type = op_attributes.op_type,
+      .op_bytes = op_attributes.op_size_bytes,
+      .num_ops = 1,
+      .initiator_qp_id = qp_id,
+      .flush = flush,
+      .intended_post_tsc = intended_post_tsc};
+
+  switch (op_attributes.op_type) {
+    case OpTypes::kWrite:
+    case OpTypes::kRead:
+      return PostOps(initiator_attributes);
+    case OpTypes::kFetchAdd:
+      initiator_attributes.op_bytes = TestOp::kAtomicWordSize;
+      initiator_attributes.add = atomic_value;
+      return PostOps(initiator_attributes);
+    case OpTypes::kCompSwap:
+      initiator_attributes.op_bytes = TestOp::kAtomicWordSize;
+      initiator_attributes.compare = {};
+      initiator_attributes.swap = atomic_value;
+      return PostOps(initiator_attributes);
+    case OpTypes::kSend: {
+      if (qp_state->is_rc()) {
+        uint32_t remote_qp_id = qp_state->remote_qp_state()->qp_id();
+        const Client::OpAttributes target_attributes = {
+            .op_type = OpTypes::kRecv,
+            .op_bytes = op_attributes.op_size_bytes,
+            .num_ops = 1,
+            .initiator_qp_id = remote_qp_id,
+            .flush = flush};
+        RETURN_IF_ERROR(target.PostOps(target_attributes));
+        return PostOps(initiator_attributes);
+      }
+      QpState::UdDestination remote_qp = qp_state->random_ud_destination();
+      // Because UD ops are unordered, all UD receives must have space for the
+      // largest ops.
+      Client::OpAttributes target_attributes = {
+          .op_type = OpTypes::kRecv,
+          .op_bytes = ud_recv_bytes,
+          .num_ops = 1,
+          .initiator_qp_id = remote_qp.qp_state->qp_id()};
+      RETURN_IF_ERROR(target.PostOps(target_attributes));
+      initiator_attributes.ud_send_attributes = {
+          .remote_qp = remote_qp.qp_state,
+          .remote_op_id = remote_qp.qp_state->GetLastOpId(),
+          .remote_ah = remote_qp.ah};
+      return PostOps(initiator_attributes);
+    }
+
+    default:
+      LOG(ERROR) << "Unsupported op type: "
+                 << TestOp::ToString(op_attributes.op_type);
+      return absl::OkStatus();
+  }
+}
+
+void Client::StartRecording(std::unique_ptr<OpTraceWriter> trace_writer) {
+  trace_writer_ = std::move(trace_writer);
+  for (auto& [qp_id, qp_state] : qps_) {
+    qp_state->set_trace_writer(trace_writer_.get());
+  }
+  LOG(INFO) << "Client " << client_id() << " records its ops into "
+            << trace_writer_->path();
+}
+
+absl::Status Client::StopRecording() {
+  if (trace_writer_ == nullptr) return absl::OkStatus();
+  for (auto& [qp_id, qp_state] : qps_) {
+    qp_state->set_trace_writer(nullptr);
+  }
+  absl::Status status = trace_writer_->Close();
+  trace_writer_.reset();
+  return status;
+}
+
+absl::StatusOr<int> Client::ReplayTrace(Client& target,
+                                        const OpTraceReader& trace,
+                                        const size_t max_inflight_ops_total) {
+  // Number of records replayed between releasing the pages of replayed
+  // records.
+  constexpr size_t kReleaseInterval = size_t{1} << 16;
+  const absl::Duration timeout = absl::GetFlag(FLAGS_completion_timeout_s);
+  const TscClock& clock = TscClock::Get();
+  absl::Time no_completion_timeout = absl::Now() + timeout;
+  size_t inflight_ops = 0;
+  int completed_ops = 0;
+
+  // Polls and validates completions. Returns false once no completion was
+  // validated for `timeout`.
+  auto poll_completions_and_validate_them = [&]() {
+    const int count = static_cast<int>(max_inflight_ops_total) + 1;
+    for (const CompletionShard& shard : target.shards_) {
+      target.TryPollCompletions(count, shard.recv_cq);
+    }
+    for (const CompletionShard& shard : shards_) {
+      TryPollCompletions(count, shard.send_cq);
+    }
+    int validated = ValidateOrDeferCompletions();
+    absl::Time now = absl::Now();
+    if (validated > 0) {
+      completed_ops += validated;
+      inflight_ops -= validated;
+      no_completion_timeout = now + timeout;
+    }
+    return now <= no_completion_timeout;
+  };
+
+  // Qps with ops which were batched but not posted yet.
+  absl::flat_hash_set<uint32_t> unflushed_qps;
+  auto flush = [this, &target](uint32_t qp_id) {
+    QpState* qp_state = this->qp_state(qp_id);
+    if (qp_state->is_rc()) {
+      target.qp_state(qp_state->remote_qp_state()->qp_id())->FlushRcRecvWqes();
+    }
+    qp_state->FlushRcSendWqes();
+  };
+  auto timeout_error = [&]() {
+    return absl::DeadlineExceededError(absl::StrCat(
+        "Client ", client_id(), ": no completion for ",
+        absl::FormatDuration(timeout),
+        " while replaying the trace. Completed ", completed_ops, " ops, ",
+        inflight_ops, " in flight."));
+  };
+
+  // Kept in fractional ticks, so the rounding of gaps does not accumulate.
+  double next_post = clock.Now();
+  for (size_t i = 0; i < trace.size(); ++i) {
+    const OpTraceRecord& record = trace.record(i);
+    next_post += clock.FromNanos(record.gap_ns);
+    QpState* qp_state = this->qp_state(record.qp_id);
+    if (qp_state == nullptr) {
+      return absl::FailedPreconditionError(
+          absl::StrCat("Client ", client_id(), " has no qp ", record.qp_id,
+                       " to replay op ", i, " of the trace on."));
+    }
+    auto has_room = [&]() {
+      return inflight_ops < max_inflight_ops_total &&
+             qp_state->outstanding_ops_count() +
+                     qp_state->unchecked_initiated_ops().size() <
+                 static_cast<size_t>(max_outstanding_ops_per_qp_);
+    };
+    if (!has_room()) {
+      // Batched ops cannot complete, so post them before waiting for room.
+      for (uint32_t qp_id : unflushed_qps) flush(qp_id);
+      unflushed_qps.clear();
+    }
+    while (!has_room() || clock.Now() < next_post) {
+      if (!poll_completions_and_validate_them()) return timeout_error();
+    }
+
+    RETURN_IF_ERROR(PostOneOp(
+        target, record.qp_id,
+        {record.type(), static_cast<int>(record.op_size_bytes)},
+        /*ud_recv_bytes=*/trace.max_op_size_bytes(), /*atomic_value=*/i,
+        /*flush=*/false, /*intended_post_tsc=*/0));
+    ++inflight_ops;
+    if (record.end_of_batch()) {
+      flush(record.qp_id);
+      unflushed_qps.erase(record.qp_id);
+    } else {
+      unflushed_qps.insert(record.qp_id);
+    }
+    if ((i + 1) % kReleaseInterval == 0) {
+      trace.Release(i + 1);
+    }
+  }
+
+  for (uint32_t qp_id : unflushed_qps) flush(qp_id);
+  while (inflight_ops > 0) {
+    if (!poll_completions_and_validate_them()) return timeout_error();
+  }
+  LOG(INFO) << "Client " << client_id() << ": Replayed " << trace.size()
+            << " ops, completed " << completed_ops << ".";
+  return completed_ops;
+}
+
 int Client::ExecuteOps(Client& target, const size_t num_qps,
                        const size_t ops_per_qp, const size_t batch_per_qp,
                        const size_t max_inflight_per_qp,
                        const size_t max_inflight_ops_total,
                        const Client::CompletionMethod completion_method) {
+  // Each shard's qps are driven by their own thread, which only touches the
+  // completion queues of that shard on both clients. This requires every qp
+  // and its remote qp to belong to the same shard, otherwise all qps are
+  // driven by the calling thread.
+  const size_t num_shards = shards_.size();
+  bool sharded = num_shards > 1 && num_qps > 1;
+  if (sharded && target.shards_.size() != num_shards) {
+    LOG(WARNING) << "Client " << client_id() << " has " << num_shards
+                 << " shards but target client " << target.client_id()
+                 << " has " << target.shards_.size()
+                 << ". Executing ops on a single thread.";
+    sharded = false;
+  }
+  for (uint32_t qp_id = 0; sharded && qp_id < num_qps; ++qp_id) {
+    QpState* qp = qp_state(qp_id);
+    if (qp == nullptr || !qp->is_rc() || qp->remote_qp_state() == nullptr ||
+        qp->remote_qp_state()->qp_id() % num_shards != qp_id % num_shards) {
+      LOG(WARNING) << "Client " << client_id() << ": qp " << qp_id
+                   << " cannot be sharded (only RC qps whose remote qp is in "
+                      "the same shard can). Executing ops on a single thread.";
+      sharded = false;
+    }
+  }
+
+  LOG(INFO) << "Client " << client_id() << ": Issue " << ops_per_qp
+            << " ops per qp.";
+
+  PrepareSendCompletionChannel(completion_method);
+  target.PrepareRecvCompletionChannel(completion_method);
+  // Bound the drift of the HCA clocks over this run.
+  for (Client* client : {this, &target}) {
+    if (!client->hca_clock_.has_value()) continue;
+    absl::Status status = client->hca_clock_->Calibrate();
+    if (!status.ok()) {
+      LOG(WARNING) << "Client " << client->client_id()
+                   << ": failed to calibrate the HCA clock: " << status;
+      client->hca_clock_.reset();
+    }
+  }
+
+  const std::optional<OpPacer::Options> offered_load = OfferedLoadFromFlags();
+  const absl::Time start_time = absl::Now();
+  std::vector<ExecuteOpsStats> shard_stats;
+  if (!sharded) {
+    std::vector<uint32_t> qp_ids(num_qps);
+    std::iota(qp_ids.begin(), qp_ids.end(), 0);
+    std::vector<CompletionShard*> send_shards;
+    for (CompletionShard& shard : shards_) send_shards.push_back(&shard);
+    std::vector<CompletionShard*> recv_shards;
+    for (CompletionShard& shard : target.shards_) recv_shards.push_back(&shard);
+    shard_stats.push_back(ExecuteOpsOnShard(
+        target, qp_ids, send_shards, recv_shards, ops_per_qp, batch_per_qp,
+        max_inflight_per_qp, max_inflight_ops_total, completion_method,
+        offered_load, absl::StrCat("Client ", client_id())));
+  } else {
+    std::vector<std::vector<uint32_t>> shard_qp_ids(num_shards);
+    for (uint32_t qp_id = 0; qp_id < num_qps; ++qp_id) {
+      shard_qp_ids[qp_id % num_shards].push_back(qp_id);
+    }
+    shard_stats.resize(num_shards);
+    const int cpu_offset = absl::GetFlag(FLAGS_shard_cpu_offset);
+    // Pin to the cpus the process may run on, so that pinning does not fail
+    // under a restricted affinity mask.
+    std::vector<int> cpus;
+    if (cpu_offset >= 0) {
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+          if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+      }
+      LOG_IF(WARNING, cpus.empty())
+          << "Client " << client_id()
+          << ": failed to get the cpu affinity, not pinning shards: "
+          << std::strerror(errno);
+    }
+    std::vector<std::thread> workers;
+    for (size_t shard = 0; shard < num_shards; ++shard) {
+      if (shard_qp_ids[shard].empty()) continue;
+      // Inflight ops are split between shards in proportion to their qps.
+      size_t shard_max_inflight = std::max<size_t>(
+          1, max_inflight_ops_total * shard_qp_ids[shard].size() / num_qps);
+      // So is the offered load.
+      std::optional<OpPacer::Options> shard_offered_load = offered_load;
+      if (shard_offered_load.has_value()) {
+        const double fraction =
+            static_cast<double>(shard_qp_ids[shard].size()) / num_qps;
+        shard_offered_load->ops_per_sec *= fraction;
+        shard_offered_load->gbps *= fraction;
+      }
+      workers.emplace_back([this, &target, &shard_qp_ids, &shard_stats, &cpus,
+                            shard, cpu_offset, ops_per_qp, batch_per_qp,
+                            max_inflight_per_qp, shard_max_inflight,
+                            shard_offered_load, completion_method]() {
+        if (!cpus.empty()) {
+          const int cpu = cpus[(cpu_offset + shard) % cpus.size()];
+          cpu_set_t cpu_set;
+          CPU_ZERO(&cpu_set);
+          CPU_SET(cpu, &cpu_set);
+          int ret =
+              pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+          LOG_IF(WARNING, ret != 0)
+              << "Client " << client_id() << ": failed to pin shard " << shard
+              << " to cpu " << cpu << ": " << std::strerror(ret);
+        }
+        shard_stats[shard] = ExecuteOpsOnShard(
+            target, shard_qp_ids[shard], {&shards_[shard]},
+            {&target.shards_[shard]}, ops_per_qp, batch_per_qp,
+            max_inflight_per_qp, shard_max_inflight, completion_method,
+            shard_offered_load,
+            absl::StrCat("Client ", client_id(), " shard ", shard));
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Merge the per-shard results.
+  ExecuteOpsStats stats;
+  for (const ExecuteOpsStats& shard : shard_stats) {
+    stats.issued_ops += shard.issued_ops;
+    stats.completed_ops += shard.completed_ops;
+    stats.total_bytes += shard.total_bytes;
+    stats.send_completions += shard.send_completions;
+    stats.recv_completions += shard.recv_completions;
+    for (const auto& [op_type, count] : shard.issued_ops_by_type) {
+      stats.issued_ops_by_type[op_type] += count;
+    }
+    stats.issue_lag.Merge(shard.issue_lag);
+    stats.status.Update(shard.status);
+  }
+  EXPECT_OK(stats.status) << "Client " << client_id()
+                          << " failed to post ops: " << stats.status;
+  const absl::Duration elapsed = absl::Now() - start_time;
+  total_completions_ += stats.send_completions;
+  target.total_completions_ += stats.recv_completions;
+
+  LOG(INFO) << "Client " << client_id() << ": Asked for " << ops_per_qp
+            << " ops per qp, on " << num_qps
+            << " qps, total of : " << ops_per_qp * num_qps << "ops, totalling "
+            << stats.total_bytes << " bytes. Issued " << stats.issued_ops
+            << ". Completed " << stats.completed_ops << ".";
+
+  // Log the number of issued operations of each type.
+  for (auto& elem : stats.issued_ops_by_type) {
+    LOG(INFO) << "Issued " << elem.second << " " << TestOp::ToString(elem.first)
+              << " operations.";
+  }
+  if (offered_load.has_value()) {
+    const double elapsed_s = absl::ToDoubleSeconds(elapsed);
+    LOG(INFO) << "Client " << client_id() << ": Offered "
+              << (offered_load->ops_per_sec > 0
+                      ? absl::StrCat(offered_load->ops_per_sec, " ops/s")
+                      : absl::StrCat(offered_load->gbps, " Gb/s"))
+              << ", achieved " << stats.issued_ops / elapsed_s << " ops/s, "
+              << stats.total_bytes * 8 / elapsed_s / 1e9
+              << " Gb/s. Issue lag: " << stats.issue_lag.ToString();
+    LatencyHistograms latencies;
+    for (const CompletionShard& shard : shards_) {
+      for (const auto& [key, histogram] : shard.offered_load_latencies) {
+        latencies[key].Merge(histogram);
+      }
+    }
+    for (const auto& [key, histogram] : latencies) {
+      LOG(INFO) << "Client " << client_id() << ": Latency from intended issue "
+                << "time of " << TestOp::ToString(key.first) << " "
+                << key.second << "B ops: " << histogram.ToString();
+    }
+  }
+  LogPollStats();
+  target.LogPollStats();
+
+  return stats.completed_ops;
+}
+
+Client::ExecuteOpsStats Client::ExecuteOpsOnShard(
+    Client& target, absl::Span<const uint32_t> qp_ids,
+    absl::Span<CompletionShard* const> send_shards,
+    absl::Span<CompletionShard* const> recv_shards, const size_t ops_per_qp,
+    const size_t batch_per_qp, const size_t max_inflight_per_qp,
+    const size_t max_inflight_ops_total,
+    const Client::CompletionMethod completion_method,
+    std::optional<OpPacer::Options> offered_load,
+    absl::string_view log_prefix) {
   absl::Duration kTimeout = absl::GetFlag(FLAGS_completion_timeout_s);
   absl::Time no_completion_timeout = absl::Now() + kTimeout;
 
+  const size_t num_qps = qp_ids.size();
   size_t completions_at_once = max_inflight_ops_total + 1;
   size_t total_expected_ops = ops_per_qp * num_qps;
   absl::Time last_op_time = absl::InfinitePast();
+  const TscClock& clock = TscClock::Get();
+  std::optional<OpPacer> pacer;
+  if (offered_load.has_value()) {
+    pacer.emplace(*offered_load, clock.Now());
+  }
 
-  size_t completed_ops = 0;
-  size_t issued_ops = 0;
-  absl::flat_hash_map<OpTypes, int> issued_ops_by_type = {};
+  ExecuteOpsStats stats;
+  size_t& completed_ops = stats.completed_ops;
+  size_t& issued_ops = stats.issued_ops;
+  absl::flat_hash_map<OpTypes, int>& issued_ops_by_type =
+      stats.issued_ops_by_type;
   size_t inflight_ops = 0;
-  uint16_t next_qp_id = 0;
-  size_t total_bytes = 0;
+  size_t next_qp_index = 0;
+  size_t& total_bytes = stats.total_bytes;
 
   // 'map: [qp_id -> num_ops_completed]' to account for previously finished ops.
   absl::flat_hash_map<int, int> previously_completed_ops;
-  for (auto const& [qp_id, qp] : qps_) {
-    previously_completed_ops[qp->qp_id()] = qp->TotalOpsCompleted();
+  for (uint32_t qp_id : qp_ids) {
+    previously_completed_ops[qp_id] = qps_.at(qp_id)->TotalOpsCompleted();
   }
+  const bool print_op_buffers = absl::GetFlag(FLAGS_print_op_buffers);
+  // Completed ops hold their buffer slots until they are validated, so the
+  // per qp limit counts them too, and never exceeds the slots of a qp.
+  const size_t qp_op_budget = std::min(
+      max_inflight_per_qp, static_cast<size_t>(max_outstanding_ops_per_qp_));
+  // The dirty lists of `send_shards` hold no other qps below this id than
+  // `qp_ids`, which are sorted.
+  const uint32_t qp_id_limit = qp_ids.empty() ? 0 : qp_ids.back() + 1;
 
   // Lambda function that polls and validates completions depending on op_type.
   auto poll_completions_and_validate_them =
-      [this, &completed_ops, &no_completion_timeout, &inflight_ops, &target,
+      [this, &stats, &completed_ops, &no_completion_timeout, &inflight_ops,
+       &target, send_shards, recv_shards, print_op_buffers, qp_id_limit,
        completions_at_once, kTimeout, completion_method]() {
-        int recv_completions;
-        int send_completions;
+        int recv_completions = 0;
+        int send_completions = 0;
         switch (completion_method) {
           case Client::CompletionMethod::kPolling:
-            recv_completions =
-                target.TryPollRecvCompletions(completions_at_once);
-            send_completions = TryPollSendCompletions(completions_at_once);
+            for (CompletionShard* shard : recv_shards) {
+              recv_completions += target.PollAndStoreCompletions(
+                  completions_at_once, shard->recv_cq);
+            }
+            for (CompletionShard* shard : send_shards) {
+              send_completions +=
+                  PollAndStoreCompletions(completions_at_once, shard->send_cq);
+            }
             break;
           case Client::CompletionMethod::kEventDrivenBlocking:
           case Client::CompletionMethod::kEventDrivenNonBlocking:
-            recv_completions = target.TryPollRecvCompletionsEventDriven();
-            send_completions = TryPollSendCompletionsEventDriven();
+            for (CompletionShard* shard : recv_shards) {
+              CHECK(shard->recv_epoll_fd.has_value());  // Crash OK
+              recv_completions += target.PollAndStoreCompletionsEventDriven(
+                  *shard->recv_epoll_fd, shard->recv_cq);
+            }
+            for (CompletionShard* shard : send_shards) {
+              CHECK(shard->send_epoll_fd.has_value());  // Crash OK
+              send_completions += PollAndStoreCompletionsEventDriven(
+                  *shard->send_epoll_fd, shard->send_cq);
+            }
             break;
         }
-        int validated = ValidateOrDeferCompletions();
+        stats.send_completions += send_completions;
+        stats.recv_completions += recv_completions;
+        int validated = 0;
+        for (CompletionShard* shard : send_shards) {
+          validated += ValidateOrDeferShardCompletions(*shard, qp_id_limit,
+                                                       print_op_buffers);
+        }
 
         if (send_completions || recv_completions || validated) {
-          LOG(INFO) << "Completions Fetched/Validated "
-                  << send_completions + recv_completions << "/" << validated;
+          HOT_PATH_LOG(INFO) << "Completions Fetched/Validated "
+                             << send_completions + recv_completions << "/"
+                             << validated;
         }
         if (validated > 0) {
           completed_ops += validated;
@@ -615,13 +1170,18 @@ int Client::ExecuteOps(Client& target, const size_t num_qps,
   // Lambda function that selects a qp to issue an op on. If inflight_ops is
   // less than max and we haven't issued all ops yet, then issue a new op.
   // Selects the qps in round robin fashion.
-  auto maybe_issue_next_op = [this, &target, total_expected_ops,
+  auto maybe_issue_next_op = [this, &target, qp_ids, total_expected_ops,
                               max_inflight_ops_total, ops_per_qp, batch_per_qp,
-                              max_inflight_per_qp, num_qps, &next_qp_id,
+                              qp_op_budget, num_qps, &next_qp_index,
                               &inflight_ops, &issued_ops, &issued_ops_by_type,
                               &total_bytes, &previously_completed_ops,
-                              &last_op_time](const absl::Time now) {
-    if (now - last_op_time < absl::GetFlag(FLAGS_inter_op_delay_us)) return;
+                              &last_op_time, &clock, &pacer, &stats,
+                              log_prefix](const absl::Time now) {
+    if (pacer.has_value()) {
+      if (!pacer->Due(clock.Now())) return;
+    } else if (now - last_op_time < absl::GetFlag(FLAGS_inter_op_delay_us)) {
+      return;
+    }
 
     if (issued_ops >= total_expected_ops ||
         inflight_ops >= max_inflight_ops_total)
@@ -633,43 +1193,51 @@ int Client::ExecuteOps(Client& target, const size_t num_qps,
              qp_state->outstanding_ops_count() -
              previously_completed_ops[qp_state->qp_id()];
     };
+    // Ops which hold buffer slots of the qp: in flight or not yet validated.
+    auto qp_held_ops = [](const std::unique_ptr<QpState>& qp_state) {
+      return qp_state->outstanding_ops_count() +
+             qp_state->unchecked_initiated_ops().size();
+    };
 
     // Find the next qp that has not ops_per_qp posted on.
-    auto next_qp_id_old = next_qp_id;
+    auto next_qp_index_old = next_qp_index;
     while (true) {
-      std::unique_ptr<QpState>& qp_state = qps_[next_qp_id];
+      const std::unique_ptr<QpState>& qp_state = qps_.at(qp_ids[next_qp_index]);
       uint64_t new_ops_issued = qp_new_ops(qp_state);
-      if (new_ops_issued < ops_per_qp &&
-          qp_state->outstanding_ops_count() < max_inflight_per_qp) {
-        LOG(INFO) << "Selected qp  " << qp_state->qp_id()
-                << " to issue new op(s) on, with " << new_ops_issued
-                << " ops on it.";
+      if (new_ops_issued < ops_per_qp && qp_held_ops(qp_state) < qp_op_budget) {
+        HOT_PATH_LOG(INFO) << "Selected qp  " << qp_state->qp_id()
+                           << " to issue new op(s) on, with "
+                           << new_ops_issued << " ops on it.";
         break;
       }
 
-      next_qp_id = (next_qp_id + 1) % num_qps;
-      if (next_qp_id == next_qp_id_old) {
-        LOG(INFO) << "Searched over all qps. Not issuing a new op.";
+      next_qp_index = (next_qp_index + 1) % num_qps;
+      if (next_qp_index == next_qp_index_old) {
+        HOT_PATH_LOG(INFO) << "Searched over all qps. Not issuing a new op.";
         return;
       }
     }
 
-    std::unique_ptr<QpState>& qp_state = qps_[next_qp_id];
+    const uint32_t next_qp_id = qp_ids[next_qp_index];
+    const std::unique_ptr<QpState>& qp_state = qps_.at(next_qp_id);
     // Calculate how many ops we can post on the selected qp. This is the min of
     // 1. Number of ops required to complete a batch of send WQEs.
-    // 2. Number of ops required to reach max inflight per qp.
+    // 2. Number of ops required to reach max inflight per qp, counting ops
+    //    which still hold buffer slots until they are validated.
     // 3. Number of ops required to reach total ops to be posted per qp.
     // 4. Number of ops required to reach total max inflight ops across all qps.
     int ops_to_batch = batch_per_qp - qp_state->SendRcBatchCount();
-    int ops_to_max_inflight_per_qp = max_inflight_per_qp -
-                                     qp_state->outstanding_ops_count() -
-                                     qp_state->unchecked_initiated_ops().size();
+    int ops_to_max_inflight_per_qp = qp_op_budget - qp_held_ops(qp_state);
     int ops_to_total_ops_per_qp = ops_per_qp - qp_new_ops(qp_state);
     int ops_to_total_inflight = max_inflight_ops_total - inflight_ops;
 
     int ops_to_post =
         std::min({ops_to_batch, ops_to_max_inflight_per_qp,
                   ops_to_total_ops_per_qp, ops_to_total_inflight});
+    // Open-loop ops are issued one at a time, each when it is due.
+    if (pacer.has_value()) {
+      ops_to_post = std::min(ops_to_post, 1);
+    }
     if (ops_to_post <= 0) {
       return;
     }
@@ -680,175 +1248,289 @@ int Client::ExecuteOps(Client& target, const size_t num_qps,
           qp_state->op_generator()->NextOp();
       const OpTypes op_type = op_attributes.op_type;
       const int op_size_bytes = op_attributes.op_size_bytes;
-      Client::OpAttributes initiator_attributes = {
-          .op_type = op_type,
-          .op_bytes = op_size_bytes,
-          .num_ops = 1,
-          .initiator_qp_id = next_qp_id,
-          .flush = false};
-
-      switch (op_type) {
-        case OpTypes::kWrite:
-        case OpTypes::kRead:
-          ASSERT_OK(PostOps(initiator_attributes));
-          break;
-        case OpTypes::kFetchAdd:
-          initiator_attributes.op_bytes = TestOp::kAtomicWordSize;
-          initiator_attributes.add = i;
-          ASSERT_OK(PostOps(initiator_attributes));
-          break;
-        case OpTypes::kCompSwap:
-          initiator_attributes.op_bytes = TestOp::kAtomicWordSize;
-          initiator_attributes.compare = {};
-          initiator_attributes.swap = i;
-          ASSERT_OK(PostOps(initiator_attributes));
-          break;
-        case OpTypes::kSend: {
-          if (qp_state->is_rc()) {
-            uint32_t remote_qp_id = qp_state->remote_qp_state()->qp_id();
-            const Client::OpAttributes target_attributes = {
-                .op_type = OpTypes::kRecv,
-                .op_bytes = op_attributes.op_size_bytes,
-                .num_ops = 1,
-                .initiator_qp_id = remote_qp_id,
-                .flush = false};
-            ASSERT_OK(target.PostOps(target_attributes));
-            ASSERT_OK(PostOps(initiator_attributes));
-          } else {
-            QpState::UdDestination remote_qp =
-                qp_state->random_ud_destination();
-            // Because UD ops are unordered, all UD receives must have space
-            // for the largest ops.
-            Client::OpAttributes target_attributes = {
-                .op_type = OpTypes::kRecv,
-                .op_bytes = qp_state->op_generator()->MaxOpSize(),
-                .num_ops = 1,
-                .initiator_qp_id = remote_qp.qp_state->qp_id()};
-            ASSERT_OK(target.PostOps(target_attributes));
-            initiator_attributes.ud_send_attributes = {
-                .remote_qp = remote_qp.qp_state,
-                .remote_op_id = remote_qp.qp_state->GetLastOpId(),
-                .remote_ah = remote_qp.ah};
-            ASSERT_OK(PostOps(initiator_attributes));
-          }
-          break;
-        }
-
-        default:
-          LOG(ERROR) << "Unsupported op type: " << TestOp::ToString(op_type);
+      // Shards run on their own threads, where a failed gtest assertion would
+      // not stop the test. Stop issuing ops and report the error instead.
+      absl::Status status = PostOneOp(
+          target, next_qp_id, op_attributes,
+          /*ud_recv_bytes=*/qp_state->op_generator()->MaxOpSize(),
+          /*atomic_value=*/i, /*flush=*/false,
+          pacer.has_value() ? pacer->next_intended() : 0);
+      if (!status.ok()) {
+        stats.status = std::move(status);
+        ops_to_post = i;
+        break;
       }
 
       issued_ops_by_type[op_type] += 1;
       total_bytes += op_size_bytes;
+      if (pacer.has_value()) {
+        pacer->Issue(op_size_bytes, clock.Now());
+      }
     }
 
     inflight_ops += ops_to_post;
     issued_ops += ops_to_post;
-    LOG(INFO) << "Client " << client_id() << ": Batched " << ops_to_post
-            << " new ops. All issued ops: " << issued_ops
-            << ", Total outstanding_ops_count: " << inflight_ops;
+    HOT_PATH_LOG(INFO) << log_prefix << ": Batched " << ops_to_post
+                       << " new ops. All issued ops: " << issued_ops
+                       << ", Total outstanding_ops_count: " << inflight_ops;
 
-    if (qp_state->is_rc() && (qp_state->SendRcBatchCount() >= batch_per_qp ||
+    if (qp_state->is_rc() && (pacer.has_value() ||
+                              qp_state->SendRcBatchCount() >= batch_per_qp ||
                               qp_new_ops(qp_state) >= ops_per_qp)) {
       target.qp_state(next_qp_id)->FlushRcRecvWqes();
       qp_state->FlushRcSendWqes();
     }
 
     last_op_time = absl::Now();
-    next_qp_id = (next_qp_id + 1) % num_qps;
+    next_qp_index = (next_qp_index + 1) % num_qps;
     LOG_IF(INFO, issued_ops == total_expected_ops)
         << "Posted all requested OPs.";
   };
 
-  LOG(INFO) << "Client " << client_id() << ": Issue " << ops_per_qp
-            << " ops per qp.";
-
-  PrepareSendCompletionChannel(completion_method);
-  target.PrepareRecvCompletionChannel(completion_method);
+  // Progress is logged as one aggregate line per `summary_interval` instead of
+  // one line per op, which keeps logging off the datapath.
+  const absl::Duration summary_interval =
+      absl::GetFlag(FLAGS_op_summary_interval);
+  absl::Time last_summary_time = absl::Now();
+  size_t last_summary_completed_ops = completed_ops;
+  size_t last_summary_bytes = total_bytes;
+  auto maybe_log_summary = [&](const absl::Time now) {
+    absl::Duration elapsed = now - last_summary_time;
+    if (elapsed < summary_interval) return;
+    double elapsed_s = absl::ToDoubleSeconds(elapsed);
+    size_t interval_ops = completed_ops - last_summary_completed_ops;
+    size_t interval_bytes = total_bytes - last_summary_bytes;
+    LOG(INFO) << log_prefix << ": issued " << issued_ops
+              << ", completed " << completed_ops << ", inflight "
+              << inflight_ops << ". Last " << elapsed << ": " << interval_ops
+              << " ops (" << interval_ops / elapsed_s << " ops/s), "
+              << interval_bytes << " bytes issued ("
+              << interval_bytes / elapsed_s << " B/s).";
+    last_summary_time = now;
+    last_summary_completed_ops = completed_ops;
+    last_summary_bytes = total_bytes;
+  };
 
   // Experiment run loop.
   while (true) {
     // Fetch and validate available completions.
     poll_completions_and_validate_them();
     absl::Time now = absl::Now();
-    // End the experiment if all ops are issued and completed or haven't
-    // received new completions for over `kTimeout` since the last one.
-    if (now > no_completion_timeout || completed_ops >= total_expected_ops) {
+    // End the experiment if all ops are issued and completed, an op failed to
+    // post or no new completions arrived for over `kTimeout` since the last
+    // one.
+    if (now > no_completion_timeout || completed_ops >= total_expected_ops ||
+        !stats.status.ok()) {
       break;
     }
+    maybe_log_summary(now);
 
     // Issue the next op if possible.
     maybe_issue_next_op(now);
   }
 
-  LOG(INFO) << "Client " << client_id() << ": Asked for " << ops_per_qp
-            << " ops per qp, on " << num_qps
-            << " qps, total of : " << ops_per_qp * num_qps << "ops, totalling "
-            << total_bytes << " bytes. Issued " << issued_ops << ". Completed "
-            << completed_ops << ".";
-
-  // Log the number of issued operations of each type.
-  for (auto& elem : issued_ops_by_type) {
-    LOG(INFO) << "Issued " << elem.second << " " << TestOp::ToString(elem.first)
-              << " operations.";
-  }
-
-  return completed_ops;
+  return stats;
 }
 
 int Client::TryPollSendCompletions(int count) {
-  return TryPollCompletions(count, send_cq_);
+  int num_completed = 0;
+  for (const CompletionShard& shard : shards_) {
+    if (num_completed >= count) break;
+    num_completed += TryPollCompletions(count - num_completed, shard.send_cq);
+  }
+  return num_completed;
 }
 
 int Client::TryPollRecvCompletions(int count) {
-  return TryPollCompletions(count, recv_cq_);
+  int num_completed = 0;
+  for (const CompletionShard& shard : shards_) {
+    if (num_completed >= count) break;
+    num_completed += TryPollCompletions(count - num_completed, shard.recv_cq);
+  }
+  return num_completed;
 }
 
 int Client::TryPollCompletions(int count, ibv_cq* cq) {
-  std::vector<ibv_wc> completions(count);
-  int returned = ibv_poll_cq(cq, count, completions.data());
-  CHECK_LE(returned, count);  // Crash OK
-  if (returned == 0) return 0;
-
-  if (returned < 0) {
-    LOG(ERROR) << "Client " << client_id()
-               << ": ERROR polling completion queue!";
+  int num_completed = PollAndStoreCompletions(count, cq);
+  total_completions_ += num_completed;
+  if (HotPathLoggingEnabled()) {
+    LOG_EVERY_N(INFO, 10) << "Client " << client_id() << ": Received "
+                          << total_completions_ << " completions.";
+  }
+  return num_completed;
+}
+
+int Client::PollAndStoreCompletions(int count, ibv_cq* cq) {
+  ibv_cq_ex* cq_ex = nullptr;
+  uint64_t* failed_completions = nullptr;
+  CompletionPoller& poller = PollerFor(cq, &cq_ex, &failed_completions);
+  if (cq_ex != nullptr) {
+    return PollAndStoreExtendedCompletions(count, cq_ex, poller,
+                                           *failed_completions);
+  }
+  int num_completed = 0;
+  int remaining = count;
+  while (remaining > 0) {
+    bool error = false;
+    absl::Span<const ibv_wc> completions = poller.Poll(cq, remaining, &error);
+    if (error) {
+      LOG(ERROR) << "Client " << client_id()
+                 << ": ERROR polling completion queue!";
+      break;
+    }
+
+    const uint64_t now_ns =
+        completions.empty() ? 0 : absl::GetCurrentTimeNanos();
+    for (const ibv_wc& completion : completions) {
+      if (StoreCompletion(&completion, now_ns)) {
+        ++num_completed;
+      } else {
+        ++*failed_completions;
+        // If completion fails, check if we have async events and ack them to
+        // move forward.
+        // TODO(author5): Ideally we should handle AE in a separate thread
+        // concurrently.
+        HandleAsyncEvents();
+      }
+    }
+    // A partial batch means the cq is drained.
+    int polled = completions.size();
+    if (polled < std::min(remaining, poller.batch_size())) break;
+    remaining -= polled;
+  }
+  return num_completed;
+}
+
+int Client::PollAndStoreExtendedCompletions(int count, ibv_cq_ex* cq_ex,
+                                            CompletionPoller& poller,
+                                            uint64_t& failed_completions) {
+  if (count <= 0) return 0;
+  ibv_poll_cq_attr poll_attr = {};
+  int ret = ibv_start_poll(cq_ex, &poll_attr);
+  if (ret != 0) {
+    LOG_IF(ERROR, ret != ENOENT)
+        << "Client " << client_id() << ": ERROR polling completion queue!";
+    poller.RecordPoll(0);
     return 0;
   }
 
+  const uint64_t now_ns = absl::GetCurrentTimeNanos();
+  int polled = 0;
   int num_completed = 0;
-  for (int i = 0; i < returned; ++i) {
-    if (StoreCompletion(&completions[i])) {
-      ++num_completed;
+  int num_failed = 0;
+  do {
+    ++polled;
+    if (cq_ex->status != IBV_WC_SUCCESS) {
+      ibv_wc completion = {.wr_id = cq_ex->wr_id,
+                           .status = cq_ex->status,
+                           .opcode = ibv_wc_read_opcode(cq_ex),
+                           .vendor_err = ibv_wc_read_vendor_err(cq_ex)};
+      LOG(INFO) << "Polled completion with error: ";
+      verbs_util::PrintCompletion(completion);
+      ++num_failed;
     } else {
-      // If completion fails, check if we have async events and ack them to move
-      // forward.
-      // TODO(author5): Ideally we should handle AE in a separate thread
-      // concurrently.
-      HandleAsyncEvents();
+      auto* op = reinterpret_cast<TestOp*>(cq_ex->wr_id);
+      op->byte_len = ibv_wc_read_byte_len(cq_ex);
+      uint64_t completion_ns = now_ns;
+      if (completion_timestamps_) {
+        op->completion_timestamp = ibv_wc_read_completion_ts(cq_ex);
+        if (op->completion_timestamp != 0) {
+          ++shards_[op->qp_id % shards_.size()].timestamped_completions;
+          if (hca_clock_.has_value()) {
+            completion_ns = hca_clock_->ToHostNanos(op->completion_timestamp);
+          }
+        }
+      }
+      StoreOpCompletion(op, completion_ns);
+      ++num_completed;
     }
+  } while (polled < count && ibv_next_poll(cq_ex) == 0);
+  ibv_end_poll(cq_ex);
+  poller.RecordPoll(polled);
+  failed_completions += num_failed;
+
+  // If completion fails, check if we have async events and ack them to move
+  // forward.
+  for (int i = 0; i < num_failed; ++i) {
+    HandleAsyncEvents();
   }
-  total_completions_ += num_completed;
-  LOG_EVERY_N(INFO, 10) << "Client " << client_id() << ": Received "
-                        << total_completions_ << " completions.";
   return num_completed;
 }
+
+CompletionPoller& Client::PollerFor(ibv_cq* cq, ibv_cq_ex** cq_ex,
+                                    uint64_t** failed_completions) {
+  for (CompletionShard& shard : shards_) {
+    if (shard.send_cq == cq) {
+      *cq_ex = shard.send_cq_ex;
+      *failed_completions = &shard.failed_completions;
+      return shard.send_poller;
+    }
+    if (shard.recv_cq == cq) {
+      *cq_ex = shard.recv_cq_ex;
+      *failed_completions = &shard.failed_completions;
+      return shard.recv_poller;
+    }
+  }
+  *cq_ex = nullptr;
+  *failed_completions = &fallback_failed_completions_;
+  return fallback_poller_;
+}
+
+uint64_t Client::failed_completions() const {
+  uint64_t failed_completions = fallback_failed_completions_;
+  for (const CompletionShard& shard : shards_) {
+    failed_completions += shard.failed_completions;
+  }
+  return failed_completions;
+}
+
+uint64_t Client::timestamped_completions() const {
+  uint64_t timestamped_completions = 0;
+  for (const CompletionShard& shard : shards_) {
+    timestamped_completions += shard.timestamped_completions;
+  }
+  return timestamped_completions;
+}
+
+bool Client::extended_cqs() const {
+  for (const CompletionShard& shard : shards_) {
+    if (shard.send_cq_ex == nullptr || shard.recv_cq_ex == nullptr) {
+      return false;
+    }
+  }
+  return !shards_.empty();
+}
+
 absl::StatusOr<int> Client::PollSendCompletions(
     int count, absl::Duration timeout_duration) {
-  return PollCompletions(count, send_cq_, timeout_duration);
+  std::vector<ibv_cq*> cqs;
+  for (const CompletionShard& shard : shards_) cqs.push_back(shard.send_cq);
+  return PollCompletions(count, cqs, timeout_duration);
 }
 
 absl::StatusOr<int> Client::PollRecvCompletions(
     int count, absl::Duration timeout_duration) {
-  return PollCompletions(count, recv_cq_, timeout_duration);
+  std::vector<ibv_cq*> cqs;
+  for (const CompletionShard& shard : shards_) cqs.push_back(shard.recv_cq);
+  return PollCompletions(count, cqs, timeout_duration);
 }
 
 absl::StatusOr<int> Client::PollCompletions(int count, ibv_cq* cq,
                                             absl::Duration timeout_duration) {
+  return PollCompletions(count, absl::MakeConstSpan(&cq, 1), timeout_duration);
+}
+
+absl::StatusOr<int> Client::PollCompletions(int count,
+                                            absl::Span<ibv_cq* const> cqs,
+                                            absl::Duration timeout_duration) {
   absl::Time timeout = absl::Now() + timeout_duration;
   int num_completed = 0;
   while (true) {
-    int num_polled = TryPollCompletions(count - num_completed, cq);
+    int num_polled = 0;
+    for (ibv_cq* cq : cqs) {
+      if (num_completed + num_polled >= count) break;
+      num_polled += TryPollCompletions(count - num_completed - num_polled, cq);
+    }
     num_completed += num_polled;
     if (num_completed == count) {
       break;
@@ -870,10 +1552,14 @@ absl::StatusOr<int> Client::PollCompletions(int count, ibv_cq* cq,
 }
 
 void Client::PrepareSendCompletionChannel(CompletionMethod method) {
-  PrepareCompletionChannel(method, send_cq_, send_epoll_fd_);
+  for (CompletionShard& shard : shards_) {
+    PrepareCompletionChannel(method, shard.send_cq, shard.send_epoll_fd);
+  }
 }
 void Client::PrepareRecvCompletionChannel(CompletionMethod method) {
-  PrepareCompletionChannel(method, recv_cq_, recv_epoll_fd_);
+  for (CompletionShard& shard : shards_) {
+    PrepareCompletionChannel(method, shard.recv_cq, shard.recv_epoll_fd);
+  }
 }
 void Client::PrepareCompletionChannel(CompletionMethod method, ibv_cq* cq,
                                       std::optional<const int>& epoll_fd) {
@@ -928,16 +1614,33 @@ void Client::MakeCompletionChannelBlocking(ibv_cq* cq) {
 }
 
 int Client::TryPollSendCompletionsEventDriven() {
-  CHECK(send_epoll_fd_.has_value());  // Crash OK
-  return TryPollCompletionsEventDriven(*send_epoll_fd_, send_cq_);
+  int num_completed = 0;
+  for (const CompletionShard& shard : shards_) {
+    CHECK(shard.send_epoll_fd.has_value());  // Crash OK
+    num_completed +=
+        TryPollCompletionsEventDriven(*shard.send_epoll_fd, shard.send_cq);
+  }
+  return num_completed;
 }
 
 int Client::TryPollRecvCompletionsEventDriven() {
-  CHECK(recv_epoll_fd_.has_value());  // Crash OK
-  return TryPollCompletionsEventDriven(*recv_epoll_fd_, recv_cq_);
+  int num_completed = 0;
+  for (const CompletionShard& shard : shards_) {
+    CHECK(shard.recv_epoll_fd.has_value());  // Crash OK
+    num_completed +=
+        TryPollCompletionsEventDriven(*shard.recv_epoll_fd, shard.recv_cq);
+  }
+  return num_completed;
 }
 
 int Client::TryPollCompletionsEventDriven(const int epoll_fd, ibv_cq* cq) {
+  int num_completed = PollAndStoreCompletionsEventDriven(epoll_fd, cq);
+  total_completions_ += num_completed;
+  return num_completed;
+}
+
+int Client::PollAndStoreCompletionsEventDriven(const int epoll_fd,
+                                               ibv_cq* cq) {
   int num_completed = 0;
 
   // Poll for new CQ events.
@@ -962,7 +1665,7 @@ int Client::TryPollCompletionsEventDriven(const int epoll_fd, ibv_cq* cq) {
   EXPECT_EQ(ibv_req_notify_cq(cq, /*solicited_only=*/0), 0);
 
   while (true) {
-    int new_completions = TryPollCompletions(/*count=*/1, cq);
+    int new_completions = PollAndStoreCompletions(/*count=*/1, cq);
     if (new_completions == 0) break;
     EXPECT_EQ(new_completions, 1);
     num_completed += new_completions;
@@ -973,47 +1676,89 @@ int Client::TryPollCompletionsEventDriven(const int epoll_fd, ibv_cq* cq) {
 
 int Client::ValidateOrDeferCompletions() {
   int num_validated = 0;
-  for (const auto& [qp_id, qp_state] : qps_) {
-    auto op_uptr_it = qp_state->unchecked_initiated_ops().begin();
-    while (op_uptr_it != qp_state->unchecked_initiated_ops().end()) {
-      auto& op_uptr = *op_uptr_it;
-      EXPECT_EQ(IBV_WC_SUCCESS, op_uptr->status);
-      std::string op_type_str = TestOp::ToString(op_uptr->op_type);
-      uint8_t* src_addr = op_uptr->src_addr;
-      uint8_t* dest_addr = op_uptr->dest_addr;
-      // For two sided ops (ie. kSend, kRecv) we need to check that the
-      // completion on the other side has arrived, then we can validate the data
-      // landing. The expectation is that all Send/Recv ops on an RC qp
-      // arrive in the order they've been issued.
-      std::unique_ptr<TestOp> recv_op_ptr;
-      if (op_uptr->op_type == OpTypes::kSend) {
-        QpOpInterface* target_qp;
+  const bool print_op_buffers = absl::GetFlag(FLAGS_print_op_buffers);
+  for (CompletionShard& shard : shards_) {
+    num_validated += ValidateOrDeferShardCompletions(
+        shard, std::numeric_limits<uint32_t>::max(), print_op_buffers);
+  }
+  return num_validated;
+}
+
+int Client::ValidateOrDeferShardCompletions(CompletionShard& shard,
+                                            uint32_t qp_id_limit,
+                                            bool print_op_buffers) {
+  int num_validated = 0;
+  // Qps are relinked onto the emptied list as they are visited, so each qp is
+  // visited at most once.
+  QpState* qp_state = shard.dirty_qps;
+  shard.dirty_qps = nullptr;
+  while (qp_state != nullptr) {
+    QpState::DirtyListLink& link = qp_state->dirty_link();
+    QpState* next = link.next;
+    link = QpState::DirtyListLink();
+    if (qp_state->qp_id() < qp_id_limit) {
+      num_validated += ValidateOrDeferQpCompletions(qp_state, print_op_buffers);
+    }
+    if (!qp_state->unchecked_initiated_ops().empty()) {
+      MarkQpDirty(shard, qp_state);
+    }
+    qp_state = next;
+  }
+  return num_validated;
+}
+
+void Client::MarkQpDirty(CompletionShard& shard, QpState* qp_state) {
+  QpState::DirtyListLink& link = qp_state->dirty_link();
+  if (link.on_list) return;
+  link.next = shard.dirty_qps;
+  link.on_list = true;
+  shard.dirty_qps = qp_state;
+}
+
+int Client::ValidateOrDeferQpCompletions(QpState* qp_state,
+                                         const bool print_op_buffers) {
+  int num_validated = 0;
+  auto op_uptr_it = qp_state->unchecked_initiated_ops().begin();
+  while (op_uptr_it != qp_state->unchecked_initiated_ops().end()) {
+    auto& op_uptr = *op_uptr_it;
+    EXPECT_EQ(IBV_WC_SUCCESS, op_uptr->status);
+    uint8_t* src_addr = op_uptr->src_addr;
+    uint8_t* dest_addr = op_uptr->dest_addr;
+    // For two sided ops (ie. kSend, kRecv) we need to check that the
+    // completion on the other side has arrived, then we can validate the data
+    // landing. The expectation is that all Send/Recv ops on an RC qp
+    // arrive in the order they've been issued.
+    TestOpPtr recv_op_ptr;
+    QpOpInterface* target_qp = nullptr;
+    if (op_uptr->op_type == OpTypes::kSend) {
+      if (qp_state->is_rc()) {
+        target_qp = qp_state->remote_qp_state();
+      } else {
+        // UD qps can have multiple destinations, and the destination will be
+        // stored in the TestOp struct.
+        target_qp = op_uptr->remote_qp;
+      }
+      recv_op_ptr = target_qp->TryValidateRecvOp(*op_uptr);
+      if (recv_op_ptr == nullptr) {
+        // Cannot find the corresponding recv op.
         if (qp_state->is_rc()) {
-          target_qp = qp_state->remote_qp_state();
+          break;
         } else {
-          // UD qps can have multiple destinations, and the destination will be
-          // stored in the TestOp struct.
-          target_qp = op_uptr->remote_qp;
+          ++op_uptr_it;
+          continue;
         }
-        recv_op_ptr = target_qp->TryValidateRecvOp(*op_uptr);
-        if (recv_op_ptr == nullptr) {
-          // Cannot find the corresponding recv op.
-          if (qp_state->is_rc()) {
-            break;
-          } else {
-            ++op_uptr_it;
-            continue;
-          }
-        } else {
-          dest_addr = recv_op_ptr->dest_addr;
-          if (!qp_state->is_rc()) {
-            dest_addr += sizeof(ibv_grh);
-          }
+      } else {
+        dest_addr = recv_op_ptr->dest_addr;
+        if (!qp_state->is_rc()) {
+          dest_addr += sizeof(ibv_grh);
         }
       }
+    }
 
-      // Print the content of the buffers and validate data landed successfully
-      // in the destination buffer.
+    // Print the content of the buffers and validate data landed successfully
+    // in the destination buffer.
+    if (print_op_buffers) {
+      const std::string op_type_str = TestOp::ToString(op_uptr->op_type);
       MaybePrintBuffer(
           absl::StrFormat(
               "client %lu, qp_id %d, op_id %lu, src after %s: ", client_id(),
@@ -1021,60 +1766,79 @@ int Client::ValidateOrDeferCompletions() {
           op_uptr->SrcBuffer());
       MaybePrintBuffer(
           absl::StrFormat(
-              "client %lu, qp_id %d, op_id: %lu, dest after %s: ", client_id(),
-              op_uptr->qp_id, op_uptr->op_id, op_type_str),
+              "client %lu, qp_id %d, op_id: %lu, dest after %s: ",
+              client_id(), op_uptr->qp_id, op_uptr->op_id, op_type_str),
           op_uptr->DestBuffer());
+    }
 
-      if (op_uptr->op_type == OpTypes::kFetchAdd) {
-        DCHECK(dest_addr);
-        EXPECT_EQ(
-            *reinterpret_cast<uint64_t*>(dest_addr) + op_uptr->compare_add,
-            *reinterpret_cast<uint64_t*>(src_addr));
-      } else if (op_uptr->op_type == OpTypes::kCompSwap) {
-        // If "compare" fails, swap fails. The dest address on the initiator
-        // always holds the original value of the src address in the target.
-        EXPECT_TRUE(
-            (op_uptr->compare_add == *reinterpret_cast<uint64_t*>(dest_addr) &&
-             op_uptr->swap == *reinterpret_cast<uint64_t*>(src_addr)) ||
-            (op_uptr->compare_add != *reinterpret_cast<uint64_t*>(src_addr) &&
-             *reinterpret_cast<uint64_t*>(src_addr) ==
-                 *reinterpret_cast<uint64_t*>(dest_addr)));
-      } else if (qp_state->is_rc()) {
-        int buffer_content_compare =
-            std::memcmp(src_addr, dest_addr, op_uptr->length);
-        EXPECT_EQ(buffer_content_compare, 0);
-        if (buffer_content_compare != 0) {
-          LOG(INFO) << "Buffer mis-match:";
-          LOG(INFO) << absl::StrFormat(
-                         "client %lu, qp_id %d, op_id %lu, src after %s: ",
-                         client_id(), op_uptr->qp_id, op_uptr->op_id,
-                         op_type_str)
-                  << " " << op_uptr->SrcBuffer();
-          LOG(INFO) << absl::StrFormat(
-                         "client %lu, qp_id %d, op_id %lu, dest after %s: ",
-                         client_id(), op_uptr->qp_id, op_uptr->op_id,
-                         op_type_str)
-                  << " " << op_uptr->DestBuffer();
-        }
-        // This op's buffer was generated with op_id = op_ptr->op_id, but it
-        // should match with ops_completed on this qp if the completion order is
-        // correct.
-        EXPECT_EQ(op_uptr->op_id, qp_state->TotalOpsCompleted());
-        EXPECT_OK(
-            ValidateDstBuffer(dest_addr, op_uptr->length, op_uptr->op_id));
+    if (op_uptr->op_type == OpTypes::kFetchAdd) {
+      DCHECK(dest_addr);
+      EXPECT_EQ(
+          *reinterpret_cast<uint64_t*>(dest_addr) + op_uptr->compare_add,
+          *reinterpret_cast<uint64_t*>(src_addr));
+    } else if (op_uptr->op_type == OpTypes::kCompSwap) {
+      // If "compare" fails, swap fails. The dest address on the initiator
+      // always holds the original value of the src address in the target.
+      EXPECT_TRUE(
+          (op_uptr->compare_add == *reinterpret_cast<uint64_t*>(dest_addr) &&
+           op_uptr->swap == *reinterpret_cast<uint64_t*>(src_addr)) ||
+          (op_uptr->compare_add != *reinterpret_cast<uint64_t*>(src_addr) &&
+           *reinterpret_cast<uint64_t*>(src_addr) ==
+               *reinterpret_cast<uint64_t*>(dest_addr)));
+    } else if (qp_state->is_rc()) {
+      // The src buffer holds the pattern of this client, qp and op id, so
+      // checking the pattern in the dest buffer also verifies that it matches
+      // the src buffer, and that no other qp's or client's data landed in it.
+      absl::Status buffer_status = ValidateDstBuffer(
+          dest_addr, op_uptr->length, op_uptr->qp_id, op_uptr->op_id);
+      EXPECT_OK(buffer_status);
+      if (!buffer_status.ok()) {
+        const std::string op_type_str = TestOp::ToString(op_uptr->op_type);
+        LOG(INFO) << "Buffer mis-match:";
+        LOG(INFO) << absl::StrFormat(
+                       "client %lu, qp_id %d, op_id %lu, src after %s: ",
+                       client_id(), op_uptr->qp_id, op_uptr->op_id,
+                       op_type_str)
+                << " " << op_uptr->SrcBuffer();
+        LOG(INFO) << absl::StrFormat(
+                       "client %lu, qp_id %d, op_id %lu, dest after %s: ",
+                       client_id(), op_uptr->qp_id, op_uptr->op_id,
+                       op_type_str)
+                << " " << op_uptr->DestBuffer();
       }
+      // This op's buffer was generated with op_id = op_ptr->op_id, but it
+      // should match with ops_completed on this qp if the completion order is
+      // correct.
+      EXPECT_EQ(op_uptr->op_id, qp_state->TotalOpsCompleted());
+    }
 
-      // Update qp state after verification of buffers.
-      qp_state->IncrCompletedBytes(op_uptr->length, op_uptr->op_type);
-      qp_state->IncrCompletedOps(1, op_uptr->op_type);
-      ++num_validated;
-
-      op_uptr_it = qp_state->unchecked_initiated_ops().erase(op_uptr_it);
+    // The op's buffers were validated in place; they can now be reused.
+    qp_state->ReleaseOpBuffers(*op_uptr);
+    if (recv_op_ptr != nullptr) {
+      target_qp->ReleaseOpBuffers(*recv_op_ptr);
     }
+
+    // Update qp state after verification of buffers.
+    qp_state->IncrCompletedBytes(op_uptr->length, op_uptr->op_type);
+    qp_state->IncrCompletedOps(1, op_uptr->op_type);
+    ++num_validated;
+
+    op_uptr_it = qp_state->unchecked_initiated_ops().erase(op_uptr_it);
   }
   return num_validated;
 }
 
+void Client::LogPollStats() const {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    LOG(INFO) << "Client " << client_id() << ", shard " << i
+              << ", send cq polling: "
+              << shards_[i].send_poller.stats().ToString();
+    LOG(INFO) << "Client " << client_id() << ", shard " << i
+              << ", recv cq polling: "
+              << shards_[i].recv_poller.stats().ToString();
+  }
+}
+
 absl::Status Client::ValidateCompletions(int num_expected) {
   int num_validated = ValidateOrDeferCompletions();
   if (num_validated != num_expected) {
@@ -1142,55 +1906,92 @@ void Client::DumpPendingOps() {
 }
 
 void Client::InitializeSrcBuffer(uint8_t* src_addr, uint32_t length,
-                                 uint64_t id) {
-  constexpr int kOpIdGapInBuffer = 32;
-
-  // Fill in the buffer with random bytes.
-  std::generate_n(src_addr, length, std::ref(random));
-
-  // We want the generated byte sequence to have op_id embedded into it, but
-  // also be distinguishable across MTU boundaries to validate ordering. We do
-  // this by writing op id at the first byte, incrementing it and writing it
-  // repeatedly at fixed intervals, by default every 32 bytes. Instead of
-  // writing the full op id (uint64_t), we write it modulo (UCHAR_MAX) to fit it
-  // in a single byte.
-  //
-  // [ ]................[ ]................[ ]................[ ]........
-  //  |                  |                  |                  |
-  //  v                  v                  v                  v
-  // (op_id)            (op_id + 1)        (op_id + 2)        (op_id + 3)
-  //
-
-  for (uint32_t i = 0; i * kOpIdGapInBuffer < length; ++i) {
-    src_addr[i * kOpIdGapInBuffer] = (id + i) % UCHAR_MAX;
-  }
+                                 uint32_t qp_id, uint64_t op_id) {
+  // We want the generated byte sequence to have the op embedded into it, but
+  // also be distinguishable across MTU boundaries to validate ordering. The
+  // buffer pattern is seeded with the client, qp and op id, and depends on the
+  // offset of every word in the buffer, so it can be validated from the ids
+  // alone.
+  buffer_pattern::Fill(buffer_pattern::Seed(client_id(), qp_id, op_id),
+                       absl::MakeSpan(src_addr, length));
 }
 
 absl::Status Client::ValidateDstBuffer(uint8_t* dst_addr, uint32_t length,
-                                       uint64_t id) {
-  constexpr uint32_t kOpIdGapInBuffer = 32;
+                                       uint32_t qp_id, uint64_t op_id) {
   // Validates the sequence of bytes in the buffer as generated by the
-  // InitializeRcSrcBuffer function.
-  for (uint32_t i = 0; i * kOpIdGapInBuffer < length; ++i) {
-    EXPECT_EQ(dst_addr[i * kOpIdGapInBuffer], (id + i) % UCHAR_MAX);
+  // InitializeSrcBuffer function.
+  std::optional<uint64_t> mismatch = buffer_pattern::FindMismatch(
+      buffer_pattern::Seed(client_id(), qp_id, op_id),
+      absl::MakeConstSpan(dst_addr, length));
+  if (mismatch.has_value()) {
+    return absl::DataLossError(absl::StrFormat(
+        "Buffer of client %d, qp %u, op %lu (%u bytes) does not match its "
+        "pattern at offset %lu.",
+        client_id(), qp_id, op_id, length, *mismatch));
   }
-  LOG(INFO) << "Validation of dst_buffer successful.";
+  HOT_PATH_LOG(INFO) << "Validation of dst_buffer successful.";
   return absl::OkStatus();
 }
 
-bool Client::StoreCompletion(const ibv_wc* completion) {
+bool Client::StoreCompletion(const ibv_wc* completion, uint64_t now_ns) {
   if (completion->status != IBV_WC_SUCCESS) {
     LOG(INFO) << "Polled completion with error: ";
     verbs_util::PrintCompletion(*completion);
     return false;
   }
   auto* op = reinterpret_cast<TestOp*>(completion->wr_id);
-  op->status = completion->status;
-  auto& qp_state = qps_[op->qp_id];
-  qp_state->StoreOpForValidation(op);
+  op->byte_len = completion->byte_len;
+  StoreOpCompletion(op, now_ns);
   return true;
 }
 
+void Client::StoreOpCompletion(TestOp* op, uint64_t now_ns) {
+  op->status = IBV_WC_SUCCESS;
+  if (now_ns != 0 && op->post_timestamp_ns != 0) {
+    op->completion_timestamp_ns = now_ns;
+    // The shard's cqs are only polled by one thread at a time, so recording
+    // into the shard's histograms needs no synchronization.
+    CompletionShard& shard = shards_[op->qp_id % shards_.size()];
+    shard.latencies[{op->op_type, op->length}].Record(
+        now_ns - std::min(now_ns, op->post_timestamp_ns));
+  }
+  if (op->intended_post_tsc != 0) {
+    const TscClock& clock = TscClock::Get();
+    const uint64_t now = clock.Now();
+    shards_[op->qp_id % shards_.size()]
+        .offered_load_latencies[{op->op_type, op->length}]
+        .Record(clock.ToNanos(now - std::min(now, op->intended_post_tsc)));
+  }
+  QpState* op_qp_state = qp_state(op->qp_id);
+  op_qp_state->StoreOpForValidation(op);
+  // Only initiated ops are validated, from their initiator qp.
+  if (op->op_type != OpTypes::kRecv) {
+    MarkQpDirty(shards_[op->qp_id % shards_.size()], op_qp_state);
+  }
+}
+
+Client::LatencyHistograms Client::TakeLatencyHistograms() {
+  LatencyHistograms histograms;
+  for (CompletionShard& shard : shards_) {
+    for (const auto& [key, histogram] : shard.latencies) {
+      histograms[key].Merge(histogram);
+    }
+    shard.latencies.clear();
+  }
+  return histograms;
+}
+
+Client::LatencyHistograms Client::TakeOfferedLoadLatencyHistograms() {
+  LatencyHistograms histograms;
+  for (CompletionShard& shard : shards_) {
+    for (const auto& [key, histogram] : shard.offered_load_latencies) {
+      histograms[key].Merge(histogram);
+    }
+    shard.offered_load_latencies.clear();
+  }
+  return histograms;
+}
+
 void Client::MaybePrintBuffer(absl::string_view prefix_msg,
                               std::string op_buffer) {
   if (!absl::GetFlag(FLAGS_print_op_buffers)) {
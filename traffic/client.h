@@ -30,23 +30,38 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "infiniband/verbs.h"
+#include "internal/completion_poller.h"
 #include "internal/verbs_attribute.h"
 #include "public/rdma_memblock.h"
 #include "public/verbs_helper_suite.h"
+#include "traffic/hca_clock.h"
+#include "traffic/latency_histogram.h"
+#include "traffic/op_pacer.h"
+#include "traffic/op_trace.h"
 #include "traffic/op_types.h"
+#include "traffic/operation_generator.h"
 #include "traffic/qp_op_interface.h"
 #include "traffic/qp_state.h"
 
 ABSL_DECLARE_FLAG(bool, page_align_buffers);
 ABSL_DECLARE_FLAG(absl::Duration, inter_op_delay_us);
 ABSL_DECLARE_FLAG(absl::Duration, completion_timeout_s);
+ABSL_DECLARE_FLAG(absl::Duration, op_summary_interval);
+ABSL_DECLARE_FLAG(int, shard_cpu_offset);
+ABSL_DECLARE_FLAG(double, offered_load_ops_per_sec);
+ABSL_DECLARE_FLAG(double, offered_load_gbps);
+ABSL_DECLARE_FLAG(std::string, offered_load_interarrival);
+ABSL_DECLARE_FLAG(std::string, op_trace_dir);
 
 namespace rdma_unit_test {
 
 // A client is a collection of qps, each qp associated with two distinct
 // ranges of memory buffer for src and dest in write operations. Each client
-// is associated with a protection domain (pd). This class is not thread safe.
+// is associated with a protection domain (pd). This class is not thread safe,
+// but ExecuteOps() internally drives each shard of qps from its own thread
+// when the client is configured with more than one shard.
 class Client {
  public:
   // Information necessary to initialize ibverbs resources for a Client.
@@ -56,6 +71,18 @@ class Client {
     int max_qps;
     int send_cq_size = -1;
     int recv_cq_size = -1;
+    // Number of shards the qps are partitioned into. Each shard has its own
+    // send and recv completion queues and qp `qp_id` belongs to shard
+    // `qp_id % num_shards`. See ExecuteOps().
+    int num_shards = 1;
+    // When true, send and recv cqs are extended cqs (ibv_cq_ex), polled with
+    // ibv_start_poll/ibv_next_poll/ibv_end_poll, and hardware completion
+    // timestamps are recorded in TestOp::completion_timestamp if the device
+    // supports them. Latencies are then measured up to the hardware
+    // completion timestamp, converted to host time with an HcaClock, rather
+    // than up to when the completion is polled. Falls back to regular cqs if
+    // extended cqs cannot be created.
+    bool extended_cq = false;
   };
 
   // Methods of getting completion entries.
@@ -95,8 +122,16 @@ class Client {
     // field is ignored for UD operations, which are always flushed.
     bool flush = true;
     std::optional<UdSendAttributes> ud_send_attributes = std::nullopt;
+    // The TscClock time at which an open-loop op was intended to be issued,
+    // or 0. See TestOp::intended_post_tsc.
+    uint64_t intended_post_tsc = 0;
   };
 
+  // Latency histograms of completed ops, keyed by op type and op size in
+  // bytes.
+  using LatencyKey = std::pair<OpTypes, uint64_t>;
+  using LatencyHistograms = absl::flat_hash_map<LatencyKey, LatencyHistogram>;
+
   // Default constants.
   static constexpr int kQKey = 200;
   static constexpr int kDefaultBuffersPerQp = 4096;
@@ -112,7 +147,7 @@ class Client {
   // send_cq_size is positive, it is used as the minimum allocated send
   // completion queue size capped by dev_attr.max_cqe. If recv_cq_size is
   // positive, it is used as the minimum allocated receive completion queue size
-  // capped by dev_attr.max_cqe.
+  // capped by dev_attr.max_cqe. The cq sizes apply to each shard's cqs.
   // Note: It is the responsibility of the caller ot guarantee uniqueness of
   // client_id.
   Client(int client_id, ibv_context* context, PortAttribute port_attr,
@@ -131,8 +166,17 @@ class Client {
     return nullptr;
   }
   size_t num_qps() const { return qps_.size(); }
+  size_t num_shards() const { return shards_.size(); }
+  // True if polled TestOps carry hardware completion timestamps.
+  bool completion_timestamps() const { return completion_timestamps_; }
+  // True if every cq of the client is an extended cq, ie. completions are
+  // polled through ibv_start_poll().
+  bool extended_cqs() const;
   ibv_pd* pd() const { return pd_; }
   int client_id() const { return client_id_; }
+  // Unique to this Client within the process, unlike client_id() which the
+  // caller may reuse once a client is destroyed.
+  uint64_t instance_id() const { return instance_id_; }
 
   // Constructs a qp for this client and returns its qp_id. The qp will have
   // FLAGS_buffer_per_qp of src and dest buffer to send/accept data to/from
@@ -172,12 +216,44 @@ class Client {
   // function eventually times out and returns the number of ops completed. To
   // avoid a deadlock when `batch_per_qp > 1`, make sure that
   // batch_per_qp * num_qps >= max_inflight_ops_total.
+  // If both clients have the same number of shards (> 1) and all qps are RC
+  // qps connected to a remote qp of the same shard, the qps of each shard are
+  // driven by a dedicated thread (see --shard_cpu_offset) that polls only that
+  // shard's cqs, and max_inflight_ops_total is split between the shards in
+  // proportion to their qps. Otherwise all qps are driven by the calling
+  // thread. A shard which fails to post an op stops early, and the error is
+  // reported as a test failure from the calling thread.
+  // With --offered_load_ops_per_sec or --offered_load_gbps, ops are issued
+  // open-loop: one at a time, at the intended issue times of an OpPacer (split
+  // between shards like max_inflight_ops_total) rather than whenever an op
+  // completes. The inflight limits still apply; an op held back by them keeps
+  // its intended issue time. The latency of these ops measured from their
+  // intended issue time is logged, and available from
+  // TakeOfferedLoadLatencyHistograms().
   int ExecuteOps(Client& target, size_t num_qps, size_t ops_per_qp,
                  size_t batch_per_qp, size_t max_inflight_per_qp,
                  size_t max_inflight_ops_total,
                  Client::CompletionMethod completion_method =
                      Client::CompletionMethod::kPolling);
 
+  // Replays an op trace recorded by a Client (see --op_trace_dir) against
+  // `target`. Every op of the trace is posted on the qp of its record, the
+  // recorded gap after the previous op, with the recorded batch boundaries;
+  // sends are preceded by a recv on `target` and UD sends go to a random
+  // destination. Both clients must have the qps of the trace, set up as when
+  // it was recorded. An op is held back while `max_inflight_ops_total` ops,
+  // or max_outstanding_ops_per_qp ops on its qp, are in flight. Returns the
+  // number of ops completed, or an error if no completion arrives for
+  // --completion_timeout_s.
+  absl::StatusOr<int> ReplayTrace(Client& target, const OpTraceReader& trace,
+                                  size_t max_inflight_ops_total);
+
+  // Records the initiated ops posted on this client's qps, including qps
+  // created later, into `trace_writer` until StopRecording() is called.
+  void StartRecording(std::unique_ptr<OpTraceWriter> trace_writer);
+  // Stops recording and closes the trace, if recording.
+  absl::Status StopRecording();
+
   // Tries poll count completions, returns a lower number if fewer completions
   // are available. Also see TryPollCompletions() below.
   int TryPollSendCompletions(int count);
@@ -197,11 +273,15 @@ class Client {
   // ops are stored internally.
   absl::StatusOr<int> PollCompletions(int count, ibv_cq* cq,
                                       absl::Duration timeout_duration);
+  // Same as above, but collects the completions from any of `cqs`.
+  absl::StatusOr<int> PollCompletions(int count, absl::Span<ibv_cq* const> cqs,
+                                      absl::Duration timeout_duration);
 
   // Gets a completion channel ready to receive operation completions. Sets the
   // flags of the file descriptor according to the desired method, makes sure
   // that there is an epoll instance created to listen for events on the
-  // completion channel, and requests completion notifications.
+  // completion channel, and requests completion notifications. The Send/Recv
+  // variants prepare the channels of all shards.
   void PrepareSendCompletionChannel(CompletionMethod method);
   void PrepareRecvCompletionChannel(CompletionMethod method);
   void PrepareCompletionChannel(CompletionMethod method, ibv_cq* cq,
@@ -275,6 +355,26 @@ class Client {
   // Prints number of pending ops on all QPs for this client.
   void DumpPendingOps();
 
+  // Logs the poll batch statistics of every cq of this client.
+  void LogPollStats() const;
+
+  // Returns the number of completions with an error status polled from this
+  // client's cqs. Must not be called while ExecuteOps() is running.
+  uint64_t failed_completions() const;
+  // Returns the number of successful completions polled with a non-zero
+  // hardware completion timestamp. Must not be called while ExecuteOps() is
+  // running.
+  uint64_t timestamped_completions() const;
+
+  // Returns the latencies (from posting to polling the completion, or to the
+  // hardware completion timestamp if completion_timestamps()) of the ops
+  // completed on this client's cqs since the last call, and resets them.
+  // Must not be called while ExecuteOps() is running.
+  LatencyHistograms TakeLatencyHistograms();
+  // Same as TakeLatencyHistograms(), for the latencies of open-loop ops
+  // measured from their intended issue time. See ExecuteOps().
+  LatencyHistograms TakeOfferedLoadLatencyHistograms();
+
   RdmaMemBlock GetQpSrcBuffer(uint32_t qp_id) {
     return src_buffer_->subblock(buffer_per_qp_ * qp_id, buffer_per_qp_);
   }
@@ -287,15 +387,46 @@ class Client {
 
  protected:
   inline void InitializeSrcBuffer(uint8_t* src_addr, uint32_t length,
-                                  uint64_t id);
+                                  uint32_t qp_id, uint64_t op_id);
   inline absl::Status ValidateDstBuffer(uint8_t* dst_addr, uint32_t length,
-                                        uint64_t id);
+                                        uint32_t qp_id, uint64_t op_id);
 
   // Stores the TestOp associated with the completion in
   // `unchecked_received_ops` if it was a Recv op, or `unchecked_initiated_ops`
   // otherwise. Returns true if the completions was successful, false if it was
-  // not.
-  bool StoreCompletion(const ibv_wc* completion);
+  // not. `now_ns` is the time the completion was polled, or 0 to not record
+  // its latency.
+  bool StoreCompletion(const ibv_wc* completion, uint64_t now_ns = 0);
+
+  // The completion queues serving the qps of one shard, along with their
+  // completion channels and the pollers harvesting them.
+  struct CompletionShard {
+    ibv_comp_channel* send_cc = nullptr;
+    ibv_comp_channel* recv_cc = nullptr;
+    ibv_cq* send_cq = nullptr;
+    ibv_cq* recv_cq = nullptr;
+    // Set if `send_cq`/`recv_cq` were created as extended cqs.
+    ibv_cq_ex* send_cq_ex = nullptr;
+    ibv_cq_ex* recv_cq_ex = nullptr;
+    CompletionPoller send_poller;
+    CompletionPoller recv_poller;
+    // Latencies of the ops completed on this shard's cqs.
+    LatencyHistograms latencies;
+    // Latencies of the open-loop ops completed on this shard's cqs, from their
+    // intended issue time.
+    LatencyHistograms offered_load_latencies;
+    // Head of the work list of this shard's qps with unchecked initiated ops,
+    // linked through QpState::dirty_link().
+    QpState* dirty_qps = nullptr;
+    // Number of completions with an error status polled from this shard's cqs.
+    uint64_t failed_completions = 0;
+    // Number of completions of this shard's qps with a hardware timestamp.
+    uint64_t timestamped_completions = 0;
+    // The file descriptors corresponding to an epoll instance for each
+    // completion channel. Will be initialized in `PrepareCompletionChannel`.
+    std::optional<const int> send_epoll_fd;
+    std::optional<const int> recv_epoll_fd;
+  };
 
   VerbsHelperSuite ibv_;
   ibv_context* const context_;
@@ -305,24 +436,96 @@ class Client {
   std::unique_ptr<RdmaMemBlock> dest_buffer_;
   std::vector<ibv_mr*> src_mr_;
   std::vector<ibv_mr*> dest_mr_;
-  ibv_comp_channel* send_cc_ = nullptr;
-  ibv_comp_channel* recv_cc_ = nullptr;
-  ibv_cq* send_cq_ = nullptr;
-  ibv_cq* recv_cq_ = nullptr;
+  std::vector<CompletionShard> shards_;
+  // Used to poll cqs that do not belong to this client.
+  CompletionPoller fallback_poller_;
+  uint64_t fallback_failed_completions_ = 0;
   int total_completions_ = 0;
+  bool completion_timestamps_ = false;
+  // Converts hardware completion timestamps to host time. Set if the client
+  // records completion timestamps and the device clock can be read.
+  std::optional<HcaClock> hca_clock_;
   absl::flat_hash_map<uint32_t, std::unique_ptr<QpState>> qps_;
+  // Set while the client records its ops, see StartRecording().
+  std::unique_ptr<OpTraceWriter> trace_writer_;
   std::vector<ibv_ah*> ahs_;
   const int client_id_ = 0;
+  const uint64_t instance_id_;
   const int max_outstanding_ops_per_qp_;
   const int buffer_per_qp_;
   const size_t max_qps_;
 
-  // The file descriptor corresponding to an epoll instances for a completion
-  // channel. Will be initialized in `PrepareCompletionChannel`.
-  std::optional<const int> send_epoll_fd_;
-  std::optional<const int> recv_epoll_fd_;
-
  private:
+  // Results of running ExecuteOpsOnShard().
+  struct ExecuteOpsStats {
+    size_t issued_ops = 0;
+    size_t completed_ops = 0;
+    size_t total_bytes = 0;
+    // Completions polled from this client's send cqs and the target client's
+    // recv cqs.
+    int send_completions = 0;
+    int recv_completions = 0;
+    absl::flat_hash_map<OpTypes, int> issued_ops_by_type;
+    // How late open-loop ops were issued relative to their intended time.
+    LatencyHistogram issue_lag;
+    // The error which stopped the run early, if an op failed to post.
+    absl::Status status;
+  };
+
+  // Runs the ExecuteOps() loop over `qp_ids`, polling the send cqs of
+  // `send_shards` on this client and the recv cqs of `recv_shards` on
+  // `target`. Does not update `total_completions_`, so that shards can run
+  // concurrently as long as they own disjoint qps and cqs. Ops are paced by
+  // `offered_load` if set.
+  ExecuteOpsStats ExecuteOpsOnShard(
+      Client& target, absl::Span<const uint32_t> qp_ids,
+      absl::Span<CompletionShard* const> send_shards,
+      absl::Span<CompletionShard* const> recv_shards, size_t ops_per_qp,
+      size_t batch_per_qp, size_t max_inflight_per_qp,
+      size_t max_inflight_ops_total, CompletionMethod completion_method,
+      std::optional<OpPacer::Options> offered_load,
+      absl::string_view log_prefix);
+
+  // Same as TryPollCompletions() and TryPollCompletionsEventDriven(), but
+  // without updating `total_completions_`.
+  int PollAndStoreCompletions(int count, ibv_cq* cq);
+  // Same as PollAndStoreCompletions(), for an extended cq. Reads only the
+  // fields needed to store the completion.
+  int PollAndStoreExtendedCompletions(int count, ibv_cq_ex* cq_ex,
+                                      CompletionPoller& poller,
+                                      uint64_t& failed_completions);
+  // Records the latency of a successfully completed op which completed at
+  // host time `now_ns` and hands it over to its qp for validation.
+  void StoreOpCompletion(TestOp* op, uint64_t now_ns);
+  // Returns the poller of `cq`, sets `cq_ex` to the extended cq backing `cq`
+  // if there is one, and `failed_completions` to the failed completions
+  // counter of `cq`.
+  CompletionPoller& PollerFor(ibv_cq* cq, ibv_cq_ex** cq_ex,
+                              uint64_t** failed_completions);
+  int PollAndStoreCompletionsEventDriven(int epoll_fd, ibv_cq* cq);
+
+  // Posts an op of `op_attributes` on qp `qp_id`, preceded for sends by the
+  // matching recv on `target`, which is `ud_recv_bytes` long on UD qps.
+  // `atomic_value` is the add or swap value of atomic ops. The ops are posted
+  // to the device only if `flush` is set (or the qp is UD), otherwise they
+  // are batched on their qps.
+  absl::Status PostOneOp(Client& target, uint32_t qp_id,
+                         const OperationGenerator::OpAttributes& op_attributes,
+                         int ud_recv_bytes, uint64_t atomic_value, bool flush,
+                         uint64_t intended_post_tsc);
+
+  // ValidateOrDeferCompletions() for a single qp.
+  int ValidateOrDeferQpCompletions(QpState* qp_state, bool print_op_buffers);
+  // ValidateOrDeferCompletions() for the qps on the dirty list of `shard`
+  // whose qp_id is below `qp_id_limit`. Qps which still have unchecked
+  // initiated ops afterwards, eg. sends waiting for their recv, stay on the
+  // list.
+  int ValidateOrDeferShardCompletions(CompletionShard& shard,
+                                      uint32_t qp_id_limit,
+                                      bool print_op_buffers);
+  // Adds `qp_state` to the dirty list of `shard`, unless it is already on it.
+  static void MarkQpDirty(CompletionShard& shard, QpState* qp_state);
+
   // Print buffers content if the flag print_op_buffers is true.
   static void MaybePrintBuffer(absl::string_view prefix_msg,
                                std::string op_buffer);
@@ -0,0 +1,78 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "traffic/hca_clock.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "infiniband/verbs.h"
+
+namespace rdma_unit_test {
+namespace {
+
+// Calibration keeps the reading of the HCA clock which took the least host
+// time out of this many, as the midpoint of its host interval is then the
+// closest to the time the HCA clock was read at.
+constexpr int kCalibrationReadings = 8;
+
+}  // namespace
+
+absl::StatusOr<HcaClock> HcaClock::Create(ibv_context* context) {
+  ibv_device_attr_ex attr = {};
+  int ret = ibv_query_device_ex(context, /*input=*/nullptr, &attr);
+  if (ret != 0) {
+    return absl::InternalError(
+        absl::StrCat("Failed to query the device: ", std::strerror(ret)));
+  }
+  // hca_core_clock is in kHz.
+  if (attr.hca_core_clock == 0) {
+    return absl::UnavailableError("The device does not report its clock rate.");
+  }
+  HcaClock clock(context, 1e6 / static_cast<double>(attr.hca_core_clock));
+  absl::Status status = clock.Calibrate();
+  if (!status.ok()) return status;
+  return clock;
+}
+
+absl::Status HcaClock::Calibrate() {
+  int64_t best_interval_ns = std::numeric_limits<int64_t>::max();
+  for (int i = 0; i < kCalibrationReadings; ++i) {
+    ibv_values_ex values = {.comp_mask = IBV_VALUES_MASK_RAW_CLOCK};
+    const int64_t start_ns = absl::GetCurrentTimeNanos();
+    int ret = ibv_query_rt_values_ex(context_, &values);
+    const int64_t end_ns = absl::GetCurrentTimeNanos();
+    if (ret != 0 || !(values.comp_mask & IBV_VALUES_MASK_RAW_CLOCK)) {
+      return absl::UnavailableError(absl::StrCat(
+          "Failed to read the HCA clock: ", std::strerror(ret)));
+    }
+    if (end_ns - start_ns < best_interval_ns) {
+      best_interval_ns = end_ns - start_ns;
+      // The raw clock is a tick count held in a timespec.
+      base_ticks_ = static_cast<uint64_t>(values.raw_clock.tv_sec) *
+                        1000000000 +
+                    static_cast<uint64_t>(values.raw_clock.tv_nsec);
+      base_ns_ = start_ns + (end_ns - start_ns) / 2;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace rdma_unit_test
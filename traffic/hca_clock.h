@@ -0,0 +1,66 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_HCA_CLOCK_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_HCA_CLOCK_H_
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "infiniband/verbs.h"
+
+namespace rdma_unit_test {
+
+// Converts hardware completion timestamps, in ticks of the clock of a device
+// (the HCA clock), to host time as returned by absl::GetCurrentTimeNanos(), so
+// that they can be compared with the host timestamps taken when ops are
+// posted. The tick rate is the hca_core_clock reported by
+// ibv_query_device_ex(), and the offset between the clocks is calibrated by
+// reading the HCA clock with ibv_query_rt_values_ex(). The clocks drift apart
+// between calibrations, so Calibrate() should be called before each
+// measurement. Not thread safe while calibrating.
+class HcaClock {
+ public:
+  // Returns a calibrated clock for the device of `context`, or an error if the
+  // device does not report its clock rate or its clock cannot be read.
+  static absl::StatusOr<HcaClock> Create(ibv_context* context);
+
+  // Pairs a reading of the HCA clock with the host time it was read at.
+  absl::Status Calibrate();
+
+  // Converts a timestamp in HCA clock ticks to host nanoseconds.
+  uint64_t ToHostNanos(uint64_t ticks) const {
+    const int64_t delta_ticks = static_cast<int64_t>(ticks - base_ticks_);
+    return base_ns_ + static_cast<int64_t>(static_cast<double>(delta_ticks) *
+                                           ns_per_tick_);
+  }
+
+  double ns_per_tick() const { return ns_per_tick_; }
+
+ private:
+  HcaClock(ibv_context* context, double ns_per_tick)
+      : context_(context), ns_per_tick_(ns_per_tick) {}
+
+  ibv_context* context_;
+  double ns_per_tick_;
+  // An HCA clock reading and the host time it was taken at.
+  uint64_t base_ticks_ = 0;
+  int64_t base_ns_ = 0;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_HCA_CLOCK_H_
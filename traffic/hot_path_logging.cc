@@ -0,0 +1,22 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/hot_path_logging.h"
+
+#include "absl/flags/flag.h"
+
+ABSL_FLAG(bool, hot_path_logging, false,
+          "When true, logs every op posted, batched, polled and validated by "
+          "the traffic client. This is expensive and skews throughput and "
+          "latency results; use it for debugging only.");
@@ -0,0 +1,49 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_HOT_PATH_LOGGING_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_HOT_PATH_LOGGING_H_
+
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/log/log.h"
+
+ABSL_DECLARE_FLAG(bool, hot_path_logging);
+
+namespace rdma_unit_test {
+
+// Per-op logging on the traffic datapath (posting, batching, polling and
+// validating individual ops) is expensive enough to distort throughput and
+// latency measurements. It is disabled unless --hot_path_logging is set, and
+// can be compiled out entirely by defining
+// RDMA_UNIT_TEST_DISABLE_HOT_PATH_LOGGING.
+#ifdef RDMA_UNIT_TEST_DISABLE_HOT_PATH_LOGGING
+inline constexpr bool kHotPathLoggingCompiledIn = false;
+#else
+inline constexpr bool kHotPathLoggingCompiledIn = true;
+#endif
+
+// Returns true if per-op datapath logging should be emitted.
+inline bool HotPathLoggingEnabled() {
+  return kHotPathLoggingCompiledIn && absl::GetFlag(FLAGS_hot_path_logging);
+}
+
+}  // namespace rdma_unit_test
+
+// Logs a per-op datapath message. The streamed arguments are only evaluated
+// when HotPathLoggingEnabled() is true, so formatting is free otherwise.
+#define HOT_PATH_LOG(severity) \
+  LOG_IF(severity, ::rdma_unit_test::HotPathLoggingEnabled())
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_HOT_PATH_LOGGING_H_
@@ -0,0 +1,102 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/latency_histogram.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/str_format.h"
+
+namespace rdma_unit_test {
+
+LatencyHistogram::LatencyHistogram() : buckets_(kNumBuckets, 0) {}
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+  if (value < kSubBucketCount) return value;
+  value = std::min(value, (uint64_t{1} << kMaxValueBits) - 1);
+  // Shift the value so that it has kSubBucketBits significant bits, ie. lands
+  // in [kSubBucketHalf, kSubBucketCount).
+  int shift = absl::bit_width(value) - kSubBucketBits;
+  return kSubBucketCount + (shift - 1) * kSubBucketHalf +
+         ((value >> shift) - kSubBucketHalf);
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t index) {
+  if (index < kSubBucketCount) return index;
+  int shift = (index - kSubBucketCount) / kSubBucketHalf + 1;
+  uint64_t sub_bucket = (index - kSubBucketCount) % kSubBucketHalf +
+                        kSubBucketHalf;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t latency_ns) {
+  ++buckets_[BucketIndex(latency_ns)];
+  ++count_;
+  sum_ += latency_ns;
+  min_ = std::min(min_, latency_ns);
+  max_ = std::max(max_, latency_ns);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void LatencyHistogram::Clear() {
+  std::fill(buckets_.begin(), buckets_.end(), 0);
+  count_ = 0;
+  sum_ = 0;
+  min_ = UINT64_MAX;
+  max_ = 0;
+}
+
+double LatencyHistogram::Mean() const {
+  if (count_ == 0) return 0;
+  return static_cast<double>(sum_) / count_;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+  if (count_ == 0) return 0;
+  // Round to the nearest rank rather than up, so that floating point error
+  // does not skip a rank, eg. for p99.9 of 1000 samples.
+  uint64_t rank = static_cast<uint64_t>(
+      std::clamp(percentile, 0.0, 100.0) / 100.0 * count_ + 0.5);
+  rank = std::clamp<uint64_t>(rank, 1, count_);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::clamp(BucketUpperBound(i), min(), max_);
+    }
+  }
+  return max_;
+}
+
+std::string LatencyHistogram::ToString() const {
+  return absl::StrFormat(
+      "count: %d, mean: %.2fus, p50: %.2fus, p99: %.2fus, p99.9: %.2fus, "
+      "p99.99: %.2fus, max: %.2fus",
+      count_, Mean() / 1000, Percentile(50) / 1000.0, Percentile(99) / 1000.0,
+      Percentile(99.9) / 1000.0, Percentile(99.99) / 1000.0, max_ / 1000.0);
+}
+
+}  // namespace rdma_unit_test
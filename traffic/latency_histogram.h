@@ -0,0 +1,79 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_LATENCY_HISTOGRAM_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_LATENCY_HISTOGRAM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rdma_unit_test {
+
+// A log-linear (HDR style) histogram of latencies in nanoseconds. Values are
+// bucketed with 7 significant bits, ie. with a relative error below 1%, up to
+// 2^48 ns (~78 hours); larger values are clamped. Recording is a couple of
+// integer operations and never allocates after construction. This class is
+// not thread safe; use one histogram per recording thread and Merge() them.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  // Copyable and movable.
+  LatencyHistogram(const LatencyHistogram& other) = default;
+  LatencyHistogram& operator=(const LatencyHistogram& other) = default;
+  LatencyHistogram(LatencyHistogram&& other) = default;
+  LatencyHistogram& operator=(LatencyHistogram&& other) = default;
+  ~LatencyHistogram() = default;
+
+  void Record(uint64_t latency_ns);
+  // Adds all the samples of `other` to this histogram.
+  void Merge(const LatencyHistogram& other);
+  void Clear();
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ == 0 ? 0 : min_; }
+  uint64_t max() const { return max_; }
+  double Mean() const;
+  // Returns the smallest recorded value such that `percentile` percent of the
+  // samples are less than or equal to it, up to the bucketing error. Returns 0
+  // for an empty histogram.
+  uint64_t Percentile(double percentile) const;
+
+  // Returns "count, mean, p50, p99, p99.9, p99.99, max" in microseconds.
+  std::string ToString() const;
+
+ private:
+  static constexpr int kSubBucketBits = 7;
+  static constexpr uint64_t kSubBucketCount = 1 << kSubBucketBits;
+  static constexpr uint64_t kSubBucketHalf = kSubBucketCount / 2;
+  static constexpr int kMaxValueBits = 48;
+  static constexpr size_t kNumBuckets =
+      kSubBucketCount + (kMaxValueBits - kSubBucketBits) * kSubBucketHalf;
+
+  static size_t BucketIndex(uint64_t value);
+  // Returns the largest value mapped to `index`.
+  static uint64_t BucketUpperBound(size_t index);
+
+  std::vector<uint64_t> buckets_;
+  uint64_t count_ = 0;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0;
+  // Sum of all samples, for the mean. Saturation is not a concern with ns
+  // latencies.
+  uint64_t sum_ = 0;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,116 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/latency_histogram.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace rdma_unit_test {
+namespace {
+
+// Percentiles are the upper bound of the bucket holding the sample, which is
+// within 1% of it.
+void ExpectWithinBucketError(uint64_t actual, uint64_t expected) {
+  EXPECT_GE(actual, expected);
+  EXPECT_LE(actual, expected + expected / 100 + 1);
+}
+
+TEST(LatencyHistogramTest, Empty) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.min(), 0);
+  EXPECT_EQ(histogram.max(), 0);
+  EXPECT_EQ(histogram.Mean(), 0);
+  EXPECT_EQ(histogram.Percentile(50), 0);
+}
+
+TEST(LatencyHistogramTest, SmallValuesAreExact) {
+  LatencyHistogram histogram;
+  for (uint64_t value = 1; value <= 100; ++value) {
+    histogram.Record(value);
+  }
+  EXPECT_EQ(histogram.count(), 100);
+  EXPECT_EQ(histogram.min(), 1);
+  EXPECT_EQ(histogram.max(), 100);
+  EXPECT_DOUBLE_EQ(histogram.Mean(), 50.5);
+  EXPECT_EQ(histogram.Percentile(0), 1);
+  EXPECT_EQ(histogram.Percentile(50), 50);
+  EXPECT_EQ(histogram.Percentile(99), 99);
+  EXPECT_EQ(histogram.Percentile(100), 100);
+}
+
+TEST(LatencyHistogramTest, LargeValuesWithinOnePercent) {
+  // Record a smaller sample too, so that the median is not clamped to the
+  // minimum.
+  for (uint64_t value = 128; value < (uint64_t{1} << 40);
+       value = value * 3 + 1) {
+    LatencyHistogram histogram;
+    histogram.Record(1);
+    histogram.Record(value);
+    histogram.Record(value + 1);
+    SCOPED_TRACE(value);
+    ExpectWithinBucketError(histogram.Percentile(50), value);
+  }
+}
+
+TEST(LatencyHistogramTest, ClampsHugeValues) {
+  LatencyHistogram histogram;
+  histogram.Record(UINT64_MAX);
+  EXPECT_EQ(histogram.count(), 1);
+  EXPECT_EQ(histogram.max(), UINT64_MAX);
+  EXPECT_EQ(histogram.Percentile(100), UINT64_MAX);
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 990; ++i) histogram.Record(1000);
+  for (int i = 0; i < 9; ++i) histogram.Record(100000);
+  histogram.Record(10000000);
+  ExpectWithinBucketError(histogram.Percentile(50), 1000);
+  ExpectWithinBucketError(histogram.Percentile(99), 1000);
+  ExpectWithinBucketError(histogram.Percentile(99.9), 100000);
+  // The top percentile is clamped to the maximum.
+  EXPECT_EQ(histogram.Percentile(99.99), 10000000);
+}
+
+TEST(LatencyHistogramTest, MergeAndClear) {
+  LatencyHistogram low;
+  LatencyHistogram high;
+  for (uint64_t value = 1; value <= 50; ++value) {
+    low.Record(value);
+    high.Record(value + 50);
+  }
+  low.Merge(high);
+  EXPECT_EQ(low.count(), 100);
+  EXPECT_EQ(low.min(), 1);
+  EXPECT_EQ(low.max(), 100);
+  EXPECT_DOUBLE_EQ(low.Mean(), 50.5);
+  EXPECT_EQ(low.Percentile(50), 50);
+  EXPECT_EQ(low.Percentile(75), 75);
+  // Merging an empty histogram changes nothing.
+  low.Merge(LatencyHistogram());
+  EXPECT_EQ(low.min(), 1);
+  EXPECT_EQ(low.count(), 100);
+
+  low.Clear();
+  EXPECT_EQ(low.count(), 0);
+  EXPECT_EQ(low.min(), 0);
+  EXPECT_EQ(low.max(), 0);
+  EXPECT_EQ(low.Percentile(50), 0);
+}
+
+}  // namespace
+}  // namespace rdma_unit_test
@@ -0,0 +1,129 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/latency_measurement.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "traffic/client.h"
+#include "traffic/latency_histogram.h"
+#include "traffic/op_types.h"
+
+ABSL_FLAG(double, latency_tolerance_percent, 50,
+          "Maximum percentage by which the median latency of a stats set may "
+          "exceed the lowest median latency of all stats sets of the same op "
+          "type and size, collected with the same number of qps.");
+ABSL_FLAG(double, tail_latency_tolerance_percent, 200,
+          "Maximum percentage by which the p99 latency of a stats set may "
+          "exceed the lowest p99 latency of all stats sets of the same op type "
+          "and size, collected with the same number of qps.");
+ABSL_FLAG(absl::Duration, max_tail_latency, absl::Milliseconds(100),
+          "Maximum p99 latency of any stats set. Unlike the tolerances, this "
+          "bound also applies when there is a single stats set.");
+ABSL_FLAG(uint64_t, latency_check_min_samples, 1000,
+          "Minimum number of samples in a stats set for its latencies to be "
+          "checked.");
+
+namespace rdma_unit_test {
+
+void HistogramLatencyMeasurement::ConfigureLatencyMeasurements(
+    OpTypes op_type) {
+  primary_op_type_ = op_type;
+  stats_sets_.clear();
+}
+
+void HistogramLatencyMeasurement::CollectClientLatencyStats(Client& client) {
+  Client::LatencyHistograms histograms = client.TakeLatencyHistograms();
+  for (const auto& [key, histogram] : histograms) {
+    LOG(INFO) << "Client " << client.client_id() << " stats set "
+              << stats_sets_.size() << " (" << client.num_qps() << " qps), "
+              << AbslUnparseFlag(key.first) << " ops of " << key.second
+              << " bytes, latency (us): " << histogram.ToString();
+  }
+  stats_sets_.push_back(
+      {.num_qps = client.num_qps(), .histograms = std::move(histograms)});
+}
+
+void HistogramLatencyMeasurement::CheckLatencies() {
+  if (primary_op_type_ == OpTypes::kInvalid) return;
+  const double tolerance =
+      1 + absl::GetFlag(FLAGS_latency_tolerance_percent) / 100;
+  const double tail_tolerance =
+      1 + absl::GetFlag(FLAGS_tail_latency_tolerance_percent) / 100;
+  const uint64_t max_tail_latency_ns =
+      absl::ToInt64Nanoseconds(absl::GetFlag(FLAGS_max_tail_latency));
+  const uint64_t min_samples = absl::GetFlag(FLAGS_latency_check_min_samples);
+
+  // Find the best median and tail latency per configuration, ie. per number of
+  // qps and op size, across the stats sets.
+  using Configuration = std::pair<size_t, uint64_t>;
+  struct Baseline {
+    uint64_t p50 = std::numeric_limits<uint64_t>::max();
+    uint64_t p99 = std::numeric_limits<uint64_t>::max();
+    // Number of checked stats sets of the configuration. A set is not
+    // compared against itself, so the tolerances only apply to
+    // configurations with at least two sets.
+    int num_sets = 0;
+  };
+  absl::flat_hash_map<Configuration, Baseline> baselines;
+  for (const StatsSet& stats_set : stats_sets_) {
+    for (const auto& [key, histogram] : stats_set.histograms) {
+      if (key.first != primary_op_type_ || histogram.count() < min_samples) {
+        continue;
+      }
+      Baseline& baseline = baselines[{stats_set.num_qps, key.second}];
+      baseline.p50 = std::min(baseline.p50, histogram.Percentile(50));
+      baseline.p99 = std::min(baseline.p99, histogram.Percentile(99));
+      ++baseline.num_sets;
+    }
+  }
+
+  for (size_t i = 0; i < stats_sets_.size(); ++i) {
+    for (const auto& [key, histogram] : stats_sets_[i].histograms) {
+      if (key.first != primary_op_type_ || histogram.count() < min_samples) {
+        continue;
+      }
+      const uint64_t p50 = histogram.Percentile(50);
+      const uint64_t p99 = histogram.Percentile(99);
+      EXPECT_LE(p99, max_tail_latency_ns)
+          << "p99 latency of stats set " << i << " for "
+          << AbslUnparseFlag(key.first) << " ops of " << key.second
+          << " bytes (" << p99 << "ns) exceeds --max_tail_latency.";
+      const Baseline& baseline =
+          baselines[{stats_sets_[i].num_qps, key.second}];
+      if (baseline.num_sets < 2) continue;
+      EXPECT_LE(p50, baseline.p50 * tolerance)
+          << "Median latency of stats set " << i << " for "
+          << AbslUnparseFlag(key.first) << " ops of " << key.second
+          << " bytes (" << p50 << "ns) is out of tolerance of the best median ("
+          << baseline.p50 << "ns) with " << stats_sets_[i].num_qps << " qps.";
+      EXPECT_LE(p99, baseline.p99 * tail_tolerance)
+          << "p99 latency of stats set " << i << " for "
+          << AbslUnparseFlag(key.first) << " ops of " << key.second
+          << " bytes (" << p99 << "ns) is out of tolerance of the best p99 ("
+          << baseline.p99 << "ns) with " << stats_sets_[i].num_qps << " qps.";
+    }
+  }
+}
+
+}  // namespace rdma_unit_test
@@ -15,6 +15,9 @@
 #ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_LATENCY_MEASUREMENT_H_
 #define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_LATENCY_MEASUREMENT_H_
 
+#include <cstddef>
+#include <vector>
+
 #include "traffic/client.h"
 #include "traffic/op_types.h"
 
@@ -30,12 +33,40 @@ class LatencyMeasurement {
   virtual void ConfigureLatencyMeasurements(OpTypes op_type) {}
 
   // Collect latency measurement for Client QPs.
-  virtual void CollectClientLatencyStats(const Client& client) {}
+  virtual void CollectClientLatencyStats(Client& client) {}
 
   // Verify latency statistics.
   virtual void CheckLatencies() {}
 };
 
+// Latency measurement based on the software timestamped histograms recorded by
+// Client. Every call to CollectClientLatencyStats() takes the client's
+// histograms as a new stats set. CheckLatencies() then verifies, for the
+// primary op type, that:
+// - the p99 latency of every stats set is below --max_tail_latency, and
+// - the median and p99 latencies of a stats set stay within
+//   --latency_tolerance_percent and --tail_latency_tolerance_percent of the
+//   fastest stats set of the same configuration, ie. of the same op size and
+//   collected from a client with the same number of qps. Latencies grow with
+//   the number of qps (and so inflight ops), so other sets are not compared.
+// Higher percentiles are logged, but not checked.
+class HistogramLatencyMeasurement : public LatencyMeasurement {
+ public:
+  void ConfigureLatencyMeasurements(OpTypes op_type) override;
+  void CollectClientLatencyStats(Client& client) override;
+  void CheckLatencies() override;
+
+ private:
+  struct StatsSet {
+    // The number of qps of the client the set was collected from.
+    size_t num_qps;
+    Client::LatencyHistograms histograms;
+  };
+
+  OpTypes primary_op_type_ = OpTypes::kInvalid;
+  std::vector<StatsSet> stats_sets_;
+};
+
 }  // namespace rdma_unit_test
 
 #endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_LATENCY_MEASUREMENT_H_
@@ -0,0 +1,60 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/op_pacer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "absl/log/check.h"
+#include "absl/random/distributions.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "traffic/tsc_clock.h"
+
+namespace rdma_unit_test {
+
+absl::StatusOr<OpPacer::Interarrival> OpPacer::ParseInterarrival(
+    absl::string_view name) {
+  if (name == "fixed") return Interarrival::kFixed;
+  if (name == "poisson") return Interarrival::kPoisson;
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unknown interarrival distribution '", name,
+                   "', expected fixed or poisson."));
+}
+
+OpPacer::OpPacer(const Options& options, uint64_t start)
+    : clock_(&TscClock::Get()),
+      options_(options),
+      next_intended_(static_cast<double>(start)) {
+  CHECK((options_.ops_per_sec > 0) != (options_.gbps > 0))  // Crash OK
+      << "Exactly one of ops_per_sec and gbps must be positive.";
+}
+
+void OpPacer::Issue(uint64_t op_bytes, uint64_t now) {
+  issue_lag_.Record(clock_->ToNanos(now - std::min(now, next_intended())));
+
+  // Mean time to the next op, in ns.
+  double interval_ns = options_.ops_per_sec > 0
+                           ? 1e9 / options_.ops_per_sec
+                           : static_cast<double>(op_bytes) * 8 / options_.gbps;
+  if (options_.interarrival == Interarrival::kPoisson) {
+    interval_ns *= absl::Exponential<double>(bitgen_);
+  }
+  next_intended_ += clock_->FromNanos(interval_ns);
+}
+
+}  // namespace rdma_unit_test
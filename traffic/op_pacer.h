@@ -0,0 +1,89 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OP_PACER_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OP_PACER_H_
+
+#include <cstdint>
+
+#include "absl/random/random.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "traffic/latency_histogram.h"
+#include "traffic/tsc_clock.h"
+
+namespace rdma_unit_test {
+
+// Paces an open-loop stream of ops at a target rate. The intended issue times
+// of the ops follow a schedule set by the rate alone: an op is due once its
+// intended time has passed, whether or not earlier ops were issued on time or
+// have completed, and an op issued late keeps its intended time. Latencies
+// measured from the intended issue time therefore include the time an op
+// waited to be issued, ie. they are free of coordinated omission. Times are in
+// TscClock ticks. This class is not thread safe; use one pacer per issuing
+// thread.
+class OpPacer {
+ public:
+  // Distribution of the time between the intended issue times of consecutive
+  // ops.
+  enum class Interarrival { kFixed, kPoisson };
+
+  struct Options {
+    // The offered load, in ops per second or in gigabits of op payload per
+    // second. Exactly one of them must be positive.
+    double ops_per_sec = 0;
+    double gbps = 0;
+    Interarrival interarrival = Interarrival::kFixed;
+  };
+
+  // Parses "fixed" or "poisson".
+  static absl::StatusOr<Interarrival> ParseInterarrival(absl::string_view name);
+
+  // The first op is due at `start`.
+  OpPacer(const Options& options, uint64_t start);
+  // Movable but not copyable.
+  OpPacer(OpPacer&& pacer) = default;
+  OpPacer& operator=(OpPacer&& pacer) = default;
+  OpPacer(const OpPacer& pacer) = delete;
+  OpPacer& operator=(const OpPacer& pacer) = delete;
+  ~OpPacer() = default;
+
+  // Returns true if the next op is due at `now`.
+  bool Due(uint64_t now) const { return now >= next_intended(); }
+  // Returns the intended issue time of the next op.
+  uint64_t next_intended() const {
+    return static_cast<uint64_t>(next_intended_);
+  }
+
+  // Records that the next op, carrying `op_bytes` of payload, was issued at
+  // `now`, and schedules the op after it.
+  void Issue(uint64_t op_bytes, uint64_t now);
+
+  // Histogram of how late ops were issued relative to their intended issue
+  // time, in ns.
+  const LatencyHistogram& issue_lag() const { return issue_lag_; }
+  uint64_t issued_ops() const { return issue_lag_.count(); }
+
+ private:
+  const TscClock* clock_;
+  Options options_;
+  // Kept in fractional ticks so that rounding does not skew the rate.
+  double next_intended_;
+  absl::BitGen bitgen_;
+  LatencyHistogram issue_lag_;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OP_PACER_H_
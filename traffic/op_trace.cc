@@ -0,0 +1,215 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/op_trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/log/log.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "traffic/op_types.h"
+
+namespace rdma_unit_test {
+namespace {
+
+// Number of records buffered before they are written out.
+constexpr size_t kWriteBufferRecords = 4096;
+
+absl::Status ErrnoError(absl::string_view what, const std::string& path) {
+  return absl::InternalError(
+      absl::StrCat(what, " ", path, ": ", std::strerror(errno)));
+}
+
+// Writes all of `data` at `offset`, retrying short writes.
+bool PwriteAll(int fd, const void* data, size_t size, off_t offset) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t written = TEMP_FAILURE_RETRY(pwrite(fd, bytes, size, offset));
+    if (written <= 0) return false;
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<OpTraceWriter>> OpTraceWriter::Create(
+    const std::string& path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return ErrnoError("Failed to create op trace", path);
+  }
+  auto writer = absl::WrapUnique(new OpTraceWriter(path, fd));
+  absl::MutexLock lock(&writer->mutex_);
+  if (!PwriteAll(fd, &writer->header_, sizeof(writer->header_), 0)) {
+    return ErrnoError("Failed to write op trace", path);
+  }
+  return writer;
+}
+
+OpTraceWriter::OpTraceWriter(std::string path, int fd)
+    : path_(std::move(path)), fd_(fd) {
+  header_.record_size = sizeof(OpTraceRecord);
+  buffer_.reserve(kWriteBufferRecords);
+}
+
+OpTraceWriter::~OpTraceWriter() {
+  absl::Status status = Close();
+  LOG_IF(WARNING, !status.ok()) << status;
+}
+
+void OpTraceWriter::Append(uint64_t post_time_ns, uint32_t qp_id,
+                           OpTypes op_type, uint32_t op_size_bytes,
+                           bool end_of_batch) {
+  absl::MutexLock lock(&mutex_);
+  if (fd_ < 0) return;
+  const uint64_t gap_ns =
+      header_.num_records == 0 && buffer_.empty()
+          ? 0
+          : post_time_ns - std::min(post_time_ns, last_post_time_ns_);
+  last_post_time_ns_ = std::max(last_post_time_ns_, post_time_ns);
+  buffer_.push_back(OpTraceRecord{
+      .gap_ns = static_cast<uint32_t>(std::min<uint64_t>(
+          gap_ns, std::numeric_limits<uint32_t>::max())),
+      .qp_id = qp_id,
+      .op_size_bytes = op_size_bytes,
+      .op_type = static_cast<uint8_t>(op_type),
+      .flags = end_of_batch ? OpTraceRecord::kEndOfBatch : uint8_t{0}});
+  header_.max_op_size_bytes = std::max(header_.max_op_size_bytes, op_size_bytes);
+  if (buffer_.size() >= kWriteBufferRecords) {
+    absl::Status status = FlushLocked();
+    if (status_.ok()) status_ = status;
+  }
+}
+
+absl::Status OpTraceWriter::FlushLocked() {
+  if (buffer_.empty()) return absl::OkStatus();
+  const off_t offset = sizeof(OpTraceHeader) +
+                       header_.num_records * sizeof(OpTraceRecord);
+  const size_t num_records = buffer_.size();
+  const bool written = PwriteAll(
+      fd_, buffer_.data(), num_records * sizeof(OpTraceRecord), offset);
+  buffer_.clear();
+  if (!written) {
+    return ErrnoError("Failed to write op trace", path_);
+  }
+  header_.num_records += num_records;
+  return absl::OkStatus();
+}
+
+absl::Status OpTraceWriter::Close() {
+  absl::MutexLock lock(&mutex_);
+  if (fd_ < 0) return status_;
+  absl::Status status = FlushLocked();
+  if (status_.ok()) status_ = status;
+  if (!PwriteAll(fd_, &header_, sizeof(header_), 0) && status_.ok()) {
+    status_ = ErrnoError("Failed to write op trace", path_);
+  }
+  if (close(fd_) != 0 && status_.ok()) {
+    status_ = ErrnoError("Failed to close op trace", path_);
+  }
+  fd_ = -1;
+  return status_;
+}
+
+absl::StatusOr<std::unique_ptr<OpTraceReader>> OpTraceReader::Open(
+    const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrnoError("Failed to open op trace", path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    absl::Status status = ErrnoError("Failed to stat op trace", path);
+    close(fd);
+    return status;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  if (size < sizeof(OpTraceHeader)) {
+    close(fd);
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is too small to be an op trace."));
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return ErrnoError("Failed to map op trace", path);
+  }
+  // Construct the reader first, so that the mapping is unmapped on errors.
+  auto reader = absl::WrapUnique(new OpTraceReader(mapping, size));
+  OpTraceHeader header;
+  std::memcpy(&header, mapping, sizeof(header));
+  if (header.magic != OpTraceHeader::kMagic ||
+      header.version != OpTraceHeader::kVersion ||
+      header.record_size != sizeof(OpTraceRecord)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not a version ", OpTraceHeader::kVersion,
+                     " op trace."));
+  }
+  reader->records_ = reinterpret_cast<const OpTraceRecord*>(
+      static_cast<const char*>(mapping) + sizeof(OpTraceHeader));
+  reader->num_records_ =
+      (size - sizeof(OpTraceHeader)) / sizeof(OpTraceRecord);
+  reader->max_op_size_bytes_ = header.max_op_size_bytes;
+  if (header.num_records != reader->num_records_) {
+    // The trace was not closed, so its header is incomplete.
+    LOG(WARNING) << path << " was not closed properly, reading "
+                 << reader->num_records_ << " records.";
+    reader->max_op_size_bytes_ = 0;
+    for (size_t i = 0; i < reader->num_records_; ++i) {
+      reader->max_op_size_bytes_ = std::max(
+          reader->max_op_size_bytes_, reader->records_[i].op_size_bytes);
+    }
+    reader->Release(reader->num_records_);
+  }
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  return reader;
+}
+
+OpTraceReader::OpTraceReader(void* mapping, size_t mapping_size)
+    : mapping_(mapping), mapping_size_(mapping_size) {}
+
+OpTraceReader::~OpTraceReader() { munmap(mapping_, mapping_size_); }
+
+void OpTraceReader::Release(size_t index) const {
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t end = (sizeof(OpTraceHeader) +
+                      std::min(index, num_records_) * sizeof(OpTraceRecord)) /
+                     page_size * page_size;
+  if (end > 0) {
+    madvise(mapping_, end, MADV_DONTNEED);
+  }
+}
+
+}  // namespace rdma_unit_test
@@ -0,0 +1,147 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OP_TRACE_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OP_TRACE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "traffic/op_types.h"
+
+namespace rdma_unit_test {
+
+// An op trace records the initiated ops (ie. all but kRecv) posted by a
+// Client, in the order they were handed to the device, so that a run can be
+// replayed. The file is an OpTraceHeader followed by fixed size
+// OpTraceRecords, in host byte order.
+struct OpTraceHeader {
+  static constexpr uint64_t kMagic = 0x3143525454414452;  // "RDATTRC1"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic = kMagic;
+  uint32_t version = kVersion;
+  uint32_t record_size = 0;
+  // Only set once the trace is closed; readers count records from the file
+  // size, so that a trace cut short by a crash can still be read.
+  uint64_t num_records = 0;
+  uint32_t max_op_size_bytes = 0;
+  uint32_t reserved = 0;
+};
+static_assert(sizeof(OpTraceHeader) == 32);
+
+struct OpTraceRecord {
+  // Flags.
+  static constexpr uint8_t kEndOfBatch = 1;
+
+  // Time between the previous record and this one being posted, in ns,
+  // saturated at ~4.3s. Ops posted in the same batch have a gap of 0.
+  uint32_t gap_ns = 0;
+  uint32_t qp_id = 0;
+  uint32_t op_size_bytes = 0;
+  // An OpTypes.
+  uint8_t op_type = 0;
+  // kEndOfBatch if the op was the last of the wqes posted on its qp with one
+  // doorbell.
+  uint8_t flags = 0;
+  uint16_t reserved = 0;
+
+  OpTypes type() const { return static_cast<OpTypes>(op_type); }
+  bool end_of_batch() const { return (flags & kEndOfBatch) != 0; }
+};
+static_assert(sizeof(OpTraceRecord) == 16);
+
+// Appends records to a trace file. Records are buffered and written in large
+// chunks. Thread safe, as the qps of a Client may be driven from several
+// threads.
+class OpTraceWriter {
+ public:
+  // Creates (or truncates) the trace file at `path`.
+  static absl::StatusOr<std::unique_ptr<OpTraceWriter>> Create(
+      const std::string& path);
+  // Not copyable or movable.
+  OpTraceWriter(const OpTraceWriter& writer) = delete;
+  OpTraceWriter& operator=(const OpTraceWriter& writer) = delete;
+  OpTraceWriter(OpTraceWriter&& writer) = delete;
+  OpTraceWriter& operator=(OpTraceWriter&& writer) = delete;
+  // Closes the trace if Close() was not called.
+  ~OpTraceWriter();
+
+  // Appends an op posted at `post_time_ns` (absl::GetCurrentTimeNanos()).
+  void Append(uint64_t post_time_ns, uint32_t qp_id, OpTypes op_type,
+              uint32_t op_size_bytes, bool end_of_batch);
+
+  // Writes the buffered records and the final header, and closes the file.
+  absl::Status Close();
+
+  const std::string& path() const { return path_; }
+
+ private:
+  OpTraceWriter(std::string path, int fd);
+  absl::Status FlushLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const std::string path_;
+  absl::Mutex mutex_;
+  int fd_ ABSL_GUARDED_BY(mutex_);
+  std::vector<OpTraceRecord> buffer_ ABSL_GUARDED_BY(mutex_);
+  OpTraceHeader header_ ABSL_GUARDED_BY(mutex_);
+  uint64_t last_post_time_ns_ ABSL_GUARDED_BY(mutex_) = 0;
+  // The first error writing the file, reported by Close().
+  absl::Status status_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Reads a trace file through a read-only memory mapping, so that traces much
+// larger than memory can be streamed: the pages of records are faulted in on
+// access and, when a reader is done with them, dropped with Release().
+class OpTraceReader {
+ public:
+  static absl::StatusOr<std::unique_ptr<OpTraceReader>> Open(
+      const std::string& path);
+  // Not copyable or movable.
+  OpTraceReader(const OpTraceReader& reader) = delete;
+  OpTraceReader& operator=(const OpTraceReader& reader) = delete;
+  OpTraceReader(OpTraceReader&& reader) = delete;
+  OpTraceReader& operator=(OpTraceReader&& reader) = delete;
+  ~OpTraceReader();
+
+  size_t size() const { return num_records_; }
+  bool empty() const { return num_records_ == 0; }
+  const OpTraceRecord& record(size_t index) const { return records_[index]; }
+  uint32_t max_op_size_bytes() const { return max_op_size_bytes_; }
+
+  // Tells the kernel that records before `index` will not be read again soon,
+  // so that their pages can be reclaimed. Reading them remains valid.
+  void Release(size_t index) const;
+
+ private:
+  OpTraceReader(void* mapping, size_t mapping_size);
+
+  void* const mapping_;
+  const size_t mapping_size_;
+  const OpTraceRecord* records_ = nullptr;
+  size_t num_records_ = 0;
+  uint32_t max_op_size_bytes_ = 0;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OP_TRACE_H_
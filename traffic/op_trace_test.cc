@@ -0,0 +1,187 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "traffic/op_trace.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "public/status_matchers.h"
+#include "traffic/op_types.h"
+
+namespace rdma_unit_test {
+namespace {
+
+// More records than the writer buffers, so that traces span several writes.
+constexpr uint32_t kManyRecords = 10000;
+
+std::string TracePath(const std::string& name) {
+  return testing::TempDir() + "/" + name;
+}
+
+// Appends `count` records whose fields are derived from their index, posted
+// 10ns apart, in batches of 4.
+void AppendRecords(OpTraceWriter& writer, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    writer.Append(/*post_time_ns=*/1000 + 10 * i, /*qp_id=*/i % 7,
+                  i % 2 == 0 ? OpTypes::kWrite : OpTypes::kRead,
+                  /*op_size_bytes=*/64 + i, /*end_of_batch=*/i % 4 == 3);
+  }
+}
+
+void ExpectRecords(const OpTraceReader& reader, uint32_t count) {
+  ASSERT_EQ(reader.size(), count);
+  for (uint32_t i = 0; i < count; ++i) {
+    SCOPED_TRACE(i);
+    const OpTraceRecord& record = reader.record(i);
+    EXPECT_EQ(record.gap_ns, i == 0 ? 0 : 10);
+    EXPECT_EQ(record.qp_id, i % 7);
+    EXPECT_EQ(record.type(), i % 2 == 0 ? OpTypes::kWrite : OpTypes::kRead);
+    EXPECT_EQ(record.op_size_bytes, 64 + i);
+    EXPECT_EQ(record.end_of_batch(), i % 4 == 3);
+  }
+  EXPECT_EQ(reader.max_op_size_bytes(), count == 0 ? 0 : 64 + count - 1);
+}
+
+TEST(OpTraceTest, RoundTrip) {
+  const std::string path = TracePath("round_trip.trace");
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceWriter> writer,
+                       OpTraceWriter::Create(path));
+  EXPECT_EQ(writer->path(), path);
+  AppendRecords(*writer, kManyRecords);
+  ASSERT_OK(writer->Close());
+  // Appending after Close() is ignored.
+  AppendRecords(*writer, 1);
+  ASSERT_OK(writer->Close());
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceReader> reader,
+                       OpTraceReader::Open(path));
+  ExpectRecords(*reader, kManyRecords);
+  // Released records can still be read, from the file.
+  reader->Release(reader->size());
+  EXPECT_EQ(reader->record(0).op_size_bytes, 64);
+  EXPECT_EQ(reader->record(kManyRecords - 1).op_size_bytes,
+            64 + kManyRecords - 1);
+}
+
+TEST(OpTraceTest, EmptyTrace) {
+  const std::string path = TracePath("empty.trace");
+  {
+    // The destructor closes the trace.
+    ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceWriter> writer,
+                         OpTraceWriter::Create(path));
+  }
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceReader> reader,
+                       OpTraceReader::Open(path));
+  EXPECT_TRUE(reader->empty());
+  EXPECT_EQ(reader->max_op_size_bytes(), 0);
+}
+
+TEST(OpTraceTest, GapsSaturate) {
+  const std::string path = TracePath("gaps.trace");
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceWriter> writer,
+                       OpTraceWriter::Create(path));
+  const uint64_t start = 1000;
+  const uint64_t late = start + uint64_t{10} *
+                                    std::numeric_limits<uint32_t>::max();
+  writer->Append(start, 0, OpTypes::kSend, 8, true);
+  writer->Append(late, 0, OpTypes::kSend, 8, true);
+  // Posts racing on other threads may be appended out of order; they count as
+  // part of the same batch rather than as a negative gap.
+  writer->Append(late - 5, 0, OpTypes::kSend, 8, true);
+  ASSERT_OK(writer->Close());
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceReader> reader,
+                       OpTraceReader::Open(path));
+  ASSERT_EQ(reader->size(), 3);
+  EXPECT_EQ(reader->record(0).gap_ns, 0);
+  EXPECT_EQ(reader->record(1).gap_ns, std::numeric_limits<uint32_t>::max());
+  EXPECT_EQ(reader->record(2).gap_ns, 0);
+}
+
+TEST(OpTraceTest, RecoversUnclosedTrace) {
+  const std::string path = TracePath("unclosed.trace");
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // Crash while tracing: the buffered records are written, but neither the
+    // remaining records nor the final header are.
+    absl::StatusOr<std::unique_ptr<OpTraceWriter>> writer =
+        OpTraceWriter::Create(path);
+    if (!writer.ok()) _exit(1);
+    AppendRecords(**writer, kManyRecords);
+    _exit(0);
+  }
+  int wstatus = 0;
+  ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+  ASSERT_TRUE(WIFEXITED(wstatus));
+  ASSERT_EQ(WEXITSTATUS(wstatus), 0);
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceReader> reader,
+                       OpTraceReader::Open(path));
+  // Only whole buffers made it to the file, and the header still counts none
+  // of them. The reader recovers the written records from the file size.
+  ASSERT_GT(reader->size(), 0);
+  ASSERT_LT(reader->size(), kManyRecords);
+  ExpectRecords(*reader, reader->size());
+}
+
+TEST(OpTraceTest, IgnoresTornRecord) {
+  const std::string path = TracePath("torn.trace");
+  {
+    ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceWriter> writer,
+                         OpTraceWriter::Create(path));
+    AppendRecords(*writer, 100);
+    ASSERT_OK(writer->Close());
+  }
+  // Cut the last record in half, as a crash in the middle of a write would.
+  ASSERT_EQ(truncate(path.c_str(), sizeof(OpTraceHeader) +
+                                       100 * sizeof(OpTraceRecord) -
+                                       sizeof(OpTraceRecord) / 2),
+            0);
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<OpTraceReader> reader,
+                       OpTraceReader::Open(path));
+  ExpectRecords(*reader, 99);
+}
+
+TEST(OpTraceTest, RejectsOtherFiles) {
+  const std::string path = TracePath("not_a.trace");
+  EXPECT_THAT(OpTraceReader::Open(path).status(),
+              StatusIs(absl::StatusCode::kInternal));
+  {
+    std::ofstream file(path);
+    file << "too short";
+  }
+  EXPECT_THAT(OpTraceReader::Open(path).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  {
+    std::ofstream file(path);
+    file << std::string(sizeof(OpTraceHeader) + sizeof(OpTraceRecord), 'x');
+  }
+  EXPECT_THAT(OpTraceReader::Open(path).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace rdma_unit_test
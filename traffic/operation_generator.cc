@@ -19,12 +19,16 @@
 #include <algorithm>
 #include <cstdint>
 #include <iterator>
+#include <memory>
 #include <random>
+#include <utility>
 #include <vector>
 
 #include "absl/flags/flag.h"
+#include "absl/log/check.h"
 #include "absl/strings/string_view.h"
 #include "traffic/config.pb.h"
+#include "traffic/op_trace.h"
 #include "traffic/op_types.h"
 
 ABSL_FLAG(uint32_t, random_seed, time(nullptr),
@@ -78,4 +82,23 @@ OperationGenerator::OpAttributes RandomizedOperationGenerator::NextOp() {
           op_size_lookup_[op_size_distribution_(random_engine_)]};
 }
 
+TraceOperationGenerator::TraceOperationGenerator(
+    std::shared_ptr<const OpTraceReader> trace)
+    : trace_(std::move(trace)) {
+  CHECK(trace_ != nullptr && !trace_->empty())  // Crash OK
+      << "Cannot generate ops from an empty trace.";
+}
+
+OperationGenerator::OpAttributes TraceOperationGenerator::NextOp() {
+  const OpTraceRecord& record = trace_->record(next_record_);
+  ++next_record_;
+  if (next_record_ % kReleaseInterval == 0) {
+    trace_->Release(next_record_);
+  }
+  if (next_record_ == trace_->size()) {
+    next_record_ = 0;
+  }
+  return {record.type(), static_cast<int>(record.op_size_bytes)};
+}
+
 }  // namespace rdma_unit_test
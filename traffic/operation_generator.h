@@ -16,13 +16,16 @@
 #define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OPERATION_GENERATOR_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <random>
 #include <vector>
 
 #include "absl/flags/declare.h"
 #include "google/protobuf/repeated_ptr_field.h"
 #include "traffic/config.pb.h"
+#include "traffic/op_trace.h"
 #include "traffic/op_types.h"
 
 ABSL_DECLARE_FLAG(uint32_t, random_seed);
@@ -127,6 +130,29 @@ class ConstantUdOperationGenerator : public ConstantRcOperationGenerator {
   ~ConstantUdOperationGenerator() override {}
 };
 
+// Generates the op types and sizes of an op trace (see op_trace.h), in trace
+// order, and starts over at the end of the trace. This replays the op mix of a
+// trace with any Client::ExecuteOps() setup; Client::ReplayTrace() also
+// follows the qps, gaps and batches of the trace. The trace is streamed, so it
+// can be much larger than memory, and may be shared between generators.
+class TraceOperationGenerator : public OperationGenerator {
+ public:
+  // `trace` must not be empty.
+  explicit TraceOperationGenerator(std::shared_ptr<const OpTraceReader> trace);
+  ~TraceOperationGenerator() override {}
+
+  OpAttributes NextOp() override;
+
+  int MaxOpSize() const override { return trace_->max_op_size_bytes(); }
+
+ private:
+  // Number of records read between releasing the pages of read records.
+  static constexpr size_t kReleaseInterval = size_t{1} << 16;
+
+  std::shared_ptr<const OpTraceReader> trace_;
+  size_t next_record_ = 0;
+};
+
 }  // namespace rdma_unit_test
 
 #endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_OPERATION_GENERATOR_H_
@@ -25,7 +25,8 @@
 
 namespace rdma_unit_test {
 
-class TestOp;
+struct TestOp;
+struct TestOpDeleter;
 
 // An interface for accessing methods in QpState used by an Op. Remote QpState
 // are stored in QpState (for RC QPs) or TestOp (for UD QP). The interface
@@ -64,6 +65,9 @@ class QpOpInterface {
 
   virtual void StoreOpForValidation(TestOp* op_ptr) = 0;
 
+  // Frees the buffer slots reserved by the given op, once it was validated.
+  virtual void ReleaseOpBuffers(const TestOp& op) = 0;
+
   virtual void FreeBufferAddress(OpAddressesParams::BufferType buffer_type,
                                  uint8_t* addr) = 0;
 
@@ -71,7 +75,8 @@ class QpOpInterface {
 
   virtual void IncrCompletedOps(uint64_t op_cnt, OpTypes op_type) = 0;
 
-  virtual std::unique_ptr<TestOp> TryValidateRecvOp(const TestOp& send) = 0;
+  virtual std::unique_ptr<TestOp, TestOpDeleter> TryValidateRecvOp(
+      const TestOp& send) = 0;
 };
 
 }  // namespace rdma_unit_test
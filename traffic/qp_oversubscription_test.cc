@@ -21,6 +21,7 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/flags/flag.h"
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_format.h"
@@ -32,6 +33,10 @@
 #include "traffic/rdma_stress_fixture.h"
 #include "traffic/test_op.h"
 
+ABSL_FLAG(int, client_shards, 1,
+          "The number of shards each client partitions its qps into. Each "
+          "shard is driven by its own thread during ExecuteOps.");
+
 namespace rdma_unit_test {
 namespace {
 
@@ -57,7 +62,8 @@ TEST_P(QpOversubscriptionTest, StressTest) {
   const Client::Config kClientConfig = {
       .max_op_size = kOpSize,
       .max_outstanding_ops_per_qp = kMaxInflightOps,
-      .max_qps = kMaxQps};
+      .max_qps = kMaxQps,
+      .num_shards = absl::GetFlag(FLAGS_client_shards)};
   Client initiator(/*client_id=*/0, context(), port_attr(), kClientConfig),
       target(/*client_id=*/1, context(), port_attr(), kClientConfig);
   LOG(INFO) << "initiator id: " << initiator.client_id()
@@ -14,10 +14,9 @@
 
 #include "traffic/qp_state.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
-#include <deque>
-#include <list>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -26,7 +25,6 @@
 
 #include "gtest/gtest.h"
 #include "absl/container/flat_hash_map.h"
-#include "absl/container/flat_hash_set.h"
 #include "absl/flags/flag.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
@@ -34,8 +32,11 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
 #include "absl/types/span.h"
 #include "infiniband/verbs.h"
+#include "traffic/buffer_slot_allocator.h"
+#include "traffic/hot_path_logging.h"
 #include "traffic/op_types.h"
 #include "traffic/qp_op_interface.h"
 #include "traffic/test_op.h"
@@ -56,8 +57,13 @@ QpState::QpState(int local_client_id, ibv_qp* qp, uint32_t qp_id, bool is_rc,
       dest_buffer_{.base_addr = dest_buffer.data(),
                    .length = dest_buffer.size(),
                    .max_op_size = dest_buffer.size() / max_outstanding_ops},
+      op_pool_{static_cast<size_t>(max_outstanding_ops)},
+      unchecked_received_ops_{static_cast<size_t>(max_outstanding_ops)},
+      unchecked_initiated_ops_{static_cast<size_t>(max_outstanding_ops)},
       local_client_id_{local_client_id},
       qp_id_{qp_id} {
+  outstanding_ops_.reserve(max_outstanding_ops);
+
   // Generate the list of aligned addresses (offsets) in the src and dst buffer
   // to be used by ops posted on this qp. First, align *down* max_op_size. This
   // is safe as we added an extra buffer of sizeof(uintptr_t) bytes when
@@ -91,14 +97,12 @@ QpState::QpState(int local_client_id, ibv_qp* qp, uint32_t qp_id, bool is_rc,
                << " buffer_length: " << length;
   }
 
-  for (int i = 0; i < max_outstanding_ops; ++i) {
-    src_buffer_.free_addresses.insert(
-        static_cast<uint8_t*>(aligned_src_buffer_base_addr) +
-        i * src_buffer_.max_op_size);
-    dest_buffer_.free_addresses.insert(
-        static_cast<uint8_t*>(aligned_dest_buffer_base_addr) +
-        i * dest_buffer_.max_op_size);
-  }
+  src_buffer_.slots =
+      BufferSlotAllocator(static_cast<uint8_t*>(aligned_src_buffer_base_addr),
+                          src_buffer_.max_op_size, max_outstanding_ops);
+  dest_buffer_.slots =
+      BufferSlotAllocator(static_cast<uint8_t*>(aligned_dest_buffer_base_addr),
+                          dest_buffer_.max_op_size, max_outstanding_ops);
 }
 
 void QpState::IncrCompletedBytes(uint64_t bytes, OpTypes op_type) {
@@ -216,99 +220,120 @@ absl::StatusOr<std::vector<uint8_t*>> QpState::GetNextOpAddresses(
           "Op buffer must be allocated on src_buffer_ or dest_buffer_.");
   }
 
-  if (num_ops > buffer->free_addresses.size()) {
+  std::vector<uint8_t*> op_addrs;
+  op_addrs.reserve(num_ops);
+  if (num_ops < 0 || !buffer->slots.Allocate(num_ops, op_addrs)) {
     return absl::OutOfRangeError(
         "Allocation request exceeds available buffer space!");
   }
 
-  std::vector<uint8_t*> op_addrs;
-  op_addrs.reserve(num_ops);
-
-  for (int i = 0; i < num_ops; ++i) {
-    auto addr_iter = buffer->free_addresses.begin();
-    op_addrs.push_back(*addr_iter);
-    buffer->active_addresses.insert(*addr_iter);
-    buffer->free_addresses.erase(addr_iter);
-    LOG(INFO) << "New " << TestOp::ToString(op_type) << " op allocated on client "
-            << local_client_id_ << ", qp_id " << qp_id()
-            << ", addr: " << static_cast<void*>(op_addrs.back())
-            << ", op size: " << op_bytes;
+  if (HotPathLoggingEnabled()) {
+    for (uint8_t* op_addr : op_addrs) {
+      LOG(INFO) << "New " << TestOp::ToString(op_type)
+                << " op allocated on client " << local_client_id_ << ", qp_id "
+                << qp_id() << ", addr: " << static_cast<void*>(op_addr)
+                << ", op size: " << op_bytes;
+    }
   }
   return op_addrs;
 }
 
-void QpState::BatchRcSendWqe(std::unique_ptr<ibv_send_wr> wqe,
-                             std::unique_ptr<ibv_sge> sge, uint32_t op_id) {
-  TestOp* op_raw_ptr = reinterpret_cast<TestOp*>(wqe->wr_id);
-  LOG(INFO) << "Batching op " << op_id << ", type "
-          << TestOp::ToString(op_raw_ptr->op_type) << ", size "
-          << op_raw_ptr->length << " bytes, on qp " << qp_id();
-  if (!rc_send_batch_.empty()) {
-    rc_send_batch_.back().wqe->next = wqe.get();
+void QpState::BatchRcSendWqe(TestOp* op) {
+  HOT_PATH_LOG(INFO) << "Batching op " << op->op_id << ", type "
+                     << TestOp::ToString(op->op_type) << ", size "
+                     << op->length << " bytes, on qp " << qp_id();
+  op->send_wr.next = nullptr;
+  if (rc_send_batch_tail_ != nullptr) {
+    rc_send_batch_tail_->next = &op->send_wr;
+  } else {
+    rc_send_batch_head_ = &op->send_wr;
   }
-  rc_send_batch_.push_back({.wqe = std::move(wqe), .sge = std::move(sge)});
+  rc_send_batch_tail_ = &op->send_wr;
+  ++rc_send_batch_count_;
 }
 
 void QpState::FlushRcSendWqes() {
-  if (rc_send_batch_.empty()) return;
-  int send_batch_size = rc_send_batch_.size();
+  if (rc_send_batch_head_ == nullptr) return;
+  const uint64_t now_ns = absl::GetCurrentTimeNanos();
+  for (ibv_send_wr* wqe = rc_send_batch_head_; wqe != nullptr;
+       wqe = wqe->next) {
+    reinterpret_cast<TestOp*>(wqe->wr_id)->post_timestamp_ns = now_ns;
+  }
   ibv_send_wr* bad_wr;
-  int ibv_ret = ibv_post_send(qp_, rc_send_batch_.front().wqe.get(), &bad_wr);
+  int ibv_ret = ibv_post_send(qp_, rc_send_batch_head_, &bad_wr);
   if (ibv_ret != 0) {
     LOG(FATAL) << "ibv_post_send returned non-zero error: "  // Crash OK.
                << ibv_ret;
   }
-  LOG(INFO) << "posted a batch of size " << send_batch_size << ", on qp "
-          << qp_id();
-  do {
-    std::unique_ptr<ibv_send_wr> wqe_head =
-        std::move(rc_send_batch_.front().wqe);
-
-    // reinterpret_cast is safe bc wr_id is a cookie in the wqe that we set to
-    // the address of the corresponding TestOp, when the TestOp and its wqe are
-    // created.
-    TestOp* op_raw_ptr = reinterpret_cast<TestOp*>(wqe_head->wr_id);
-    LOG(INFO) << "\t\t  op id " << op_raw_ptr->op_id << ", type "
-            << TestOp::ToString(op_raw_ptr->op_type) << ", size "
-            << op_raw_ptr->length << " bytes.";
-    rc_send_batch_.pop_front();
-  } while (!rc_send_batch_.empty());
+  if (trace_writer_ != nullptr) {
+    for (ibv_send_wr* wqe = rc_send_batch_head_; wqe != nullptr;
+         wqe = wqe->next) {
+      RecordPostedOp(*reinterpret_cast<TestOp*>(wqe->wr_id),
+                     /*end_of_batch=*/wqe->next == nullptr);
+    }
+  }
+  if (HotPathLoggingEnabled()) {
+    LOG(INFO) << "posted a batch of size " << rc_send_batch_count_
+              << ", on qp " << qp_id();
+    for (ibv_send_wr* wqe = rc_send_batch_head_; wqe != nullptr;
+         wqe = wqe->next) {
+      // reinterpret_cast is safe bc wr_id is a cookie in the wqe that we set to
+      // the address of the corresponding TestOp, when the TestOp and its wqe
+      // are created.
+      TestOp* op_raw_ptr = reinterpret_cast<TestOp*>(wqe->wr_id);
+      LOG(INFO) << "\t\t  op id " << op_raw_ptr->op_id << ", type "
+                << TestOp::ToString(op_raw_ptr->op_type) << ", size "
+                << op_raw_ptr->length << " bytes.";
+    }
+  }
+  rc_send_batch_head_ = nullptr;
+  rc_send_batch_tail_ = nullptr;
+  rc_send_batch_count_ = 0;
 }
 
-void QpState::BatchRcRecvWqe(std::unique_ptr<ibv_recv_wr> wqe,
-                             std::unique_ptr<ibv_sge> sge, uint32_t op_id) {
-  LOG(INFO) << "Batching recv op " << op_id << ", size " << sge->length
-          << " bytes, on qp " << qp_id();
-  if (!rc_recv_batch_.empty()) {
-    rc_recv_batch_.back().wqe->next = wqe.get();
+void QpState::BatchRcRecvWqe(TestOp* op) {
+  HOT_PATH_LOG(INFO) << "Batching recv op " << op->op_id << ", size "
+                     << op->sge.length << " bytes, on qp " << qp_id();
+  op->recv_wr.next = nullptr;
+  if (rc_recv_batch_tail_ != nullptr) {
+    rc_recv_batch_tail_->next = &op->recv_wr;
+  } else {
+    rc_recv_batch_head_ = &op->recv_wr;
   }
-  rc_recv_batch_.push_back({.wqe = std::move(wqe), .sge = std::move(sge)});
+  rc_recv_batch_tail_ = &op->recv_wr;
+  ++rc_recv_batch_count_;
 }
 
 void QpState::FlushRcRecvWqes() {
-  if (rc_recv_batch_.empty()) return;
-  int recv_batch_size = rc_recv_batch_.size();
+  if (rc_recv_batch_head_ == nullptr) return;
+  const uint64_t now_ns = absl::GetCurrentTimeNanos();
+  for (ibv_recv_wr* wqe = rc_recv_batch_head_; wqe != nullptr;
+       wqe = wqe->next) {
+    reinterpret_cast<TestOp*>(wqe->wr_id)->post_timestamp_ns = now_ns;
+  }
   ibv_recv_wr* bad_wr;
-  int ibv_ret = ibv_post_recv(qp_, rc_recv_batch_.front().wqe.get(), &bad_wr);
+  int ibv_ret = ibv_post_recv(qp_, rc_recv_batch_head_, &bad_wr);
   if (ibv_ret != 0) {
     LOG(FATAL) << "ibv_post_recv returned non-zero error: "  // Crash OK.
                << ibv_ret;
   }
-  LOG(INFO) << "posted a batch of size " << recv_batch_size << ", on qp "
-          << qp_id();
-  do {
-    std::unique_ptr<ibv_recv_wr> wqe_head =
-        std::move(rc_recv_batch_.front().wqe);
-
-    // reinterpret_cast is safe bc wr_id is a cookie in the wqe that we set to
-    // the address of the corresponding TestOp, when the TestOp and its wqe are
-    // created.
-    TestOp* op_raw_ptr = reinterpret_cast<TestOp*>(wqe_head->wr_id);
-    LOG(INFO) << "\t\t  op id " << op_raw_ptr->op_id << ", type "
-            << TestOp::ToString(op_raw_ptr->op_type) << ", size "
-            << op_raw_ptr->length << " bytes.";
-    rc_recv_batch_.pop_front();
-  } while (!rc_recv_batch_.empty());
+  if (HotPathLoggingEnabled()) {
+    LOG(INFO) << "posted a batch of size " << rc_recv_batch_count_
+              << ", on qp " << qp_id();
+    for (ibv_recv_wr* wqe = rc_recv_batch_head_; wqe != nullptr;
+         wqe = wqe->next) {
+      // reinterpret_cast is safe bc wr_id is a cookie in the wqe that we set to
+      // the address of the corresponding TestOp, when the TestOp and its wqe
+      // are created.
+      TestOp* op_raw_ptr = reinterpret_cast<TestOp*>(wqe->wr_id);
+      LOG(INFO) << "\t\t  op id " << op_raw_ptr->op_id << ", type "
+                << TestOp::ToString(op_raw_ptr->op_type) << ", size "
+                << op_raw_ptr->length << " bytes.";
+    }
+  }
+  rc_recv_batch_head_ = nullptr;
+  rc_recv_batch_tail_ = nullptr;
+  rc_recv_batch_count_ = 0;
 }
 
 void QpState::CheckDataLanded() {
@@ -319,7 +344,7 @@ void QpState::CheckDataLanded() {
   LOG(INFO) << "client " << local_client_id_ << " qp_id " << qp_id() << ", has "
             << outstanding_ops().size() << " outstanding_ops "
             << unchecked_initiated_ops_.size() << " unchecked_initiated_ops_ "
-            << unchecked_received_ops_.size() << " unchecked_received_ops_";
+            << unchecked_received_ops_count() << " unchecked_received_ops_";
 
   for (const auto& [op_id, op_ptr] : outstanding_ops()) {
     if (op_ptr == nullptr) {
@@ -359,10 +384,17 @@ void QpState::CheckDataLanded() {
     LOG(INFO) << "src: " << op_ptr->SrcBuffer();
     LOG(INFO) << "dst: " << op_ptr->DestBuffer();
   }
+  for (const auto& [header, op_ptr] : unchecked_ud_received_ops_) {
+    LOG(INFO) << "op_id " << op_ptr->op_id << " from client "
+              << header.client_id << " qp_id " << header.qp_id << " op_id "
+              << header.op_id << " "
+              << static_cast<void*>(op_ptr->dest_addr);
+    LOG(INFO) << "dst: " << op_ptr->DestBuffer();
+  }
 }
 
-std::unique_ptr<TestOp> QpState::TryValidateRecvOp(const TestOp& send) {
-  std::unique_ptr<TestOp> target_op_uptr = nullptr;
+TestOpPtr QpState::TryValidateRecvOp(const TestOp& send) {
+  TestOpPtr target_op_uptr = nullptr;
   if (is_rc()) {
     if (!unchecked_received_ops_.empty()) {
       target_op_uptr = std::move(unchecked_received_ops_.front());
@@ -370,25 +402,49 @@ std::unique_ptr<TestOp> QpState::TryValidateRecvOp(const TestOp& send) {
     }
   } else {  // is UD
     // Because UD operations can arrive out of order, find the corresponding
-    // receive operation to this send by comparing op buffers directly.
+    // receive operation to this send by the header embedded in its payload,
+    // and only compare the payloads of the matched pair.
+    if (send.length >= sizeof(UdPayloadHeader)) {
+      auto dest_it = unchecked_ud_received_ops_.find(
+          UdPayloadHeader::ReadFrom(send.src_addr));
+      if (dest_it != unchecked_ud_received_ops_.end()) {
+        target_op_uptr = std::move(dest_it->second);
+        unchecked_ud_received_ops_.erase(dest_it);
+        EXPECT_TRUE(target_op_uptr->length == sizeof(ibv_grh) + send.length &&
+                    std::memcmp(send.src_addr,
+                                target_op_uptr->dest_addr + sizeof(ibv_grh),
+                                send.length) == 0)
+            << "UD recv op_id " << target_op_uptr->op_id << " of "
+            << target_op_uptr->length << " bytes does not match send qp_id "
+            << send.qp_id << " op_id " << send.op_id;
+      }
+    }
+    // Sends without a header, and sends whose recv could not be indexed
+    // because another recv already took its header, are matched by comparing
+    // op buffers directly. A recv whose header was corrupted on the wire is
+    // indexed under the corrupt header and never matches, since the compared
+    // payload includes the header; its send stays unmatched and is reported
+    // by CheckDataLanded().
     for (auto dest_it = unchecked_received_ops_.begin();
-         dest_it != unchecked_received_ops_.end(); ++dest_it) {
-      if (std::memcmp(send.src_addr,
+         target_op_uptr == nullptr && dest_it != unchecked_received_ops_.end();
+         ++dest_it) {
+      if ((*dest_it)->length == sizeof(ibv_grh) + send.length &&
+          std::memcmp(send.src_addr,
                       (*dest_it)->dest_addr + sizeof(struct ibv_grh),
                       send.length) == 0) {
         target_op_uptr = std::move(*dest_it);
         unchecked_received_ops_.erase(dest_it);
-        break;
       }
     }
   }
 
   if (target_op_uptr == nullptr) {
-    LOG(INFO) << absl::StrFormat(
-        "Store SEND op for future validation! qp_id "
-        "%d, op_id %lu, src after %s: ",
-        send.qp_id, send.op_id, TestOp::ToString(send.op_type)),
-        send.SrcBuffer();
+    HOT_PATH_LOG(INFO) << absl::StrFormat(
+                              "Store SEND op for future validation! qp_id "
+                              "%d, op_id %lu, src after %s: ",
+                              send.qp_id, send.op_id,
+                              TestOp::ToString(send.op_type))
+                       << send.SrcBuffer();
   } else {
     EXPECT_EQ(target_op_uptr->status, IBV_WC_SUCCESS);
     IncrCompletedBytes(send.length, OpTypes::kRecv);
@@ -406,83 +462,89 @@ void QpState::StoreOpForValidation(TestOp* op_ptr) {
   }
 
   // Move the op from outstanding_ops to unchecked_ops.
-  if (op_ptr->op_type == OpTypes::kRecv) {
-    unchecked_received_ops().push_back(
-        std::move(outstanding_ops().at(op_ptr->op_id)));
-  } else {
-    unchecked_initiated_ops().push_back(
-        std::move(outstanding_ops().at(op_ptr->op_id)));
+  TestOpPtr op = std::move(iter->second);
+  outstanding_ops().erase(iter);
+  if (op_ptr->op_type != OpTypes::kRecv) {
+    unchecked_initiated_ops().push_back(std::move(op));
+    return;
   }
-  outstanding_ops().erase(op_ptr->op_id);
 
-  // Make a copy of op src/dest buffer in a separate variable.
-  if (op_ptr->src_addr != nullptr) {
-    op_ptr->src_buffer_copy = std::make_unique<std::vector<uint8_t>>(
-        op_ptr->src_addr, op_ptr->src_addr + src_buffer_.max_op_size);
+  if (!is_rc()) {
+    // Only copy the bytes actually received (including the GRH), which may be
+    // fewer than were posted for.
+    op_ptr->length = std::min<uint64_t>(op_ptr->length, op_ptr->byte_len);
+    op_ptr->dest_buffer_copy.assign(op_ptr->dest_addr,
+                                    op_ptr->dest_addr + op_ptr->length);
+    FreeBufferAddress(BufferType::kDestBuffer, op_ptr->dest_addr);
+    op_ptr->dest_addr = op_ptr->dest_buffer_copy.data();
+    if (op_ptr->length >= sizeof(ibv_grh) + sizeof(UdPayloadHeader)) {
+      // try_emplace() leaves `op` untouched if the header is already taken,
+      // eg. by a payload corrupted into another send's header, in which case
+      // it is matched by contents.
+      if (unchecked_ud_received_ops_
+              .try_emplace(UdPayloadHeader::ReadFrom(op_ptr->dest_addr +
+                                                     sizeof(ibv_grh)),
+                           std::move(op))
+              .second) {
+        return;
+      }
+    }
   }
-  if (op_ptr->dest_addr != nullptr) {
-    op_ptr->dest_buffer_copy = std::make_unique<std::vector<uint8_t>>(
-        op_ptr->dest_addr, op_ptr->dest_addr + dest_buffer_.max_op_size);
+  unchecked_received_ops().push_back(std::move(op));
+}
+
+void QpState::ReleaseOpBuffers(const TestOp& op) {
+  using BufferType = QpState::OpAddressesParams::BufferType;
+  if (!is_rc() && op.op_type == OpTypes::kRecv &&
+      op.dest_addr == op.dest_buffer_copy.data()) {
+    // The slot was already freed by StoreOpForValidation().
+    return;
   }
 
   // Free up the initiator side buffer address.
-  switch (op_ptr->op_type) {
+  switch (op.op_type) {
     case OpTypes::kWrite:
     case OpTypes::kSend:
-      FreeBufferAddress(BufferType::kSrcBuffer, op_ptr->src_addr);
+      FreeBufferAddress(BufferType::kSrcBuffer, op.src_addr);
       break;
     case OpTypes::kRead:
     case OpTypes::kRecv:
     case OpTypes::kCompSwap:
     case OpTypes::kFetchAdd:
-      FreeBufferAddress(BufferType::kDestBuffer, op_ptr->dest_addr);
+      FreeBufferAddress(BufferType::kDestBuffer, op.dest_addr);
       break;
     case OpTypes::kInvalid:
       LOG(FATAL) << "Invalid op_type.";  // Crash OK.
   }
   // If one-sided op, then free up the buffer address on the target side too.
-  if (op_ptr->op_type != OpTypes::kSend && op_ptr->op_type != OpTypes::kRecv) {
+  if (op.op_type != OpTypes::kSend && op.op_type != OpTypes::kRecv) {
     QpOpInterface* target_qp;
     if (is_rc()) {
       target_qp = remote_qp_state();
     } else {  // is UD.
-      target_qp = op_ptr->remote_qp;
+      target_qp = op.remote_qp;
     }
     if (target_qp == nullptr) {
       LOG(FATAL) << "Target QP cannot be null";  // Crash OK.
     }
-    if (op_ptr->op_type == OpTypes::kWrite) {
-      target_qp->FreeBufferAddress(BufferType::kDestBuffer, op_ptr->dest_addr);
+    if (op.op_type == OpTypes::kWrite) {
+      target_qp->FreeBufferAddress(BufferType::kDestBuffer, op.dest_addr);
     } else {
-      target_qp->FreeBufferAddress(BufferType::kSrcBuffer, op_ptr->src_addr);
+      target_qp->FreeBufferAddress(BufferType::kSrcBuffer, op.src_addr);
     }
   }
-
-  // Set the src/dst addr to point to the copy data.
-  if (op_ptr->src_addr != nullptr) {
-    op_ptr->src_addr = op_ptr->src_buffer_copy->data();
-  }
-  if (op_ptr->dest_addr != nullptr) {
-    op_ptr->dest_addr = op_ptr->dest_buffer_copy->data();
-  }
 }
 
 void QpState::FreeBufferAddress(OpAddressesParams::BufferType buffer_type,
                                 uint8_t* addr) {
   if (buffer_type == OpAddressesParams::BufferType::kSrcBuffer) {
-    auto iter = src_buffer_.active_addresses.find(addr);
-    if (iter == src_buffer_.active_addresses.end()) {
+    if (!src_buffer_.slots.Free(addr)) {
       LOG(FATAL) << "Freeing src buffer addr that is not pending";  // Crash OK.
     }
-    src_buffer_.free_addresses.insert(addr);
-    src_buffer_.active_addresses.erase(iter);
   } else {
-    auto iter = dest_buffer_.active_addresses.find(addr);
-    if (iter == dest_buffer_.active_addresses.end()) {
+    if (!dest_buffer_.slots.Free(addr)) {
       LOG(FATAL) << "Freeing dst buffer addr that is not pending";  // Crash OK.
     }
-    dest_buffer_.free_addresses.insert(addr);
-    dest_buffer_.active_addresses.erase(iter);
   }
 }
 
@@ -507,7 +569,7 @@ std::string QpState::DumpState() const {
       << " total_ops_completed: " << TotalOpsCompleted() << ",\n"
       << " total_ops_pending: " << outstanding_ops_count() << ",\n"
       << " unchecked_initiate_ops: " << unchecked_initiated_ops_.size() << ",\n"
-      << " unchecked_receive_ops: " << unchecked_received_ops_.size() << ",\n";
+      << " unchecked_receive_ops: " << unchecked_received_ops_count() << ",\n";
   return out.str();
 }
 
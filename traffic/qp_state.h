@@ -18,20 +18,19 @@
 #include <stdlib.h>
 
 #include <cstdint>
-#include <deque>
-#include <list>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
-#include "absl/container/flat_hash_set.h"
 #include "absl/flags/declare.h"
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "infiniband/verbs.h"
+#include "traffic/buffer_slot_allocator.h"
+#include "traffic/op_trace.h"
 #include "traffic/op_types.h"
 #include "traffic/operation_generator.h"
 #include "traffic/qp_op_interface.h"
@@ -47,16 +46,14 @@ namespace rdma_unit_test {
 class QpState : public QpOpInterface {
  public:
   // Contains information about a contiguous range of memory, defined by
-  // base_addr and length. It also keeps track of a list of addresses on which
-  // ops are posted, and can either be free or pending.
+  // base_addr and length. It is divided into max_op_size slots on which ops
+  // are posted, and each slot can either be free or active. An active slot is
+  // one with a pending operation using it.
   struct BufferInfo {
     uint8_t* base_addr = nullptr;
     uint64_t length = 0;
     uint64_t max_op_size = 0;
-    // List of free and active address. An active address is one with a pending
-    // operation using it.
-    absl::flat_hash_set<uint8_t*> free_addresses;
-    absl::flat_hash_set<uint8_t*> active_addresses;
+    BufferSlotAllocator slots;
   };
 
   // Contains information that defines a UD op's destination, i.e. an address
@@ -111,24 +108,55 @@ class QpState : public QpOpInterface {
     return outstanding_ops_.size();
   }
 
-  BufferInfo src_buffer() const { return src_buffer_; }
-  BufferInfo dest_buffer() const { return dest_buffer_; }
+  const BufferInfo& src_buffer() const { return src_buffer_; }
+  const BufferInfo& dest_buffer() const { return dest_buffer_; }
 
-  absl::flat_hash_map<uint64_t, std::unique_ptr<TestOp>>& outstanding_ops() {
+  absl::flat_hash_map<uint64_t, TestOpPtr>& outstanding_ops() {
     return outstanding_ops_;
   }
-  std::list<std::unique_ptr<TestOp>>& unchecked_received_ops() {
+  TestOpQueue& unchecked_received_ops() {
     return unchecked_received_ops_;
   }
-  std::list<std::unique_ptr<TestOp>>& unchecked_initiated_ops() {
+  // Number of kRecv ops waiting for their send to be validated, including the
+  // UD recv ops indexed by payload header.
+  size_t unchecked_received_ops_count() const {
+    return unchecked_received_ops_.size() + unchecked_ud_received_ops_.size();
+  }
+  TestOpQueue& unchecked_initiated_ops() {
     return unchecked_initiated_ops_;
   }
 
+  // Returns a TestOp from this qp's pool of op records. The op is returned to
+  // the pool when the TestOpPtr is destroyed.
+  TestOpPtr NewOp() { return op_pool_.Acquire(); }
+
   void set_op_generator(OperationGenerator* op_generator) {
     op_generator_ = op_generator;
   }
   OperationGenerator* op_generator() { return op_generator_; }
 
+  // Intrusive link of the qp into a work list of qps with unchecked initiated
+  // ops, which lets the owning Client validate completions without visiting
+  // idle qps. `on_list` is true while the qp is linked.
+  struct DirtyListLink {
+    QpState* next = nullptr;
+    bool on_list = false;
+  };
+  DirtyListLink& dirty_link() { return dirty_link_; }
+
+  // Records the initiated ops subsequently handed to the device on this qp
+  // into `trace_writer`, or stops recording if nullptr.
+  void set_trace_writer(OpTraceWriter* trace_writer) {
+    trace_writer_ = trace_writer;
+  }
+  // Records `op`, which was just handed to the device, if the qp is recorded.
+  void RecordPostedOp(const TestOp& op, bool end_of_batch) {
+    if (trace_writer_ != nullptr) {
+      trace_writer_->Append(op.post_timestamp_ns, qp_id_, op.op_type,
+                            op.length, end_of_batch);
+    }
+  }
+
   void set_src_lkey(uint32_t src_lkey) { src_lkey_ = src_lkey; }
   void set_src_rkey(uint32_t src_rkey) { src_rkey_ = src_rkey; }
   void set_dest_lkey(uint32_t dest_lkey) { dest_lkey_ = dest_lkey; }
@@ -139,16 +167,14 @@ class QpState : public QpOpInterface {
   // Returns the id of the most recent op.
   uint64_t GetLastOpId() const override { return next_op_id_ - 1; }
 
-  // Given the wqe associated with TestOp with op_id, this function saves the
-  // wqe in a batch on the qp.
-  void BatchRcSendWqe(std::unique_ptr<ibv_send_wr> wqe,
-                      std::unique_ptr<ibv_sge> sge, uint32_t op_id);
+  // Saves the send_wr (or recv_wr) of the given op in a batch on the qp. The
+  // op must remain alive until the batch is flushed.
+  void BatchRcSendWqe(TestOp* op);
   void FlushRcSendWqes();
-  void BatchRcRecvWqe(std::unique_ptr<ibv_recv_wr> wqe,
-                      std::unique_ptr<ibv_sge> sge, uint32_t op_id);
+  void BatchRcRecvWqe(TestOp* op);
   void FlushRcRecvWqes();
-  uint32_t SendRcBatchCount() const { return rc_send_batch_.size(); }
-  uint32_t RecvRcBatchCount() const { return rc_recv_batch_.size(); }
+  uint32_t SendRcBatchCount() const { return rc_send_batch_count_; }
+  uint32_t RecvRcBatchCount() const { return rc_recv_batch_count_; }
 
   uint64_t TotalOpsCompleted() const;
   uint64_t OpsCompleted(OpTypes op_type) const;
@@ -158,11 +184,9 @@ class QpState : public QpOpInterface {
 
   // Returns buffer spaces for some RDMA ops, based on parameters provided in
   // the op_params. The function returns op addresses from the least recently
-  // used chunks of the qp buffer. Since the length of the qp buffer is finite,
-  // the op buffer allocation eventually wraps around; hence the function
-  // doesn't guarantee that new ops won't over write previous inflight ops. The
-  // call returns a failure if num_ops*op_bytes is larger than the length of the
-  // target buffer.
+  // freed slots of the qp buffer, which are adjacent in the buffer whenever
+  // earlier ops completed in order. The call returns a failure if fewer than
+  // num_ops slots are free.
   absl::StatusOr<std::vector<uint8_t*>> GetNextOpAddresses(
       const OpAddressesParams& op_params) override;
 
@@ -179,28 +203,25 @@ class QpState : public QpOpInterface {
   // Validate whether the recv end of a two-sided SEND/RECV op is successful.
   // Return the corresponding RECV op as a TestOp unique_ptr if it can be found.
   // Otherwise, return nullptr.
-  std::unique_ptr<TestOp> TryValidateRecvOp(const TestOp& send) override;
+  TestOpPtr TryValidateRecvOp(const TestOp& send) override;
 
   // Stores the given TestOp for future validation upon receiving a completion
-  // for the TestOp. It moves the TestOp from outstanding_ops to unchecked_ops,
-  // makes a copy of the src/dst buffers and frees up the src/dst addresses to
-  // be used by subsequent ops.
+  // for the TestOp. It moves the TestOp from outstanding_ops to unchecked_ops.
+  // The src/dst buffer slots of the op stay reserved until ReleaseOpBuffers()
+  // is called, so that the op is validated in place without copying its
+  // buffers. The exception are UD recv ops, whose sender is not known until
+  // they are matched: their received data is copied (op length bytes) and
+  // their slot is freed right away.
   void StoreOpForValidation(TestOp* op_ptr) override;
 
+  // Frees the buffer slots of a validated op on the initiator and, for one
+  // sided ops, on the target qp.
+  void ReleaseOpBuffers(const TestOp& op) override;
+
   // Dumps the QP's internal stats into a string.
   virtual std::string ToString() const = 0;
 
  private:
-  struct SendWork {
-    std::unique_ptr<ibv_send_wr> wqe{};
-    std::unique_ptr<ibv_sge> sge{};
-  };
-
-  struct RecvWork {
-    std::unique_ptr<ibv_recv_wr> wqe{};
-    std::unique_ptr<ibv_sge> sge{};
-  };
-
   // Print buffers content if the flag print_op_buffers is true.
   static void MaybePrintBuffer(absl::string_view prefix_msg,
                                std::string op_buffer);
@@ -216,19 +237,30 @@ class QpState : public QpOpInterface {
   BufferInfo dest_buffer_;
   uint64_t next_op_id_ = 0;
 
+  // Backing storage for all TestOps posted on this qp. Declared before the
+  // containers below so that it outlives every TestOpPtr they hold.
+  TestOpPool op_pool_;
+
   // A map of inflight (submitted but not completed) ops on this qp.
   // Map format: op_id -> TestOp
-  // Using unique_ptr to provide pointer_stability for the values.
-  absl::flat_hash_map<uint64_t, std::unique_ptr<TestOp>> outstanding_ops_;
+  // The ops are owned by op_pool_, which provides pointer stability.
+  absl::flat_hash_map<uint64_t, TestOpPtr> outstanding_ops_;
 
   // Stores ops of type kRecv that have been polled with ibv_post_recv, but
   // haven't been validated yet. The local_ client needs to store unchecked
   // completions in this list until the corresponding kSend op completes at the
   // remote_.
-  std::list<std::unique_ptr<TestOp>> unchecked_received_ops_;
+  TestOpQueue unchecked_received_ops_;
+  // Unchecked kRecv ops of a UD qp, indexed by the UdPayloadHeader of the send
+  // they received. UD recv ops without a header, ie. shorter than one, are
+  // kept in unchecked_received_ops_.
+  absl::flat_hash_map<UdPayloadHeader, TestOpPtr> unchecked_ud_received_ops_;
   // Similar to unchecked_received_ops, but for initiated ops: kSend, kWrite,
   // and kRead.
-  std::list<std::unique_ptr<TestOp>> unchecked_initiated_ops_;
+  TestOpQueue unchecked_initiated_ops_;
+
+  DirtyListLink dirty_link_;
+  OpTraceWriter* trace_writer_ = nullptr;
 
   // Keeps a pointer to the remote client and local client and qp_id.
   int local_client_id_ = 0;
@@ -257,12 +289,16 @@ class QpState : public QpOpInterface {
   uint32_t dest_lkey_ = 0;
   uint32_t dest_rkey_ = 0;
 
-  // Collection of work requests that have been prepared but not yet posted to
-  // the device for processing. The items on these lists are intrusively linked
-  // to allow to post them all to the RDMA device with a single post call of the
-  // head element.
-  std::deque<SendWork> rc_send_batch_;
-  std::deque<RecvWork> rc_recv_batch_;
+  // Work requests that have been prepared but not yet posted to the device for
+  // processing. The work requests live in their TestOps and are intrusively
+  // linked through their `next` field, to allow to post them all to the RDMA
+  // device with a single post call of the head element.
+  ibv_send_wr* rc_send_batch_head_ = nullptr;
+  ibv_send_wr* rc_send_batch_tail_ = nullptr;
+  uint32_t rc_send_batch_count_ = 0;
+  ibv_recv_wr* rc_recv_batch_head_ = nullptr;
+  ibv_recv_wr* rc_recv_batch_tail_ = nullptr;
+  uint32_t rc_recv_batch_count_ = 0;
 };
 
 class RcQpState : public QpState {
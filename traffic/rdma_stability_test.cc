@@ -12,7 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <chrono>  // NOLINT
+#include <cstdint>
 #include <future>  // NOLINT
 #include <memory>
 
@@ -30,6 +32,7 @@
 #include "traffic/client.h"
 #include "traffic/config.pb.h"
 #include "traffic/op_types.h"
+#include "traffic/operation_generator.h"
 #include "traffic/rdma_stress_fixture.h"
 
 // TODO(author5) Add canned configs via TEST_P to replace the flags.
@@ -40,6 +43,12 @@ ABSL_FLAG(absl::Duration, test_duration, absl::Seconds(10),
 ABSL_FLAG(int, outstanding_ops, 10, "The number of outstainding ops per QP.");
 ABSL_FLAG(int, qps, 10, "The number of QPs created by the test.");
 ABSL_FLAG(int, op_size, 8, "The op size in bytes.");
+ABSL_FLAG(absl::Duration, stats_interval, absl::Seconds(1),
+          "The interval at which StabilityPipelinedTest reports its "
+          "throughput and error rate.");
+ABSL_FLAG(int, stability_shards, 4,
+          "The number of shards each client of StabilityShardedTest partitions "
+          "its QPs into. Each shard is driven by its own thread.");
 
 namespace rdma_unit_test {
 namespace {
@@ -186,6 +195,227 @@ TEST_F(RdmaStabilityTest, StabilityDurationTest) {
   }
 }
 
+// Same as StabilityDurationTest, but instead of posting a wave of ops on every
+// QP and waiting for the whole wave to complete, keeps every QP at
+// --outstanding_ops ops in flight by reposting on a QP as soon as its own ops
+// complete. The NIC thus sees a steady offered load for the whole test rather
+// than idling at the tail of every wave. Reports the throughput, the inflight
+// depth and the error rate every --stats_interval, and the sustained
+// throughput over the full test.
+TEST_F(RdmaStabilityTest, StabilityPipelinedTest) {
+  Client initiator(/*client_id=*/0, context(), port_attr(), kClientConfig),
+      target(/*client_id=*/1, context(), port_attr(), kClientConfig);
+  int num_qps = absl::GetFlag(FLAGS_qps);
+  ASSERT_LE(num_qps, kMaxQps);
+  int ops = absl::GetFlag(FLAGS_outstanding_ops);
+  ASSERT_LE(ops, kMaxOutstandingOps);
+  int op_size = absl::GetFlag(FLAGS_op_size);
+  ASSERT_LE(op_size, kMaxOpSize);
+  OpTypes op_type = absl::GetFlag(FLAGS_op_type);
+  const bool two_sided = op_type == OpTypes::kSend || op_type == OpTypes::kRecv;
+  ASSERT_TRUE(two_sided || op_type == OpTypes::kRead ||
+              op_type == OpTypes::kWrite)
+      << "Not supported OP type.";
+  CreateSetUpRcQps(initiator, target, num_qps);
+
+  // Posts `num_ops` more ops on QP `qp_id`. For SEND/RECV, the RECVs are posted
+  // on the target before the SENDs on the initiator.
+  auto post_ops = [&](int qp_id, int num_ops) -> absl::Status {
+    Client::OpAttributes attributes = {.op_type = op_type,
+                                       .op_bytes = op_size,
+                                       .num_ops = num_ops,
+                                       .initiator_qp_id =
+                                           static_cast<uint32_t>(qp_id)};
+    if (two_sided) {
+      attributes.op_type = OpTypes::kRecv;
+      RETURN_IF_ERROR(target.PostOps(attributes));
+      attributes.op_type = OpTypes::kSend;
+    }
+    return initiator.PostOps(attributes);
+  };
+
+  const absl::Duration stats_interval = absl::GetFlag(FLAGS_stats_interval);
+  const absl::Duration completion_timeout =
+      absl::GetFlag(FLAGS_completion_timeout_s);
+  const absl::Time start_time = absl::Now();
+  const absl::Time end_time = start_time + absl::GetFlag(FLAGS_test_duration);
+  absl::Time interval_start = start_time;
+  absl::Time last_completion = start_time;
+  int64_t total_completed_ops = 0;
+  uint64_t total_failed_completions = 0;
+  // Statistics of the current interval. The inflight depth of every QP is
+  // sampled once per loop iteration before refilling it, so it shows how far
+  // the QP drained since the previous iteration. The error rate is over the
+  // initiator's ops, ie. validated plus failed initiator completions; failed
+  // RECV completions on the target are reported separately.
+  int64_t interval_completed_ops = 0;
+  uint64_t interval_failed_base = initiator.failed_completions();
+  uint64_t interval_failed_recv_base = target.failed_completions();
+  int64_t interval_inflight_sum = 0;
+  int64_t interval_samples = 0;
+  int interval_min_qp_depth = ops;
+
+  auto report_interval = [&](absl::Time now) {
+    const double seconds = absl::ToDoubleSeconds(now - interval_start);
+    const uint64_t failed =
+        initiator.failed_completions() - interval_failed_base;
+    const uint64_t failed_recvs =
+        target.failed_completions() - interval_failed_recv_base;
+    const uint64_t attempted = interval_completed_ops + failed;
+    LOG(INFO) << "Interval [" << interval_start - start_time << ", "
+              << now - start_time << "): " << interval_completed_ops
+              << " ops completed, "
+              << interval_completed_ops / std::max(seconds, 1e-9)
+              << " ops/s, "
+              << interval_completed_ops * op_size * 8 /
+                     std::max(seconds, 1e-9) / 1e9
+              << " Gbps, mean inflight depth per QP before refill "
+              << (interval_samples == 0
+                      ? 0.0
+                      : static_cast<double>(interval_inflight_sum) /
+                            interval_samples / num_qps)
+              << ", min QP depth " << interval_min_qp_depth << ", " << failed
+              << " failed completions (error rate "
+              << (attempted == 0 ? 0.0
+                                 : static_cast<double>(failed) / attempted)
+              << "), " << failed_recvs << " failed RECV completions.";
+    total_failed_completions += failed + failed_recvs;
+    interval_start = now;
+    interval_completed_ops = 0;
+    interval_failed_base += failed;
+    interval_failed_recv_base += failed_recvs;
+    interval_inflight_sum = 0;
+    interval_samples = 0;
+    interval_min_qp_depth = ops;
+  };
+
+  // Keep every QP topped up until the end of the test, then drain.
+  while (true) {
+    const absl::Time now = absl::Now();
+    const bool refill = now < end_time;
+    int64_t inflight_ops = 0;
+    int64_t unvalidated_ops = 0;
+    for (int qp_id = 0; qp_id < num_qps; ++qp_id) {
+      QpState* qp_state = initiator.qp_state(qp_id);
+      const int inflight = static_cast<int>(qp_state->outstanding_ops_count());
+      interval_min_qp_depth = std::min(interval_min_qp_depth, inflight);
+      inflight_ops += inflight;
+      // Ops which completed but are not validated yet still hold their
+      // buffers, so they count against the depth to refill.
+      const int unvalidated =
+          static_cast<int>(qp_state->unchecked_initiated_ops().size());
+      unvalidated_ops += unvalidated;
+      const int depth = inflight + unvalidated;
+      if (refill && depth < ops) {
+        ASSERT_OK(post_ops(qp_id, ops - depth))
+            << "Fail to refill QP-" << qp_id << "\n"
+            << validation_->TransportSnapshot();
+      }
+    }
+    interval_inflight_sum += inflight_ops;
+    ++interval_samples;
+    if (!refill && inflight_ops + unvalidated_ops == 0) break;
+
+    initiator.TryPollSendCompletions(num_qps * ops);
+    if (two_sided) target.TryPollRecvCompletions(num_qps * ops);
+    if (int validated = initiator.ValidateOrDeferCompletions(); validated > 0) {
+      interval_completed_ops += validated;
+      total_completed_ops += validated;
+      last_completion = now;
+    } else if (now - last_completion > completion_timeout) {
+      ADD_FAILURE() << "No completion for " << completion_timeout << " with "
+                    << inflight_ops << " ops in flight\n"
+                    << validation_->TransportSnapshot();
+      break;
+    }
+    if (now - interval_start >= stats_interval) report_interval(now);
+  }
+  const absl::Time finish_time = absl::Now();
+  report_interval(finish_time);
+
+  const double seconds = absl::ToDoubleSeconds(finish_time - start_time);
+  LOG(INFO) << "Sustained " << total_completed_ops / seconds << " ops/s, "
+            << total_completed_ops * op_size * 8 / seconds / 1e9
+            << " Gbps over " << finish_time - start_time << " ("
+            << total_completed_ops << " ops completed, "
+            << total_failed_completions << " failed completions).";
+  EXPECT_EQ(total_failed_completions, 0);
+
+  ASSERT_OK(PollAndAckAsyncEvents()) << "Has async events\n"
+                                     << validation_->TransportSnapshot();
+
+  EXPECT_THAT(validation_->PostTestValidation(), IsOk());
+  initiator.CheckAllDataLanded();
+  if (two_sided) {
+    target.CheckAllDataLanded();
+  }
+}
+
+// Same as StabilityPipelinedTest, but the QPs are partitioned into
+// --stability_shards shards and Client::ExecuteOps drives each shard from its
+// own thread, so that a single core does not cap the offered load. Ops are
+// issued in rounds of kOpsPerQpPerRound ops per QP until the end of the test.
+TEST_F(RdmaStabilityTest, StabilityShardedTest) {
+  constexpr int kOpsPerQpPerRound = 1000;
+  int num_qps = absl::GetFlag(FLAGS_qps);
+  ASSERT_LE(num_qps, kMaxQps);
+  int ops = absl::GetFlag(FLAGS_outstanding_ops);
+  ASSERT_LE(ops, kMaxOutstandingOps);
+  int op_size = absl::GetFlag(FLAGS_op_size);
+  ASSERT_LE(op_size, kMaxOpSize);
+  OpTypes op_type = absl::GetFlag(FLAGS_op_type);
+  const bool two_sided = op_type == OpTypes::kSend || op_type == OpTypes::kRecv;
+  ASSERT_TRUE(two_sided || op_type == OpTypes::kRead ||
+              op_type == OpTypes::kWrite)
+      << "Not supported OP type.";
+  const Client::Config config = {
+      .max_op_size = kMaxOpSize,
+      .max_outstanding_ops_per_qp = kMaxOutstandingOps,
+      .max_qps = kMaxQps,
+      .num_shards = absl::GetFlag(FLAGS_stability_shards)};
+  Client initiator(/*client_id=*/0, context(), port_attr(), config),
+      target(/*client_id=*/1, context(), port_attr(), config);
+  // The QPs of both clients are created in pairs, so that each QP and its
+  // remote QP have the same id and thus the same shard.
+  CreateSetUpRcQps(initiator, target, num_qps);
+  // ExecuteOps posts the RECV on the target for every SEND.
+  ConstantRcOperationGenerator op_generator(
+      two_sided ? OpTypes::kSend : op_type, op_size);
+  for (int qp_id = 0; qp_id < num_qps; ++qp_id) {
+    initiator.qp_state(qp_id)->set_op_generator(&op_generator);
+  }
+
+  const absl::Time start_time = absl::Now();
+  const absl::Time end_time = start_time + absl::GetFlag(FLAGS_test_duration);
+  int64_t total_completed_ops = 0;
+  while (absl::Now() < end_time) {
+    int completed_ops = initiator.ExecuteOps(
+        target, num_qps, kOpsPerQpPerRound, /*batch_per_qp=*/1,
+        /*max_inflight_per_qp=*/ops, /*max_inflight_ops_total=*/ops * num_qps);
+    total_completed_ops += completed_ops;
+    ASSERT_EQ(completed_ops, num_qps * kOpsPerQpPerRound)
+        << "Fail to complete a round of ops\n"
+        << validation_->TransportSnapshot();
+  }
+  const absl::Duration elapsed = absl::Now() - start_time;
+  const double seconds = absl::ToDoubleSeconds(elapsed);
+  LOG(INFO) << "Sustained " << total_completed_ops / seconds << " ops/s, "
+            << total_completed_ops * op_size * 8 / seconds / 1e9 << " Gbps over "
+            << elapsed << " on " << initiator.num_shards() << " shards ("
+            << total_completed_ops << " ops completed, "
+            << initiator.failed_completions() + target.failed_completions()
+            << " failed completions).";
+
+  ASSERT_OK(PollAndAckAsyncEvents()) << "Has async events\n"
+                                     << validation_->TransportSnapshot();
+
+  EXPECT_THAT(validation_->PostTestValidation(), IsOk());
+  initiator.CheckAllDataLanded();
+  if (two_sided) {
+    target.CheckAllDataLanded();
+  }
+}
+
 // We test the stability by focusing on possible resource leaks. The steps are
 // as below:
 // In a loop till the test timeouts:
@@ -33,6 +33,7 @@
 #include "absl/strings/str_cat.h"
 #include "infiniband/verbs.h"
 #include "internal/verbs_attribute.h"
+#include "public/introspection.h"
 #include "public/status_matchers.h"
 #include "traffic/client.h"
 #include "traffic/latency_measurement.h"
@@ -43,8 +44,8 @@
 namespace rdma_unit_test {
 
 RdmaStressFixture::RdmaStressFixture() {
-  validation_ = std::make_unique<TransportValidation>();
-  latency_measure_ = std::make_unique<LatencyMeasurement>();
+  validation_ = std::make_unique<CounterTransportValidation>(Introspection());
+  latency_measure_ = std::make_unique<HistogramLatencyMeasurement>();
   // Open the verbs device available.
   absl::Status status = ibv_.OpenAllDevices(contexts_);
   CHECK_OK(status);  // Crash OK
@@ -184,10 +185,16 @@ void RdmaStressFixture::HaltExecution(Client& client) {
   client.DumpPendingOps();
   client.CheckAllDataLanded();
 
-  // Log a summary of all qps.
+  // Log a summary of all qps, and report the ops the client completed to
+  // normalize the transport statistics.
+  uint64_t completed_ops = 0;
   for (uint32_t qp_id = 0; qp_id < client.num_qps(); ++qp_id) {
-    LOG(INFO) << client.qp_state(qp_id)->ToString();
+    QpState* qp_state = client.qp_state(qp_id);
+    LOG(INFO) << qp_state->ToString();
+    completed_ops +=
+        qp_state->TotalOpsCompleted() - qp_state->OpsCompleted(OpTypes::kRecv);
   }
+  validation_->RecordCompletedOps(client.instance_id(), completed_ops);
 
   // Keep polling async events for possible errors until no more events exist.
   while (true) {
@@ -255,7 +262,7 @@ void RdmaStressFixture::ConfigureLatencyMeasurements(OpTypes op_type) {
   latency_measure_->ConfigureLatencyMeasurements(op_type);
 }
 
-void RdmaStressFixture::CollectClientLatencyStats(const Client& client) {
+void RdmaStressFixture::CollectClientLatencyStats(Client& client) {
   latency_measure_->CollectClientLatencyStats(client);
 }
 
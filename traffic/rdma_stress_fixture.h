@@ -96,7 +96,7 @@ class RdmaStressFixture : public BasicFixture {
   void ConfigureLatencyMeasurements(OpTypes op_type);
 
   // Collects latencies statistics for a a given client.
-  void CollectClientLatencyStats(const Client& client);
+  void CollectClientLatencyStats(Client& client);
 
   // Makes sure that the latency measurements in each stats set are within
   // a certain percentage of one another.
@@ -312,8 +312,8 @@ TEST_F(SimpleRdmaTest, UdSend) {
   ASSERT_THAT(initiator.PostOps(attributes), IsOk());
 
   // Poll and validate the completion
-  std::unique_ptr<TestOp> sender_op = nullptr;
-  std::unique_ptr<TestOp> receiver_op = nullptr;
+  TestOpPtr sender_op = nullptr;
+  TestOpPtr receiver_op = nullptr;
 
   EXPECT_THAT(initiator.PollSendCompletions(/*count*/ 1), IsOk());
   QpState *sender_qp = initiator.qp_state(0);
@@ -14,8 +14,14 @@
 
 #include "traffic/test_op.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
@@ -49,6 +55,24 @@ std::string TestOp::ToString(OpTypes op_type) {
   }
 }
 
+void UdPayloadHeader::WriteTo(uint8_t* payload) const {
+  std::memcpy(payload, &client_id, sizeof(client_id));
+  std::memcpy(payload + sizeof(client_id), &qp_id, sizeof(qp_id));
+  std::memcpy(payload + sizeof(client_id) + sizeof(qp_id), &op_id,
+              sizeof(op_id));
+}
+
+UdPayloadHeader UdPayloadHeader::ReadFrom(const uint8_t* payload) {
+  UdPayloadHeader header;
+  std::memcpy(&header.client_id, payload, sizeof(header.client_id));
+  std::memcpy(&header.qp_id, payload + sizeof(header.client_id),
+              sizeof(header.qp_id));
+  std::memcpy(&header.op_id,
+              payload + sizeof(header.client_id) + sizeof(header.qp_id),
+              sizeof(header.op_id));
+  return header;
+}
+
 std::string TestOp::SrcBuffer() const {
   if (!src_addr || length == 0) {
     return "Empty source buffer";
@@ -67,4 +91,86 @@ std::string TestOp::DestBuffer() const {
       HexFormatter());
 }
 
+void TestOpDeleter::operator()(TestOp* op) const {
+  if (op == nullptr) return;
+  if (op->pool == nullptr) {
+    delete op;
+    return;
+  }
+  op->pool->Release(op);
+}
+
+TestOpPool::TestOpPool(size_t chunk_size)
+    : chunk_size_(std::max<size_t>(chunk_size, 1)) {
+  Grow();
+}
+
+TestOpPtr TestOpPool::Acquire() {
+  if (free_ops_.empty()) {
+    Grow();
+  }
+  TestOp* op = free_ops_.back();
+  free_ops_.pop_back();
+  return TestOpPtr(op);
+}
+
+void TestOpPool::Release(TestOp* op) {
+  std::vector<uint8_t> dest_buffer_copy = std::move(op->dest_buffer_copy);
+  dest_buffer_copy.clear();
+  *op = TestOp();
+  op->dest_buffer_copy = std::move(dest_buffer_copy);
+  op->pool = this;
+  free_ops_.push_back(op);
+}
+
+void TestOpPool::Grow() {
+  chunks_.push_back(std::make_unique<TestOp[]>(chunk_size_));
+  free_ops_.reserve(capacity());
+  TestOp* chunk = chunks_.back().get();
+  // Hand out records in address order.
+  for (size_t i = chunk_size_; i > 0; --i) {
+    chunk[i - 1].pool = this;
+    free_ops_.push_back(&chunk[i - 1]);
+  }
+}
+
+TestOpQueue::TestOpQueue(size_t capacity)
+    : slots_(std::max<size_t>(capacity, 1)) {}
+
+void TestOpQueue::push_back(TestOpPtr op) {
+  if (size_ == slots_.size()) {
+    Grow();
+  }
+  at(size_) = std::move(op);
+  ++size_;
+}
+
+void TestOpQueue::pop_front() {
+  at(0).reset();
+  head_ = (head_ + 1) % slots_.size();
+  --size_;
+}
+
+TestOpQueue::iterator TestOpQueue::erase(iterator pos) {
+  if (pos.index_ == 0) {
+    pop_front();
+    return begin();
+  }
+  for (size_t i = pos.index_; i + 1 < size_; ++i) {
+    at(i) = std::move(at(i + 1));
+  }
+  at(size_ - 1).reset();
+  --size_;
+  return pos;
+}
+
+void TestOpQueue::Grow() {
+  std::vector<TestOpPtr> slots(slots_.size() * 2);
+  for (size_t i = 0; i < size_; ++i) {
+    slots[i] = std::move(at(i));
+  }
+  slots_ = std::move(slots);
+  head_ = 0;
+}
+
 }  // namespace rdma_unit_test
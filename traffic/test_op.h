@@ -15,9 +15,11 @@
 #ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TEST_OP_H_
 #define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TEST_OP_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "infiniband/verbs.h"
@@ -26,6 +28,17 @@
 
 namespace rdma_unit_test {
 
+class TestOpPool;
+struct TestOp;
+
+// Returns a TestOp to the TestOpPool it was acquired from, or deletes it if it
+// does not belong to a pool.
+struct TestOpDeleter {
+  void operator()(TestOp* op) const;
+};
+
+using TestOpPtr = std::unique_ptr<TestOp, TestOpDeleter>;
+
 // The TestOp structure represents a single RDMA operation being performed in
 // the test. It stores all the information related to the op, such as op_type,
 // op size, source/destination addresses, which qp it's being performed on and
@@ -58,12 +71,181 @@ struct TestOp {
   uint64_t compare_add = 0;
   // Relevant only for atomic "comp_swap" operation.
   uint64_t swap = 0;
-  // Copy of op buffers for deferred validation.
-  std::unique_ptr<std::vector<uint8_t>> src_buffer_copy = nullptr;
-  std::unique_ptr<std::vector<uint8_t>> dest_buffer_copy = nullptr;
+  // Number of bytes a recv op received, from its completion.
+  uint32_t byte_len = 0;
+  // Copy of the received data of a UD recv op, which is deferred for
+  // validation without reserving its buffer slot. Other ops are validated in
+  // place, from their reserved buffer slots. The storage is kept when the op
+  // is recycled by its TestOpPool, so that copies do not allocate in steady
+  // state.
+  std::vector<uint8_t> dest_buffer_copy;
 
+  // Host timestamps (absl::GetCurrentTimeNanos()) taken right before the op is
+  // handed to the device and when its completion is polled, or, with
+  // hardware completion timestamps, when the device completed the op.
+  uint64_t post_timestamp_ns = 0;
+  uint64_t completion_timestamp_ns = 0;
+  // For ops issued open-loop, the TscClock time at which the op was intended
+  // to be issued, which may be earlier than when it was actually posted. 0
+  // otherwise.
+  uint64_t intended_post_tsc = 0;
   // Assigned when completion is polled.
   ibv_wc_status status;
+  // Hardware (HCA clock) completion timestamp. Only captured by clients using
+  // extended cqs on devices that support IBV_WC_EX_WITH_COMPLETION_TIMESTAMP;
+  // 0 otherwise.
+  uint64_t completion_timestamp = 0;
+
+  // Scatter-gather entry and work request used to post the op. Only one of
+  // send_wr and recv_wr is used, depending on op_type. They are kept alongside
+  // the op so that posting an op does not require separate allocations.
+  ibv_sge sge = {};
+  ibv_send_wr send_wr = {};
+  ibv_recv_wr recv_wr = {};
+
+  // The pool that owns this op, if any.
+  TestOpPool* pool = nullptr;
+};
+
+// Identifies a UD send op. It is written over the first bytes of the send's
+// payload, so that the receiving qp can find the recv op a send landed in with
+// a hash lookup rather than by comparing the payload against every unchecked
+// recv op. Payloads shorter than the header do not carry one.
+struct UdPayloadHeader {
+  // Writes the header to / reads a header from the first
+  // sizeof(UdPayloadHeader) bytes of `payload`, which need not be aligned.
+  void WriteTo(uint8_t* payload) const;
+  static UdPayloadHeader ReadFrom(const uint8_t* payload);
+
+  friend bool operator==(const UdPayloadHeader& a, const UdPayloadHeader& b) {
+    return a.client_id == b.client_id && a.qp_id == b.qp_id &&
+           a.op_id == b.op_id;
+  }
+  template <typename H>
+  friend H AbslHashValue(H h, const UdPayloadHeader& header) {
+    return H::combine(std::move(h), header.client_id, header.qp_id,
+                      header.op_id);
+  }
+
+  // Client, qp_id and op_id of the send op.
+  uint32_t client_id = 0;
+  uint32_t qp_id = 0;
+  uint64_t op_id = 0;
+};
+
+// A pool of TestOp records owned by a single qp. Records are allocated in
+// chunks of `chunk_size` up front and recycled when the owning TestOpPtr is
+// destroyed, so posting and completing ops does not allocate in steady state.
+// The pool only grows (by another chunk) when more ops are alive at once than
+// it has records for, e.g. when completed ops are waiting for validation.
+// Records are never moved, so TestOp pointers remain valid as wr_id cookies
+// for the lifetime of the pool. This class is not thread safe.
+class TestOpPool {
+ public:
+  explicit TestOpPool(size_t chunk_size);
+  // Movable and copyable are disallowed, since ops point back at the pool.
+  TestOpPool(const TestOpPool& other) = delete;
+  TestOpPool& operator=(const TestOpPool& other) = delete;
+  ~TestOpPool() = default;
+
+  // Returns a default-initialized TestOp which is returned to the pool when
+  // the TestOpPtr is destroyed.
+  TestOpPtr Acquire();
+
+  // Total number of records owned by the pool.
+  size_t capacity() const { return chunks_.size() * chunk_size_; }
+  // Number of records currently available for Acquire().
+  size_t available() const { return free_ops_.size(); }
+
+ private:
+  friend struct TestOpDeleter;
+
+  // Returns `op` to the free list after resetting it, keeping the storage of
+  // its dest_buffer_copy.
+  void Release(TestOp* op);
+  // Allocates another chunk of records and adds them to the free list.
+  void Grow();
+
+  const size_t chunk_size_;
+  std::vector<std::unique_ptr<TestOp[]>> chunks_;
+  std::vector<TestOp*> free_ops_;
+};
+
+// A FIFO of TestOpPtrs stored in a ring buffer, used for the completed ops of a
+// qp waiting for validation. Its storage is reserved up front and reused, so
+// queueing and dequeuing ops does not allocate in steady state, unlike
+// std::deque which allocates and frees a block every few hundred ops. The ring
+// only grows (doubling) when more ops are queued at once than it has room for.
+// Ops can also be erased from the middle, which moves the ops behind them
+// forward. This class is not thread safe.
+class TestOpQueue {
+ public:
+  // Iterates over the queue from the oldest op. Invalidated by any change to
+  // the queue other than through erase().
+  template <typename Queue, typename Value>
+  class Iterator {
+   public:
+    Value& operator*() const { return queue_->at(index_); }
+    Value* operator->() const { return &queue_->at(index_); }
+    Iterator& operator++() {
+      ++index_;
+      return *this;
+    }
+    friend bool operator==(const Iterator& a, const Iterator& b) {
+      return a.queue_ == b.queue_ && a.index_ == b.index_;
+    }
+    friend bool operator!=(const Iterator& a, const Iterator& b) {
+      return !(a == b);
+    }
+
+   private:
+    friend class TestOpQueue;
+    Iterator(Queue* queue, size_t index) : queue_(queue), index_(index) {}
+
+    Queue* queue_;
+    // Position in the queue, 0 being the oldest op.
+    size_t index_;
+  };
+  using iterator = Iterator<TestOpQueue, TestOpPtr>;
+  using const_iterator = Iterator<const TestOpQueue, const TestOpPtr>;
+
+  explicit TestOpQueue(size_t capacity);
+  // Movable and copyable are disallowed, like TestOpPool.
+  TestOpQueue(const TestOpQueue& other) = delete;
+  TestOpQueue& operator=(const TestOpQueue& other) = delete;
+  ~TestOpQueue() = default;
+
+  void push_back(TestOpPtr op);
+  void pop_front();
+  // Removes the op at `pos` and returns an iterator to the op after it.
+  iterator erase(iterator pos);
+
+  TestOpPtr& front() { return at(0); }
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  // Number of ops the queue holds without growing.
+  size_t capacity() const { return slots_.size(); }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, size_); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size_); }
+
+ private:
+  // Returns the op at position `index` of the queue, 0 being the oldest op.
+  TestOpPtr& at(size_t index) {
+    return slots_[(head_ + index) % slots_.size()];
+  }
+  const TestOpPtr& at(size_t index) const {
+    return slots_[(head_ + index) % slots_.size()];
+  }
+  // Doubles the capacity, moving the ops to the start of the new ring.
+  void Grow();
+
+  std::vector<TestOpPtr> slots_;
+  // Slot of the oldest op.
+  size_t head_ = 0;
+  size_t size_ = 0;
 };
 
 }  // namespace rdma_unit_test
@@ -0,0 +1,188 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "traffic/test_op.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+
+namespace rdma_unit_test {
+namespace {
+
+TEST(TestOpPoolTest, AcquireAndRelease) {
+  constexpr size_t kChunkSize = 4;
+  TestOpPool pool(kChunkSize);
+  EXPECT_EQ(pool.capacity(), kChunkSize);
+  EXPECT_EQ(pool.available(), kChunkSize);
+  {
+    TestOpPtr op = pool.Acquire();
+    ASSERT_NE(op, nullptr);
+    EXPECT_EQ(op->pool, &pool);
+    EXPECT_EQ(pool.available(), kChunkSize - 1);
+  }
+  EXPECT_EQ(pool.available(), kChunkSize);
+}
+
+TEST(TestOpPoolTest, ReusesAndResetsReleasedOps) {
+  TestOpPool pool(/*chunk_size=*/1);
+  TestOp* released = nullptr;
+  {
+    TestOpPtr op = pool.Acquire();
+    op->op_id = 7;
+    op->length = 100;
+    op->op_type = OpTypes::kRecv;
+    op->dest_buffer_copy.assign(100, 0xab);
+    released = op.get();
+  }
+  TestOpPtr op = pool.Acquire();
+  EXPECT_EQ(op.get(), released);
+  EXPECT_EQ(pool.capacity(), 1);
+  EXPECT_EQ(op->op_id, 0);
+  EXPECT_EQ(op->length, 0);
+  EXPECT_EQ(op->op_type, OpTypes::kInvalid);
+  EXPECT_EQ(op->pool, &pool);
+  // The storage of the copy is kept for the next UD recv.
+  EXPECT_TRUE(op->dest_buffer_copy.empty());
+  EXPECT_GE(op->dest_buffer_copy.capacity(), 100);
+}
+
+TEST(TestOpPoolTest, GrowsByChunksAndKeepsOpsInPlace) {
+  constexpr size_t kChunkSize = 4;
+  TestOpPool pool(kChunkSize);
+  std::vector<TestOpPtr> ops;
+  absl::flat_hash_set<TestOp*> addresses;
+  for (size_t i = 0; i < 3 * kChunkSize + 1; ++i) {
+    ops.push_back(pool.Acquire());
+    ops.back()->op_id = i;
+    addresses.insert(ops.back().get());
+  }
+  EXPECT_EQ(addresses.size(), ops.size());
+  EXPECT_EQ(pool.capacity(), 4 * kChunkSize);
+  EXPECT_EQ(pool.available(), kChunkSize - 1);
+  // Growing does not move the ops acquired before.
+  for (size_t i = 0; i < ops.size(); ++i) {
+    EXPECT_EQ(ops[i]->op_id, i);
+  }
+  ops.clear();
+  EXPECT_EQ(pool.available(), pool.capacity());
+}
+
+TEST(TestOpPoolTest, OpsWithoutPoolAreDeleted) {
+  TestOpPtr op(new TestOp());
+  EXPECT_EQ(op->pool, nullptr);
+  op.reset();
+}
+
+// Queues an op with `op_id` from `pool` on `queue`.
+void Push(TestOpPool& pool, TestOpQueue& queue, uint64_t op_id) {
+  TestOpPtr op = pool.Acquire();
+  op->op_id = op_id;
+  queue.push_back(std::move(op));
+}
+
+std::vector<uint64_t> OpIds(const TestOpQueue& queue) {
+  std::vector<uint64_t> op_ids;
+  for (const TestOpPtr& op : queue) {
+    op_ids.push_back(op->op_id);
+  }
+  return op_ids;
+}
+
+TEST(TestOpQueueTest, FifoAcrossWraparound) {
+  constexpr size_t kCapacity = 4;
+  TestOpPool pool(kCapacity);
+  TestOpQueue queue(kCapacity);
+  EXPECT_TRUE(queue.empty());
+  uint64_t pushed = 0;
+  uint64_t popped = 0;
+  // Keep the queue half full so that it wraps around several times.
+  while (popped < 5 * kCapacity) {
+    while (pushed - popped < kCapacity / 2) Push(pool, queue, pushed++);
+    ASSERT_FALSE(queue.empty());
+    EXPECT_EQ(queue.front()->op_id, popped++);
+    queue.pop_front();
+  }
+  EXPECT_EQ(queue.capacity(), kCapacity);
+  EXPECT_EQ(queue.size(), pushed - popped);
+}
+
+TEST(TestOpQueueTest, PopReturnsOpToPool) {
+  TestOpPool pool(/*chunk_size=*/2);
+  TestOpQueue queue(/*capacity=*/2);
+  Push(pool, queue, 0);
+  EXPECT_EQ(pool.available(), 1);
+  queue.pop_front();
+  EXPECT_EQ(pool.available(), 2);
+}
+
+TEST(TestOpQueueTest, GrowsWhenFullKeepingOrder) {
+  constexpr size_t kCapacity = 4;
+  TestOpPool pool(kCapacity);
+  TestOpQueue queue(kCapacity);
+  // Wrap the ring around before it grows.
+  Push(pool, queue, 0);
+  Push(pool, queue, 1);
+  queue.pop_front();
+  queue.pop_front();
+  for (uint64_t op_id = 2; op_id < 2 + 3 * kCapacity; ++op_id) {
+    Push(pool, queue, op_id);
+  }
+  EXPECT_EQ(queue.size(), 3 * kCapacity);
+  EXPECT_EQ(queue.capacity(), 4 * kCapacity);
+  std::vector<uint64_t> expected;
+  for (uint64_t op_id = 2; op_id < 2 + 3 * kCapacity; ++op_id) {
+    expected.push_back(op_id);
+  }
+  EXPECT_EQ(OpIds(queue), expected);
+}
+
+TEST(TestOpQueueTest, EraseKeepsOrderOfOtherOps) {
+  TestOpPool pool(/*chunk_size=*/8);
+  TestOpQueue queue(/*capacity=*/4);
+  // Start the ops in the middle of the ring, so that they wrap around.
+  Push(pool, queue, 100);
+  Push(pool, queue, 101);
+  queue.pop_front();
+  queue.pop_front();
+  for (uint64_t op_id = 0; op_id < 4; ++op_id) Push(pool, queue, op_id);
+  ASSERT_EQ(queue.capacity(), 4);
+
+  // Erase the odd ops, as validation does for ops it does not defer.
+  for (auto it = queue.begin(); it != queue.end();) {
+    if ((*it)->op_id % 2 == 1) {
+      it = queue.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  EXPECT_EQ(OpIds(queue), (std::vector<uint64_t>{0, 2}));
+  // Erasing the front.
+  auto it = queue.erase(queue.begin());
+  EXPECT_EQ((*it)->op_id, 2);
+  EXPECT_EQ(OpIds(queue), (std::vector<uint64_t>{2}));
+  it = queue.erase(it);
+  EXPECT_TRUE(it == queue.end());
+  EXPECT_TRUE(queue.empty());
+  // Every erased op went back to the pool.
+  EXPECT_EQ(pool.available(), pool.capacity());
+}
+
+}  // namespace
+}  // namespace rdma_unit_test
@@ -0,0 +1,323 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput benchmark for the traffic Client. Sweeps op type x op size x qp
+// count x ops in flight x batch size over a loopback RC connection and writes
+// one result row per sweep point (ops/s, Gb/s, cpu cost per op and completion
+// latency percentiles) as CSV or JSON, so that results can be compared across
+// NIC firmware and host stack versions. Eg.
+//
+//   throughput_bench --bench_op_types=write,read --bench_op_sizes=64,4096
+//       --bench_num_qps=1,16 --bench_format=json --bench_output=/tmp/out.json
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/flags/flag.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "traffic/client.h"
+#include "traffic/latency_histogram.h"
+#include "traffic/op_types.h"
+#include "traffic/operation_generator.h"
+#include "traffic/rdma_stress_fixture.h"
+#include "traffic/test_op.h"
+
+ABSL_FLAG(std::vector<std::string>, bench_op_types,
+          std::vector<std::string>({"write", "read", "send"}),
+          "Op types to sweep. Atomic op types are only run with 8 byte ops.");
+ABSL_FLAG(std::vector<std::string>, bench_op_sizes,
+          std::vector<std::string>({"64", "4096", "65536"}),
+          "Op sizes in bytes to sweep.");
+ABSL_FLAG(std::vector<std::string>, bench_num_qps,
+          std::vector<std::string>({"1", "16"}), "Qp counts to sweep.");
+ABSL_FLAG(std::vector<std::string>, bench_ops_in_flight,
+          std::vector<std::string>({"32"}),
+          "Maximum ops in flight per qp to sweep.");
+ABSL_FLAG(std::vector<std::string>, bench_batch_sizes,
+          std::vector<std::string>({"1", "8"}),
+          "Number of wqes posted per doorbell to sweep. Batch sizes larger "
+          "than the ops in flight are skipped.");
+ABSL_FLAG(int, bench_ops_per_point, 200000,
+          "Number of ops executed at every sweep point. Reduced for ops of "
+          "16KB and larger, see RdmaStressFixture::LimitNumOps.");
+ABSL_FLAG(int, bench_warmup_ops, 1000,
+          "Number of ops executed on every sweep point before measuring.");
+ABSL_FLAG(std::string, bench_format, "csv",
+          "Output format of the results: csv or json.");
+ABSL_FLAG(std::string, bench_output, "",
+          "File the results are written to. Logged only if empty.");
+
+namespace rdma_unit_test {
+namespace {
+
+// Counts the cpu cycles spent by this process, including threads created after
+// construction, such as the Client's per-shard worker threads. Reports 0 if the
+// perf events are not available, eg. because of perf_event_paranoid.
+class CycleCounter {
+ public:
+  CycleCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.inherit = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, /*pid=*/0,
+                                   /*cpu=*/-1, /*group_fd=*/-1, /*flags=*/0));
+    LOG_IF(WARNING, fd_ < 0)
+        << "Cannot count cpu cycles (" << strerror(errno)
+        << "), cycles per op will be reported as 0.";
+  }
+  CycleCounter(const CycleCounter&) = delete;
+  CycleCounter& operator=(const CycleCounter&) = delete;
+  ~CycleCounter() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  uint64_t Read() const {
+    uint64_t cycles = 0;
+    if (fd_ < 0 || read(fd_, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+      return 0;
+    }
+    return cycles;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+uint64_t ProcessCpuTimeNs() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+std::vector<int> ParseIntList(const std::vector<std::string>& values,
+                              absl::string_view flag_name) {
+  std::vector<int> ints;
+  for (const std::string& value : values) {
+    int parsed;
+    CHECK(absl::SimpleAtoi(value, &parsed) && parsed > 0)  // Crash OK
+        << "Invalid value '" << value << "' in --" << flag_name;
+    ints.push_back(parsed);
+  }
+  return ints;
+}
+
+struct SweepPoint {
+  OpTypes op_type;
+  int op_size;
+  int num_qps;
+  int ops_in_flight;
+  int batch_size;
+};
+
+struct Result {
+  SweepPoint point;
+  int ops_completed = 0;
+  double seconds = 0;
+  double ops_per_second = 0;
+  double gbps = 0;
+  double cycles_per_op = 0;
+  double cpu_ns_per_op = 0;
+  LatencyHistogram latency;
+};
+
+constexpr absl::string_view kCsvHeader =
+    "op_type,op_size,num_qps,ops_in_flight,batch_size,ops,seconds,ops_per_"
+    "second,gbps,cycles_per_op,cpu_ns_per_op,latency_p50_us,latency_p99_us,"
+    "latency_p999_us,latency_max_us";
+
+double Micros(uint64_t nanos) { return nanos / 1000.0; }
+
+std::string ToCsv(const Result& result) {
+  return absl::StrFormat(
+      "%s,%d,%d,%d,%d,%d,%.6f,%.1f,%.3f,%.1f,%.1f,%.3f,%.3f,%.3f,%.3f",
+      TestOp::ToString(result.point.op_type), result.point.op_size,
+      result.point.num_qps, result.point.ops_in_flight,
+      result.point.batch_size, result.ops_completed, result.seconds,
+      result.ops_per_second, result.gbps, result.cycles_per_op,
+      result.cpu_ns_per_op, Micros(result.latency.Percentile(50)),
+      Micros(result.latency.Percentile(99)),
+      Micros(result.latency.Percentile(99.9)), Micros(result.latency.max()));
+}
+
+std::string ToJson(const Result& result) {
+  return absl::StrFormat(
+      "{\"op_type\": \"%s\", \"op_size\": %d, \"num_qps\": %d, "
+      "\"ops_in_flight\": %d, \"batch_size\": %d, \"ops\": %d, "
+      "\"seconds\": %.6f, \"ops_per_second\": %.1f, \"gbps\": %.3f, "
+      "\"cycles_per_op\": %.1f, \"cpu_ns_per_op\": %.1f, "
+      "\"latency_p50_us\": %.3f, \"latency_p99_us\": %.3f, "
+      "\"latency_p999_us\": %.3f, \"latency_max_us\": %.3f}",
+      TestOp::ToString(result.point.op_type), result.point.op_size,
+      result.point.num_qps, result.point.ops_in_flight,
+      result.point.batch_size, result.ops_completed, result.seconds,
+      result.ops_per_second, result.gbps, result.cycles_per_op,
+      result.cpu_ns_per_op, Micros(result.latency.Percentile(50)),
+      Micros(result.latency.Percentile(99)),
+      Micros(result.latency.Percentile(99.9)), Micros(result.latency.max()));
+}
+
+class ThroughputBench : public RdmaStressFixture {
+ protected:
+  // Returns the sweep points defined by the --bench_* flags.
+  static std::vector<SweepPoint> SweepPoints() {
+    std::vector<OpTypes> op_types;
+    for (const std::string& name : absl::GetFlag(FLAGS_bench_op_types)) {
+      OpTypes op_type;
+      std::string error;
+      CHECK(AbslParseFlag(name, &op_type, &error) &&  // Crash OK
+            op_type != OpTypes::kInvalid && op_type != OpTypes::kRecv)
+          << "Invalid value '" << name << "' in --bench_op_types.";
+      op_types.push_back(op_type);
+    }
+    const std::vector<int> op_sizes =
+        ParseIntList(absl::GetFlag(FLAGS_bench_op_sizes), "bench_op_sizes");
+    const std::vector<int> num_qps =
+        ParseIntList(absl::GetFlag(FLAGS_bench_num_qps), "bench_num_qps");
+    const std::vector<int> ops_in_flight = ParseIntList(
+        absl::GetFlag(FLAGS_bench_ops_in_flight), "bench_ops_in_flight");
+    const std::vector<int> batch_sizes = ParseIntList(
+        absl::GetFlag(FLAGS_bench_batch_sizes), "bench_batch_sizes");
+
+    std::vector<SweepPoint> points;
+    for (OpTypes op_type : op_types) {
+      const bool is_atomic =
+          op_type == OpTypes::kFetchAdd || op_type == OpTypes::kCompSwap;
+      std::vector<int> sizes = op_sizes;
+      if (is_atomic) sizes = {TestOp::kAtomicWordSize};
+      for (int op_size : sizes) {
+        for (int qps : num_qps) {
+          for (int inflight : ops_in_flight) {
+            for (int batch : batch_sizes) {
+              if (batch > inflight) continue;
+              points.push_back({.op_type = op_type,
+                                .op_size = op_size,
+                                .num_qps = qps,
+                                .ops_in_flight = inflight,
+                                .batch_size = batch});
+            }
+          }
+        }
+      }
+    }
+    return points;
+  }
+
+  Result Run(const SweepPoint& point, const CycleCounter& cycle_counter) {
+    const Client::Config client_config = {
+        .max_op_size = point.op_size,
+        .max_outstanding_ops_per_qp = point.ops_in_flight,
+        .max_qps = point.num_qps};
+    Client initiator(/*client_id=*/0, context(), port_attr(), client_config),
+        target(/*client_id=*/1, context(), port_attr(), client_config);
+    CreateSetUpRcQps(initiator, target, point.num_qps);
+    ConstantRcOperationGenerator op_generator(point.op_type, point.op_size);
+    for (int qp_id = 0; qp_id < point.num_qps; ++qp_id) {
+      initiator.qp_state(qp_id)->set_op_generator(&op_generator);
+    }
+    const int max_inflight_total = point.ops_in_flight * point.num_qps;
+
+    // Warm up the qps and caches, then discard the warm up latencies.
+    const int warmup_ops_per_qp =
+        std::max(1, absl::GetFlag(FLAGS_bench_warmup_ops) / point.num_qps);
+    initiator.ExecuteOps(target, point.num_qps, warmup_ops_per_qp,
+                         point.batch_size, point.ops_in_flight,
+                         max_inflight_total);
+    initiator.TakeLatencyHistograms();
+
+    const int ops_per_qp = std::max(
+        1, LimitNumOps(point.op_size, absl::GetFlag(FLAGS_bench_ops_per_point)) /
+               point.num_qps);
+    const uint64_t start_cycles = cycle_counter.Read();
+    const uint64_t start_cpu_ns = ProcessCpuTimeNs();
+    const absl::Time start = absl::Now();
+    Result result{.point = point};
+    result.ops_completed = initiator.ExecuteOps(
+        target, point.num_qps, ops_per_qp, point.batch_size,
+        point.ops_in_flight, max_inflight_total);
+    result.seconds = absl::ToDoubleSeconds(absl::Now() - start);
+    const uint64_t cycles = cycle_counter.Read() - start_cycles;
+    const uint64_t cpu_ns = ProcessCpuTimeNs() - start_cpu_ns;
+    EXPECT_EQ(result.ops_completed, ops_per_qp * point.num_qps);
+
+    if (result.ops_completed > 0 && result.seconds > 0) {
+      result.ops_per_second = result.ops_completed / result.seconds;
+      result.gbps = result.ops_per_second * point.op_size * 8 / 1e9;
+      result.cycles_per_op = static_cast<double>(cycles) / result.ops_completed;
+      result.cpu_ns_per_op = static_cast<double>(cpu_ns) / result.ops_completed;
+    }
+    for (const auto& [key, histogram] : initiator.TakeLatencyHistograms()) {
+      if (key.first == point.op_type) result.latency.Merge(histogram);
+    }
+    return result;
+  }
+};
+
+TEST_F(ThroughputBench, Sweep) {
+  const std::string format = absl::GetFlag(FLAGS_bench_format);
+  ASSERT_TRUE(format == "csv" || format == "json")
+      << "Unknown --bench_format " << format;
+  const std::vector<SweepPoint> points = SweepPoints();
+  ASSERT_FALSE(points.empty()) << "Empty sweep.";
+
+  CycleCounter cycle_counter;
+  std::vector<std::string> rows;
+  for (const SweepPoint& point : points) {
+    Result result = Run(point, cycle_counter);
+    LOG(INFO) << kCsvHeader << "\n" << ToCsv(result);
+    rows.push_back(format == "csv" ? ToCsv(result) : ToJson(result));
+  }
+
+  std::string output;
+  if (format == "csv") {
+    output = absl::StrCat(kCsvHeader, "\n", absl::StrJoin(rows, "\n"), "\n");
+  } else {
+    output = absl::StrCat("[\n  ", absl::StrJoin(rows, ",\n  "), "\n]\n");
+  }
+  const std::string path = absl::GetFlag(FLAGS_bench_output);
+  if (path.empty()) {
+    LOG(INFO) << "Results:\n" << output;
+    return;
+  }
+  std::ofstream file(path);
+  ASSERT_TRUE(file.is_open()) << "Cannot open " << path;
+  file << output;
+  file.close();
+  EXPECT_TRUE(file.good()) << "Failed writing " << path;
+  LOG(INFO) << "Wrote " << rows.size() << " results to " << path;
+}
+
+}  // namespace
+}  // namespace rdma_unit_test
@@ -0,0 +1,168 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/transport_validation.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include <magic_enum.hpp>
+#include "public/counter_sampler.h"
+#include "public/introspection.h"
+
+ABSL_FLAG(std::vector<std::string>, transport_counter_budgets,
+          std::vector<std::string>({"kOutOfSeqNaks:1000", "kRnrNak:10000",
+                                    "kTrptRetryExcErr:0",
+                                    "kRnrRetryExcErr:0"}),
+          "Comma separated list of <counter>:<budget> pairs. A test fails if "
+          "a hardware counter (named after NicIntrospection::HardwareCounter) "
+          "increases by more than its budget per million completed ops.");
+ABSL_FLAG(uint64_t, transport_counter_budget_min_ops, 100000,
+          "The minimum number of ops --transport_counter_budgets are scaled "
+          "to. The counters are device wide, so tests with fewer completed "
+          "ops get the absolute allowance of this many ops, rather than a "
+          "budget which a single background event would exceed.");
+
+namespace rdma_unit_test {
+namespace {
+
+using HardwareCounter = NicIntrospection::HardwareCounter;
+
+// Counters of packet retransmissions, not checked if retransmissions are
+// allowed.
+bool IsRetransmissionCounter(HardwareCounter counter) {
+  return counter == HardwareCounter::kOutOfSeqNaks ||
+         counter == HardwareCounter::kTrptRetryExcErr;
+}
+
+// Returns the budgets per million ops from --transport_counter_budgets.
+absl::flat_hash_map<std::string, double> CounterBudgets() {
+  absl::flat_hash_map<std::string, double> budgets;
+  for (const std::string& entry :
+       absl::GetFlag(FLAGS_transport_counter_budgets)) {
+    std::vector<std::string> parts = absl::StrSplit(entry, ':');
+    double budget;
+    if (parts.size() != 2 || !absl::SimpleAtod(parts[1], &budget)) {
+      LOG(ERROR) << "Ignoring invalid --transport_counter_budgets entry "
+                 << entry;
+      continue;
+    }
+    budgets[parts[0]] = budget;
+  }
+  return budgets;
+}
+
+}  // namespace
+
+CounterTransportValidation::CounterTransportValidation(
+    const NicIntrospection& introspection)
+    : introspection_(introspection) {
+  baseline_ = introspection_.counter_sampler().Snapshot();
+}
+
+absl::Status CounterTransportValidation::PreTestValidation() {
+  baseline_ = introspection_.counter_sampler().Snapshot();
+  client_ops_.clear();
+  return absl::OkStatus();
+}
+
+void CounterTransportValidation::RecordCompletedOps(
+    uint64_t client_instance_id, uint64_t total_ops) {
+  client_ops_[client_instance_id] = total_ops;
+}
+
+NicIntrospection::CounterSnapshot CounterTransportValidation::Deltas() const {
+  NicIntrospection::CounterSnapshot deltas;
+  for (const auto& [counter, value] :
+       introspection_.counter_sampler().Snapshot()) {
+    auto iter = baseline_.find(counter);
+    if (iter == baseline_.end()) continue;
+    deltas[counter] = value >= iter->second ? value - iter->second : 0;
+  }
+  return deltas;
+}
+
+uint64_t CounterTransportValidation::CompletedOps(
+    const NicIntrospection::CounterSnapshot& deltas) const {
+  uint64_t ops = 0;
+  for (const auto& [client_instance_id, total_ops] : client_ops_) {
+    ops += total_ops;
+  }
+  if (ops > 0) return ops;
+  for (HardwareCounter counter :
+       {HardwareCounter::kRdmaTxRead, HardwareCounter::kRdmaTxWrite,
+        HardwareCounter::kRdmaTxSend, HardwareCounter::kRdmaTxAtomic}) {
+    auto iter = deltas.find(counter);
+    if (iter != deltas.end()) ops += iter->second;
+  }
+  return ops;
+}
+
+absl::Status CounterTransportValidation::TransportSnapshot() {
+  for (const auto& [counter, delta] : Deltas()) {
+    if (delta == 0) continue;
+    LOG(INFO) << "Transport counter " << magic_enum::enum_name(counter)
+              << " increased by " << delta;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CounterTransportValidation::PostTestValidation(bool check_retx) {
+  const NicIntrospection::CounterSnapshot deltas = Deltas();
+  const uint64_t ops = CompletedOps(deltas);
+  const uint64_t budget_ops =
+      std::max(ops, absl::GetFlag(FLAGS_transport_counter_budget_min_ops));
+  const absl::flat_hash_map<std::string, double> budgets = CounterBudgets();
+  std::vector<std::string> violations;
+  for (const auto& [counter, delta] : deltas) {
+    const std::string name(magic_enum::enum_name(counter));
+    if (ops == 0) {
+      LOG_IF(INFO, delta > 0) << "Transport counter " << name
+                              << " increased by " << delta;
+      continue;
+    }
+    const double per_million_ops = delta * 1e6 / ops;
+    LOG_IF(INFO, delta > 0) << absl::StrFormat(
+        "Transport counter %s increased by %lu, %.3f per million ops.", name,
+        delta, per_million_ops);
+    auto budget = budgets.find(name);
+    if (budget == budgets.end()) continue;
+    if (!check_retx && IsRetransmissionCounter(counter)) continue;
+    if (delta * 1e6 / budget_ops > budget->second) {
+      violations.push_back(absl::StrFormat(
+          "%s: %.3f per million ops (budget %.3f, %lu over %lu ops)", name,
+          per_million_ops, budget->second, delta, ops));
+    }
+  }
+  if (!violations.empty()) {
+    return absl::InternalError(
+        absl::StrCat("Transport counters over budget: ",
+                     absl::StrJoin(violations, "; ")));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace rdma_unit_test
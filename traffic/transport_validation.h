@@ -15,7 +15,17 @@
 #ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TRANSPORT_VALIDATION_H_
 #define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TRANSPORT_VALIDATION_H_
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/declare.h"
 #include "absl/status/status.h"
+#include "public/introspection.h"
+
+ABSL_DECLARE_FLAG(std::vector<std::string>, transport_counter_budgets);
+ABSL_DECLARE_FLAG(uint64_t, transport_counter_budget_min_ops);
 
 namespace rdma_unit_test {
 
@@ -34,6 +44,48 @@ class TransportValidation {
   // Used to capture the intermediate details. We separate "dumping debug state"
   // from post-test validation.
   virtual absl::Status TransportSnapshot() { return absl::OkStatus(); }
+  // Reports the total number of ops initiated and completed so far by the
+  // client instance with the given Client::instance_id(), used to normalize
+  // the transport statistics.
+  virtual void RecordCompletedOps(uint64_t client_instance_id,
+                                  uint64_t total_ops) {}
+};
+
+// Validates the transport through the hardware counters of the device. The
+// counters are diffed between PreTestValidation() (or construction) and
+// PostTestValidation(), normalized per million completed ops, and checked
+// against the per million op budgets of --transport_counter_budgets. Tests
+// with fewer than --transport_counter_budget_min_ops ops are held to the
+// budget of that many ops instead. Counters the device does not provide are
+// ignored.
+class CounterTransportValidation : public TransportValidation {
+ public:
+  explicit CounterTransportValidation(const NicIntrospection& introspection);
+  ~CounterTransportValidation() override = default;
+
+  // Takes the baseline counter snapshot.
+  absl::Status PreTestValidation() override;
+  // Logs the counter deltas since the baseline and their rates per million
+  // ops. Returns an error listing every counter over its budget. Budgets of
+  // retransmission counters are only enforced if `check_retx` is true.
+  absl::Status PostTestValidation(bool check_retx = true) override;
+  // Logs the counter deltas since the baseline.
+  absl::Status TransportSnapshot() override;
+  void RecordCompletedOps(uint64_t client_instance_id,
+                          uint64_t total_ops) override;
+
+ private:
+  using HardwareCounter = NicIntrospection::HardwareCounter;
+
+  // Returns the number of completed ops since the baseline: the ops reported
+  // by the clients or, if none were reported, the ops counted by the device.
+  uint64_t CompletedOps(const NicIntrospection::CounterSnapshot& deltas) const;
+  NicIntrospection::CounterSnapshot Deltas() const;
+
+  const NicIntrospection& introspection_;
+  NicIntrospection::CounterSnapshot baseline_;
+  // Latest total ops reported per client instance.
+  absl::flat_hash_map<uint64_t, uint64_t> client_ops_;
 };
 
 }  // namespace rdma_unit_test
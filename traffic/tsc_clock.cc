@@ -0,0 +1,76 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "traffic/tsc_clock.h"
+
+#include <cstdint>
+
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+#ifdef RDMA_UNIT_TEST_TSC_CLOCK_X86
+#include <cpuid.h>
+#endif
+
+namespace rdma_unit_test {
+namespace {
+
+// The interval over which the TSC rate is measured.
+constexpr absl::Duration kCalibrationInterval = absl::Milliseconds(20);
+
+bool HasInvariantTsc() {
+#ifdef RDMA_UNIT_TEST_TSC_CLOCK_X86
+  unsigned int eax, ebx, ecx, edx;
+  // CPUID.80000007H:EDX[8] reports an invariant TSC, ie. one ticking at a
+  // constant rate across frequency and power states.
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return (edx & (1u << 8)) != 0;
+  }
+#endif
+  return false;
+}
+
+}  // namespace
+
+const TscClock& TscClock::Get() {
+  static const TscClock* const clock = new TscClock();
+  return *clock;
+}
+
+TscClock::TscClock() {
+  if (!HasInvariantTsc()) {
+    LOG(INFO) << "No invariant TSC, TscClock uses the system clock.";
+    return;
+  }
+#ifdef RDMA_UNIT_TEST_TSC_CLOCK_X86
+  const int64_t start_ns = absl::GetCurrentTimeNanos();
+  const uint64_t start_ticks = __rdtsc();
+  absl::SleepFor(kCalibrationInterval);
+  const int64_t end_ns = absl::GetCurrentTimeNanos();
+  const uint64_t end_ticks = __rdtsc();
+  if (end_ns <= start_ns || end_ticks <= start_ticks) {
+    LOG(WARNING) << "Failed to calibrate the TSC, TscClock uses the system "
+                    "clock.";
+    return;
+  }
+  uses_tsc_ = true;
+  ns_per_tick_ = static_cast<double>(end_ns - start_ns) /
+                 static_cast<double>(end_ticks - start_ticks);
+  LOG(INFO) << "TscClock calibrated at " << 1.0 / ns_per_tick_
+            << " ticks per ns.";
+#endif
+}
+
+}  // namespace rdma_unit_test
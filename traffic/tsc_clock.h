@@ -0,0 +1,73 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TSC_CLOCK_H_
+#define THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TSC_CLOCK_H_
+
+#include <cstdint>
+
+#include "absl/time/clock.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define RDMA_UNIT_TEST_TSC_CLOCK_X86 1
+#endif
+
+namespace rdma_unit_test {
+
+// A clock reading the cpu timestamp counter (TSC), which is cheap enough to be
+// read for every op on the datapath. Ticks are converted to nanoseconds with a
+// rate calibrated against the system clock when the clock is created, so only
+// differences between ticks are meaningful. Falls back to
+// absl::GetCurrentTimeNanos(), with 1ns ticks, on cpus without an invariant
+// TSC. Thread safe.
+class TscClock {
+ public:
+  // Returns the process wide clock, which is calibrated on first use.
+  static const TscClock& Get();
+
+  // Not copyable or movable.
+  TscClock(const TscClock& clock) = delete;
+  TscClock& operator=(const TscClock& clock) = delete;
+  TscClock(TscClock&& clock) = delete;
+  TscClock& operator=(TscClock&& clock) = delete;
+  ~TscClock() = default;
+
+  // Returns the current time in ticks.
+  uint64_t Now() const {
+#ifdef RDMA_UNIT_TEST_TSC_CLOCK_X86
+    if (uses_tsc_) return __rdtsc();
+#endif
+    return static_cast<uint64_t>(absl::GetCurrentTimeNanos());
+  }
+
+  // Converts a number of ticks to nanoseconds and back.
+  uint64_t ToNanos(uint64_t ticks) const {
+    return static_cast<uint64_t>(static_cast<double>(ticks) * ns_per_tick_);
+  }
+  double FromNanos(double ns) const { return ns / ns_per_tick_; }
+
+  bool uses_tsc() const { return uses_tsc_; }
+  double ns_per_tick() const { return ns_per_tick_; }
+
+ private:
+  TscClock();
+
+  bool uses_tsc_ = false;
+  double ns_per_tick_ = 1.0;
+};
+
+}  // namespace rdma_unit_test
+
+#endif  // THIRD_PARTY_RDMA_UNIT_TEST_TRAFFIC_TSC_CLOCK_H_